@@ -23,13 +23,22 @@ limitations under the License.
 #include <array>
 #include <algorithm>
 #include <chrono>
+#include <map>
+#include <mutex>
 
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
 
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "thread_pool.h"
+#include "cpu_dispatch.h"
 
+/* Minimum pixels per task of ThreadPool */
+static constexpr int32_t kGrainSize = 4096;
+/* Raw disparity of DepthAI StereoDepth */
+static constexpr int32_t kStereoSubpixelFractionalBits = 3;     /* fixed in DepthAI 2.14 */
+static constexpr float kStereoMaxDisparity = 95.0f;             /* [px] without extended disparity */
 
 cv::Scalar CommonHelper::CreateCvColor(int32_t b, int32_t g, int32_t r)
 {
@@ -111,6 +120,196 @@ void CommonHelper::CropResizeCvt(const cv::Mat& org, cv::Mat& dst, int32_t& crop
 
 }
 
+cv::Mat CommonHelper::NormalizeMinMax(const cv::Mat& mat_depth)
+{
+    /* (255 * (prediction - depth_min) / (depth_max - depth_min)) */
+    cv::Mat mat_out;
+    double depth_min, depth_max;
+    cv::minMaxLoc(mat_depth, &depth_min, &depth_max);
+    if (depth_max <= depth_min) {
+        /* flat input. avoid division by zero */
+        return cv::Mat::zeros(mat_depth.size(), CV_8UC1);
+    }
+    mat_depth.convertTo(mat_out, CV_8UC1, 255. / (depth_max - depth_min), (-255. * depth_min) / (depth_max - depth_min));
+    return mat_out;
+}
+
+cv::Mat CommonHelper::NormalizeDisparity(const cv::Mat& mat_disparity, float max_disparity, float mag)
+{
+    const cv::Mat mat_src = mat_disparity.isContinuous() ? mat_disparity : mat_disparity.clone();
+    cv::Mat mat_depth(mat_src.size(), CV_8UC1);
+    /* truncate toward zero as before, but saturate instead of wrapping around for out of range values */
+    const float scale = mag * 255.0f / max_disparity;
+    const int32_t total = static_cast<int32_t>(mat_src.total());
+    ThreadPool::GetInstance().ParallelFor(0, total, kGrainSize, [&](int32_t i_begin, int32_t i_end) {
+        CpuDispatch::ScaleToUint8(mat_src.ptr<float>() + i_begin, mat_depth.ptr<uint8_t>() + i_begin, i_end - i_begin, scale);
+    });
+    return mat_depth;
+}
+
+cv::Mat CommonHelper::ConvertDisparity2Depth(const cv::Mat& mat_disparity, float fov, float baseline, float mag)
+{
+    const cv::Mat mat_src = mat_disparity.isContinuous() ? mat_disparity : mat_disparity.clone();
+    cv::Mat mat_depth(mat_src.size(), CV_8UC1);
+    const float scale = mag * fov * baseline;
+    const int32_t total = static_cast<int32_t>(mat_src.total());
+    ThreadPool::GetInstance().ParallelFor(0, total, kGrainSize, [&](int32_t i_begin, int32_t i_end) {
+        CpuDispatch::ReciprocalToUint8(mat_src.ptr<float>() + i_begin, mat_depth.ptr<uint8_t>() + i_begin, i_end - i_begin, scale);
+    });
+    return mat_depth;
+}
+
+cv::Mat CommonHelper::ConvertDisparity2Depth16(const cv::Mat& mat_disparity, float scale)
+{
+    const cv::Mat mat_src = mat_disparity.isContinuous() ? mat_disparity : mat_disparity.clone();
+    cv::Mat mat_depth(mat_src.size(), CV_16UC1);
+    const int32_t total = static_cast<int32_t>(mat_src.total());
+    ThreadPool::GetInstance().ParallelFor(0, total, kGrainSize, [&](int32_t i_begin, int32_t i_end) {
+        CpuDispatch::ReciprocalToUint16(mat_src.ptr<uint16_t>() + i_begin, mat_depth.ptr<uint16_t>() + i_begin, i_end - i_begin, scale);
+    });
+    return mat_depth;
+}
+
+float CommonHelper::GetStereoDisparityScale(bool is_subpixel)
+{
+    return is_subpixel ? 1.0f / (1 << kStereoSubpixelFractionalBits) : 1.0f;
+}
+
+float CommonHelper::GetStereoMaxDisparity(bool is_extended)
+{
+    return is_extended ? kStereoMaxDisparity * 2 : kStereoMaxDisparity;
+}
+
+void CommonHelper::ComputeTilePosition(int32_t length, int32_t tile_size, int32_t overlap_min, std::vector<int32_t>& position_list)
+{
+    position_list.clear();
+    if (length <= tile_size) {
+        position_list.push_back(0);
+        return;
+    }
+    const int32_t step_max = (std::max)(tile_size - overlap_min, 1);
+    const int32_t tile_num = (length - tile_size + step_max - 1) / step_max + 1;
+    for (int32_t i = 0; i < tile_num; i++) {
+        position_list.push_back(static_cast<int32_t>(static_cast<int64_t>(length - tile_size) * i / (tile_num - 1)));
+    }
+}
+
+template <typename T>
+static void WarpDisparityRow(const T* src, float* dst, int32_t width, float scale)
+{
+    std::fill(dst, dst + width, 0.0f);
+    for (int32_t x = 0; x < width; x++) {
+        const float d = static_cast<float>(src[x]) * scale;
+        if (!(d > 0.0f)) continue;
+        const int32_t x_l = x + static_cast<int32_t>(d + 0.5f);
+        if (x_l < width && dst[x_l] < d) dst[x_l] = d;
+    }
+    /* Rounded positions of a slanted surface leave gaps of 1 px. Not regarded as occlusion, which is wider */
+    for (int32_t x = 1; x < width - 1; x++) {
+        if (!(dst[x] > 0.0f) && dst[x - 1] > 0.0f && dst[x + 1] > 0.0f) {
+            dst[x] = (std::max)(dst[x - 1], dst[x + 1]);
+        }
+    }
+}
+
+void CommonHelper::WarpDisparityRightToLeft(const cv::Mat& disparity_r, float scale, cv::Mat& disparity_l)
+{
+    disparity_l.create(disparity_r.size(), CV_32FC1);
+    const int32_t grain_size = (std::max)(kGrainSize / (std::max)(disparity_r.cols, 1), 1);
+    ThreadPool::GetInstance().ParallelFor(0, disparity_r.rows, grain_size, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            if (disparity_r.type() == CV_8UC1) {
+                WarpDisparityRow(disparity_r.ptr<uint8_t>(y), disparity_l.ptr<float>(y), disparity_r.cols, scale);
+            } else if (disparity_r.type() == CV_16UC1) {
+                WarpDisparityRow(disparity_r.ptr<uint16_t>(y), disparity_l.ptr<float>(y), disparity_r.cols, scale);
+            } else {
+                WarpDisparityRow(disparity_r.ptr<float>(y), disparity_l.ptr<float>(y), disparity_r.cols, scale);
+            }
+        }
+    });
+}
+
+float CommonHelper::ComputeDisparityUnreliableRatio(const cv::Mat& disparity, const cv::Rect& rect, float jump_threshold)
+{
+    int32_t count = 0;
+    for (int32_t y = rect.y; y < rect.y + rect.height; y++) {
+        const float* row = disparity.ptr<float>(y);
+        const float* row_next = (y + 1 < disparity.rows) ? disparity.ptr<float>(y + 1) : row;
+        for (int32_t x = rect.x; x < rect.x + rect.width; x++) {
+            const float d = row[x];
+            if (!(d > 0.0f)) {
+                count++;
+                continue;
+            }
+            const float d_right = (x + 1 < disparity.cols) ? row[x + 1] : d;
+            const float d_down = row_next[x];
+            if ((d_right > 0.0f && std::abs(d - d_right) > jump_threshold) || (d_down > 0.0f && std::abs(d - d_down) > jump_threshold)) {
+                count++;
+            }
+        }
+    }
+    return static_cast<float>(count) / (std::max)(rect.area(), 1);
+}
+
+/* Table of the colormap is created by OpenCV once, so the colors are the same as cv::applyColorMap */
+static cv::Mat GetColorMapLut(int32_t colormap)
+{
+    static std::mutex s_mutex;
+    static std::map<int32_t, cv::Mat> s_lut_map;
+    std::lock_guard<std::mutex> lock(s_mutex);
+    cv::Mat& lut_cached = s_lut_map[colormap];
+    if (lut_cached.empty()) {
+        cv::Mat mat_ramp(1, 256, CV_8UC1);
+        for (int32_t i = 0; i < 256; i++) mat_ramp.at<uint8_t>(i) = static_cast<uint8_t>(i);
+        cv::applyColorMap(mat_ramp, lut_cached, colormap);
+    }
+    return lut_cached;
+}
+
+void CommonHelper::ApplyColorMap(const cv::Mat& src, cv::Mat& dst, int32_t colormap)
+{
+    if (src.type() != CV_8UC1) {
+        cv::applyColorMap(src, dst, colormap);
+        return;
+    }
+
+    const cv::Mat lut = GetColorMapLut(colormap);
+    const cv::Mat mat_src = src.isContinuous() ? src : src.clone();
+    cv::Mat mat_dst(mat_src.size(), CV_8UC3);   /* not dst, which may be src */
+    const int32_t total = static_cast<int32_t>(mat_src.total());
+    ThreadPool::GetInstance().ParallelFor(0, total, kGrainSize, [&](int32_t i_begin, int32_t i_end) {
+        CpuDispatch::ApplyLut3(mat_src.ptr<uint8_t>() + i_begin, mat_dst.ptr<uint8_t>() + i_begin * 3, i_end - i_begin, lut.ptr<uint8_t>());
+    });
+    dst = mat_dst;
+}
+
+void CommonHelper::ApplyColorMap(const cv::Mat& src, cv::Mat& dst, int32_t colormap, float scale)
+{
+    /* scale in fixed point with 12 fractional bits, which is enough for the index of 256 colors */
+    const float scale_q12 = std::round(scale * 4096.0f);
+    if (src.type() != CV_16UC1 || !(scale_q12 >= 0.0f && scale_q12 <= 65535.0f)) {
+        cv::Mat mat_uint8;
+        src.convertTo(mat_uint8, CV_8UC1, scale);
+        ApplyColorMap(mat_uint8, dst, colormap);
+        return;
+    }
+
+    const cv::Mat lut = GetColorMapLut(colormap);
+    const cv::Mat mat_src = src.isContinuous() ? src : src.clone();
+    cv::Mat mat_dst(mat_src.size(), CV_8UC3);
+    const int32_t total = static_cast<int32_t>(mat_src.total());
+    ThreadPool::GetInstance().ParallelFor(0, total, kGrainSize, [&](int32_t i_begin, int32_t i_end) {
+        /* The index stays in the cache between the kernels instead of an image of CV_8UC1 */
+        uint8_t index[kGrainSize];
+        for (int32_t i = i_begin; i < i_end; i += kGrainSize) {
+            const int32_t num = std::min(kGrainSize, i_end - i);
+            CpuDispatch::ScaleUint16ToUint8(mat_src.ptr<uint16_t>() + i, index, num, static_cast<uint16_t>(scale_q12));
+            CpuDispatch::ApplyLut3(index, mat_dst.ptr<uint8_t>() + i * 3, num, lut.ptr<uint8_t>());
+        }
+    });
+    dst = mat_dst;
+}
+
 /* https://github.com/JetsonHacksNano/CSI-Camera/blob/master/simple_camera.cpp */
 /* modified by iwatake2222 */
 std::string CommonHelper::CreateGStreamerPipeline(int capture_width, int capture_height, int display_width, int display_height, int framerate, int flip_method) {
@@ -37,6 +37,29 @@ enum {
 cv::Scalar CreateCvColor(int32_t b, int32_t g, int32_t r);
 void DrawText(cv::Mat& mat, const std::string& text, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true);
 void CropResizeCvt(const cv::Mat& org, cv::Mat& dst, int32_t& crop_x, int32_t& crop_y, int32_t& crop_w, int32_t& crop_h, bool is_rgb = true, int32_t crop_type = kCropTypeStretch, bool resize_by_linear = true);
+/* CV_32FC1 -> CV_8UC1 */
+cv::Mat NormalizeMinMax(const cv::Mat& mat_depth);
+cv::Mat NormalizeDisparity(const cv::Mat& mat_disparity, float max_disparity, float mag = 1.0f);
+/* Z = mag * fov * baseline / disparity. 255 for invalid (disparity <= 0) or far */
+cv::Mat ConvertDisparity2Depth(const cv::Mat& mat_disparity, float fov, float baseline, float mag = 1.0f);
+/* CV_16UC1 (fixed point disparity) -> CV_16UC1. Z = scale / disparity, truncated and saturated to 65535. 0 for invalid (disparity = 0) */
+cv::Mat ConvertDisparity2Depth16(const cv::Mat& mat_disparity, float scale);
+/* Raw disparity of DepthAI StereoDepth. [px] per unit of the raw value, and the max disparity [px] by the modes of StereoDepth */
+float GetStereoDisparityScale(bool is_subpixel);
+float GetStereoMaxDisparity(bool is_extended);
+/* Positions of the tiles along an axis, which cover [0, length) with overlap of overlap_min at least. Evenly spaced. One tile at 0 if length <= tile_size */
+void ComputeTilePosition(int32_t length, int32_t tile_size, int32_t overlap_min, std::vector<int32_t>& position_list);
+/*
+ * Disparity aligned to the right image -> aligned to the left image (x_l = x_r + d) in [px] (CV_32FC1, 0 = invalid). The nearer one (larger disparity) wins at collision
+ * disparity_r: CV_8UC1, CV_16UC1 (fixed point, e.g. subpixel by DepthAI) or CV_32FC1, converted to px by scale. Gaps of 1 px between valid pixels are filled
+ */
+void WarpDisparityRightToLeft(const cv::Mat& disparity_r, float scale, cv::Mat& disparity_l);
+/* Ratio of the pixels in rect (of CV_32FC1) which are invalid, or differ from the valid right / lower neighbor by more than jump_threshold */
+float ComputeDisparityUnreliableRatio(const cv::Mat& disparity, const cv::Rect& rect, float jump_threshold);
+/* The same as cv::applyColorMap. Faster for CV_8UC1 */
+void ApplyColorMap(const cv::Mat& src, cv::Mat& dst, int32_t colormap);
+/* The same as cv::applyColorMap of src converted to CV_8UC1 with scale. CV_16UC1 (scale < 16) is converted in integer without an intermediate image, where the index is truncated instead of rounded */
+void ApplyColorMap(const cv::Mat& src, cv::Mat& dst, int32_t colormap, float scale);
 std::string CreateGStreamerPipeline(int capture_width, int capture_height, int display_width, int display_height, int framerate, int flip_method);
 bool FindSourceImage(const std::string& input_name, cv::VideoCapture& cap, int32_t width = 640, int32_t height = 480);
 bool InputKeyCommand(cv::VideoCapture& cap);
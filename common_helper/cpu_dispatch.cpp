@@ -0,0 +1,280 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_DISPATCH_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "common_helper.h"
+#include "cpu_dispatch_kernel.h"
+#include "cpu_dispatch.h"
+
+/*** Macro ***/
+#define TAG "CpuDispatch"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+#define ENV_ISA "COMMON_HELPER_ISA"
+
+/*** Global variable ***/
+static const char* kIsaNameList[CpuDispatch::kIsaNum] = { "generic", "avx2", "avx512", "neon" };
+
+static std::atomic<const CpuDispatchKernel*> s_kernel(nullptr);
+static std::atomic<int32_t> s_isa(CpuDispatch::kIsaGeneric);
+
+/*** Function ***/
+#if defined(CPU_DISPATCH_X86)
+static void Cpuid(uint32_t leaf, uint32_t subleaf, uint32_t reg[4])
+{
+#if defined(_MSC_VER)
+    int32_t r[4];
+    __cpuidex(reinterpret_cast<int*>(r), static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int32_t i = 0; i < 4; i++) reg[i] = static_cast<uint32_t>(r[i]);
+#else
+    __cpuid_count(leaf, subleaf, reg[0], reg[1], reg[2], reg[3]);
+#endif
+}
+
+/* Register states enabled by OS */
+static uint64_t Xgetbv(void)
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+#endif
+
+static bool IsSupportedByCpu(CpuDispatch::Isa isa)
+{
+    switch (isa) {
+    case CpuDispatch::kIsaGeneric:
+        return true;
+#if defined(CPU_DISPATCH_X86)
+    case CpuDispatch::kIsaAvx2:
+    case CpuDispatch::kIsaAvx512:
+    {
+        uint32_t reg[4];
+        Cpuid(0, 0, reg);
+        if (reg[0] < 7) return false;
+        Cpuid(1, 0, reg);
+        const bool has_osxsave = (reg[2] >> 27) & 1;
+        const bool has_avx = (reg[2] >> 28) & 1;
+        if (!has_osxsave || !has_avx) return false;
+        const uint64_t xcr0 = Xgetbv();
+        if ((xcr0 & 0x06) != 0x06) return false;       /* XMM, YMM */
+        Cpuid(7, 0, reg);
+        const bool has_avx2 = (reg[1] >> 5) & 1;
+        if (isa == CpuDispatch::kIsaAvx2) return has_avx2;
+        const bool has_avx512f = (reg[1] >> 16) & 1;
+        const bool has_avx512bw = (reg[1] >> 30) & 1;
+        return has_avx2 && has_avx512f && has_avx512bw && ((xcr0 & 0xE0) == 0xE0);    /* opmask, ZMM */
+    }
+#elif defined(__aarch64__)
+    case CpuDispatch::kIsaNeon:
+#if defined(__linux__)
+        return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#else
+        return true;    /* mandatory in ARMv8-A */
+#endif
+#endif
+    default:
+        return false;
+    }
+}
+
+/* nullptr if not built in this binary */
+static const CpuDispatchKernel* GetKernel(CpuDispatch::Isa isa)
+{
+    switch (isa) {
+    case CpuDispatch::kIsaGeneric:
+        return CpuDispatchGetKernelGeneric();
+#if defined(COMMON_HELPER_WITH_AVX2)
+    case CpuDispatch::kIsaAvx2:
+        return CpuDispatchGetKernelAvx2();
+#endif
+#if defined(COMMON_HELPER_WITH_AVX512)
+    case CpuDispatch::kIsaAvx512:
+        return CpuDispatchGetKernelAvx512();
+#endif
+#if defined(COMMON_HELPER_WITH_NEON)
+    case CpuDispatch::kIsaNeon:
+        return CpuDispatchGetKernelNeon();
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+static CpuDispatch::Isa SelectIsa(void)
+{
+    CpuDispatch::Isa isa_best = CpuDispatch::kIsaGeneric;
+    for (int32_t i = 0; i < CpuDispatch::kIsaNum; i++) {
+        const CpuDispatch::Isa isa = static_cast<CpuDispatch::Isa>(i);
+        /* later ISAs in the list are faster ones on the same architecture */
+        if (CpuDispatch::IsAvailable(isa)) isa_best = isa;
+    }
+
+    const char* env = std::getenv(ENV_ISA);
+    if (env && env[0] != '\0') {
+        for (int32_t i = 0; i < CpuDispatch::kIsaNum; i++) {
+            if (std::strcmp(env, kIsaNameList[i]) != 0) continue;
+            const CpuDispatch::Isa isa = static_cast<CpuDispatch::Isa>(i);
+            if (CpuDispatch::IsAvailable(isa)) return isa;
+            PRINT_E("%s=%s is not available. Use %s\n", ENV_ISA, env, kIsaNameList[isa_best]);
+            return isa_best;
+        }
+        PRINT_E("Unknown %s=%s. Use %s\n", ENV_ISA, env, kIsaNameList[isa_best]);
+    }
+    return isa_best;
+}
+
+static const CpuDispatchKernel* GetCurrentKernel(void)
+{
+    const CpuDispatchKernel* kernel = s_kernel.load(std::memory_order_acquire);
+    if (kernel) return kernel;
+
+    static std::once_flag once_flag;
+    std::call_once(once_flag, [] {
+        const CpuDispatch::Isa isa = SelectIsa();
+        PRINT("ISA = %s\n", kIsaNameList[isa]);
+        const CpuDispatchKernel* expected = nullptr;
+        /* Keep the one set by SetIsa before the first call */
+        if (s_kernel.compare_exchange_strong(expected, GetKernel(isa), std::memory_order_acq_rel)) {
+            s_isa.store(isa);
+        }
+    });
+    return s_kernel.load(std::memory_order_acquire);
+}
+
+CpuDispatch::Isa CpuDispatch::GetIsa(void)
+{
+    GetCurrentKernel();
+    return static_cast<Isa>(s_isa.load());
+}
+
+const char* CpuDispatch::GetIsaName(Isa isa)
+{
+    if (isa < 0 || isa >= kIsaNum) return "unknown";
+    return kIsaNameList[isa];
+}
+
+bool CpuDispatch::IsAvailable(Isa isa)
+{
+    return GetKernel(isa) != nullptr && IsSupportedByCpu(isa);
+}
+
+int32_t CpuDispatch::SetIsa(Isa isa)
+{
+    if (!IsAvailable(isa)) {
+        PRINT_E("%s is not available\n", GetIsaName(isa));
+        return kRetErr;
+    }
+    s_isa.store(isa);
+    s_kernel.store(GetKernel(isa), std::memory_order_release);
+    return kRetOk;
+}
+
+void CpuDispatch::PackUint8ToFloat(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale)
+{
+    GetCurrentKernel()->pack_uint8_to_float(src, src_stride, dst, num, scale);
+}
+
+void CpuDispatch::ScaleToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    GetCurrentKernel()->scale_to_uint8(src, dst, num, scale);
+}
+
+void CpuDispatch::ReciprocalToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    GetCurrentKernel()->reciprocal_to_uint8(src, dst, num, scale);
+}
+
+void CpuDispatch::ScaleUint16ToUint8(const uint16_t* src, uint8_t* dst, int32_t num, uint16_t scale_q12)
+{
+    GetCurrentKernel()->scale_uint16_to_uint8(src, dst, num, scale_q12);
+}
+
+void CpuDispatch::ReciprocalToUint16(const uint16_t* src, uint16_t* dst, int32_t num, float scale)
+{
+    GetCurrentKernel()->reciprocal_to_uint16(src, dst, num, scale);
+}
+
+void CpuDispatch::ApplyLut3(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut)
+{
+    GetCurrentKernel()->apply_lut3(src, dst, num, lut);
+}
+
+void CpuDispatch::TemporalFilter(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max)
+{
+    /* hole_count is uint8_t */
+    hole_frame_max = (hole_frame_max < 0) ? 0 : ((hole_frame_max > 255) ? 255 : hole_frame_max);
+    GetCurrentKernel()->temporal_filter(src, history, hole_count, dst, num, alpha, reset_ratio, hole_frame_max);
+}
+
+/* The SIMD versions process 16 disparities at once, and keep a path in a buffer on the stack */
+static bool IsSgmSimdAvailable(int32_t disparity_num)
+{
+    return disparity_num > 0 && disparity_num % 16 == 0 && disparity_num <= kCpuDispatchSgmDisparityMax;
+}
+
+void CpuDispatch::SgmCensusCost(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t width, int32_t disparity_num, uint8_t cost_invalid)
+{
+    if (!IsSgmSimdAvailable(disparity_num)) {
+        CpuDispatchSgmCensusCostScalar(census_l, census_r, cost, 0, width, disparity_num, cost_invalid);
+        return;
+    }
+    GetCurrentKernel()->sgm_census_cost(census_l, census_r, cost, width, disparity_num, cost_invalid);
+}
+
+void CpuDispatch::SgmAggregate(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2)
+{
+    if (!IsSgmSimdAvailable(disparity_num)) {
+        CpuDispatchSgmAggregateScalar(cost, path_prev, path_cur, sum, num, stride, disparity_num, p1, p2);
+        return;
+    }
+    GetCurrentKernel()->sgm_aggregate(cost, path_prev, path_cur, sum, num, stride, disparity_num, p1, p2);
+}
+
+void CpuDispatch::SgmSelectDisparity(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t width, int32_t disparity_num, int32_t uniqueness_ratio)
+{
+    if (!IsSgmSimdAvailable(disparity_num)) {
+        CpuDispatchSgmSelectDisparityInit(disparity_r, cost_min_r, width);
+        for (int32_t x = 0; x < width; x++) {
+            CpuDispatchSgmSelectDisparityPixel(sum, disparity_l, disparity_r, cost_min_r, x, disparity_num, uniqueness_ratio);
+        }
+        return;
+    }
+    GetCurrentKernel()->sgm_select_disparity(sum, disparity_l, disparity_r, cost_min_r, width, disparity_num, uniqueness_ratio);
+}
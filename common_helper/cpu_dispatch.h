@@ -0,0 +1,94 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef CPU_DISPATCH_
+#define CPU_DISPATCH_
+
+/* for general */
+#include <cstdint>
+
+/*
+ * Hot kernels built for several instruction sets, one of which is selected at runtime
+ *   - The library itself is built for the baseline CPU. Only the kernel files are built with -mavx2 etc.
+ *   - The best ISA supported by the CPU (CPUID / hwcaps) is selected at the first call
+ *   - Environment variable COMMON_HELPER_ISA=generic|avx2|avx512|neon forces one of them (e.g. to test each path)
+ *   - All the variants return exactly the same output
+ */
+namespace CpuDispatch
+{
+enum {
+    kRetOk = 0,
+    kRetErr = -1,
+};
+
+enum Isa {
+    kIsaGeneric = 0,
+    kIsaAvx2,
+    kIsaAvx512,     /* AVX-512F + BW */
+    kIsaNeon,
+    kIsaNum,
+};
+
+Isa GetIsa(void);
+const char* GetIsaName(Isa isa);
+/* Built in this binary and supported by the CPU */
+bool IsAvailable(Isa isa);
+/* Switch the kernels in use. For tests and benchmarks */
+int32_t SetIsa(Isa isa);
+
+/* dst[i] = src[i * src_stride] * scale. For packing an interleaved image into a planar tensor */
+void PackUint8ToFloat(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale);
+/* dst[i] = src[i] * scale, truncated and saturated to [0, 255]. NaN is 0 */
+void ScaleToUint8(const float* src, uint8_t* dst, int32_t num, float scale);
+/* dst[i] = scale / src[i], truncated and saturated to [0, 255]. 255 for src[i] <= 0 */
+void ReciprocalToUint8(const float* src, uint8_t* dst, int32_t num, float scale);
+/* dst[i] = (src[i] * scale_q12) >> 12, saturated to 255. scale_q12 is fixed point with 12 fractional bits (4096 = 1.0). e.g. 16-bit disparity to the index of a colormap */
+void ScaleUint16ToUint8(const uint16_t* src, uint8_t* dst, int32_t num, uint16_t scale_q12);
+/* dst[i] = scale / src[i], truncated and saturated to [0, 65535]. 0 for src[i] = 0. e.g. 16-bit disparity to depth [mm] */
+void ReciprocalToUint16(const uint16_t* src, uint16_t* dst, int32_t num, float scale);
+/* dst[i * 3 + c] = lut[src[i] * 3 + c]. lut has 256 x 3 entries (e.g. BGR colormap) */
+void ApplyLut3(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut);
+/*
+ * Temporal filter for depth / disparity. history and hole_count are the state kept by the caller (0 at first)
+ *   valid src (> 0) and |src - history| <= reset_ratio * history: history += alpha * (src - history)
+ *   valid src otherwise (motion or no history)                 : history = src
+ *   invalid src: history is kept for hole_frame_max frames, then 0
+ *   dst[i] = history[i] after the update
+ */
+void TemporalFilter(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max);
+/*
+ * Kernels of semi-global matching. Costs are stored as [x][disparity] (disparity_num entries per pixel)
+ *   SIMD is used when disparity_num is a multiple of 16 and up to 256. The scalar version is used otherwise
+ */
+/* cost[x * disparity_num + d] = popcount(census_l[x] ^ census_r[x - d]) for a row. cost_invalid for x < d */
+void SgmCensusCost(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t width, int32_t disparity_num, uint8_t cost_invalid);
+/*
+ * Path cost along a path for num pixels. Pixel i uses the entries at i * stride (stride = +-disparity_num) of each array
+ *   path_cur[d] = cost[d] + min(path_prev[d], path_prev[d - 1] + p1, path_prev[d + 1] + p1, min(path_prev) + p2) - min(path_prev)
+ *   path_prev = nullptr: start of the path (path_cur = cost)
+ *   sum += path_cur (wrap around at 65536), unless sum is nullptr
+ *   path_cur <= 255 + p2, so p2 < 16384 keeps min(path_prev) + p2 in uint16
+ * path_prev may point to the previous pixel in path_cur (path_cur - stride) for a path along the row
+ */
+void SgmAggregate(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2);
+/*
+ * Winner-takes-all for a row of the aggregated costs (sum of SgmAggregate). d <= x only. The smallest d for ties
+ *   disparity_l[x] = argmin(sum[x][d]), -1 unless min * (100 + uniqueness_ratio) < (min except d_best +- 1) * 100
+ *   disparity_r[x] = argmin(sum[x + d][d]) for the right image, -1 if none. cost_min_r is a work buffer
+ * Each array has width entries
+ */
+void SgmSelectDisparity(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t width, int32_t disparity_num, int32_t uniqueness_ratio);
+}
+
+#endif
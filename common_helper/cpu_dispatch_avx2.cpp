@@ -0,0 +1,362 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <immintrin.h>
+
+#include "cpu_dispatch_kernel.h"
+
+/* Built with -mavx2 (/arch:AVX2). Called only when the CPU supports AVX2 */
+
+/*** Function ***/
+/* 8 x int32 (0 - 255) in a, b, c, d -> 32 x uint8 in order */
+static inline __m256i PackInt32ToUint8(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+    const __m256i ab = _mm256_packs_epi32(a, b);
+    const __m256i cd = _mm256_packs_epi32(c, d);
+    const __m256i abcd = _mm256_packus_epi16(ab, cd);
+    /* packs works in each 128-bit lane: a0 b0 c0 d0 a1 b1 c1 d1 (4 bytes each) */
+    return _mm256_permutevar8x32_epi32(abcd, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+static void PackUint8ToFloat(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale)
+{
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    int32_t i = 0;
+    if (src_stride == 1) {
+        for (; i + 8 <= num; i += 8) {
+            const __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), v_scale));
+        }
+    } else if (src_stride > 1) {
+        /* Gather 4 bytes at each pixel and use the lowest one. Stop before reading beyond the last pixel */
+        const __m256i v_index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(src_stride));
+        const __m256i v_mask = _mm256_set1_epi32(0xFF);
+        const int64_t last = static_cast<int64_t>(num - 1) * src_stride;
+        for (; static_cast<int64_t>(i + 7) * src_stride + 3 <= last; i += 8) {
+            const int32_t* base = reinterpret_cast<const int32_t*>(src + static_cast<int64_t>(i) * src_stride);
+            const __m256i v = _mm256_and_si256(_mm256_i32gather_epi32(base, v_index, 1), v_mask);
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), v_scale));
+        }
+    }
+    CpuDispatchPackUint8ToFloatScalar(src + static_cast<int64_t>(i) * src_stride, src_stride, dst + i, num - i, scale);
+}
+
+static void ScaleToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    const __m256 v_zero = _mm256_setzero_ps();
+    const __m256 v_255 = _mm256_set1_ps(255.0f);
+    int32_t i = 0;
+    for (; i + 32 <= num; i += 32) {
+        __m256i v[4];
+        for (int32_t j = 0; j < 4; j++) {
+            __m256 f = _mm256_mul_ps(_mm256_loadu_ps(src + i + j * 8), v_scale);
+            f = _mm256_min_ps(_mm256_max_ps(f, v_zero), v_255);    /* max returns the 2nd operand (0) for NaN */
+            v[j] = _mm256_cvttps_epi32(f);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), PackInt32ToUint8(v[0], v[1], v[2], v[3]));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchScaleToUint8(src[i] * scale);
+    }
+}
+
+static void ReciprocalToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    const __m256 v_zero = _mm256_setzero_ps();
+    const __m256 v_255 = _mm256_set1_ps(255.0f);
+    const __m256i v_255i = _mm256_set1_epi32(255);
+    int32_t i = 0;
+    for (; i + 32 <= num; i += 32) {
+        __m256i v[4];
+        for (int32_t j = 0; j < 4; j++) {
+            const __m256 d = _mm256_loadu_ps(src + i + j * 8);
+            __m256 z = _mm256_div_ps(v_scale, d);      /* not rcp, to get the same result as the scalar version */
+            z = _mm256_min_ps(_mm256_max_ps(z, v_zero), v_255);
+            const __m256 is_valid = _mm256_cmp_ps(d, v_zero, _CMP_GT_OQ);
+            v[j] = _mm256_blendv_epi8(v_255i, _mm256_cvttps_epi32(z), _mm256_castps_si256(is_valid));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), PackInt32ToUint8(v[0], v[1], v[2], v[3]));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint8(src[i], scale);
+    }
+}
+
+static void ScaleUint16ToUint8(const uint16_t* src, uint8_t* dst, int32_t num, uint16_t scale_q12)
+{
+    const __m256i v_scale = _mm256_set1_epi32(scale_q12);
+    int32_t i = 0;
+    for (; i + 32 <= num; i += 32) {
+        __m256i v[4];
+        for (int32_t j = 0; j < 4; j++) {
+            const __m256i s = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + j * 8)));
+            v[j] = _mm256_srli_epi32(_mm256_mullo_epi32(s, v_scale), 12);   /* < 2^20. Saturated to 255 by the packs */
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), PackInt32ToUint8(v[0], v[1], v[2], v[3]));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchScaleUint16ToUint8(src[i], scale_q12);
+    }
+}
+
+static void ReciprocalToUint16(const uint16_t* src, uint16_t* dst, int32_t num, float scale)
+{
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    const __m256 v_zero = _mm256_setzero_ps();
+    const __m256 v_65535 = _mm256_set1_ps(65535.0f);
+    const __m256i v_zeroi = _mm256_setzero_si256();
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        __m256i v[2];
+        for (int32_t j = 0; j < 2; j++) {
+            const __m256i s = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + j * 8)));
+            __m256 z = _mm256_div_ps(v_scale, _mm256_cvtepi32_ps(s));      /* no integer division in SIMD. Exact for uint16 */
+            z = _mm256_min_ps(_mm256_max_ps(z, v_zero), v_65535);
+            const __m256i is_valid = _mm256_cmpgt_epi32(s, v_zeroi);
+            v[j] = _mm256_and_si256(_mm256_cvttps_epi32(z), is_valid);
+        }
+        /* packus works in each 128-bit lane: a0 b0 a1 b1 (8 bytes each) */
+        const __m256i ab = _mm256_permute4x64_epi64(_mm256_packus_epi32(v[0], v[1]), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), ab);
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint16(src[i], scale);
+    }
+}
+
+static void ApplyLut3(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut)
+{
+    /* 4 bytes per entry, so that an entry is gathered at once */
+    alignas(32) int32_t lut32[256];
+    for (int32_t i = 0; i < 256; i++) {
+        lut32[i] = lut[i * 3 + 0] | (lut[i * 3 + 1] << 8) | (lut[i * 3 + 2] << 16);
+    }
+    /* BGR0 x 4 -> BGR x 4 + 4 bytes of zero in each lane */
+    const __m256i v_shuffle = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int32_t i = 0;
+    /* Each 16-byte store writes 4 bytes beyond its 12 bytes, which are overwritten by the next store. Keep them in dst */
+    for (; (i + 8) * 3 + 4 <= num * 3; i += 8) {
+        const __m256i v_index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+        const __m256i v = _mm256_shuffle_epi8(_mm256_i32gather_epi32(lut32, v_index, 4), v_shuffle);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm256_castsi256_si128(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3 + 12), _mm256_extracti128_si256(v, 1));
+    }
+    CpuDispatchApplyLut3Scalar(src + i, dst + i * 3, num - i, lut);
+}
+
+static void TemporalFilter(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max)
+{
+    const __m256 v_alpha = _mm256_set1_ps(alpha);
+    const __m256 v_reset_ratio = _mm256_set1_ps(reset_ratio);
+    const __m256 v_zero = _mm256_setzero_ps();
+    const __m256 v_abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    const __m256i v_hole_frame_max = _mm256_set1_epi32(hole_frame_max);
+    const __m256i v_pack = _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4);
+    int32_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        const __m256 v = _mm256_loadu_ps(src + i);
+        const __m256 h = _mm256_loadu_ps(history + i);
+        const __m256 is_valid = _mm256_cmp_ps(v, v_zero, _CMP_GT_OQ);
+        const __m256 is_history_valid = _mm256_cmp_ps(h, v_zero, _CMP_GT_OQ);
+        const __m256 diff = _mm256_sub_ps(v, h);
+        const __m256 is_static = _mm256_and_ps(is_history_valid,
+            _mm256_cmp_ps(_mm256_and_ps(diff, v_abs_mask), _mm256_mul_ps(v_reset_ratio, h), _CMP_LE_OQ));
+        const __m256 value_new = _mm256_blendv_ps(v, _mm256_add_ps(h, _mm256_mul_ps(v_alpha, diff)), is_static);
+
+        /* Holes: keep the history while the count is less than max */
+        const __m256i count = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(hole_count + i)));
+        const __m256i is_keep = _mm256_andnot_si256(_mm256_castps_si256(is_valid),
+            _mm256_and_si256(_mm256_castps_si256(is_history_valid), _mm256_cmpgt_epi32(v_hole_frame_max, count)));
+        const __m256 value_hole = _mm256_and_ps(h, _mm256_castsi256_ps(is_keep));
+        const __m256 value_out = _mm256_blendv_ps(value_hole, value_new, is_valid);
+        _mm256_storeu_ps(history + i, value_out);
+        _mm256_storeu_ps(dst + i, value_out);
+
+        /* count + 1 (keep), 0 (valid). The result is 0 - 255, so pack doesn't saturate */
+        __m256i count_new = _mm256_andnot_si256(_mm256_castps_si256(is_valid), _mm256_sub_epi32(count, is_keep));
+        count_new = _mm256_packus_epi16(_mm256_packus_epi32(count_new, count_new), count_new);
+        count_new = _mm256_permutevar8x32_epi32(count_new, v_pack);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(hole_count + i), _mm256_castsi256_si128(count_new));
+    }
+    CpuDispatchTemporalFilterScalar(src + i, history + i, hole_count + i, dst + i, num - i, alpha, reset_ratio, hole_frame_max);
+}
+
+/* popcount of each uint32 by a nibble table */
+static inline __m256i Popcount32(__m256i v)
+{
+    const __m256i v_lut = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i v_mask = _mm256_set1_epi8(0x0F);
+    const __m256i count_lo = _mm256_shuffle_epi8(v_lut, _mm256_and_si256(v, v_mask));
+    const __m256i count_hi = _mm256_shuffle_epi8(v_lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), v_mask));
+    const __m256i count = _mm256_add_epi8(count_lo, count_hi);
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(count, _mm256_set1_epi8(1)), _mm256_set1_epi16(1));
+}
+
+static void SgmCensusCost(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t width, int32_t disparity_num, uint8_t cost_invalid)
+{
+    /* Pixels with invalid disparities */
+    const int32_t x_simd = (disparity_num - 1 < width) ? disparity_num - 1 : width;
+    CpuDispatchSgmCensusCostScalar(census_l, census_r, cost, 0, x_simd, disparity_num, cost_invalid);
+
+    /* census_r[x - d] for d, d + 1, ... is in the reverse order in memory */
+    const __m256i v_reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    for (int32_t x = x_simd; x < width; x++) {
+        const __m256i v_l = _mm256_set1_epi32(static_cast<int32_t>(census_l[x]));
+        uint8_t* c = cost + static_cast<int64_t>(x) * disparity_num;
+        for (int32_t d = 0; d < disparity_num; d += 16) {
+            const __m256i r0 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(census_r + x - d - 7)), v_reverse);
+            const __m256i r1 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(census_r + x - d - 15)), v_reverse);
+            /* 0 - 32. packs works in each 128-bit lane */
+            __m256i count = _mm256_packs_epi32(Popcount32(_mm256_xor_si256(v_l, r0)), Popcount32(_mm256_xor_si256(v_l, r1)));
+            count = _mm256_permute4x64_epi64(count, 0xD8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(c + d), _mm_packus_epi16(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1)));
+        }
+    }
+}
+
+static void SgmAggregate(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2)
+{
+    /* path_prev with a sentinel at both ends, so that d - 1 and d + 1 are unaligned loads */
+    alignas(32) uint16_t prev[kCpuDispatchSgmDisparityMax + 16];
+    const __m256i v_p1 = _mm256_set1_epi16(static_cast<int16_t>(p1));
+    for (int32_t i = 0; i < num; i++) {
+        const int64_t offset = static_cast<int64_t>(i) * stride;
+        const uint8_t* c = cost + offset;
+        uint16_t* l = path_cur + offset;
+        uint16_t* s = sum ? sum + offset : nullptr;
+        if (!path_prev) {
+            for (int32_t d = 0; d < disparity_num; d += 16) {
+                const __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c + d)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(l + d), v);
+                if (s) _mm256_storeu_si256(reinterpret_cast<__m256i*>(s + d), _mm256_add_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + d)), v));
+            }
+            continue;
+        }
+
+        const uint16_t* l_prev = path_prev + offset;
+        __m256i v_min = _mm256_set1_epi16(-1);
+        for (int32_t d = 0; d < disparity_num; d += 16) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(l_prev + d));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(prev + 1 + d), v);
+            v_min = _mm256_min_epu16(v_min, v);
+        }
+        prev[0] = 0xFFFF;
+        prev[disparity_num + 1] = 0xFFFF;
+        const __m128i min_128 = _mm_minpos_epu16(_mm_min_epu16(_mm256_castsi256_si128(v_min), _mm256_extracti128_si256(v_min, 1)));
+        const uint16_t min_prev = static_cast<uint16_t>(_mm_cvtsi128_si32(min_128));
+        const __m256i v_min_prev = _mm256_set1_epi16(static_cast<int16_t>(min_prev));
+        const __m256i v_min_prev_p2 = _mm256_set1_epi16(static_cast<int16_t>(min_prev + p2));
+
+        for (int32_t d = 0; d < disparity_num; d += 16) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + 1 + d));
+            const __m256i v_left = _mm256_adds_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + d)), v_p1);
+            const __m256i v_right = _mm256_adds_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + 2 + d)), v_p1);
+            __m256i v_out = _mm256_min_epu16(_mm256_min_epu16(v, v_min_prev_p2), _mm256_min_epu16(v_left, v_right));
+            v_out = _mm256_add_epi16(_mm256_sub_epi16(v_out, v_min_prev), _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c + d))));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(l + d), v_out);
+            if (s) _mm256_storeu_si256(reinterpret_cast<__m256i*>(s + d), _mm256_add_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + d)), v_out));
+        }
+    }
+}
+
+/* min of 16 x uint16 */
+static inline uint16_t ReduceMinUint16(__m256i v)
+{
+    const __m128i v_min = _mm_minpos_epu16(_mm_min_epu16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+    return static_cast<uint16_t>(_mm_cvtsi128_si32(v_min));
+}
+
+/* a < b for uint16 */
+static inline __m256i CompareLessUint16(__m256i a, __m256i b)
+{
+    const __m256i v_sign = _mm256_set1_epi16(static_cast<int16_t>(0x8000));
+    return _mm256_cmpgt_epi16(_mm256_xor_si256(b, v_sign), _mm256_xor_si256(a, v_sign));
+}
+
+void CpuDispatchSgmSelectDisparityAvx2(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t width, int32_t disparity_num, int32_t uniqueness_ratio)
+{
+    CpuDispatchSgmSelectDisparityInit(disparity_r, cost_min_r, width);
+    /* Pixels where some disparities are invalid */
+    const int32_t x_simd = (disparity_num - 1 < width) ? disparity_num - 1 : width;
+    for (int32_t x = 0; x < x_simd; x++) {
+        CpuDispatchSgmSelectDisparityPixel(sum, disparity_l, disparity_r, cost_min_r, x, disparity_num, uniqueness_ratio);
+    }
+
+    const __m256i v_max = _mm256_set1_epi16(-1);
+    const __m256i v_16 = _mm256_set1_epi16(16);
+    const __m256i v_index = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m256i v_index_reverse = _mm256_setr_epi16(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i v_shuffle_reverse = _mm256_setr_epi8(
+        14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+        14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    for (int32_t x = x_simd; x < width; x++) {
+        const uint16_t* s = sum + static_cast<int64_t>(x) * disparity_num;
+
+        /* The best cost and the first d of it in each lane, then the smallest d of the best cost */
+        __m256i v_best = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+        __m256i v_best_index = v_index;
+        __m256i v_d = _mm256_add_epi16(v_index, v_16);
+        for (int32_t d = 16; d < disparity_num; d += 16) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + d));
+            v_best_index = _mm256_blendv_epi8(v_best_index, v_d, CompareLessUint16(v, v_best));
+            v_best = _mm256_min_epu16(v_best, v);
+            v_d = _mm256_add_epi16(v_d, v_16);
+        }
+        const uint16_t cost_best = ReduceMinUint16(v_best);
+        const __m256i is_best = _mm256_cmpeq_epi16(v_best, _mm256_set1_epi16(static_cast<int16_t>(cost_best)));
+        const int32_t d_best = ReduceMinUint16(_mm256_blendv_epi8(v_max, v_best_index, is_best));
+
+        /* The second best except d_best - 1, d_best, d_best + 1 */
+        const __m256i v_exclude_begin = _mm256_set1_epi16(static_cast<int16_t>(d_best - 2));
+        const __m256i v_exclude_end = _mm256_set1_epi16(static_cast<int16_t>(d_best + 2));
+        __m256i v_second = v_max;
+        v_d = v_index;
+        for (int32_t d = 0; d < disparity_num; d += 16) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + d));
+            const __m256i is_excluded = _mm256_and_si256(_mm256_cmpgt_epi16(v_d, v_exclude_begin), _mm256_cmpgt_epi16(v_exclude_end, v_d));
+            v_second = _mm256_min_epu16(v_second, _mm256_or_si256(v, is_excluded));
+            v_d = _mm256_add_epi16(v_d, v_16);
+        }
+        const int32_t cost_second = ReduceMinUint16(v_second);
+        disparity_l[x] = (cost_best * (100 + uniqueness_ratio) < cost_second * 100) ? static_cast<int16_t>(d_best) : -1;
+
+        /* Right image: x - d for d, d + 1, ... is in the reverse order in memory */
+        for (int32_t d = 0; d < disparity_num; d += 16) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + d));
+            v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, v_shuffle_reverse), 0x4E);
+            uint16_t* c = cost_min_r + x - d - 15;
+            int16_t* dr = disparity_r + x - d - 15;
+            const __m256i v_cost = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c));
+            const __m256i v_disparity = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dr));
+            const __m256i is_better = CompareLessUint16(v, v_cost);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(c), _mm256_min_epu16(v, v_cost));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dr), _mm256_blendv_epi8(v_disparity, _mm256_add_epi16(v_index_reverse, _mm256_set1_epi16(static_cast<int16_t>(d))), is_better));
+        }
+    }
+}
+
+const CpuDispatchKernel* CpuDispatchGetKernelAvx2(void)
+{
+    static const CpuDispatchKernel kernel = { PackUint8ToFloat, ScaleToUint8, ReciprocalToUint8, ScaleUint16ToUint8, ReciprocalToUint16, ApplyLut3, TemporalFilter, SgmCensusCost, SgmAggregate, CpuDispatchSgmSelectDisparityAvx2 };
+    return &kernel;
+}
@@ -0,0 +1,252 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <immintrin.h>
+
+#include "cpu_dispatch_kernel.h"
+
+/* Built with -mavx512f -mavx512bw (/arch:AVX512). Called only when the CPU supports AVX-512F and BW */
+
+/*** Function ***/
+static void PackUint8ToFloat(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale)
+{
+    const __m512 v_scale = _mm512_set1_ps(scale);
+    int32_t i = 0;
+    if (src_stride == 1) {
+        for (; i + 16 <= num; i += 16) {
+            const __m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+            _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), v_scale));
+        }
+    } else if (src_stride > 1) {
+        /* Gather 4 bytes at each pixel and use the lowest one. Stop before reading beyond the last pixel */
+        const __m512i v_index = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(src_stride));
+        const __m512i v_mask = _mm512_set1_epi32(0xFF);
+        const int64_t last = static_cast<int64_t>(num - 1) * src_stride;
+        for (; static_cast<int64_t>(i + 15) * src_stride + 3 <= last; i += 16) {
+            const void* base = src + static_cast<int64_t>(i) * src_stride;
+            const __m512i v = _mm512_and_si512(_mm512_i32gather_epi32(v_index, base, 1), v_mask);
+            _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), v_scale));
+        }
+    }
+    CpuDispatchPackUint8ToFloatScalar(src + static_cast<int64_t>(i) * src_stride, src_stride, dst + i, num - i, scale);
+}
+
+static void ScaleToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    const __m512 v_scale = _mm512_set1_ps(scale);
+    const __m512 v_zero = _mm512_setzero_ps();
+    const __m512 v_255 = _mm512_set1_ps(255.0f);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        __m512 f = _mm512_mul_ps(_mm512_loadu_ps(src + i), v_scale);
+        f = _mm512_min_ps(_mm512_max_ps(f, v_zero), v_255);    /* max returns the 2nd operand (0) for NaN */
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(f)));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchScaleToUint8(src[i] * scale);
+    }
+}
+
+static void ReciprocalToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    const __m512 v_scale = _mm512_set1_ps(scale);
+    const __m512 v_zero = _mm512_setzero_ps();
+    const __m512 v_255 = _mm512_set1_ps(255.0f);
+    const __m512i v_255i = _mm512_set1_epi32(255);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m512 d = _mm512_loadu_ps(src + i);
+        __m512 z = _mm512_div_ps(v_scale, d);      /* not rcp, to get the same result as the scalar version */
+        z = _mm512_min_ps(_mm512_max_ps(z, v_zero), v_255);
+        const __mmask16 is_valid = _mm512_cmp_ps_mask(d, v_zero, _CMP_GT_OQ);
+        const __m512i v = _mm512_mask_blend_epi32(is_valid, v_255i, _mm512_cvttps_epi32(z));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm512_cvtusepi32_epi8(v));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint8(src[i], scale);
+    }
+}
+
+static void ScaleUint16ToUint8(const uint16_t* src, uint8_t* dst, int32_t num, uint16_t scale_q12)
+{
+    const __m512i v_scale = _mm512_set1_epi32(scale_q12);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m512i s = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+        const __m512i v = _mm512_srli_epi32(_mm512_mullo_epi32(s, v_scale), 12);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm512_cvtusepi32_epi8(v));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchScaleUint16ToUint8(src[i], scale_q12);
+    }
+}
+
+static void ReciprocalToUint16(const uint16_t* src, uint16_t* dst, int32_t num, float scale)
+{
+    const __m512 v_scale = _mm512_set1_ps(scale);
+    const __m512 v_zero = _mm512_setzero_ps();
+    const __m512 v_65535 = _mm512_set1_ps(65535.0f);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m512i s = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+        __m512 z = _mm512_div_ps(v_scale, _mm512_cvtepi32_ps(s));      /* no integer division in SIMD. Exact for uint16 */
+        z = _mm512_min_ps(_mm512_max_ps(z, v_zero), v_65535);
+        const __mmask16 is_valid = _mm512_test_epi32_mask(s, s);
+        const __m512i v = _mm512_maskz_mov_epi32(is_valid, _mm512_cvttps_epi32(z));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm512_cvtusepi32_epi16(v));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint16(src[i], scale);
+    }
+}
+
+static void ApplyLut3(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut)
+{
+    /* 4 bytes per entry, so that an entry is gathered at once */
+    alignas(64) int32_t lut32[256];
+    for (int32_t i = 0; i < 256; i++) {
+        lut32[i] = lut[i * 3 + 0] | (lut[i * 3 + 1] << 8) | (lut[i * 3 + 2] << 16);
+    }
+    /* BGR0 x 4 -> BGR x 4 in each lane, then 12 bytes of each lane are packed into 48 bytes */
+    const __m512i v_shuffle = _mm512_mask_broadcast_i32x4(_mm512_setzero_si512(), 0xFFFF, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    const __m512i v_permute = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 15, 15, 15, 15);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m512i v_index = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        __m512i v = _mm512_shuffle_epi8(_mm512_i32gather_epi32(v_index, lut32, 4), v_shuffle);
+        v = _mm512_permutexvar_epi32(v_permute, v);
+        _mm512_mask_storeu_epi32(dst + i * 3, 0x0FFF, v);
+    }
+    CpuDispatchApplyLut3Scalar(src + i, dst + i * 3, num - i, lut);
+}
+
+static void TemporalFilter(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max)
+{
+    const __m512 v_alpha = _mm512_set1_ps(alpha);
+    const __m512 v_reset_ratio = _mm512_set1_ps(reset_ratio);
+    const __m512 v_zero = _mm512_setzero_ps();
+    const __m512i v_hole_frame_max = _mm512_set1_epi32(hole_frame_max);
+    const __m512i v_one = _mm512_set1_epi32(1);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m512 v = _mm512_loadu_ps(src + i);
+        const __m512 h = _mm512_loadu_ps(history + i);
+        const __mmask16 is_valid = _mm512_cmp_ps_mask(v, v_zero, _CMP_GT_OQ);
+        const __mmask16 is_history_valid = _mm512_cmp_ps_mask(h, v_zero, _CMP_GT_OQ);
+        const __m512 diff = _mm512_sub_ps(v, h);
+        const __mmask16 is_static = _mm512_mask_cmp_ps_mask(is_history_valid, _mm512_abs_ps(diff), _mm512_mul_ps(v_reset_ratio, h), _CMP_LE_OQ);
+        const __m512 value_new = _mm512_mask_blend_ps(is_static, v, _mm512_add_ps(h, _mm512_mul_ps(v_alpha, diff)));
+
+        /* Holes: keep the history while the count is less than max */
+        const __m512i count = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hole_count + i)));
+        const __mmask16 is_keep = _mm512_mask_cmplt_epi32_mask(static_cast<__mmask16>(~is_valid & is_history_valid), count, v_hole_frame_max);
+        const __m512 value_out = _mm512_mask_blend_ps(is_valid, _mm512_maskz_mov_ps(is_keep, h), value_new);
+        _mm512_storeu_ps(history + i, value_out);
+        _mm512_storeu_ps(dst + i, value_out);
+
+        const __m512i count_new = _mm512_maskz_mov_epi32(static_cast<__mmask16>(~is_valid), _mm512_mask_add_epi32(count, is_keep, count, v_one));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(hole_count + i), _mm512_cvtepi32_epi8(count_new));
+    }
+    CpuDispatchTemporalFilterScalar(src + i, history + i, hole_count + i, dst + i, num - i, alpha, reset_ratio, hole_frame_max);
+}
+
+/* popcount of each uint32 by a nibble table */
+static inline __m512i Popcount32(__m512i v)
+{
+    const __m512i v_lut = _mm512_mask_broadcast_i32x4(_mm512_setzero_si512(), 0xFFFF, _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+    const __m512i v_mask = _mm512_set1_epi8(0x0F);
+    const __m512i count_lo = _mm512_shuffle_epi8(v_lut, _mm512_and_si512(v, v_mask));
+    const __m512i count_hi = _mm512_shuffle_epi8(v_lut, _mm512_and_si512(_mm512_srli_epi16(v, 4), v_mask));
+    const __m512i count = _mm512_add_epi8(count_lo, count_hi);
+    return _mm512_madd_epi16(_mm512_maddubs_epi16(count, _mm512_set1_epi8(1)), _mm512_set1_epi16(1));
+}
+
+static void SgmCensusCost(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t width, int32_t disparity_num, uint8_t cost_invalid)
+{
+    /* Pixels with invalid disparities */
+    const int32_t x_simd = (disparity_num - 1 < width) ? disparity_num - 1 : width;
+    CpuDispatchSgmCensusCostScalar(census_l, census_r, cost, 0, x_simd, disparity_num, cost_invalid);
+
+    /* census_r[x - d] for d, d + 1, ... is in the reverse order in memory */
+    const __m512i v_reverse = _mm512_setr_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    for (int32_t x = x_simd; x < width; x++) {
+        const __m512i v_l = _mm512_set1_epi32(static_cast<int32_t>(census_l[x]));
+        uint8_t* c = cost + static_cast<int64_t>(x) * disparity_num;
+        for (int32_t d = 0; d < disparity_num; d += 16) {
+            const __m512i r = _mm512_permutexvar_epi32(v_reverse, _mm512_loadu_si512(census_r + x - d - 15));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(c + d), _mm512_cvtepi32_epi8(Popcount32(_mm512_xor_si512(v_l, r))));
+        }
+    }
+}
+
+static void SgmAggregate(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2)
+{
+    /* path_prev with a sentinel at both ends, so that d - 1 and d + 1 are unaligned loads */
+    alignas(64) uint16_t prev[kCpuDispatchSgmDisparityMax + 32];
+    const __m512i v_p1 = _mm512_set1_epi16(static_cast<int16_t>(p1));
+    const __m512i v_max = _mm512_set1_epi16(-1);
+    /* 32 disparities at once. The last block may have only 16 */
+    const __mmask32 mask_tail = (disparity_num % 32 == 0) ? 0xFFFFFFFFu : 0x0000FFFFu;
+    for (int32_t i = 0; i < num; i++) {
+        const int64_t offset = static_cast<int64_t>(i) * stride;
+        const uint8_t* c = cost + offset;
+        uint16_t* l = path_cur + offset;
+        uint16_t* s = sum ? sum + offset : nullptr;
+        if (!path_prev) {
+            for (int32_t d = 0; d < disparity_num; d += 32) {
+                const __mmask32 mask = (d + 32 <= disparity_num) ? 0xFFFFFFFFu : mask_tail;
+                const __m512i v = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(_mm512_maskz_loadu_epi8(mask, c + d)));
+                _mm512_mask_storeu_epi16(l + d, mask, v);
+                if (s) _mm512_mask_storeu_epi16(s + d, mask, _mm512_add_epi16(_mm512_maskz_loadu_epi16(mask, s + d), v));
+            }
+            continue;
+        }
+
+        const uint16_t* l_prev = path_prev + offset;
+        __m512i v_min = v_max;
+        for (int32_t d = 0; d < disparity_num; d += 32) {
+            const __mmask32 mask = (d + 32 <= disparity_num) ? 0xFFFFFFFFu : mask_tail;
+            const __m512i v = _mm512_mask_loadu_epi16(v_max, mask, l_prev + d);
+            _mm512_mask_storeu_epi16(prev + 1 + d, mask, v);
+            v_min = _mm512_min_epu16(v_min, v);
+        }
+        prev[0] = 0xFFFF;
+        prev[disparity_num + 1] = 0xFFFF;
+        const __m256i min_256 = _mm256_min_epu16(_mm512_castsi512_si256(v_min), _mm512_extracti64x4_epi64(v_min, 1));
+        const __m128i min_128 = _mm_minpos_epu16(_mm_min_epu16(_mm256_castsi256_si128(min_256), _mm256_extracti128_si256(min_256, 1)));
+        const uint16_t min_prev = static_cast<uint16_t>(_mm_cvtsi128_si32(min_128));
+        const __m512i v_min_prev = _mm512_set1_epi16(static_cast<int16_t>(min_prev));
+        const __m512i v_min_prev_p2 = _mm512_set1_epi16(static_cast<int16_t>(min_prev + p2));
+
+        for (int32_t d = 0; d < disparity_num; d += 32) {
+            const __mmask32 mask = (d + 32 <= disparity_num) ? 0xFFFFFFFFu : mask_tail;
+            const __m512i v = _mm512_maskz_loadu_epi16(mask, prev + 1 + d);
+            const __m512i v_left = _mm512_adds_epu16(_mm512_maskz_loadu_epi16(mask, prev + d), v_p1);
+            const __m512i v_right = _mm512_adds_epu16(_mm512_maskz_loadu_epi16(mask, prev + 2 + d), v_p1);
+            __m512i v_out = _mm512_min_epu16(_mm512_min_epu16(v, v_min_prev_p2), _mm512_min_epu16(v_left, v_right));
+            v_out = _mm512_add_epi16(_mm512_sub_epi16(v_out, v_min_prev), _mm512_cvtepu8_epi16(_mm512_castsi512_si256(_mm512_maskz_loadu_epi8(mask, c + d))));
+            _mm512_mask_storeu_epi16(l + d, mask, v_out);
+            if (s) _mm512_mask_storeu_epi16(s + d, mask, _mm512_add_epi16(_mm512_maskz_loadu_epi16(mask, s + d), v_out));
+        }
+    }
+}
+
+const CpuDispatchKernel* CpuDispatchGetKernelAvx512(void)
+{
+    static const CpuDispatchKernel kernel = { PackUint8ToFloat, ScaleToUint8, ReciprocalToUint8, ScaleUint16ToUint8, ReciprocalToUint16, ApplyLut3, TemporalFilter, SgmCensusCost, SgmAggregate, CpuDispatchSgmSelectDisparityAvx2 };
+    return &kernel;
+}
@@ -0,0 +1,87 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+
+#include "cpu_dispatch_kernel.h"
+
+/*** Function ***/
+static void PackUint8ToFloat(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale)
+{
+    CpuDispatchPackUint8ToFloatScalar(src, src_stride, dst, num, scale);
+}
+
+static void ScaleToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    for (int32_t i = 0; i < num; i++) {
+        dst[i] = CpuDispatchScaleToUint8(src[i] * scale);
+    }
+}
+
+static void ReciprocalToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    for (int32_t i = 0; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint8(src[i], scale);
+    }
+}
+
+static void ScaleUint16ToUint8(const uint16_t* src, uint8_t* dst, int32_t num, uint16_t scale_q12)
+{
+    for (int32_t i = 0; i < num; i++) {
+        dst[i] = CpuDispatchScaleUint16ToUint8(src[i], scale_q12);
+    }
+}
+
+static void ReciprocalToUint16(const uint16_t* src, uint16_t* dst, int32_t num, float scale)
+{
+    for (int32_t i = 0; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint16(src[i], scale);
+    }
+}
+
+static void ApplyLut3(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut)
+{
+    CpuDispatchApplyLut3Scalar(src, dst, num, lut);
+}
+
+static void TemporalFilter(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max)
+{
+    CpuDispatchTemporalFilterScalar(src, history, hole_count, dst, num, alpha, reset_ratio, hole_frame_max);
+}
+
+static void SgmCensusCost(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t width, int32_t disparity_num, uint8_t cost_invalid)
+{
+    CpuDispatchSgmCensusCostScalar(census_l, census_r, cost, 0, width, disparity_num, cost_invalid);
+}
+
+static void SgmAggregate(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2)
+{
+    CpuDispatchSgmAggregateScalar(cost, path_prev, path_cur, sum, num, stride, disparity_num, p1, p2);
+}
+
+static void SgmSelectDisparity(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t width, int32_t disparity_num, int32_t uniqueness_ratio)
+{
+    CpuDispatchSgmSelectDisparityInit(disparity_r, cost_min_r, width);
+    for (int32_t x = 0; x < width; x++) {
+        CpuDispatchSgmSelectDisparityPixel(sum, disparity_l, disparity_r, cost_min_r, x, disparity_num, uniqueness_ratio);
+    }
+}
+
+const CpuDispatchKernel* CpuDispatchGetKernelGeneric(void)
+{
+    static const CpuDispatchKernel kernel = { PackUint8ToFloat, ScaleToUint8, ReciprocalToUint8, ScaleUint16ToUint8, ReciprocalToUint16, ApplyLut3, TemporalFilter, SgmCensusCost, SgmAggregate, SgmSelectDisparity };
+    return &kernel;
+}
@@ -0,0 +1,205 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef CPU_DISPATCH_KERNEL_
+#define CPU_DISPATCH_KERNEL_
+
+/* for general */
+#include <cstdint>
+
+/*
+ * Internal header for cpu_dispatch_*.cpp
+ *   Each kernel file is built with its own ISA flags. Don't include headers with inline functions or templates
+ *   (e.g. <algorithm>) in them: the linker may pick an AVX2 copy of the function for the whole binary.
+ *   Helpers here are static, so each file has its own copy
+ */
+typedef struct CpuDispatchKernel_ {
+    void (*pack_uint8_to_float)(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale);
+    void (*scale_to_uint8)(const float* src, uint8_t* dst, int32_t num, float scale);
+    void (*reciprocal_to_uint8)(const float* src, uint8_t* dst, int32_t num, float scale);
+    void (*scale_uint16_to_uint8)(const uint16_t* src, uint8_t* dst, int32_t num, uint16_t scale_q12);
+    void (*reciprocal_to_uint16)(const uint16_t* src, uint16_t* dst, int32_t num, float scale);
+    void (*apply_lut3)(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut);
+    void (*temporal_filter)(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max);
+    void (*sgm_census_cost)(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t width, int32_t disparity_num, uint8_t cost_invalid);
+    void (*sgm_aggregate)(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2);
+    void (*sgm_select_disparity)(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t width, int32_t disparity_num, int32_t uniqueness_ratio);
+} CpuDispatchKernel;
+
+/* SIMD versions of the SGM kernels: disparity_num is a multiple of 16 and up to this (checked by the caller) */
+static constexpr int32_t kCpuDispatchSgmDisparityMax = 256;
+
+const CpuDispatchKernel* CpuDispatchGetKernelGeneric(void);
+const CpuDispatchKernel* CpuDispatchGetKernelAvx2(void);
+const CpuDispatchKernel* CpuDispatchGetKernelAvx512(void);
+const CpuDispatchKernel* CpuDispatchGetKernelNeon(void);
+
+/* Shared by the AVX-512 kernel, where 16 disparities at once are enough for the range in use */
+void CpuDispatchSgmSelectDisparityAvx2(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t width, int32_t disparity_num, int32_t uniqueness_ratio);
+
+/* Scalar version, used for the remainder of SIMD loops too */
+static inline uint8_t CpuDispatchScaleToUint8(float value)
+{
+    if (!(value > 0.0f)) return 0;
+    if (value >= 255.0f) return 255;
+    return static_cast<uint8_t>(value);
+}
+
+static inline uint8_t CpuDispatchReciprocalToUint8(float value, float scale)
+{
+    if (!(value > 0.0f)) return 255;
+    const float z = scale / value;
+    if (!(z > 0.0f)) return 0;
+    if (z >= 255.0f) return 255;
+    return static_cast<uint8_t>(z);
+}
+
+/* 65535 * 65535 fits in uint32 */
+static inline uint8_t CpuDispatchScaleUint16ToUint8(uint16_t value, uint16_t scale_q12)
+{
+    const uint32_t z = (static_cast<uint32_t>(value) * scale_q12) >> 12;
+    return static_cast<uint8_t>((z > 255) ? 255 : z);
+}
+
+static inline uint16_t CpuDispatchReciprocalToUint16(uint16_t value, float scale)
+{
+    if (value == 0) return 0;
+    const float z = scale / static_cast<float>(value);
+    if (!(z > 0.0f)) return 0;
+    if (z >= 65535.0f) return 65535;
+    return static_cast<uint16_t>(z);
+}
+
+static inline void CpuDispatchPackUint8ToFloatScalar(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale)
+{
+    for (int32_t i = 0; i < num; i++) {
+        dst[i] = src[static_cast<int64_t>(i) * src_stride] * scale;
+    }
+}
+
+static inline void CpuDispatchApplyLut3Scalar(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut)
+{
+    for (int32_t i = 0; i < num; i++) {
+        const uint8_t* entry = lut + src[i] * 3;
+        dst[i * 3 + 0] = entry[0];
+        dst[i * 3 + 1] = entry[1];
+        dst[i * 3 + 2] = entry[2];
+    }
+}
+
+static inline void CpuDispatchTemporalFilterScalar(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max)
+{
+    for (int32_t i = 0; i < num; i++) {
+        const float value = src[i];
+        const float value_history = history[i];
+        float value_out = 0.0f;
+        if (value > 0.0f) {
+            /* Same operation order as the SIMD versions. No std::abs (see above) */
+            const float diff = value - value_history;
+            const float diff_abs = (diff < 0.0f) ? -diff : diff;
+            const bool is_static = (value_history > 0.0f) && (diff_abs <= reset_ratio * value_history);
+            value_out = is_static ? value_history + alpha * diff : value;
+            hole_count[i] = 0;
+        } else if (value_history > 0.0f && hole_count[i] < hole_frame_max) {
+            value_out = value_history;
+            hole_count[i]++;
+        }
+        history[i] = value_out;
+        dst[i] = value_out;
+    }
+}
+
+static inline uint8_t CpuDispatchPopcount32(uint32_t value)
+{
+    value = value - ((value >> 1) & 0x55555555u);
+    value = (value & 0x33333333u) + ((value >> 2) & 0x33333333u);
+    value = (value + (value >> 4)) & 0x0F0F0F0Fu;
+    return static_cast<uint8_t>((value * 0x01010101u) >> 24);
+}
+
+/* for pixels [x_begin, x_end) of a row */
+static inline void CpuDispatchSgmCensusCostScalar(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t x_begin, int32_t x_end, int32_t disparity_num, uint8_t cost_invalid)
+{
+    for (int32_t x = x_begin; x < x_end; x++) {
+        uint8_t* c = cost + static_cast<int64_t>(x) * disparity_num;
+        for (int32_t d = 0; d < disparity_num; d++) {
+            c[d] = (d <= x) ? CpuDispatchPopcount32(census_l[x] ^ census_r[x - d]) : cost_invalid;
+        }
+    }
+}
+
+static inline void CpuDispatchSgmAggregateScalar(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2)
+{
+    for (int32_t i = 0; i < num; i++) {
+        const int64_t offset = static_cast<int64_t>(i) * stride;
+        const uint8_t* c = cost + offset;
+        uint16_t* l = path_cur + offset;
+        if (!path_prev) {
+            for (int32_t d = 0; d < disparity_num; d++) l[d] = c[d];
+        } else {
+            const uint16_t* l_prev = path_prev + offset;
+            int32_t min_prev = l_prev[0];
+            for (int32_t d = 1; d < disparity_num; d++) {
+                if (l_prev[d] < min_prev) min_prev = l_prev[d];
+            }
+            int32_t value_left = 0xFFFF;
+            for (int32_t d = 0; d < disparity_num; d++) {
+                const int32_t value = l_prev[d];
+                const int32_t value_right = (d + 1 < disparity_num) ? l_prev[d + 1] : 0xFFFF;
+                int32_t value_min = min_prev + p2;
+                if (value < value_min) value_min = value;
+                if (value_left + p1 < value_min) value_min = value_left + p1;
+                if (value_right + p1 < value_min) value_min = value_right + p1;
+                l[d] = static_cast<uint16_t>(c[d] + value_min - min_prev);
+                value_left = value;
+            }
+        }
+        if (sum) {
+            uint16_t* s = sum + offset;
+            for (int32_t d = 0; d < disparity_num; d++) s[d] = static_cast<uint16_t>(s[d] + l[d]);
+        }
+    }
+}
+
+static inline void CpuDispatchSgmSelectDisparityInit(int16_t* disparity_r, uint16_t* cost_min_r, int32_t width)
+{
+    for (int32_t x = 0; x < width; x++) {
+        disparity_r[x] = -1;
+        cost_min_r[x] = 0xFFFF;
+    }
+}
+
+/* for a pixel x. Pixels are processed in the order of x, so that the right image gets the same result as the SIMD versions */
+static inline void CpuDispatchSgmSelectDisparityPixel(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t x, int32_t disparity_num, int32_t uniqueness_ratio)
+{
+    const uint16_t* s = sum + static_cast<int64_t>(x) * disparity_num;
+    const int32_t d_num = (x + 1 < disparity_num) ? x + 1 : disparity_num;
+    int32_t d_best = 0;
+    for (int32_t d = 1; d < d_num; d++) {
+        if (s[d] < s[d_best]) d_best = d;
+    }
+    int32_t cost_second = 0xFFFF;
+    for (int32_t d = 0; d < d_num; d++) {
+        if ((d < d_best - 1 || d > d_best + 1) && s[d] < cost_second) cost_second = s[d];
+    }
+    disparity_l[x] = (s[d_best] * (100 + uniqueness_ratio) < cost_second * 100) ? static_cast<int16_t>(d_best) : -1;
+    for (int32_t d = 0; d < d_num; d++) {
+        if (s[d] < cost_min_r[x - d]) {
+            cost_min_r[x - d] = s[d];
+            disparity_r[x - d] = static_cast<int16_t>(d);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,376 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <arm_neon.h>
+
+#include "cpu_dispatch_kernel.h"
+
+/* For aarch64, where NEON (Advanced SIMD) is available on all the CPUs */
+
+/*** Function ***/
+static inline float32x4_t ConvertUint16x4ToFloat(uint16x4_t v)
+{
+    return vcvtq_f32_u32(vmovl_u16(v));
+}
+
+static void PackUint8ToFloat(const uint8_t* src, int32_t src_stride, float* dst, int32_t num, float scale)
+{
+    int32_t i = 0;
+    if (src_stride == 1 || src_stride == 3 || src_stride == 4) {
+        /* vld3/vld4 read all the channels of 16 pixels. Stop before reading beyond the last pixel */
+        const int64_t last = static_cast<int64_t>(num - 1) * src_stride;
+        for (; static_cast<int64_t>(i + 16) * src_stride - 1 <= last; i += 16) {
+            const uint8_t* s = src + static_cast<int64_t>(i) * src_stride;
+            uint8x16_t v;
+            if (src_stride == 1) {
+                v = vld1q_u8(s);
+            } else if (src_stride == 3) {
+                v = vld3q_u8(s).val[0];
+            } else {
+                v = vld4q_u8(s).val[0];
+            }
+            const uint16x8_t v_lo = vmovl_u8(vget_low_u8(v));
+            const uint16x8_t v_hi = vmovl_u8(vget_high_u8(v));
+            vst1q_f32(dst + i + 0, vmulq_n_f32(ConvertUint16x4ToFloat(vget_low_u16(v_lo)), scale));
+            vst1q_f32(dst + i + 4, vmulq_n_f32(ConvertUint16x4ToFloat(vget_high_u16(v_lo)), scale));
+            vst1q_f32(dst + i + 8, vmulq_n_f32(ConvertUint16x4ToFloat(vget_low_u16(v_hi)), scale));
+            vst1q_f32(dst + i + 12, vmulq_n_f32(ConvertUint16x4ToFloat(vget_high_u16(v_hi)), scale));
+        }
+    }
+    CpuDispatchPackUint8ToFloatScalar(src + static_cast<int64_t>(i) * src_stride, src_stride, dst + i, num - i, scale);
+}
+
+/* 4 x 4 floats (already clamped to [0, 255]) -> 16 x uint8 */
+static inline uint8x16_t ConvertToUint8(float32x4_t f0, float32x4_t f1, float32x4_t f2, float32x4_t f3)
+{
+    const uint16x8_t lo = vcombine_u16(vmovn_u32(vcvtq_u32_f32(f0)), vmovn_u32(vcvtq_u32_f32(f1)));
+    const uint16x8_t hi = vcombine_u16(vmovn_u32(vcvtq_u32_f32(f2)), vmovn_u32(vcvtq_u32_f32(f3)));
+    return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+}
+
+static void ScaleToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    const float32x4_t v_zero = vdupq_n_f32(0.0f);
+    const float32x4_t v_255 = vdupq_n_f32(255.0f);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        float32x4_t f[4];
+        for (int32_t j = 0; j < 4; j++) {
+            f[j] = vmulq_n_f32(vld1q_f32(src + i + j * 4), scale);
+            f[j] = vminq_f32(vmaxnmq_f32(f[j], v_zero), v_255);    /* maxnm returns the number (0) for NaN */
+        }
+        vst1q_u8(dst + i, ConvertToUint8(f[0], f[1], f[2], f[3]));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchScaleToUint8(src[i] * scale);
+    }
+}
+
+static void ReciprocalToUint8(const float* src, uint8_t* dst, int32_t num, float scale)
+{
+    const float32x4_t v_scale = vdupq_n_f32(scale);
+    const float32x4_t v_zero = vdupq_n_f32(0.0f);
+    const float32x4_t v_255 = vdupq_n_f32(255.0f);
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        float32x4_t f[4];
+        uint32x4_t is_valid[4];
+        for (int32_t j = 0; j < 4; j++) {
+            const float32x4_t d = vld1q_f32(src + i + j * 4);
+            f[j] = vdivq_f32(v_scale, d);      /* not reciprocal estimate, to get the same result as the scalar version */
+            f[j] = vminq_f32(vmaxnmq_f32(f[j], v_zero), v_255);
+            is_valid[j] = vcgtq_f32(d, v_zero);
+        }
+        const uint16x8_t valid_lo = vcombine_u16(vmovn_u32(is_valid[0]), vmovn_u32(is_valid[1]));
+        const uint16x8_t valid_hi = vcombine_u16(vmovn_u32(is_valid[2]), vmovn_u32(is_valid[3]));
+        const uint8x16_t valid = vcombine_u8(vmovn_u16(valid_lo), vmovn_u16(valid_hi));
+        vst1q_u8(dst + i, vbslq_u8(valid, ConvertToUint8(f[0], f[1], f[2], f[3]), vdupq_n_u8(255)));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint8(src[i], scale);
+    }
+}
+
+/* 8 x uint16 -> (x * scale_q12) >> 12 in 2 x 4 x uint32 -> 8 x uint16 (saturated) */
+static inline uint16x8_t ScaleUint16Q12(uint16x8_t v, uint32_t scale_q12)
+{
+    const uint32x4_t lo = vshrq_n_u32(vmulq_n_u32(vmovl_u16(vget_low_u16(v)), scale_q12), 12);
+    const uint32x4_t hi = vshrq_n_u32(vmulq_n_u32(vmovl_u16(vget_high_u16(v)), scale_q12), 12);
+    return vcombine_u16(vqmovn_u32(lo), vqmovn_u32(hi));
+}
+
+static void ScaleUint16ToUint8(const uint16_t* src, uint8_t* dst, int32_t num, uint16_t scale_q12)
+{
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const uint16x8_t lo = ScaleUint16Q12(vld1q_u16(src + i + 0), scale_q12);
+        const uint16x8_t hi = ScaleUint16Q12(vld1q_u16(src + i + 8), scale_q12);
+        vst1q_u8(dst + i, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchScaleUint16ToUint8(src[i], scale_q12);
+    }
+}
+
+static void ReciprocalToUint16(const uint16_t* src, uint16_t* dst, int32_t num, float scale)
+{
+    const float32x4_t v_scale = vdupq_n_f32(scale);
+    const float32x4_t v_zero = vdupq_n_f32(0.0f);
+    const float32x4_t v_65535 = vdupq_n_f32(65535.0f);
+    int32_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        const uint16x8_t s = vld1q_u16(src + i);
+        float32x4_t f[2];
+        f[0] = vdivq_f32(v_scale, ConvertUint16x4ToFloat(vget_low_u16(s)));     /* no integer division in SIMD. Exact for uint16 */
+        f[1] = vdivq_f32(v_scale, ConvertUint16x4ToFloat(vget_high_u16(s)));
+        for (int32_t j = 0; j < 2; j++) {
+            f[j] = vminq_f32(vmaxnmq_f32(f[j], v_zero), v_65535);
+        }
+        const uint16x8_t v = vcombine_u16(vmovn_u32(vcvtq_u32_f32(f[0])), vmovn_u32(vcvtq_u32_f32(f[1])));
+        vst1q_u16(dst + i, vandq_u16(v, vtstq_u16(s, s)));
+    }
+    for (; i < num; i++) {
+        dst[i] = CpuDispatchReciprocalToUint16(src[i], scale);
+    }
+}
+
+/* 256-entry table lookup by 4 lookups in 64-byte tables. tbx keeps dst for an index out of range */
+static inline uint8x16_t Lookup256(const uint8x16x4_t table[4], uint8x16_t index)
+{
+    const uint8x16_t v_64 = vdupq_n_u8(64);
+    uint8x16_t v = vqtbl4q_u8(table[0], index);
+    index = vsubq_u8(index, v_64);
+    v = vqtbx4q_u8(v, table[1], index);
+    index = vsubq_u8(index, v_64);
+    v = vqtbx4q_u8(v, table[2], index);
+    index = vsubq_u8(index, v_64);
+    v = vqtbx4q_u8(v, table[3], index);
+    return v;
+}
+
+static void ApplyLut3(const uint8_t* src, uint8_t* dst, int32_t num, const uint8_t* lut)
+{
+    /* Planar table for each channel */
+    uint8_t lut_planar[3][256];
+    for (int32_t i = 0; i < 256; i++) {
+        lut_planar[0][i] = lut[i * 3 + 0];
+        lut_planar[1][i] = lut[i * 3 + 1];
+        lut_planar[2][i] = lut[i * 3 + 2];
+    }
+    uint8x16x4_t table[3][4];
+    for (int32_t c = 0; c < 3; c++) {
+        for (int32_t k = 0; k < 4; k++) {
+            const uint8_t* p = lut_planar[c] + k * 64;
+            table[c][k].val[0] = vld1q_u8(p + 0);
+            table[c][k].val[1] = vld1q_u8(p + 16);
+            table[c][k].val[2] = vld1q_u8(p + 32);
+            table[c][k].val[3] = vld1q_u8(p + 48);
+        }
+    }
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const uint8x16_t index = vld1q_u8(src + i);
+        uint8x16x3_t v;
+        v.val[0] = Lookup256(table[0], index);
+        v.val[1] = Lookup256(table[1], index);
+        v.val[2] = Lookup256(table[2], index);
+        vst3q_u8(dst + i * 3, v);
+    }
+    CpuDispatchApplyLut3Scalar(src + i, dst + i * 3, num - i, lut);
+}
+
+static void TemporalFilter(const float* src, float* history, uint8_t* hole_count, float* dst, int32_t num, float alpha, float reset_ratio, int32_t hole_frame_max)
+{
+    const float32x4_t v_zero = vdupq_n_f32(0.0f);
+    const uint8x16_t v_hole_frame_max = vdupq_n_u8(static_cast<uint8_t>(hole_frame_max));
+    int32_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        uint32x4_t is_valid[4];
+        uint32x4_t is_history_valid[4];
+        float32x4_t value_new[4];
+        for (int32_t j = 0; j < 4; j++) {
+            const float32x4_t v = vld1q_f32(src + i + j * 4);
+            const float32x4_t h = vld1q_f32(history + i + j * 4);
+            is_valid[j] = vcgtq_f32(v, v_zero);
+            is_history_valid[j] = vcgtq_f32(h, v_zero);
+            const float32x4_t diff = vsubq_f32(v, h);
+            const uint32x4_t is_static = vandq_u32(is_history_valid[j], vcleq_f32(vabsq_f32(diff), vmulq_n_f32(h, reset_ratio)));
+            value_new[j] = vbslq_f32(is_static, vaddq_f32(h, vmulq_n_f32(diff, alpha)), v);
+        }
+
+        /* Holes: keep the history while the count is less than max */
+        const uint8x16_t count = vld1q_u8(hole_count + i);
+        const uint8x16_t valid = vcombine_u8(
+            vmovn_u16(vcombine_u16(vmovn_u32(is_valid[0]), vmovn_u32(is_valid[1]))),
+            vmovn_u16(vcombine_u16(vmovn_u32(is_valid[2]), vmovn_u32(is_valid[3]))));
+        const uint8x16_t history_valid = vcombine_u8(
+            vmovn_u16(vcombine_u16(vmovn_u32(is_history_valid[0]), vmovn_u32(is_history_valid[1]))),
+            vmovn_u16(vcombine_u16(vmovn_u32(is_history_valid[2]), vmovn_u32(is_history_valid[3]))));
+        const uint8x16_t keep = vbicq_u8(vandq_u8(history_valid, vcltq_u8(count, v_hole_frame_max)), valid);
+        const uint16x8_t keep_lo = vmovl_u8(vget_low_u8(keep));
+        const uint16x8_t keep_hi = vmovl_u8(vget_high_u8(keep));
+        const uint32x4_t is_keep[4] = {
+            vmovl_u16(vget_low_u16(keep_lo)), vmovl_u16(vget_high_u16(keep_lo)),
+            vmovl_u16(vget_low_u16(keep_hi)), vmovl_u16(vget_high_u16(keep_hi)) };
+        for (int32_t j = 0; j < 4; j++) {
+            /* keep (0xFF) is extended to 0x000000FF. Compare to make a full mask */
+            const float32x4_t h = vld1q_f32(history + i + j * 4);
+            const uint32x4_t is_keep_mask = vtstq_u32(is_keep[j], is_keep[j]);
+            const float32x4_t value_hole = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(h), is_keep_mask));
+            const float32x4_t value_out = vbslq_f32(is_valid[j], value_new[j], value_hole);
+            vst1q_f32(history + i + j * 4, value_out);
+            vst1q_f32(dst + i + j * 4, value_out);
+        }
+
+        /* count + 1 (keep), 0 (valid) */
+        vst1q_u8(hole_count + i, vbicq_u8(vsubq_u8(count, keep), valid));
+    }
+    CpuDispatchTemporalFilterScalar(src + i, history + i, hole_count + i, dst + i, num - i, alpha, reset_ratio, hole_frame_max);
+}
+
+/* {v[3], v[2], v[1], v[0]} */
+static inline uint32x4_t ReverseUint32x4(uint32x4_t v)
+{
+    const uint32x4_t v_rev64 = vrev64q_u32(v);
+    return vcombine_u32(vget_high_u32(v_rev64), vget_low_u32(v_rev64));
+}
+
+static void SgmCensusCost(const uint32_t* census_l, const uint32_t* census_r, uint8_t* cost, int32_t width, int32_t disparity_num, uint8_t cost_invalid)
+{
+    /* Pixels with invalid disparities */
+    const int32_t x_simd = (disparity_num - 1 < width) ? disparity_num - 1 : width;
+    CpuDispatchSgmCensusCostScalar(census_l, census_r, cost, 0, x_simd, disparity_num, cost_invalid);
+
+    /* census_r[x - d] for d, d + 1, ... is in the reverse order in memory */
+    for (int32_t x = x_simd; x < width; x++) {
+        const uint32x4_t v_l = vdupq_n_u32(census_l[x]);
+        uint8_t* c = cost + static_cast<int64_t>(x) * disparity_num;
+        for (int32_t d = 0; d < disparity_num; d += 16) {
+            uint8x16_t count[4];
+            for (int32_t j = 0; j < 4; j++) {
+                const uint32x4_t r = ReverseUint32x4(vld1q_u32(census_r + x - d - j * 4 - 3));
+                count[j] = vcntq_u8(vreinterpretq_u8_u32(veorq_u32(v_l, r)));
+            }
+            /* Sum of 4 bytes of each uint32, in order */
+            vst1q_u8(c + d, vpaddq_u8(vpaddq_u8(count[0], count[1]), vpaddq_u8(count[2], count[3])));
+        }
+    }
+}
+
+static void SgmAggregate(const uint8_t* cost, const uint16_t* path_prev, uint16_t* path_cur, uint16_t* sum, int32_t num, int32_t stride, int32_t disparity_num, uint16_t p1, uint16_t p2)
+{
+    /* path_prev with a sentinel at both ends, so that d - 1 and d + 1 are unaligned loads */
+    alignas(16) uint16_t prev[kCpuDispatchSgmDisparityMax + 16];
+    const uint16x8_t v_p1 = vdupq_n_u16(p1);
+    for (int32_t i = 0; i < num; i++) {
+        const int64_t offset = static_cast<int64_t>(i) * stride;
+        const uint8_t* c = cost + offset;
+        uint16_t* l = path_cur + offset;
+        uint16_t* s = sum ? sum + offset : nullptr;
+        if (!path_prev) {
+            for (int32_t d = 0; d < disparity_num; d += 8) {
+                const uint16x8_t v = vmovl_u8(vld1_u8(c + d));
+                vst1q_u16(l + d, v);
+                if (s) vst1q_u16(s + d, vaddq_u16(vld1q_u16(s + d), v));
+            }
+            continue;
+        }
+
+        const uint16_t* l_prev = path_prev + offset;
+        uint16x8_t v_min = vdupq_n_u16(0xFFFF);
+        for (int32_t d = 0; d < disparity_num; d += 8) {
+            const uint16x8_t v = vld1q_u16(l_prev + d);
+            vst1q_u16(prev + 1 + d, v);
+            v_min = vminq_u16(v_min, v);
+        }
+        prev[0] = 0xFFFF;
+        prev[disparity_num + 1] = 0xFFFF;
+        const uint16_t min_prev = vminvq_u16(v_min);
+        const uint16x8_t v_min_prev = vdupq_n_u16(min_prev);
+        const uint16x8_t v_min_prev_p2 = vdupq_n_u16(static_cast<uint16_t>(min_prev + p2));
+
+        for (int32_t d = 0; d < disparity_num; d += 8) {
+            const uint16x8_t v = vld1q_u16(prev + 1 + d);
+            const uint16x8_t v_left = vqaddq_u16(vld1q_u16(prev + d), v_p1);
+            const uint16x8_t v_right = vqaddq_u16(vld1q_u16(prev + 2 + d), v_p1);
+            uint16x8_t v_out = vminq_u16(vminq_u16(v, v_min_prev_p2), vminq_u16(v_left, v_right));
+            v_out = vaddq_u16(vsubq_u16(v_out, v_min_prev), vmovl_u8(vld1_u8(c + d)));
+            vst1q_u16(l + d, v_out);
+            if (s) vst1q_u16(s + d, vaddq_u16(vld1q_u16(s + d), v_out));
+        }
+    }
+}
+
+static void SgmSelectDisparity(const uint16_t* sum, int16_t* disparity_l, int16_t* disparity_r, uint16_t* cost_min_r, int32_t width, int32_t disparity_num, int32_t uniqueness_ratio)
+{
+    CpuDispatchSgmSelectDisparityInit(disparity_r, cost_min_r, width);
+    /* Pixels where some disparities are invalid */
+    const int32_t x_simd = (disparity_num - 1 < width) ? disparity_num - 1 : width;
+    for (int32_t x = 0; x < x_simd; x++) {
+        CpuDispatchSgmSelectDisparityPixel(sum, disparity_l, disparity_r, cost_min_r, x, disparity_num, uniqueness_ratio);
+    }
+
+    const uint16_t kIndexList[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    const uint16x8_t v_index = vld1q_u16(kIndexList);
+    const uint16x8_t v_index_reverse = vextq_u16(vrev64q_u16(v_index), vrev64q_u16(v_index), 4);
+    const uint16x8_t v_max = vdupq_n_u16(0xFFFF);
+    for (int32_t x = x_simd; x < width; x++) {
+        const uint16_t* s = sum + static_cast<int64_t>(x) * disparity_num;
+
+        /* The best cost and the first d of it in each lane, then the smallest d of the best cost */
+        uint16x8_t v_best = vld1q_u16(s);
+        uint16x8_t v_best_index = v_index;
+        for (int32_t d = 8; d < disparity_num; d += 8) {
+            const uint16x8_t v = vld1q_u16(s + d);
+            v_best_index = vbslq_u16(vcltq_u16(v, v_best), vaddq_u16(v_index, vdupq_n_u16(static_cast<uint16_t>(d))), v_best_index);
+            v_best = vminq_u16(v_best, v);
+        }
+        const uint16_t cost_best = vminvq_u16(v_best);
+        const int32_t d_best = vminvq_u16(vbslq_u16(vceqq_u16(v_best, vdupq_n_u16(cost_best)), v_best_index, v_max));
+
+        /* The second best except d_best - 1, d_best, d_best + 1 */
+        const int16x8_t v_exclude_begin = vdupq_n_s16(static_cast<int16_t>(d_best - 2));
+        const int16x8_t v_exclude_end = vdupq_n_s16(static_cast<int16_t>(d_best + 2));
+        uint16x8_t v_second = v_max;
+        for (int32_t d = 0; d < disparity_num; d += 8) {
+            const int16x8_t v_d = vreinterpretq_s16_u16(vaddq_u16(v_index, vdupq_n_u16(static_cast<uint16_t>(d))));
+            const uint16x8_t is_excluded = vandq_u16(vcgtq_s16(v_d, v_exclude_begin), vcltq_s16(v_d, v_exclude_end));
+            v_second = vminq_u16(v_second, vorrq_u16(vld1q_u16(s + d), is_excluded));
+        }
+        const int32_t cost_second = vminvq_u16(v_second);
+        disparity_l[x] = (cost_best * (100 + uniqueness_ratio) < cost_second * 100) ? static_cast<int16_t>(d_best) : -1;
+
+        /* Right image: x - d for d, d + 1, ... is in the reverse order in memory */
+        for (int32_t d = 0; d < disparity_num; d += 8) {
+            const uint16x8_t v_rev64 = vrev64q_u16(vld1q_u16(s + d));
+            const uint16x8_t v = vextq_u16(v_rev64, v_rev64, 4);
+            uint16_t* c = cost_min_r + x - d - 7;
+            int16_t* dr = disparity_r + x - d - 7;
+            const uint16x8_t v_cost = vld1q_u16(c);
+            const uint16x8_t is_better = vcltq_u16(v, v_cost);
+            vst1q_u16(c, vminq_u16(v, v_cost));
+            const uint16x8_t v_disparity = vaddq_u16(v_index_reverse, vdupq_n_u16(static_cast<uint16_t>(d)));
+            vst1q_s16(dr, vreinterpretq_s16_u16(vbslq_u16(is_better, v_disparity, vreinterpretq_u16_s16(vld1q_s16(dr)))));
+        }
+    }
+}
+
+const CpuDispatchKernel* CpuDispatchGetKernelNeon(void)
+{
+    static const CpuDispatchKernel kernel = { PackUint8ToFloat, ScaleToUint8, ReciprocalToUint8, ScaleUint16ToUint8, ReciprocalToUint16, ApplyLut3, TemporalFilter, SgmCensusCost, SgmAggregate, SgmSelectDisparity };
+    return &kernel;
+}
@@ -0,0 +1,205 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "thread_pool.h"
+#include "depth_alignment.h"
+
+/*** Macro ***/
+#define TAG "DepthAlignment"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Huber threshold relative to RMS of residual in the previous iteration */
+static constexpr double kHuberThresholdScale = 1.345;
+static constexpr int32_t kMinSampleNum = 64;
+/* Sampled rows per block of the reduction. Partial sums of the blocks are added in order, so the result doesn't depend on the thread num */
+static constexpr int32_t kReductionBlockRows = 8;
+/* Minimum rows per task of ThreadPool */
+static constexpr int32_t kGrainSize = 8;
+
+typedef struct FitSum_ {
+    double w, x, y, xx, xy, rr;
+    int32_t num;
+    FitSum_() : w(0), x(0), y(0), xx(0), xy(0), rr(0), num(0) {}
+} FitSum;
+
+/*** Function ***/
+
+int32_t DepthAlignment::Fit(const cv::Mat& mat_relative, const cv::Mat& mat_disparity, int32_t sample_step, int32_t iteration_num)
+{
+    if (mat_relative.type() != CV_32FC1 || mat_disparity.type() != CV_32FC1 || mat_relative.size() != mat_disparity.size()) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+    sample_step = (std::max)(sample_step, 1);
+    iteration_num = (std::max)(iteration_num, 1);
+
+    const int32_t width = mat_relative.cols;
+    const int32_t height = mat_relative.rows;
+    double scale = 0;
+    double shift = 0;
+    double huber_threshold = 0;     /* 0 = ordinary least squares for the first iteration */
+    int32_t sample_num = 0;
+    /* Block of kReductionBlockRows sampled rows */
+    const int32_t block_height = kReductionBlockRows * sample_step;
+    const int32_t block_num = (height + block_height - 1) / block_height;
+
+    for (int32_t iteration = 0; iteration < iteration_num; iteration++) {
+        /* Weighted sums for normal equation. Each block of rows is independent, so reduce in parallel */
+        std::vector<FitSum> sum_list(block_num);
+        ThreadPool::GetInstance().ParallelFor(0, block_num, 1, [&](int32_t block_begin, int32_t block_end) {
+            for (int32_t block = block_begin; block < block_end; block++) {
+                FitSum& sum = sum_list[block];
+                const int32_t y_end = (std::min)(height, (block + 1) * block_height);
+                for (int32_t y = block * block_height; y < y_end; y += sample_step) {
+                    const float* rel = mat_relative.ptr<float>(y);
+                    const float* disp = mat_disparity.ptr<float>(y);
+                    for (int32_t x = 0; x < width; x += sample_step) {
+                        const double d = disp[x];
+                        const double r = rel[x];
+                        if (!(d > 0) || !std::isfinite(r)) continue;
+                        double w = 1.0;
+                        if (huber_threshold > 0) {
+                            const double residual = std::abs(d - (scale * r + shift));
+                            w = (residual <= huber_threshold) ? 1.0 : huber_threshold / residual;
+                            sum.rr += residual * residual;
+                        }
+                        sum.w += w;
+                        sum.x += w * r;
+                        sum.y += w * d;
+                        sum.xx += w * r * r;
+                        sum.xy += w * r * d;
+                        sum.num++;
+                    }
+                }
+            }
+        });
+        double sum_w = 0, sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0, sum_rr = 0;
+        int32_t num = 0;
+        for (const auto& sum : sum_list) {
+            sum_w += sum.w;
+            sum_x += sum.x;
+            sum_y += sum.y;
+            sum_xx += sum.xx;
+            sum_xy += sum.xy;
+            sum_rr += sum.rr;
+            num += sum.num;
+        }
+
+        if (num < kMinSampleNum) {
+            PRINT_E("Not enough valid pixels: %d\n", num);
+            return kRetErr;
+        }
+        const double det = sum_w * sum_xx - sum_x * sum_x;
+        if (std::abs(det) < 1e-12 * sum_w * sum_w) {
+            PRINT_E("Relative depth is flat\n");
+            return kRetErr;
+        }
+        const double scale_new = (sum_w * sum_xy - sum_x * sum_y) / det;
+        const double shift_new = (sum_y - scale_new * sum_x) / sum_w;
+
+        /* Threshold for the next iteration from the residual of the current parameters */
+        if (huber_threshold > 0) {
+            huber_threshold = kHuberThresholdScale * std::sqrt(sum_rr / num);
+        } else {
+            std::vector<double> sum_rr_list(block_num, 0.0);
+            ThreadPool::GetInstance().ParallelFor(0, block_num, 1, [&](int32_t block_begin, int32_t block_end) {
+                for (int32_t block = block_begin; block < block_end; block++) {
+                    const int32_t y_end = (std::min)(height, (block + 1) * block_height);
+                    for (int32_t y = block * block_height; y < y_end; y += sample_step) {
+                        const float* rel = mat_relative.ptr<float>(y);
+                        const float* disp = mat_disparity.ptr<float>(y);
+                        for (int32_t x = 0; x < width; x += sample_step) {
+                            if (!(disp[x] > 0) || !std::isfinite(rel[x])) continue;
+                            const double residual = disp[x] - (scale_new * rel[x] + shift_new);
+                            sum_rr_list[block] += residual * residual;
+                        }
+                    }
+                }
+            });
+            double sum_rr_ols = 0;
+            for (double sum_rr_block : sum_rr_list) sum_rr_ols += sum_rr_block;
+            huber_threshold = kHuberThresholdScale * std::sqrt(sum_rr_ols / num);
+        }
+        scale = scale_new;
+        shift = shift_new;
+        sample_num = num;
+        if (huber_threshold <= 0) break;    /* perfect fit */
+    }
+
+    if (!(scale > 0)) {
+        /* relative inverse depth must increase with disparity */
+        PRINT_E("Invalid scale: %f\n", scale);
+        return kRetErr;
+    }
+
+    scale_ = static_cast<float>(scale);
+    shift_ = static_cast<float>(shift);
+    sample_num_ = sample_num;
+    is_valid_ = true;
+    return kRetOk;
+}
+
+int32_t DepthAlignment::Apply(const cv::Mat& mat_relative, cv::Mat& mat_disparity_aligned) const
+{
+    if (!is_valid_ || mat_relative.type() != CV_32FC1) {
+        return kRetErr;
+    }
+    mat_relative.convertTo(mat_disparity_aligned, CV_32FC1, scale_, shift_);
+    return kRetOk;
+}
+
+int32_t DepthAlignment::Fuse(const cv::Mat& mat_relative, const cv::Mat& mat_disparity, float focal_length, float baseline, cv::Mat& mat_depth) const
+{
+    if (!is_valid_ || mat_relative.type() != CV_32FC1) {
+        return kRetErr;
+    }
+    const bool has_disparity = !mat_disparity.empty();
+    if (has_disparity && (mat_disparity.type() != CV_32FC1 || mat_disparity.size() != mat_relative.size())) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+
+    const int32_t width = mat_relative.cols;
+    const int32_t height = mat_relative.rows;
+    const float focal_baseline = focal_length * baseline;
+    const float scale = scale_;
+    const float shift = shift_;
+    mat_depth.create(height, width, CV_32FC1);
+    ThreadPool::GetInstance().ParallelFor(0, height, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            const float* rel = mat_relative.ptr<float>(y);
+            const float* disp = has_disparity ? mat_disparity.ptr<float>(y) : nullptr;
+            float* depth = mat_depth.ptr<float>(y);
+            for (int32_t x = 0; x < width; x++) {
+                float d = scale * rel[x] + shift;
+                if (disp && disp[x] > 0) d = disp[x];
+                depth[x] = (d > 0) ? focal_baseline / d : 0.0f;
+            }
+        }
+    });
+    return kRetOk;
+}
@@ -0,0 +1,59 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef DEPTH_ALIGNMENT_
+#define DEPTH_ALIGNMENT_
+
+/* for general */
+#include <cstdint>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Alignment of relative inverse depth (e.g. MiDaS) to metric disparity (e.g. stereo)
+ *   - Fit finds scale and shift so that disparity = scale * relative + shift
+ *   - Robust least squares (IRLS with Huber weight) over pixels sampled on a grid where disparity is valid (> 0)
+ *   - The last valid parameters are kept, so Apply / Fuse can be called on frames without disparity
+ */
+class DepthAlignment {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+public:
+    DepthAlignment() : scale_(0), shift_(0), sample_num_(0), is_valid_(false) {}
+    ~DepthAlignment() {}
+    /* mat_relative, mat_disparity: CV_32FC1 with the same size */
+    int32_t Fit(const cv::Mat& mat_relative, const cv::Mat& mat_disparity, int32_t sample_step = 4, int32_t iteration_num = 3);
+    /* mat_disparity_aligned: CV_32FC1 */
+    int32_t Apply(const cv::Mat& mat_relative, cv::Mat& mat_disparity_aligned) const;
+    /* Use mat_disparity where it is valid, otherwise aligned relative depth. mat_depth: CV_32FC1 [unit of baseline]. 0 = invalid */
+    int32_t Fuse(const cv::Mat& mat_relative, const cv::Mat& mat_disparity, float focal_length, float baseline, cv::Mat& mat_depth) const;
+    void Reset(void) { is_valid_ = false; }
+    bool IsValid(void) const { return is_valid_; }
+    float GetScale(void) const { return scale_; }
+    float GetShift(void) const { return shift_; }
+    int32_t GetSampleNum(void) const { return sample_num_; }
+
+private:
+    float scale_;
+    float shift_;
+    int32_t sample_num_;
+    bool is_valid_;
+};
+
+#endif
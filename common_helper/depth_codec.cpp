@@ -0,0 +1,334 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "depth_codec.h"
+
+/*** Macro ***/
+#define TAG "DepthCodec"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+typedef struct {
+    uint64_t buffer;        // bits not written yet, from the lowest bit
+    int32_t  bit_num;
+    uint8_t* dst;
+    uint8_t* dst_end;
+    bool     is_overflow;
+} NibbleWriter;
+
+typedef struct {
+    uint64_t buffer;        // bits not read yet, from the lowest bit
+    int32_t  bit_num;
+    const uint8_t* src;
+    const uint8_t* src_end;
+    bool     is_error;
+} NibbleReader;
+
+/* Pixels in a 64-bit word, for scanning runs (little endian) */
+template <typename T>
+struct Lane {
+    static constexpr int32_t kNum = static_cast<int32_t>(sizeof(uint64_t) / sizeof(T));
+    static constexpr int32_t kBit = static_cast<int32_t>(sizeof(T) * 8);
+    static constexpr uint64_t kOne = ~0ULL / ((1ULL << kBit) - 1);     // 1 in each lane
+    static constexpr uint64_t kHigh = kOne << (kBit - 1);               // MSB of each lane
+};
+
+/*** Function ***/
+static inline int32_t CountTrailingZero(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<int32_t>(index);
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+template <typename T>
+static inline int32_t CountZero(const T* src, int32_t index, int32_t num)
+{
+    const int32_t start = index;
+    for (; index + Lane<T>::kNum <= num; index += Lane<T>::kNum) {
+        uint64_t word;
+        memcpy(&word, src + index, sizeof(word));
+        if (word != 0) return index - start + CountTrailingZero(word) / Lane<T>::kBit;
+    }
+    while (index < num && src[index] == 0) index++;
+    return index - start;
+}
+
+template <typename T>
+static inline int32_t CountNonZero(const T* src, int32_t index, int32_t num)
+{
+    const int32_t start = index;
+    for (; index + Lane<T>::kNum <= num; index += Lane<T>::kNum) {
+        uint64_t word;
+        memcpy(&word, src + index, sizeof(word));
+        /* The lowest flagged lane is the first zero (upper lanes may be flagged by the borrow) */
+        const uint64_t zero_mask = (word - Lane<T>::kOne) & ~word & Lane<T>::kHigh;
+        if (zero_mask != 0) return index - start + CountTrailingZero(zero_mask) / Lane<T>::kBit;
+    }
+    while (index < num && src[index] != 0) index++;
+    return index - start;
+}
+
+static inline uint32_t ZigZag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+static inline int32_t UnZigZag(uint32_t value)
+{
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+/* len <= 32 */
+static inline void PutBits(NibbleWriter& writer, uint64_t code, int32_t len)
+{
+    writer.buffer |= code << writer.bit_num;
+    writer.bit_num += len;
+    if (writer.bit_num >= 32) {
+        if (writer.dst_end - writer.dst >= 4) {
+            const uint32_t word = static_cast<uint32_t>(writer.buffer);
+            memcpy(writer.dst, &word, sizeof(word));
+            writer.dst += 4;
+        } else {
+            writer.is_overflow = true;
+        }
+        writer.buffer >>= 32;
+        writer.bit_num -= 32;
+    }
+}
+
+static inline void PutVle(NibbleWriter& writer, uint32_t value)
+{
+    if (value < 8) {
+        PutBits(writer, value, 4);
+        return;
+    }
+    uint64_t code = 0;
+    int32_t len = 0;
+    do {
+        uint64_t nibble = value & 7;
+        value >>= 3;
+        if (value != 0) nibble |= 8;
+        code |= nibble << len;
+        len += 4;
+    } while (value != 0);
+    if (len > 32) {
+        PutBits(writer, code & 0xFFFFFFFF, 32);
+        PutBits(writer, code >> 32, len - 32);
+    } else {
+        PutBits(writer, code, len);
+    }
+}
+
+static inline void Refill(NibbleReader& reader)
+{
+    if (reader.src_end - reader.src < 4) return;
+    uint32_t word;
+    memcpy(&word, reader.src, sizeof(word));
+    reader.src += 4;
+    reader.buffer |= static_cast<uint64_t>(word) << reader.bit_num;
+    reader.bit_num += 32;
+}
+
+static inline uint64_t GetVle(NibbleReader& reader)
+{
+    if (reader.bit_num < 24) Refill(reader);
+    const uint32_t last_mask = static_cast<uint32_t>(~reader.buffer) & 0x888888;
+    if (reader.bit_num >= 24 && last_mask != 0) {
+        /* Up to 6 nibbles without branches. Most of the values are here */
+        const int32_t nibble_num = CountTrailingZero(last_mask) / 4 + 1;
+        const uint32_t bits = static_cast<uint32_t>(reader.buffer);
+        const uint32_t value = (bits & 07) | ((bits >> 1) & 070) | ((bits >> 2) & 0700) | ((bits >> 3) & 07000) | ((bits >> 4) & 070000) | ((bits >> 5) & 0700000);
+        reader.buffer >>= nibble_num * 4;
+        reader.bit_num -= nibble_num * 4;
+        return value & ((1u << (nibble_num * 3)) - 1);
+    }
+    uint64_t value = 0;
+    for (int32_t shift = 0; shift < 36; shift += 3) {     /* 12 nibbles at most */
+        if (reader.bit_num < 4) {
+            Refill(reader);
+            if (reader.bit_num < 4) break;
+        }
+        const uint32_t nibble = static_cast<uint32_t>(reader.buffer & 0xF);
+        reader.buffer >>= 4;
+        reader.bit_num -= 4;
+        value |= static_cast<uint64_t>(nibble & 7) << shift;
+        if ((nibble & 8) == 0) return value;
+    }
+    reader.is_error = true;
+    return 0;
+}
+
+static inline int32_t CountLeadingZero(uint32_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return 31 - static_cast<int32_t>(index);
+#else
+    return __builtin_clz(value);
+#endif
+}
+
+/* value < 2^18 (6 nibbles). Without branches, for deltas */
+static inline void PutVleShort(NibbleWriter& writer, uint32_t value)
+{
+    const int32_t nibble_num = (32 - CountLeadingZero(value | 1) + 2) / 3;
+    uint64_t code = (value & 07) | ((value & 070) << 1) | ((value & 0700) << 2) | ((value & 07000) << 3) | ((value & 070000) << 4) | ((value & 0700000) << 5);
+    code |= 0x888888 & ((1u << ((nibble_num - 1) * 4)) - 1);   /* continuation bits */
+    PutBits(writer, code, nibble_num * 4);
+}
+
+template <typename T>
+static int32_t EncodeImpl(const T* src, int32_t num, uint8_t* dst, size_t dst_capacity, size_t& encoded_size)
+{
+    encoded_size = 0;
+    if (num < 0 || (num > 0 && (!src || !dst))) return DepthCodec::kRetErr;
+
+    NibbleWriter writer = { 0, 0, dst, dst + dst_capacity, false };
+    int32_t value_previous = 0;
+    int32_t index = 0;
+    while (index < num) {
+        const int32_t zero_num = CountZero(src, index, num);
+        index += zero_num;
+        PutVle(writer, static_cast<uint32_t>(zero_num));
+        const int32_t nonzero_num = CountNonZero(src, index, num);
+        PutVle(writer, static_cast<uint32_t>(nonzero_num));
+        for (const int32_t index_end = index + nonzero_num; index < index_end; index++) {
+            const int32_t value = src[index];
+            PutVleShort(writer, ZigZag(value - value_previous));
+            value_previous = value;
+        }
+        if (writer.is_overflow) return DepthCodec::kRetErr;
+    }
+    if (writer.bit_num > 0) {
+        PutBits(writer, 0, 32 - writer.bit_num);     /* pad the last word with 0 */
+    }
+    if (writer.is_overflow) return DepthCodec::kRetErr;
+
+    encoded_size = static_cast<size_t>(writer.dst - dst);
+    return DepthCodec::kRetOk;
+}
+
+template <typename T>
+static int32_t DecodeImpl(const uint8_t* src, size_t src_size, T* dst, int32_t num)
+{
+    if (num < 0 || (num > 0 && (!src || !dst)) || src_size % 4 != 0) return DepthCodec::kRetErr;
+
+    NibbleReader reader = { 0, 0, src, src + src_size, false };
+    int32_t value_previous = 0;
+    int32_t index = 0;
+    while (index < num) {
+        const uint64_t zero_num = GetVle(reader);
+        if (reader.is_error || zero_num > static_cast<uint64_t>(num - index)) return DepthCodec::kRetErr;
+        memset(dst + index, 0, static_cast<size_t>(zero_num) * sizeof(T));
+        index += static_cast<int32_t>(zero_num);
+        const uint64_t nonzero_num = GetVle(reader);
+        if (reader.is_error || nonzero_num > static_cast<uint64_t>(num - index)) return DepthCodec::kRetErr;
+        for (const int32_t index_end = index + static_cast<int32_t>(nonzero_num); index < index_end; index++) {
+            value_previous += UnZigZag(static_cast<uint32_t>(GetVle(reader)));
+            dst[index] = static_cast<T>(value_previous);
+        }
+        if (reader.is_error) return DepthCodec::kRetErr;
+    }
+    /* Only the padding can be left */
+    if (reader.src != reader.src_end || reader.buffer != 0) return DepthCodec::kRetErr;
+    return DepthCodec::kRetOk;
+}
+
+size_t DepthCodec::GetMaxEncodedSize(int32_t num)
+{
+    /* A zero costs 1 nibble at most (in the run length), a non-zero costs 1 + 6 (delta of 17 bits).
+     * Plus the first zero run and the last non-zero run, both of which can be empty */
+    if (num < 0) return 0;
+    const size_t nibble_num = static_cast<size_t>(num) * 7 + 2;
+    return (nibble_num + 7) / 8 * 4;
+}
+
+int32_t DepthCodec::Encode(const uint16_t* src, int32_t num, uint8_t* dst, size_t dst_capacity, size_t& encoded_size)
+{
+    return EncodeImpl(src, num, dst, dst_capacity, encoded_size);
+}
+
+int32_t DepthCodec::Encode(const uint8_t* src, int32_t num, uint8_t* dst, size_t dst_capacity, size_t& encoded_size)
+{
+    return EncodeImpl(src, num, dst, dst_capacity, encoded_size);
+}
+
+int32_t DepthCodec::Decode(const uint8_t* src, size_t src_size, uint16_t* dst, int32_t num)
+{
+    return DecodeImpl(src, src_size, dst, num);
+}
+
+int32_t DepthCodec::Decode(const uint8_t* src, size_t src_size, uint8_t* dst, int32_t num)
+{
+    return DecodeImpl(src, src_size, dst, num);
+}
+
+bool DepthCodec::IsSupported(int32_t type)
+{
+    return type == CV_16UC1 || type == CV_8UC1;
+}
+
+int32_t DepthCodec::Encode(const cv::Mat& mat, uint8_t* dst, size_t dst_capacity, size_t& encoded_size)
+{
+    encoded_size = 0;
+    if (mat.empty() || mat.dims != 2 || !IsSupported(mat.type()) || mat.total() > static_cast<size_t>((std::numeric_limits<int32_t>::max)())) {
+        PRINT_E("Unsupported image\n");
+        return DepthCodec::kRetErr;
+    }
+    if (!mat.isContinuous()) {
+        return Encode(mat.clone(), dst, dst_capacity, encoded_size);
+    }
+    const int32_t num = static_cast<int32_t>(mat.total());
+    if (mat.type() == CV_16UC1) {
+        return Encode(mat.ptr<uint16_t>(), num, dst, dst_capacity, encoded_size);
+    } else {
+        return Encode(mat.ptr<uint8_t>(), num, dst, dst_capacity, encoded_size);
+    }
+}
+
+int32_t DepthCodec::Decode(const uint8_t* src, size_t src_size, int32_t rows, int32_t cols, int32_t type, cv::Mat& mat)
+{
+    if (rows <= 0 || cols <= 0 || !IsSupported(type) || static_cast<int64_t>(rows) * cols > (std::numeric_limits<int32_t>::max)()) {
+        PRINT_E("Unsupported image\n");
+        return DepthCodec::kRetErr;
+    }
+    mat.create(rows, cols, type);
+    if (!mat.isContinuous()) mat = cv::Mat(rows, cols, type);
+    const int32_t num = rows * cols;
+    if (type == CV_16UC1) {
+        return Decode(src, src_size, mat.ptr<uint16_t>(), num);
+    } else {
+        return Decode(src, src_size, mat.ptr<uint8_t>(), num);
+    }
+}
@@ -0,0 +1,58 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef DEPTH_CODEC_
+#define DEPTH_CODEC_
+
+/* for general */
+#include <cstdint>
+#include <cstddef>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Lossless codec for depth / disparity images (RVL: Run length and Variable Length encoding)
+ *   - Pixels are coded as pairs of [number of zeros][number of non-zeros][delta]...[delta].
+ *     delta is the difference from the previous non-zero pixel (zigzag)
+ *   - Numbers are coded in 4-bit nibbles: 3 bits of value and 1 continuation bit, lower bits first.
+ *     Nibbles are packed into little endian 32-bit words from the lowest bit
+ *   - Zero runs (invalid pixels) are scanned and filled 64 bits at a time
+ *   - Smooth depth with holes becomes 3x - 6x smaller. Noisy images can be larger than the input,
+ *     so Encode fails if the result doesn't fit in dst_capacity (use the raw data then)
+ *   - Unsigned 8-bit and 16-bit pixels. Float disparity needs to be converted to fixed point first
+ */
+namespace DepthCodec
+{
+enum {
+    kRetOk = 0,
+    kRetErr = -1,
+};
+
+/* Size enough for any input of num pixels */
+size_t GetMaxEncodedSize(int32_t num);
+int32_t Encode(const uint16_t* src, int32_t num, uint8_t* dst, size_t dst_capacity, size_t& encoded_size);
+int32_t Encode(const uint8_t* src, int32_t num, uint8_t* dst, size_t dst_capacity, size_t& encoded_size);
+/* dst has num pixels. kRetErr if src is broken or doesn't have exactly num pixels */
+int32_t Decode(const uint8_t* src, size_t src_size, uint16_t* dst, int32_t num);
+int32_t Decode(const uint8_t* src, size_t src_size, uint8_t* dst, int32_t num);
+
+/* CV_16UC1 and CV_8UC1 */
+bool IsSupported(int32_t type);
+int32_t Encode(const cv::Mat& mat, uint8_t* dst, size_t dst_capacity, size_t& encoded_size);
+/* mat is (re)allocated with the size and type */
+int32_t Decode(const uint8_t* src, size_t src_size, int32_t rows, int32_t cols, int32_t type, cv::Mat& mat);
+}
+
+#endif
@@ -0,0 +1,207 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "depth_roi_stats.h"
+
+/*** Macro ***/
+#define TAG "DepthRoiStats"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/*** Function ***/
+int32_t DepthRoiStats::Build(const cv::Mat& mat_depth, float value_min, float value_max, int32_t bin_num, int32_t cell_size)
+{
+    if (mat_depth.empty() || mat_depth.channels() != 1) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+    if (value_max <= value_min || bin_num <= 0 || cell_size <= 0) {
+        PRINT_E("Invalid parameter\n");
+        return kRetErr;
+    }
+
+    width_ = mat_depth.cols;
+    height_ = mat_depth.rows;
+    bin_num_ = bin_num;
+    cell_size_ = cell_size;
+    grid_width_ = (width_ + cell_size - 1) / cell_size;
+    grid_height_ = (height_ + cell_size - 1) / cell_size;
+    value_min_ = value_min;
+    value_max_ = value_max;
+
+    /* Buffers are reused across frames, so allocation happens only when the size changes */
+    sat_sum_.resize(static_cast<size_t>(width_ + 1) * (height_ + 1));
+    sat_count_.resize(static_cast<size_t>(width_ + 1) * (height_ + 1));
+    integral_histogram_.assign(static_cast<size_t>(grid_width_ + 1) * (grid_height_ + 1) * bin_num_, 0);
+
+    switch (mat_depth.depth()) {
+    case CV_8U:
+        BuildTables<uint8_t>(mat_depth);
+        break;
+    case CV_16U:
+        BuildTables<uint16_t>(mat_depth);
+        break;
+    case CV_32F:
+        BuildTables<float>(mat_depth);
+        break;
+    default:
+        PRINT_E("Unsupported type: %d\n", mat_depth.type());
+        width_ = 0;
+        height_ = 0;
+        return kRetErr;
+    }
+
+    return kRetOk;
+}
+
+template<typename T>
+void DepthRoiStats::BuildTables(const cv::Mat& mat_depth)
+{
+    const int32_t stride = width_ + 1;
+    const float bin_scale = bin_num_ / (value_max_ - value_min_);
+    const int32_t hist_stride = (grid_width_ + 1) * bin_num_;
+
+    std::fill(sat_sum_.begin(), sat_sum_.begin() + stride, 0.0);
+    std::fill(sat_count_.begin(), sat_count_.begin() + stride, 0);
+
+    /* Summed-area tables, and per cell histograms which are stored at (grid_y + 1, grid_x + 1) */
+    for (int32_t y = 0; y < height_; y++) {
+        const T* src = mat_depth.ptr<T>(y);
+        const double* sum_prev = &sat_sum_[static_cast<size_t>(y) * stride];
+        double* sum_current = &sat_sum_[static_cast<size_t>(y + 1) * stride];
+        const int32_t* count_prev = &sat_count_[static_cast<size_t>(y) * stride];
+        int32_t* count_current = &sat_count_[static_cast<size_t>(y + 1) * stride];
+        int32_t* hist_row = &integral_histogram_[static_cast<size_t>(y / cell_size_ + 1) * hist_stride];
+        double row_sum = 0;
+        int32_t row_count = 0;
+        sum_current[0] = 0;
+        count_current[0] = 0;
+        for (int32_t x = 0; x < width_; x++) {
+            const float value = static_cast<float>(src[x]);
+            if (value >= value_min_ && value <= value_max_) {     /* false for NaN */
+                row_sum += value;
+                row_count++;
+                const int32_t bin = (std::min)(static_cast<int32_t>((value - value_min_) * bin_scale), bin_num_ - 1);
+                hist_row[(x / cell_size_ + 1) * bin_num_ + bin]++;
+            }
+            sum_current[x + 1] = sum_prev[x + 1] + row_sum;
+            count_current[x + 1] = count_prev[x + 1] + row_count;
+        }
+    }
+
+    /* Integral histogram on the grid */
+    for (int32_t gy = 1; gy <= grid_height_; gy++) {
+        int32_t* hist_prev_row = &integral_histogram_[static_cast<size_t>(gy - 1) * hist_stride];
+        int32_t* hist_row = &integral_histogram_[static_cast<size_t>(gy) * hist_stride];
+        for (int32_t gx = 1; gx <= grid_width_; gx++) {
+            int32_t* dst = hist_row + gx * bin_num_;
+            const int32_t* left = hist_row + (gx - 1) * bin_num_;
+            const int32_t* top = hist_prev_row + gx * bin_num_;
+            const int32_t* top_left = hist_prev_row + (gx - 1) * bin_num_;
+            for (int32_t b = 0; b < bin_num_; b++) {
+                dst[b] += left[b] + top[b] - top_left[b];
+            }
+        }
+    }
+}
+
+cv::Rect DepthRoiStats::ClipRect(const cv::Rect& rect) const
+{
+    const int32_t x0 = (std::max)(rect.x, 0);
+    const int32_t y0 = (std::max)(rect.y, 0);
+    const int32_t x1 = (std::min)(rect.x + rect.width, width_);
+    const int32_t y1 = (std::min)(rect.y + rect.height, height_);
+    if (x1 <= x0 || y1 <= y0) return cv::Rect(0, 0, 0, 0);
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+int32_t DepthRoiStats::GetMean(const cv::Rect& rect, float& mean, int32_t& valid_num) const
+{
+    const cv::Rect r = ClipRect(rect);
+    if (r.width <= 0 || r.height <= 0) return kRetErr;
+
+    const int32_t stride = width_ + 1;
+    const size_t i00 = static_cast<size_t>(r.y) * stride + r.x;
+    const size_t i01 = static_cast<size_t>(r.y) * stride + r.x + r.width;
+    const size_t i10 = static_cast<size_t>(r.y + r.height) * stride + r.x;
+    const size_t i11 = static_cast<size_t>(r.y + r.height) * stride + r.x + r.width;
+    const double sum = sat_sum_[i11] - sat_sum_[i01] - sat_sum_[i10] + sat_sum_[i00];
+    valid_num = sat_count_[i11] - sat_count_[i01] - sat_count_[i10] + sat_count_[i00];
+    mean = (valid_num > 0) ? static_cast<float>(sum / valid_num) : 0.0f;
+    return (valid_num > 0) ? kRetOk : kRetErr;
+}
+
+int32_t DepthRoiStats::GetPercentile(const cv::Rect& rect, float percentile, float& value) const
+{
+    const cv::Rect r = ClipRect(rect);
+    if (r.width <= 0 || r.height <= 0) return kRetErr;
+
+    /* Snap the rectangle to the grid (at least one cell) */
+    int32_t gx0 = (std::min)((r.x + cell_size_ / 2) / cell_size_, grid_width_ - 1);
+    int32_t gy0 = (std::min)((r.y + cell_size_ / 2) / cell_size_, grid_height_ - 1);
+    int32_t gx1 = (std::max)((r.x + r.width + cell_size_ / 2) / cell_size_, gx0 + 1);
+    int32_t gy1 = (std::max)((r.y + r.height + cell_size_ / 2) / cell_size_, gy0 + 1);
+    gx1 = (std::min)(gx1, grid_width_);
+    gy1 = (std::min)(gy1, grid_height_);
+
+    const int32_t hist_stride = (grid_width_ + 1) * bin_num_;
+    const int32_t* h00 = &integral_histogram_[static_cast<size_t>(gy0) * hist_stride + gx0 * bin_num_];
+    const int32_t* h01 = &integral_histogram_[static_cast<size_t>(gy0) * hist_stride + gx1 * bin_num_];
+    const int32_t* h10 = &integral_histogram_[static_cast<size_t>(gy1) * hist_stride + gx0 * bin_num_];
+    const int32_t* h11 = &integral_histogram_[static_cast<size_t>(gy1) * hist_stride + gx1 * bin_num_];
+
+    int32_t total = 0;
+    for (int32_t b = 0; b < bin_num_; b++) {
+        total += h11[b] - h01[b] - h10[b] + h00[b];
+    }
+    if (total <= 0) return kRetErr;
+
+    /* Find the bin which contains the rank, then interpolate linearly in the bin */
+    const float rank = (std::min)((std::max)(percentile, 0.0f), 1.0f) * total;
+    const float bin_width = (value_max_ - value_min_) / bin_num_;
+    int32_t cumulative = 0;
+    for (int32_t b = 0; b < bin_num_; b++) {
+        const int32_t count = h11[b] - h01[b] - h10[b] + h00[b];
+        if (count > 0 && cumulative + count >= rank) {
+            const float fraction = (rank - cumulative) / count;
+            value = value_min_ + (b + fraction) * bin_width;
+            return kRetOk;
+        }
+        cumulative += count;
+    }
+    value = value_max_;
+    return kRetOk;
+}
+
+int32_t DepthRoiStats::Query(const cv::Rect& rect, Stats& stats) const
+{
+    stats = Stats();
+    const cv::Rect r = ClipRect(rect);
+    if (r.width <= 0 || r.height <= 0) return kRetErr;
+    if (GetMean(r, stats.mean, stats.valid_num) != kRetOk) return kRetErr;
+    stats.valid_ratio = static_cast<float>(stats.valid_num) / r.area();
+    return GetPercentile(r, 0.5f, stats.median);
+}
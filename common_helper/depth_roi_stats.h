@@ -0,0 +1,78 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef DEPTH_ROI_STATS_
+#define DEPTH_ROI_STATS_
+
+/* for general */
+#include <cstdint>
+#include <vector>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Statistics of depth (or disparity) in many rectangles of the same frame
+ *   - Build creates acceleration structures once per frame
+ *       - summed-area tables of value and valid pixel count (pixel accuracy) for mean
+ *       - integral histogram on a coarse grid (cell_size x cell_size pixels) for median / percentile
+ *   - Mean costs O(1), and median / percentile cost O(bin_num) per rectangle
+ *   - Pixels whose value is out of [value_min, value_max] (e.g. 0 = invalid disparity) are ignored
+ *   - Percentile of disparity can be converted to depth directly because depth is monotonic to disparity
+ */
+class DepthRoiStats {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct Stats_ {
+        float   mean;
+        float   median;
+        int32_t valid_num;     // number of valid pixels in the rectangle
+        float   valid_ratio;
+        Stats_() : mean(0), median(0), valid_num(0), valid_ratio(0)
+        {}
+    } Stats;
+
+public:
+    DepthRoiStats() : width_(0), height_(0), bin_num_(0), cell_size_(0), grid_width_(0), grid_height_(0), value_min_(0), value_max_(0) {}
+    ~DepthRoiStats() {}
+    /* mat_depth: CV_8UC1, CV_16UC1 or CV_32FC1 */
+    int32_t Build(const cv::Mat& mat_depth, float value_min, float value_max, int32_t bin_num = 64, int32_t cell_size = 8);
+    int32_t GetMean(const cv::Rect& rect, float& mean, int32_t& valid_num) const;
+    int32_t GetPercentile(const cv::Rect& rect, float percentile, float& value) const;   /* percentile: 0.0 - 1.0 */
+    int32_t Query(const cv::Rect& rect, Stats& stats) const;
+
+private:
+    template<typename T> void BuildTables(const cv::Mat& mat_depth);
+    cv::Rect ClipRect(const cv::Rect& rect) const;
+
+private:
+    int32_t width_;
+    int32_t height_;
+    int32_t bin_num_;
+    int32_t cell_size_;
+    int32_t grid_width_;
+    int32_t grid_height_;
+    float   value_min_;
+    float   value_max_;
+
+    std::vector<double>  sat_sum_;     // [(height + 1) * (width + 1)]
+    std::vector<int32_t> sat_count_;   // [(height + 1) * (width + 1)]
+    std::vector<int32_t> integral_histogram_;  // [(grid_height + 1) * (grid_width + 1) * bin_num]
+};
+
+#endif
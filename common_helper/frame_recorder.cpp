@@ -0,0 +1,651 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "frame_recorder.h"
+#include "depth_codec.h"
+
+/*** Macro ***/
+#define TAG "FrameRecorder"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+using namespace FrameRecordFormat;
+
+/* Upper limit of streams in a file. FrameReader rejects larger stream ids, so that a broken record doesn't allocate a huge list */
+static constexpr uint32_t kStreamNumMax = 256;
+
+/*** Function ***/
+static inline uint64_t AlignUp(uint64_t size)
+{
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+/* Check an entry read from the file before it is used as cv::Mat. Same checks as ShmFrameReader::Get */
+static bool IsValidEntry(const IndexEntry& entry, uint64_t mapped_size)
+{
+    if (entry.rows <= 0 || entry.cols <= 0 || entry.type < 0 || entry.type != CV_MAT_TYPE(entry.type)) return false;
+    if (entry.offset > mapped_size || entry.payload_size > mapped_size - entry.offset) return false;
+    if (entry.compression == kCompressionNone) {
+        if (entry.step < static_cast<uint64_t>(entry.cols) * CV_ELEM_SIZE(entry.type)) return false;
+        if (static_cast<uint64_t>(entry.step) * entry.rows > entry.payload_size) return false;
+    } else if (entry.compression != kCompressionRvl) {
+        return false;
+    }
+    return true;
+}
+
+static_assert(sizeof(FileHeader) % kAlignment == 0, "FileHeader must keep the payload aligned");
+static_assert(sizeof(RecordHeader) % kAlignment == 0, "RecordHeader must keep the payload aligned");
+
+
+FrameRecorder::FrameRecorder()
+    : fp_(nullptr), file_offset_(0), chunk_size_(0), current_chunk_(nullptr), is_running_(false), has_write_error_(false)
+{
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    if (fp_) {
+        Close();
+    }
+}
+
+int32_t FrameRecorder::Open(const std::string& filename, size_t chunk_size, int32_t chunk_num)
+{
+    if (fp_) {
+        PRINT_E("Already opened\n");
+        return kRetErr;
+    }
+    if (chunk_num < 2) {
+        PRINT_E("At least 2 chunks are required to overlap copy and write\n");
+        return kRetErr;
+    }
+
+    fp_ = fopen(filename.c_str(), "wb");
+    if (!fp_) {
+        PRINT_E("Unable to open %s\n", filename.c_str());
+        return kRetErr;
+    }
+
+    FileHeader file_header;
+    memset(&file_header, 0, sizeof(file_header));
+    memcpy(file_header.magic, kFileMagic, sizeof(file_header.magic));
+    file_header.version = kVersion;
+    file_header.alignment = static_cast<uint32_t>(kAlignment);
+    if (fwrite(&file_header, sizeof(file_header), 1, fp_) != 1) {
+        PRINT_E("Unable to write %s\n", filename.c_str());
+        fclose(fp_);
+        fp_ = nullptr;
+        return kRetErr;
+    }
+    file_offset_ = sizeof(file_header);
+
+    /* Chunks are allocated here once, and then recycled between Write (copy) and the writer thread (fwrite) */
+    chunk_size_ = static_cast<size_t>(AlignUp(chunk_size));
+    chunk_list_.clear();
+    free_queue_.clear();
+    write_queue_.clear();
+    for (int32_t i = 0; i < chunk_num; i++) {
+        chunk_list_.push_back(std::unique_ptr<Chunk>(new Chunk()));
+        chunk_list_.back()->buffer.resize(chunk_size_);
+        free_queue_.push_back(chunk_list_.back().get());
+    }
+    current_chunk_ = free_queue_.front();
+    free_queue_.pop_front();
+
+    stream_name_list_.clear();
+    stream_compression_list_.clear();
+    index_list_.clear();
+    statistics_ = Statistics();
+    has_write_error_ = false;
+    is_running_ = true;
+    thread_writer_ = std::thread(&FrameRecorder::ThreadWriter, this);
+
+    return kRetOk;
+}
+
+int32_t FrameRecorder::Close(void)
+{
+    if (!fp_) {
+        PRINT_E("Not opened\n");
+        return kRetErr;
+    }
+
+    /* Flush all the chunks */
+    SubmitCurrentChunk();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_running_ = false;
+    }
+    cond_.notify_all();
+    if (thread_writer_.joinable()) {
+        thread_writer_.join();
+    }
+
+    /* Write stream names, index and footer */
+    Footer footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.stream_name_offset = file_offset_;
+    footer.stream_num = static_cast<uint32_t>(stream_name_list_.size());
+    for (size_t i = 0; i < stream_name_list_.size(); i++) {
+        StreamName stream_name;
+        memset(&stream_name, 0, sizeof(stream_name));
+        strncpy(stream_name.name, stream_name_list_[i].c_str(), kStreamNameLength - 1);
+        stream_name.stream_id = static_cast<uint32_t>(i);
+        if (fwrite(&stream_name, sizeof(stream_name), 1, fp_) != 1) has_write_error_ = true;
+    }
+    footer.index_offset = footer.stream_name_offset + sizeof(StreamName) * stream_name_list_.size();
+    footer.index_num = index_list_.size();
+    if (!index_list_.empty()) {
+        if (fwrite(index_list_.data(), sizeof(IndexEntry), index_list_.size(), fp_) != index_list_.size()) has_write_error_ = true;
+    }
+    memcpy(footer.magic, kFooterMagic, sizeof(footer.magic));
+    if (fwrite(&footer, sizeof(footer), 1, fp_) != 1) has_write_error_ = true;
+
+    fclose(fp_);
+    fp_ = nullptr;
+    current_chunk_ = nullptr;
+    chunk_list_.clear();
+    free_queue_.clear();
+    write_queue_.clear();
+
+    if (has_write_error_) {
+        PRINT_E("Error occurred while writing\n");
+        return kRetErr;
+    }
+    return kRetOk;
+}
+
+int32_t FrameRecorder::AddStream(const std::string& name, uint32_t compression)
+{
+    if (name.size() >= kStreamNameLength) {
+        PRINT_E("Stream name is too long: %s\n", name.c_str());
+        return kRetErr;
+    }
+    if (compression != kCompressionNone && compression != kCompressionRvl) {
+        PRINT_E("Invalid compression: %u\n", compression);
+        return kRetErr;
+    }
+    if (stream_name_list_.size() >= kStreamNumMax) {
+        PRINT_E("Too many streams: %s\n", name.c_str());
+        return kRetErr;
+    }
+    stream_name_list_.push_back(name);
+    stream_compression_list_.push_back(compression);
+    return static_cast<int32_t>(stream_name_list_.size()) - 1;
+}
+
+int32_t FrameRecorder::Write(int32_t stream_id, const cv::Mat& mat, int64_t timestamp_us, int64_t sequence_num)
+{
+    if (!fp_) {
+        PRINT_E("Not opened\n");
+        return kRetErr;
+    }
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(stream_name_list_.size())) {
+        PRINT_E("Invalid stream id: %d\n", stream_id);
+        return kRetErr;
+    }
+    if (mat.empty() || mat.dims != 2) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+
+    const size_t row_size = mat.cols * mat.elemSize();
+    const uint64_t raw_size = static_cast<uint64_t>(row_size) * mat.rows;
+    /* Space for the raw image. Compressed data is used only when it is smaller */
+    size_t record_size = static_cast<size_t>(sizeof(RecordHeader) + AlignUp(raw_size));
+
+    if (current_chunk_->used > 0 && current_chunk_->used + record_size > current_chunk_->buffer.size()) {
+        if (SubmitCurrentChunk() != kRetOk) return kRetErr;
+        current_chunk_ = AcquireFreeChunk(record_size);
+    }
+    if (current_chunk_->buffer.size() < record_size) {
+        /* A record larger than the chunk size. Grow the chunk (this happens only once per chunk) */
+        current_chunk_->buffer.resize(record_size);
+    }
+
+    /* Copy (or encode) payload and header into the chunk */
+    uint8_t* dst = current_chunk_->buffer.data() + current_chunk_->used;
+    uint8_t* dst_payload = dst + sizeof(RecordHeader);
+    uint32_t compression = kCompressionNone;
+    uint64_t payload_size = raw_size;
+    if (stream_compression_list_[stream_id] == kCompressionRvl && DepthCodec::IsSupported(mat.type())) {
+        size_t encoded_size = 0;
+        if (DepthCodec::Encode(mat, dst_payload, static_cast<size_t>(raw_size), encoded_size) == DepthCodec::kRetOk && encoded_size < raw_size) {
+            compression = kCompressionRvl;
+            payload_size = encoded_size;
+            record_size = static_cast<size_t>(sizeof(RecordHeader) + AlignUp(payload_size));
+        }
+    }
+    if (compression == kCompressionNone) {
+        if (mat.isContinuous()) {
+            memcpy(dst_payload, mat.data, static_cast<size_t>(payload_size));
+        } else {
+            for (int32_t y = 0; y < mat.rows; y++) {
+                memcpy(dst_payload + y * row_size, mat.ptr(y), row_size);
+            }
+        }
+    }
+    memset(dst_payload + payload_size, 0, static_cast<size_t>(record_size - sizeof(RecordHeader) - payload_size));
+
+    RecordHeader record_header;
+    memset(&record_header, 0, sizeof(record_header));
+    record_header.magic = kRecordMagic;
+    record_header.stream_id = static_cast<uint32_t>(stream_id);
+    record_header.sequence_num = sequence_num;
+    record_header.timestamp_us = timestamp_us;
+    record_header.rows = mat.rows;
+    record_header.cols = mat.cols;
+    record_header.type = mat.type();
+    record_header.step = static_cast<uint32_t>(row_size);
+    record_header.payload_size = payload_size;
+    record_header.compression = compression;
+    memcpy(dst, &record_header, sizeof(record_header));
+
+    IndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = file_offset_ + current_chunk_->used + sizeof(record_header);
+    entry.payload_size = payload_size;
+    entry.sequence_num = sequence_num;
+    entry.timestamp_us = timestamp_us;
+    entry.stream_id = record_header.stream_id;
+    entry.rows = record_header.rows;
+    entry.cols = record_header.cols;
+    entry.type = record_header.type;
+    entry.step = record_header.step;
+    entry.compression = record_header.compression;
+    index_list_.push_back(entry);
+
+    current_chunk_->used += record_size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        statistics_.frame_num++;
+        statistics_.byte_written += record_size;
+        statistics_.byte_raw += raw_size;
+    }
+
+    return has_write_error_ ? kRetErr : kRetOk;
+}
+
+FrameRecorder::Statistics FrameRecorder::GetStatistics(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+int32_t FrameRecorder::SubmitCurrentChunk(void)
+{
+    if (!current_chunk_ || current_chunk_->used == 0) return kRetOk;
+    /* Before queueing. The writer thread clears used after writing */
+    file_offset_ += current_chunk_->used;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        write_queue_.push_back(current_chunk_);
+    }
+    cond_.notify_all();
+    current_chunk_ = nullptr;
+    return kRetOk;
+}
+
+FrameRecorder::Chunk* FrameRecorder::AcquireFreeChunk(size_t required_size)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (free_queue_.empty()) {
+        /* The disk cannot keep up. Wait rather than drop frames */
+        statistics_.stall_num++;
+        cond_.wait(lock, [this] { return !free_queue_.empty(); });
+    }
+    Chunk* chunk = free_queue_.front();
+    free_queue_.pop_front();
+    lock.unlock();
+
+    chunk->used = 0;
+    if (chunk->buffer.size() < required_size) {
+        chunk->buffer.resize(required_size);
+    }
+    return chunk;
+}
+
+void FrameRecorder::ThreadWriter(void)
+{
+    while (true) {
+        Chunk* chunk = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return !write_queue_.empty() || !is_running_; });
+            if (write_queue_.empty()) break;    /* is_running_ == false and all chunks are written */
+            chunk = write_queue_.front();
+            write_queue_.pop_front();
+        }
+
+        if (fwrite(chunk->buffer.data(), 1, chunk->used, fp_) != chunk->used) {
+            has_write_error_ = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            chunk->used = 0;
+            free_queue_.push_back(chunk);
+        }
+        cond_.notify_all();
+    }
+}
+
+
+FrameReader::FrameReader()
+    : mapped_data_(nullptr), mapped_size_(0)
+#ifdef _WIN32
+    , handle_file_(INVALID_HANDLE_VALUE), handle_mapping_(nullptr)
+#else
+    , fd_(-1)
+#endif
+{
+}
+
+FrameReader::~FrameReader()
+{
+    Unmap();
+}
+
+int32_t FrameReader::Open(const std::string& filename)
+{
+    if (mapped_data_) {
+        PRINT_E("Already opened\n");
+        return kRetErr;
+    }
+    if (Map(filename) != kRetOk) {
+        return kRetErr;
+    }
+
+    const FileHeader* file_header = reinterpret_cast<const FileHeader*>(mapped_data_);
+    if (mapped_size_ < sizeof(FileHeader) || memcmp(file_header->magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+        PRINT_E("Invalid file: %s\n", filename.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    if (file_header->version > kVersion) {
+        PRINT_E("Unsupported version (%u): %s\n", file_header->version, filename.c_str());
+        Unmap();
+        return kRetErr;
+    }
+
+    if (ReadIndex() != kRetOk) {
+        PRINT("Index is not found. Rebuild index: %s\n", filename.c_str());
+        if (RebuildIndex() != kRetOk) {
+            Unmap();
+            return kRetErr;
+        }
+    }
+
+    return kRetOk;
+}
+
+int32_t FrameReader::Close(void)
+{
+    if (!mapped_data_) {
+        PRINT_E("Not opened\n");
+        return kRetErr;
+    }
+    Unmap();
+    return kRetOk;
+}
+
+int32_t FrameReader::GetStreamId(const std::string& name) const
+{
+    for (size_t i = 0; i < stream_name_list_.size(); i++) {
+        if (stream_name_list_[i] == name) return static_cast<int32_t>(i);
+    }
+    return kRetErr;
+}
+
+int32_t FrameReader::GetStreamNum(void) const
+{
+    return static_cast<int32_t>(stream_name_list_.size());
+}
+
+const std::string& FrameReader::GetStreamName(int32_t stream_id) const
+{
+    static const std::string kEmpty;
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(stream_name_list_.size())) return kEmpty;
+    return stream_name_list_[stream_id];
+}
+
+int32_t FrameReader::GetFrameNum(int32_t stream_id) const
+{
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(index_list_.size())) return 0;
+    return static_cast<int32_t>(index_list_[stream_id].size());
+}
+
+int32_t FrameReader::GetFrame(int32_t stream_id, int32_t frame_index, Frame& frame) const
+{
+    if (frame_index < 0 || frame_index >= GetFrameNum(stream_id)) {
+        PRINT_E("Invalid frame: stream = %d, index = %d\n", stream_id, frame_index);
+        return kRetErr;
+    }
+    /* Entries are checked by IsValidEntry when the index is loaded */
+    const IndexEntry& entry = index_list_[stream_id][frame_index];
+    if (entry.compression == kCompressionRvl) {
+        cv::Mat mat;
+        if (DepthCodec::Decode(mapped_data_ + entry.offset, static_cast<size_t>(entry.payload_size), entry.rows, entry.cols, entry.type, mat) != DepthCodec::kRetOk) {
+            PRINT_E("Broken frame: stream = %d, index = %d\n", stream_id, frame_index);
+            return kRetErr;
+        }
+        frame.mat = mat;
+    } else if (entry.compression == kCompressionNone) {
+        /* Zero copy. cv::Mat does not own the mapped memory */
+        frame.mat = cv::Mat(entry.rows, entry.cols, entry.type, const_cast<uint8_t*>(mapped_data_ + entry.offset), entry.step);
+    } else {
+        PRINT_E("Unsupported compression (%u): stream = %d, index = %d\n", entry.compression, stream_id, frame_index);
+        return kRetErr;
+    }
+    frame.timestamp_us = entry.timestamp_us;
+    frame.sequence_num = entry.sequence_num;
+    return kRetOk;
+}
+
+int32_t FrameReader::FindFrameBySequenceNum(int32_t stream_id, int64_t sequence_num) const
+{
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(index_list_.size())) return kRetErr;
+    const auto& entry_list = index_list_[stream_id];
+    const auto& it = std::lower_bound(entry_list.begin(), entry_list.end(), sequence_num,
+        [](const IndexEntry& entry, int64_t value) { return entry.sequence_num < value; });
+    if (it == entry_list.end() || it->sequence_num != sequence_num) return kRetErr;
+    return static_cast<int32_t>(it - entry_list.begin());
+}
+
+int32_t FrameReader::Map(const std::string& filename)
+{
+#ifdef _WIN32
+    handle_file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle_file_ == INVALID_HANDLE_VALUE) {
+        PRINT_E("Unable to open %s\n", filename.c_str());
+        return kRetErr;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle_file_, &file_size) || file_size.QuadPart == 0) {
+        PRINT_E("Invalid file size: %s\n", filename.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    handle_mapping_ = CreateFileMappingA(handle_file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!handle_mapping_) {
+        PRINT_E("Unable to map %s\n", filename.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    mapped_data_ = static_cast<const uint8_t*>(MapViewOfFile(handle_mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!mapped_data_) {
+        PRINT_E("Unable to map %s\n", filename.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    mapped_size_ = static_cast<uint64_t>(file_size.QuadPart);
+#else
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        PRINT_E("Unable to open %s\n", filename.c_str());
+        return kRetErr;
+    }
+    struct stat file_stat;
+    if (fstat(fd_, &file_stat) != 0 || file_stat.st_size == 0) {
+        PRINT_E("Invalid file size: %s\n", filename.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        PRINT_E("Unable to map %s\n", filename.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    mapped_data_ = static_cast<const uint8_t*>(p);
+    mapped_size_ = static_cast<uint64_t>(file_stat.st_size);
+#endif
+    return kRetOk;
+}
+
+void FrameReader::Unmap(void)
+{
+#ifdef _WIN32
+    if (mapped_data_) UnmapViewOfFile(mapped_data_);
+    if (handle_mapping_) CloseHandle(handle_mapping_);
+    if (handle_file_ != INVALID_HANDLE_VALUE) CloseHandle(handle_file_);
+    handle_mapping_ = nullptr;
+    handle_file_ = INVALID_HANDLE_VALUE;
+#else
+    if (mapped_data_) munmap(const_cast<uint8_t*>(mapped_data_), static_cast<size_t>(mapped_size_));
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+#endif
+    mapped_data_ = nullptr;
+    mapped_size_ = 0;
+    stream_name_list_.clear();
+    index_list_.clear();
+}
+
+int32_t FrameReader::ReadIndex(void)
+{
+    if (mapped_size_ < sizeof(FileHeader) + sizeof(Footer)) return kRetErr;
+
+    Footer footer;
+    memcpy(&footer, mapped_data_ + mapped_size_ - sizeof(Footer), sizeof(Footer));
+    if (memcmp(footer.magic, kFooterMagic, sizeof(kFooterMagic)) != 0) return kRetErr;
+    if (footer.stream_num > kStreamNumMax || footer.index_num > mapped_size_ / sizeof(IndexEntry) || footer.stream_name_offset > mapped_size_) return kRetErr;
+    if (footer.stream_name_offset + sizeof(StreamName) * footer.stream_num != footer.index_offset) return kRetErr;
+    if (footer.index_offset + sizeof(IndexEntry) * footer.index_num + sizeof(Footer) != mapped_size_) return kRetErr;
+
+    stream_name_list_.clear();
+    index_list_.clear();
+    for (uint32_t i = 0; i < footer.stream_num; i++) {
+        StreamName stream_name;
+        memcpy(&stream_name, mapped_data_ + footer.stream_name_offset + sizeof(StreamName) * i, sizeof(StreamName));
+        stream_name.name[kStreamNameLength - 1] = '\0';
+        stream_name_list_.push_back(stream_name.name);
+    }
+    index_list_.resize(stream_name_list_.size());
+    for (uint64_t i = 0; i < footer.index_num; i++) {
+        IndexEntry entry;
+        memcpy(&entry, mapped_data_ + footer.index_offset + sizeof(IndexEntry) * i, sizeof(IndexEntry));
+        if (entry.stream_id >= footer.stream_num || !IsValidEntry(entry, mapped_size_)
+            || entry.offset + entry.payload_size > footer.stream_name_offset) {
+            PRINT_E("Invalid index entry [%llu]\n", static_cast<unsigned long long>(i));
+            return kRetErr;     /* rebuilt from the records */
+        }
+        AddEntry(entry);
+    }
+    return kRetOk;
+}
+
+int32_t FrameReader::RebuildIndex(void)
+{
+    stream_name_list_.clear();
+    index_list_.clear();
+
+    uint64_t offset = sizeof(FileHeader);
+    while (offset + sizeof(RecordHeader) <= mapped_size_) {
+        RecordHeader record_header;
+        memcpy(&record_header, mapped_data_ + offset, sizeof(RecordHeader));
+        if (record_header.magic != kRecordMagic) break;
+        const uint64_t payload_offset = offset + sizeof(RecordHeader);
+        if (record_header.payload_size > mapped_size_ - payload_offset) break;   /* truncated record */
+        if (record_header.stream_id >= kStreamNumMax) break;     /* broken record. Records after it cannot be located */
+
+        IndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset = payload_offset;
+        entry.payload_size = record_header.payload_size;
+        entry.sequence_num = record_header.sequence_num;
+        entry.timestamp_us = record_header.timestamp_us;
+        entry.stream_id = record_header.stream_id;
+        entry.rows = record_header.rows;
+        entry.cols = record_header.cols;
+        entry.type = record_header.type;
+        entry.step = record_header.step;
+        entry.compression = record_header.compression;
+        if (!IsValidEntry(entry, mapped_size_)) {
+            PRINT_E("Broken record at %llu. Records after it are ignored\n", static_cast<unsigned long long>(offset));
+            break;
+        }
+        AddEntry(entry);
+
+        offset = payload_offset + AlignUp(record_header.payload_size);
+    }
+
+    /* Stream names are stored only at Close */
+    for (size_t i = 0; i < index_list_.size(); i++) {
+        stream_name_list_.push_back("stream_" + std::to_string(i));
+    }
+
+    if (index_list_.empty()) {
+        PRINT_E("No record is found\n");
+        return kRetErr;
+    }
+    return kRetOk;
+}
+
+void FrameReader::AddEntry(const IndexEntry& entry)
+{
+    if (entry.stream_id >= index_list_.size()) {
+        index_list_.resize(entry.stream_id + 1);
+    }
+    index_list_[entry.stream_id].push_back(entry);
+}
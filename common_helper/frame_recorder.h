@@ -0,0 +1,213 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef FRAME_RECORDER_
+#define FRAME_RECORDER_
+
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Recording container for multi-stream sessions
+ *   [FileHeader][Record]...[Record][StreamName]...[IndexEntry]...[Footer]
+ *   - Record = RecordHeader + payload. Payload is aligned to kAlignment so that it can be used as cv::Mat data directly
+ *   - Records are written in large append-only chunks by a background thread
+ *   - Index is written at Close. If it is missing (e.g. the process was killed), FrameReader rebuilds it by scanning RecordHeaders
+ *   - Streams of 8-bit / 16-bit depth can be compressed losslessly (DepthCodec). Such records are decoded by FrameReader
+ */
+namespace FrameRecordFormat
+{
+static constexpr char kFileMagic[8] = { 'D', 'A', 'I', 'R', 'E', 'C', '0', '1' };
+static constexpr char kFooterMagic[8] = { 'D', 'A', 'I', 'R', 'I', 'D', 'X', '1' };
+static constexpr uint32_t kRecordMagic = 0x31434552;    /* "REC1" */
+static constexpr uint32_t kVersion = 2;      /* 2: compression */
+static constexpr uint64_t kAlignment = 64;
+static constexpr int32_t kStreamNameLength = 56;
+static constexpr uint32_t kCompressionNone = 0;
+static constexpr uint32_t kCompressionRvl = 1;
+
+#pragma pack(push, 1)
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    uint8_t  reserved[48];
+} FileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t stream_id;
+    int64_t  sequence_num;
+    int64_t  timestamp_us;
+    int32_t  rows;
+    int32_t  cols;
+    int32_t  type;          // cv::Mat::type()
+    uint32_t step;          // [byte]
+    uint64_t payload_size;  // [byte] compressed size if compressed
+    uint32_t compression;   // kCompressionXxx
+    uint8_t  reserved[12];
+} RecordHeader;
+
+typedef struct {
+    uint64_t offset;        // [byte] offset of the payload from the beginning of the file
+    uint64_t payload_size;  // [byte]
+    int64_t  sequence_num;
+    int64_t  timestamp_us;
+    uint32_t stream_id;
+    int32_t  rows;
+    int32_t  cols;
+    int32_t  type;
+    uint32_t step;
+    uint32_t compression;
+    uint8_t  reserved[8];
+} IndexEntry;
+
+typedef struct {
+    char     name[kStreamNameLength];
+    uint32_t stream_id;
+    uint32_t reserved;
+} StreamName;
+
+typedef struct {
+    uint64_t stream_name_offset;
+    uint64_t index_offset;
+    uint64_t index_num;
+    uint32_t stream_num;
+    uint32_t reserved;
+    char     magic[8];
+} Footer;
+#pragma pack(pop)
+}
+
+class FrameRecorder {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct Statistics_ {
+        uint64_t frame_num;
+        uint64_t byte_written;
+        uint64_t byte_raw;         // size of the images before compression
+        uint64_t stall_num;        // number of times Write waited for the background writer
+        Statistics_() : frame_num(0), byte_written(0), byte_raw(0), stall_num(0)
+        {}
+    } Statistics;
+
+public:
+    FrameRecorder();
+    ~FrameRecorder();
+    int32_t Open(const std::string& filename, size_t chunk_size = 32 * 1024 * 1024, int32_t chunk_num = 4);
+    int32_t Close(void);
+    /* compression: kCompressionRvl for depth (CV_16UC1 / CV_8UC1). Other images and images which don't get smaller are stored as they are */
+    int32_t AddStream(const std::string& name, uint32_t compression = FrameRecordFormat::kCompressionNone);
+    int32_t Write(int32_t stream_id, const cv::Mat& mat, int64_t timestamp_us, int64_t sequence_num);
+    Statistics GetStatistics(void);
+
+private:
+    typedef struct Chunk_ {
+        std::vector<uint8_t> buffer;
+        size_t used;
+        Chunk_() : used(0) {}
+    } Chunk;
+
+private:
+    void ThreadWriter(void);
+    int32_t SubmitCurrentChunk(void);
+    Chunk* AcquireFreeChunk(size_t required_size);
+
+private:
+    FILE* fp_;
+    uint64_t file_offset_;     // file offset where current_chunk_ starts
+    size_t chunk_size_;
+    std::vector<std::unique_ptr<Chunk>> chunk_list_;
+    Chunk* current_chunk_;
+    std::deque<Chunk*> free_queue_;
+    std::deque<Chunk*> write_queue_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_writer_;
+    bool is_running_;
+    std::atomic<bool> has_write_error_;
+
+    std::vector<std::string> stream_name_list_;
+    std::vector<uint32_t> stream_compression_list_;
+    std::vector<FrameRecordFormat::IndexEntry> index_list_;
+    Statistics statistics_;
+};
+
+
+class FrameReader {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct Frame_ {
+        cv::Mat  mat;              // header only. points to the mapped file, so do not modify it and do not use it after Close (decoded copy for compressed records)
+        int64_t  timestamp_us;
+        int64_t  sequence_num;
+        Frame_() : timestamp_us(0), sequence_num(0)
+        {}
+    } Frame;
+
+public:
+    FrameReader();
+    ~FrameReader();
+    int32_t Open(const std::string& filename);
+    int32_t Close(void);
+    int32_t GetStreamId(const std::string& name) const;
+    int32_t GetStreamNum(void) const;
+    const std::string& GetStreamName(int32_t stream_id) const;
+    int32_t GetFrameNum(int32_t stream_id) const;
+    int32_t GetFrame(int32_t stream_id, int32_t frame_index, Frame& frame) const;
+    int32_t FindFrameBySequenceNum(int32_t stream_id, int64_t sequence_num) const;
+
+private:
+    int32_t Map(const std::string& filename);
+    void Unmap(void);
+    int32_t ReadIndex(void);
+    int32_t RebuildIndex(void);
+    void AddEntry(const FrameRecordFormat::IndexEntry& entry);
+
+private:
+    const uint8_t* mapped_data_;
+    uint64_t mapped_size_;
+#ifdef _WIN32
+    void* handle_file_;
+    void* handle_mapping_;
+#else
+    int32_t fd_;
+#endif
+
+    std::vector<std::string> stream_name_list_;
+    std::vector<std::vector<FrameRecordFormat::IndexEntry>> index_list_;   // [stream_id][frame_index]
+};
+
+#endif
@@ -0,0 +1,253 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "thread_pool.h"
+#include "guided_filter.h"
+
+/*** Macro ***/
+#define TAG "GuidedFilter"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Minimum rows per task of ThreadPool */
+static constexpr int32_t kGrainSize = 8;
+
+/*** Function ***/
+int32_t GuidedFilter::Filter(const cv::Mat& mat_guide, const cv::Mat& mat_src, cv::Mat& mat_dst, int32_t radius, float eps, float value_scale)
+{
+    if (mat_guide.empty() || mat_src.empty() || mat_guide.size() != mat_src.size() || mat_src.channels() != 1) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+    if (mat_guide.type() != CV_8UC1 && mat_guide.type() != CV_8UC3) {
+        PRINT_E("Unsupported guide type: %d\n", mat_guide.type());
+        return kRetErr;
+    }
+    if (radius <= 0) {
+        PRINT_E("Invalid radius: %d\n", radius);
+        return kRetErr;
+    }
+
+    /*** Prepare inputs ***/
+    const cv::Mat* guide = &mat_guide;
+    if (mat_guide.channels() == 3) {
+        cv::cvtColor(mat_guide, mat_guide_gray_, cv::COLOR_BGR2GRAY);
+        guide = &mat_guide_gray_;
+    }
+    ComputeCoefficients(*guide, mat_src, radius, eps);
+    mat_dst.create(mat_src.rows, mat_src.cols, CV_32FC1);    /* after reading src, in case they are the same */
+
+    /*** Output ***/
+    const int32_t width = mat_src.cols;
+    const int32_t height = mat_src.rows;
+    ThreadPool::GetInstance().ParallelFor(0, height, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            const float* I = mat_i_.ptr<float>(y);
+            const float* m = mat_m_.ptr<float>(y);
+            const float* mean_ac = mat_ac_.ptr<float>(y);
+            const float* mean_bc = mat_bc_.ptr<float>(y);
+            const float* mean_c = mat_c_.ptr<float>(y);
+            float* q = mat_dst.ptr<float>(y);
+            for (int32_t x = 0; x < width; x++) {
+                /* mean_c > 0 at valid pixels because the pixel itself has valid coefficients */
+                const float inv_c = m[x] * value_scale / (mean_c[x] + (1.0f - m[x]));
+                q[x] = (mean_ac[x] * I[x] + mean_bc[x]) * inv_c;
+            }
+        }
+    });
+
+    return kRetOk;
+}
+
+int32_t GuidedFilter::Upsample(const cv::Mat& mat_guide, const cv::Mat& mat_src, cv::Mat& mat_dst, int32_t radius, float eps, float value_scale)
+{
+    if (mat_guide.empty() || mat_src.empty() || mat_src.channels() != 1
+        || mat_src.cols > mat_guide.cols || mat_src.rows > mat_guide.rows) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+    if (mat_guide.type() != CV_8UC1 && mat_guide.type() != CV_8UC3) {
+        PRINT_E("Unsupported guide type: %d\n", mat_guide.type());
+        return kRetErr;
+    }
+    if (radius <= 0) {
+        PRINT_E("Invalid radius: %d\n", radius);
+        return kRetErr;
+    }
+
+    /*** Coefficients at the resolution of src ***/
+    const cv::Mat* guide = &mat_guide;
+    if (mat_guide.channels() == 3) {
+        cv::cvtColor(mat_guide, mat_guide_gray_, cv::COLOR_BGR2GRAY);
+        guide = &mat_guide_gray_;
+    }
+    cv::resize(*guide, mat_guide_low_, mat_src.size(), 0, 0, cv::INTER_AREA);
+    ComputeCoefficients(mat_guide_low_, mat_src, radius, eps);
+
+    /*** Output: coefficients are interpolated (bilinear), and applied to the guide at full resolution ***/
+    const int32_t width = mat_guide.cols;
+    const int32_t height = mat_guide.rows;
+    const int32_t width_low = mat_src.cols;
+    const int32_t height_low = mat_src.rows;
+    const float scale_x = static_cast<float>(width_low) / width;
+    const float scale_y = static_cast<float>(height_low) / height;
+    /* Source position of each column. Same as cv::INTER_LINEAR (pixel center aligned) and cv::INTER_NEAREST for validity */
+    x_index_list_.resize(width * 3);
+    x_weight_list_.resize(width);
+    for (int32_t x = 0; x < width; x++) {
+        const float fx = (std::max)((x + 0.5f) * scale_x - 0.5f, 0.0f);
+        const int32_t x0 = (std::min)(static_cast<int32_t>(fx), width_low - 1);
+        x_index_list_[x * 3 + 0] = x0;
+        x_index_list_[x * 3 + 1] = (std::min)(x0 + 1, width_low - 1);
+        x_index_list_[x * 3 + 2] = (std::min)(static_cast<int32_t>(x * scale_x), width_low - 1);
+        x_weight_list_[x] = fx - x0;
+    }
+    mat_dst.create(height, width, CV_32FC1);
+    ThreadPool::GetInstance().ParallelFor(0, height, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            const float fy = (std::max)((y + 0.5f) * scale_y - 0.5f, 0.0f);
+            const int32_t y0 = (std::min)(static_cast<int32_t>(fy), height_low - 1);
+            const int32_t y1 = (std::min)(y0 + 1, height_low - 1);
+            const float wy = fy - y0;
+            const float* ac0 = mat_ac_.ptr<float>(y0);
+            const float* ac1 = mat_ac_.ptr<float>(y1);
+            const float* bc0 = mat_bc_.ptr<float>(y0);
+            const float* bc1 = mat_bc_.ptr<float>(y1);
+            const float* c0 = mat_c_.ptr<float>(y0);
+            const float* c1 = mat_c_.ptr<float>(y1);
+            const float* m = mat_m_.ptr<float>((std::min)(static_cast<int32_t>(y * scale_y), height_low - 1));
+            const uint8_t* g = guide->ptr<uint8_t>(y);
+            float* q = mat_dst.ptr<float>(y);
+            for (int32_t x = 0; x < width; x++) {
+                const int32_t xa = x_index_list_[x * 3 + 0];
+                const int32_t xb = x_index_list_[x * 3 + 1];
+                const float wx = x_weight_list_[x];
+                const float w00 = (1.0f - wx) * (1.0f - wy);
+                const float w01 = wx * (1.0f - wy);
+                const float w10 = (1.0f - wx) * wy;
+                const float w11 = wx * wy;
+                const float mean_ac = ac0[xa] * w00 + ac0[xb] * w01 + ac1[xa] * w10 + ac1[xb] * w11;
+                const float mean_bc = bc0[xa] * w00 + bc0[xb] * w01 + bc1[xa] * w10 + bc1[xb] * w11;
+                const float mean_c = c0[xa] * w00 + c0[xb] * w01 + c1[xa] * w10 + c1[xb] * w11;
+                /* mean_c > 0 at valid pixels because the nearest source pixel has valid coefficients and weight >= 0.25 */
+                const float valid = m[x_index_list_[x * 3 + 2]];
+                const float inv_c = valid * value_scale / (mean_c + (1.0f - valid));
+                q[x] = (mean_ac * (g[x] * (1.0f / 255.0f)) + mean_bc) * inv_c;
+            }
+        }
+    });
+
+    return kRetOk;
+}
+
+void GuidedFilter::ComputeCoefficients(const cv::Mat& guide_gray, const cv::Mat& mat_src, int32_t radius, float eps)
+{
+    const cv::Mat* guide = &guide_gray;
+    const cv::Mat* src = &mat_src;
+    if (mat_src.type() != CV_32FC1) {
+        mat_src.convertTo(mat_src_fp_, CV_32FC1);
+        src = &mat_src_fp_;
+    }
+
+    const int32_t width = mat_src.cols;
+    const int32_t height = mat_src.rows;
+    mat_i_.create(height, width, CV_32FC1);
+    mat_m_.create(height, width, CV_32FC1);
+    mat_pm_.create(height, width, CV_32FC1);
+    mat_im_.create(height, width, CV_32FC1);
+    mat_iim_.create(height, width, CV_32FC1);
+    mat_ipm_.create(height, width, CV_32FC1);
+    mat_ac_.create(height, width, CV_32FC1);
+    mat_bc_.create(height, width, CV_32FC1);
+    mat_c_.create(height, width, CV_32FC1);
+
+    /*** Products for local statistics ***/
+    ThreadPool::GetInstance().ParallelFor(0, height, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            const uint8_t* g = guide->ptr<uint8_t>(y);
+            float* I = mat_i_.ptr<float>(y);
+            float* m = mat_m_.ptr<float>(y);
+            float* pm = mat_pm_.ptr<float>(y);
+            const float* p = src->ptr<float>(y);
+            float* im = mat_im_.ptr<float>(y);
+            float* iim = mat_iim_.ptr<float>(y);
+            float* ipm = mat_ipm_.ptr<float>(y);
+            for (int32_t x = 0; x < width; x++) {
+                const float i = g[x] * (1.0f / 255.0f);
+                const float valid = (p[x] > 0.0f) ? 1.0f : 0.0f;    /* false for NaN */
+                const float v = (p[x] > 0.0f) ? p[x] : 0.0f;
+                I[x] = i;
+                m[x] = valid;
+                pm[x] = v;
+                im[x] = i * valid;
+                iim[x] = i * i * valid;
+                ipm[x] = i * v;
+            }
+        }
+    });
+
+    /*** Local mean ***/
+    const cv::Size ksize(2 * radius + 1, 2 * radius + 1);
+    cv::boxFilter(mat_m_, mat_c_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);  /* use mat_c_ as temporary not to overwrite m */
+    cv::boxFilter(mat_pm_, mat_pm_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::boxFilter(mat_im_, mat_im_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::boxFilter(mat_iim_, mat_iim_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::boxFilter(mat_ipm_, mat_ipm_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+
+    /*** Linear coefficients: q = a * I + b in each window ***/
+    const float valid_threshold = 0.5f / ksize.area();     /* at least one valid pixel in the window */
+    ThreadPool::GetInstance().ParallelFor(0, height, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            const float* mean_m = mat_c_.ptr<float>(y);
+            const float* mean_pm = mat_pm_.ptr<float>(y);
+            const float* mean_im = mat_im_.ptr<float>(y);
+            const float* mean_iim = mat_iim_.ptr<float>(y);
+            const float* mean_ipm = mat_ipm_.ptr<float>(y);
+            float* ac = mat_ac_.ptr<float>(y);
+            float* bc = mat_bc_.ptr<float>(y);
+            float* c = mat_pm_.ptr<float>(y);   /* mean_pm is not used after this line, so reuse it for c */
+            for (int32_t x = 0; x < width; x++) {
+                const float w = mean_m[x];
+                const float valid = (w > valid_threshold) ? 1.0f : 0.0f;
+                const float inv_w = valid / (w + (1.0f - valid));      /* 0 if invalid, without branch */
+                const float mean_i = mean_im[x] * inv_w;
+                const float mean_p = mean_pm[x] * inv_w;
+                const float cov_ip = mean_ipm[x] * inv_w - mean_i * mean_p;
+                const float var_i = mean_iim[x] * inv_w - mean_i * mean_i;
+                const float a = cov_ip / (var_i + eps);
+                const float b = mean_p - a * mean_i;
+                ac[x] = a * valid;
+                bc[x] = b * valid;
+                c[x] = valid;
+            }
+        }
+    });
+
+    /*** Average coefficients ***/
+    cv::boxFilter(mat_ac_, mat_ac_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::boxFilter(mat_bc_, mat_bc_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::boxFilter(mat_pm_, mat_c_, CV_32F, ksize, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+}
@@ -0,0 +1,81 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef GUIDED_FILTER_
+#define GUIDED_FILTER_
+
+/* for general */
+#include <cstdint>
+#include <vector>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Edge preserving filter for disparity / depth using an image as guide (He et al., Guided Image Filtering)
+ *   - O(1) per pixel regardless of radius. Box filters are done by cv::boxFilter, and the other passes are row parallel
+ *   - Invalid pixels (value <= 0) are excluded from the statistics, and stay invalid in the output
+ *   - Work buffers are kept in the instance, so allocation happens only when the image size changes
+ *   - Upsample is the fast guided filter (He and Sun): the coefficients are computed at the low resolution of src,
+ *     and applied to the full resolution guide. Edges of the output follow the guide instead of the blocks of src
+ */
+class GuidedFilter {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+public:
+    GuidedFilter() {}
+    ~GuidedFilter() {}
+    /*
+     * mat_guide: CV_8UC1 or CV_8UC3 with the same size as mat_src
+     * mat_src: CV_8UC1, CV_16UC1 or CV_32FC1
+     * mat_dst: CV_32FC1 (reallocated only if the size is different)
+     * eps: regularization for the guide normalized to 0.0 - 1.0. Larger value makes the result smoother
+     * value_scale: multiplied to the output (e.g. 1 / 8 for disparity in 1/8 px)
+     */
+    int32_t Filter(const cv::Mat& mat_guide, const cv::Mat& mat_src, cv::Mat& mat_dst, int32_t radius = 4, float eps = 1e-2f, float value_scale = 1.0f);
+    /*
+     * mat_guide: CV_8UC1 or CV_8UC3 with the output size. Must not be smaller than mat_src
+     * mat_src: low resolution input. Same types as Filter
+     * mat_dst: CV_32FC1 with the size of mat_guide
+     * radius: in the pixel of mat_src
+     * value_scale: multiplied to the output (e.g. the ratio of the widths for disparity)
+     */
+    int32_t Upsample(const cv::Mat& mat_guide, const cv::Mat& mat_src, cv::Mat& mat_dst, int32_t radius = 4, float eps = 1e-2f, float value_scale = 1.0f);
+
+private:
+    /* mat_ac_, mat_bc_, mat_c_ (averaged) and mat_i_, mat_m_ at the resolution of src */
+    void ComputeCoefficients(const cv::Mat& guide_gray, const cv::Mat& mat_src, int32_t radius, float eps);
+
+private:
+    cv::Mat mat_guide_gray_;
+    cv::Mat mat_guide_low_;     // guide resized to src for Upsample
+    cv::Mat mat_src_fp_;
+    cv::Mat mat_i_;         // guide (0.0 - 1.0)
+    cv::Mat mat_m_;         // validity mask
+    cv::Mat mat_pm_;        // p * m
+    cv::Mat mat_im_;        // I * m
+    cv::Mat mat_iim_;       // I * I * m
+    cv::Mat mat_ipm_;       // I * p * m
+    cv::Mat mat_ac_;        // a * c
+    cv::Mat mat_bc_;        // b * c
+    cv::Mat mat_c_;         // validity of coefficients
+    std::vector<int32_t> x_index_list_;     // source columns of each output column for Upsample
+    std::vector<float> x_weight_list_;
+};
+
+#endif
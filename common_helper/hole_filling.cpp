@@ -0,0 +1,220 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "thread_pool.h"
+#include "hole_filling.h"
+
+/*** Macro ***/
+#define TAG "HoleFilling"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Minimum rows per task of ThreadPool. Upper levels are small, and run in one thread */
+static constexpr int32_t kGrainSize = 32;
+
+/*** Function ***/
+/* Weight of the coarser level is saturated at 1.0 (fully valid). value is premultiplied by weight */
+static inline void StorePush(float value_sum, float weight_sum, float& value, float& weight)
+{
+    const float weight_saturated = (std::min)(weight_sum, 1.0f);
+    weight = weight_saturated;
+    value = (weight_sum > 0.0f) ? value_sum * (weight_saturated / weight_sum) : 0.0f;
+}
+
+/* 2x2 pixels of the image (rows src0 and src1) into a pixel of the first level. Valid pixels have weight 1.0 */
+static void PushImageRow(const float* src0, const float* src1, int32_t width_src, float* value, float* weight, int32_t width)
+{
+    for (int32_t x = 0; x < width; x++) {
+        const int32_t x0 = 2 * x;
+        const int32_t x1 = (std::min)(2 * x + 1, width_src - 1);
+        const float v00 = (src0[x0] > 0.0f) ? src0[x0] : 0.0f;
+        const float v01 = (src0[x1] > 0.0f) ? src0[x1] : 0.0f;
+        const float v10 = (src1[x0] > 0.0f) ? src1[x0] : 0.0f;
+        const float v11 = (src1[x1] > 0.0f) ? src1[x1] : 0.0f;
+        const float w00 = (src0[x0] > 0.0f) ? 1.0f : 0.0f;
+        const float w01 = (src0[x1] > 0.0f) ? 1.0f : 0.0f;
+        const float w10 = (src1[x0] > 0.0f) ? 1.0f : 0.0f;
+        const float w11 = (src1[x1] > 0.0f) ? 1.0f : 0.0f;
+        StorePush(v00 + v01 + v10 + v11, w00 + w01 + w10 + w11, value[x], weight[x]);
+    }
+}
+
+/* 2x2 pixels of a level (rows 0 and 1) into a pixel of the next level */
+static void PushLevelRow(const float* value0, const float* weight0, const float* value1, const float* weight1, int32_t width_src, float* value, float* weight, int32_t width)
+{
+    for (int32_t x = 0; x < width; x++) {
+        const int32_t x0 = 2 * x;
+        const int32_t x1 = (std::min)(2 * x + 1, width_src - 1);
+        StorePush(value0[x0] + value0[x1] + value1[x0] + value1[x1], weight0[x0] + weight0[x1] + weight1[x0] + weight1[x1], value[x], weight[x]);
+    }
+}
+
+/* Row of the coarser level which is the nearest to row y, and the next nearest one (bilinear 2x upsample: 0.75, 0.25) */
+static inline void GetParentIndex(int32_t y, int32_t size_parent, int32_t& index_near, int32_t& index_far)
+{
+    index_near = y >> 1;
+    index_far = (y & 1) ? (std::min)(index_near + 1, size_parent - 1) : (std::max)(index_near - 1, 0);
+}
+
+static inline float Interpolate(const float* row_near, const float* row_far, int32_t x_near, int32_t x_far)
+{
+    return 0.75f * (0.75f * row_near[x_near] + 0.25f * row_near[x_far]) + 0.25f * (0.75f * row_far[x_near] + 0.25f * row_far[x_far]);
+}
+
+/* Fill the rest of weight of a level with the upsampled coarser level (rows near and far) */
+static void PullLevelRow(const float* value_near, const float* weight_near, const float* value_far, const float* weight_far, int32_t width_parent, float* value, float* weight, int32_t width)
+{
+    for (int32_t x = 0; x < width; x++) {
+        int32_t x_near, x_far;
+        GetParentIndex(x, width_parent, x_near, x_far);
+        const float rest = 1.0f - weight[x];
+        value[x] += rest * Interpolate(value_near, value_far, x_near, x_far);
+        weight[x] += rest * Interpolate(weight_near, weight_far, x_near, x_far);
+    }
+}
+
+/* Pull to the image. Valid pixels have weight 1.0, so they are kept, and invalid pixels take the upsampled value */
+static void PullImageRow(const float* src, const float* value_near, const float* weight_near, const float* value_far, const float* weight_far, int32_t width_parent,
+    float* dst, uint8_t* valid, int32_t width)
+{
+    for (int32_t x = 0; x < width; x++) {
+        int32_t x_near, x_far;
+        GetParentIndex(x, width_parent, x_near, x_far);
+        const float value_parent = Interpolate(value_near, value_far, x_near, x_far);
+        const float weight_parent = Interpolate(weight_near, weight_far, x_near, x_far);
+        const float value_filled = (weight_parent > 0.0f) ? value_parent / weight_parent : 0.0f;
+        const bool is_valid = src[x] > 0.0f;
+        dst[x] = is_valid ? src[x] : value_filled;
+        valid[x] = is_valid ? 255 : 0;
+    }
+}
+
+void HoleFilling::Allocate(int32_t width, int32_t height, int32_t level_num)
+{
+    if (width == width_ && height == height_ && level_num == level_num_) return;
+    level_value_list_.resize(level_num);
+    level_weight_list_.resize(level_num);
+    int32_t level_width = width;
+    int32_t level_height = height;
+    for (int32_t level = 0; level < level_num; level++) {
+        level_width = (level_width + 1) / 2;
+        level_height = (level_height + 1) / 2;
+        level_value_list_[level].create(level_height, level_width, CV_32FC1);
+        level_weight_list_[level].create(level_height, level_width, CV_32FC1);
+    }
+    width_ = width;
+    height_ = height;
+    level_num_ = level_num;
+}
+
+int32_t HoleFilling::Fill(const cv::Mat& mat_src, cv::Mat& mat_dst, cv::Mat& mat_valid, int32_t level_num)
+{
+    if (mat_src.empty() || mat_src.channels() != 1) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+    const int32_t type = mat_src.type();
+    if (type != CV_8UC1 && type != CV_16UC1 && type != CV_16FC1 && type != CV_32FC1) {
+        PRINT_E("Unsupported type: %d\n", type);
+        return kRetErr;
+    }
+    if (level_num < 0) {
+        PRINT_E("Invalid parameter: level_num = %d\n", level_num);
+        return kRetErr;
+    }
+
+    const cv::Mat* src = &mat_src;
+    if (type != CV_32FC1) {
+        mat_src.convertTo(mat_src_fp_, CV_32FC1);
+        src = &mat_src_fp_;
+    }
+
+    const int32_t width = mat_src.cols;
+    const int32_t height = mat_src.rows;
+    int32_t level_num_used = 0;
+    for (int32_t level_width = width, level_height = height; (level_width > 1 || level_height > 1) && (level_num == 0 || level_num_used < level_num); level_num_used++) {
+        level_width = (level_width + 1) / 2;
+        level_height = (level_height + 1) / 2;
+    }
+    Allocate(width, height, level_num_used);
+    mat_dst.create(height, width, CV_32FC1);
+    mat_valid.create(height, width, CV_8UC1);
+
+    if (level_num_used == 0) {
+        /* 1 pixel. Nothing to fill from */
+        const float value = src->at<float>(0, 0);
+        mat_dst.at<float>(0, 0) = (value > 0.0f) ? value : 0.0f;
+        mat_valid.at<uint8_t>(0, 0) = (value > 0.0f) ? 255 : 0;
+        return kRetOk;
+    }
+
+    /*** Push ***/
+    for (int32_t level = 0; level < level_num_used; level++) {
+        cv::Mat& mat_value = level_value_list_[level];
+        cv::Mat& mat_weight = level_weight_list_[level];
+        const cv::Mat& mat_value_src = (level == 0) ? *src : level_value_list_[level - 1];
+        const cv::Mat& mat_weight_src = (level == 0) ? *src : level_weight_list_[level - 1];
+        ThreadPool::GetInstance().ParallelFor(0, mat_value.rows, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+            for (int32_t y = y_begin; y < y_end; y++) {
+                const int32_t y0 = 2 * y;
+                const int32_t y1 = (std::min)(2 * y + 1, mat_value_src.rows - 1);
+                if (level == 0) {
+                    PushImageRow(mat_value_src.ptr<float>(y0), mat_value_src.ptr<float>(y1), mat_value_src.cols, mat_value.ptr<float>(y), mat_weight.ptr<float>(y), mat_value.cols);
+                } else {
+                    PushLevelRow(mat_value_src.ptr<float>(y0), mat_weight_src.ptr<float>(y0), mat_value_src.ptr<float>(y1), mat_weight_src.ptr<float>(y1), mat_value_src.cols,
+                        mat_value.ptr<float>(y), mat_weight.ptr<float>(y), mat_value.cols);
+                }
+            }
+        });
+    }
+
+    /*** Pull ***/
+    for (int32_t level = level_num_used - 2; level >= 0; level--) {
+        cv::Mat& mat_value = level_value_list_[level];
+        cv::Mat& mat_weight = level_weight_list_[level];
+        const cv::Mat& mat_value_parent = level_value_list_[level + 1];
+        const cv::Mat& mat_weight_parent = level_weight_list_[level + 1];
+        ThreadPool::GetInstance().ParallelFor(0, mat_value.rows, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+            for (int32_t y = y_begin; y < y_end; y++) {
+                int32_t y_near, y_far;
+                GetParentIndex(y, mat_value_parent.rows, y_near, y_far);
+                PullLevelRow(mat_value_parent.ptr<float>(y_near), mat_weight_parent.ptr<float>(y_near), mat_value_parent.ptr<float>(y_far), mat_weight_parent.ptr<float>(y_far),
+                    mat_value_parent.cols, mat_value.ptr<float>(y), mat_weight.ptr<float>(y), mat_value.cols);
+            }
+        });
+    }
+    const cv::Mat& mat_value_parent = level_value_list_[0];
+    const cv::Mat& mat_weight_parent = level_weight_list_[0];
+    ThreadPool::GetInstance().ParallelFor(0, height, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            int32_t y_near, y_far;
+            GetParentIndex(y, mat_value_parent.rows, y_near, y_far);
+            PullImageRow(src->ptr<float>(y), mat_value_parent.ptr<float>(y_near), mat_weight_parent.ptr<float>(y_near), mat_value_parent.ptr<float>(y_far), mat_weight_parent.ptr<float>(y_far),
+                mat_value_parent.cols, mat_dst.ptr<float>(y), mat_valid.ptr<uint8_t>(y), width);
+        }
+    });
+
+    return kRetOk;
+}
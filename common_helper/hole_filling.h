@@ -0,0 +1,65 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef HOLE_FILLING_
+#define HOLE_FILLING_
+
+/* for general */
+#include <cstdint>
+#include <vector>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Hole filling for disparity / depth by push-pull (Gortler et al., The Lumigraph)
+ *   - Push: averages valid pixels into a pyramid with validity weight. Pull: fills the pixels of each level
+ *     with the bilinear upsample of the coarser level, weighted by how much they are not valid yet
+ *   - O(pixels) in total (the pyramid is 4/3 of the image), without iteration. Each level is row parallel
+ *   - Invalid pixels (value <= 0) are filled, valid pixels are kept as they are
+ *   - Pyramid levels are kept in the instance, so allocation happens only when the image size changes
+ */
+class HoleFilling {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+public:
+    HoleFilling() : width_(0), height_(0), level_num_(0) {}
+    ~HoleFilling() {}
+    /*
+     * mat_src: CV_8UC1, CV_16UC1, CV_16FC1 or CV_32FC1
+     * mat_dst: CV_32FC1 (reallocated only if the size is different). Can be the same as mat_src if it's CV_32FC1
+     * mat_valid: CV_8UC1. 255 where mat_src is valid, 0 where filled
+     * level_num: pyramid levels. Holes are filled up to about 2^level_num pixels away from valid pixels, and the rest stays 0.
+     *            0 = until the top level is 1 pixel (everything is filled if the image has a valid pixel)
+     */
+    int32_t Fill(const cv::Mat& mat_src, cv::Mat& mat_dst, cv::Mat& mat_valid, int32_t level_num = 0);
+
+private:
+    void Allocate(int32_t width, int32_t height, int32_t level_num);
+
+private:
+    cv::Mat mat_src_fp_;
+    int32_t width_;
+    int32_t height_;
+    int32_t level_num_;
+    /* Level i is the (i + 1)-th level of the pyramid. The image itself is level 0 and is not copied */
+    std::vector<cv::Mat> level_value_list_;     // CV_32FC1. value * weight
+    std::vector<cv::Mat> level_weight_list_;    // CV_32FC1. 0.0 - 1.0
+};
+
+#endif
@@ -0,0 +1,176 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "mat_ring.h"
+
+/*** Macro ***/
+#define TAG "MatRing"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/*** Global variable ***/
+/* Slot reserved by Acquire, which is passed to allocate called from cv::Mat::create in the same thread */
+static thread_local const MatRing* s_reserved_ring = nullptr;
+static thread_local void* s_reserved_slot = nullptr;
+
+/*** Function ***/
+MatRing::MatRing(int32_t slot_num)
+    : slot_list_((std::max)(slot_num, 1)), leased_num_(0), next_slot_(0), wait_num_(0)
+{
+}
+
+MatRing::~MatRing()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (leased_num_ > 0) {
+        /* buffers of the leased slots are leaked rather than freed under the users */
+        PRINT_E("Destroyed while %d slots are leased\n", leased_num_);
+    }
+    for (auto& slot : slot_list_) {
+        if (!slot.is_leased && slot.buffer) cv::fastFree(slot.buffer);
+    }
+}
+
+int32_t MatRing::Acquire(int32_t rows, int32_t cols, int32_t type, cv::Mat& mat, int32_t timeout_ms)
+{
+    /* Return the lease held by mat first, otherwise a ring with one slot would wait for itself */
+    mat.release();
+
+    const size_t size = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+    Slot* slot = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const int32_t slot_num = static_cast<int32_t>(slot_list_.size());
+        auto has_free_slot = [this, slot_num] { return leased_num_ < slot_num; };
+        if (!has_free_slot()) {
+            wait_num_++;
+            if (timeout_ms < 0) {
+                cond_.wait(lock, has_free_slot);
+            } else if (!cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), has_free_slot)) {
+                return kRetErr;
+            }
+        }
+        /* Round robin, so that the slot released last is not overwritten first */
+        for (int32_t i = 0; i < slot_num; i++) {
+            Slot& s = slot_list_[(next_slot_ + i) % slot_num];
+            if (!s.is_leased) {
+                slot = &s;
+                next_slot_ = (next_slot_ + i + 1) % slot_num;
+                break;
+            }
+        }
+        slot->is_leased = true;
+        leased_num_++;
+    }
+
+    /* The slot is owned by this thread now */
+    if (slot->capacity < size) {
+        if (slot->buffer) cv::fastFree(slot->buffer);
+        slot->buffer = cv::fastMalloc(size);
+        slot->capacity = size;
+    }
+
+    cv::Mat mat_slot;
+    mat_slot.allocator = this;
+    s_reserved_ring = this;
+    s_reserved_slot = slot;
+    mat_slot.create(rows, cols, type);
+    s_reserved_ring = nullptr;
+    s_reserved_slot = nullptr;
+    if (mat_slot.u == nullptr || mat_slot.u->currAllocator != this) {
+        /* allocate failed and OpenCV fell back to the default allocator. Give the slot back */
+        PRINT_E("Failed to map the slot\n");
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot->is_leased = false;
+        leased_num_--;
+        cond_.notify_all();
+        return kRetErr;
+    }
+    mat = mat_slot;
+    return kRetOk;
+}
+
+bool MatRing::WaitAllReleased(int32_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cond_.wait_for(lock, std::chrono::milliseconds((std::max)(timeout_ms, 0)), [this] { return leased_num_ == 0; });
+}
+
+int32_t MatRing::GetLeasedNum(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return leased_num_;
+}
+
+uint64_t MatRing::GetWaitNum(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return wait_num_;
+}
+
+cv::UMatData* MatRing::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const
+{
+    if (data0 || s_reserved_ring != this) {
+        /* Not from Acquire (e.g. create() called again on a leased cv::Mat with another size) */
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usage_flags);
+    }
+    Slot* slot = static_cast<Slot*>(s_reserved_slot);
+
+    /* The same layout as the standard allocator */
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) step[i] = total;
+        total *= sizes[i];
+    }
+    CV_Assert(total <= slot->capacity);
+
+    cv::UMatData* u = new cv::UMatData(this);
+    u->data = u->origdata = static_cast<uint8_t*>(slot->buffer);
+    u->size = total;
+    u->userdata = slot;
+    return u;
+}
+
+bool MatRing::allocate(cv::UMatData* u, cv::AccessFlag /*access_flags*/, cv::UMatUsageFlags /*usage_flags*/) const
+{
+    return u != nullptr;
+}
+
+void MatRing::deallocate(cv::UMatData* u) const
+{
+    if (!u) return;
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    Slot* slot = static_cast<Slot*>(u->userdata);
+    delete u;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->is_leased = false;
+    leased_num_--;
+    cond_.notify_all();
+}
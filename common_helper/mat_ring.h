@@ -0,0 +1,81 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef MAT_RING_
+#define MAT_RING_
+
+/* for general */
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Fixed number of output buffers handed out as cv::Mat
+ *   - Acquire leases a free slot. The lease is the refcount of cv::Mat: the slot returns to the ring when the last
+ *     cv::Mat referring to it is released, so results can be copied and kept like any other cv::Mat
+ *   - Acquire blocks while all the slots are leased (back-pressure to the producer)
+ *   - A slot buffer grows to the largest size requested, and is reused afterwards
+ *   - The ring must outlive the leases. Call WaitAllReleased before destroying it
+ */
+class MatRing : public cv::MatAllocator {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+private:
+    typedef struct Slot_ {
+        void*  buffer;
+        size_t capacity;
+        bool   is_leased;
+        Slot_() : buffer(nullptr), capacity(0), is_leased(false)
+        {}
+    } Slot;
+
+public:
+    explicit MatRing(int32_t slot_num);
+    ~MatRing() override;
+    /* timeout_ms < 0: wait forever. kRetErr if no slot is returned within timeout_ms */
+    int32_t Acquire(int32_t rows, int32_t cols, int32_t type, cv::Mat& mat, int32_t timeout_ms = -1);
+    /* return false if some slots are still leased after timeout_ms */
+    bool WaitAllReleased(int32_t timeout_ms);
+    int32_t GetSlotNum(void) const { return static_cast<int32_t>(slot_list_.size()); }
+    int32_t GetLeasedNum(void) const;
+    /* number of Acquire which had to wait for a slot */
+    uint64_t GetWaitNum(void) const;
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+private:
+    MatRing(const MatRing&) = delete;
+    MatRing& operator=(const MatRing&) = delete;
+
+private:
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cond_;
+    mutable std::vector<Slot> slot_list_;       /* not resized after construction */
+    mutable int32_t leased_num_;
+    int32_t next_slot_;
+    uint64_t wait_num_;
+};
+
+#endif
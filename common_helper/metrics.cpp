@@ -0,0 +1,373 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET SocketType;
+#define INVALID_SOCKET_VALUE INVALID_SOCKET
+#define CloseSocket closesocket
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+typedef int SocketType;
+#define INVALID_SOCKET_VALUE (-1)
+#define CloseSocket close
+#endif
+
+#include "common_helper.h"
+#include "metrics.h"
+
+/*** Macro ***/
+#define TAG "Metrics"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Interval to check the stop request in the server thread */
+static constexpr int32_t kPollIntervalMs = 200;
+
+/*** Function ***/
+MetricsHistogram::MetricsHistogram(const std::vector<double>& bucket_list)
+    : bucket_list_(bucket_list), count_list_(new std::atomic<uint64_t>[bucket_list.size() + 1]), count_(0), sum_(0)
+{
+    std::sort(bucket_list_.begin(), bucket_list_.end());
+    for (size_t i = 0; i <= bucket_list_.size(); i++) count_list_[i] = 0;
+}
+
+void MetricsHistogram::Observe(double value)
+{
+    const size_t index = std::lower_bound(bucket_list_.begin(), bucket_list_.end(), value) - bucket_list_.begin();    /* le */
+    count_list_[index].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    double sum = sum_.load(std::memory_order_relaxed);
+    while (!sum_.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+
+Metrics& Metrics::GetInstance(void)
+{
+    static Metrics instance;
+    return instance;
+}
+
+const std::vector<double>& Metrics::GetLatencyBucketList(void)
+{
+    static const std::vector<double> bucket_list = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+    return bucket_list;
+}
+
+Metrics::~Metrics()
+{
+    Stop();
+}
+
+Metrics::Entry* Metrics::FindOrAdd(const std::string& name, const std::string& labels, const std::string& help, Type type)
+{
+    for (auto& entry : entry_list_) {
+        if (entry.name == name && entry.labels == labels) {
+            if (entry.type != type) {
+                PRINT_E("%s{%s} is already registered with another type\n", name.c_str(), labels.c_str());
+                return nullptr;
+            }
+            return &entry;
+        }
+    }
+    entry_list_.emplace_back();
+    Entry& entry = entry_list_.back();
+    entry.name = name;
+    entry.labels = labels;
+    entry.help = help;
+    entry.type = type;
+    return &entry;
+}
+
+MetricsCounter* Metrics::AddCounter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* entry = FindOrAdd(name, labels, help, kTypeCounter);
+    if (!entry) return nullptr;
+    if (!entry->counter) entry->counter.reset(new MetricsCounter());
+    return entry->counter.get();
+}
+
+MetricsGauge* Metrics::AddGauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* entry = FindOrAdd(name, labels, help, kTypeGauge);
+    if (!entry) return nullptr;
+    if (!entry->gauge) entry->gauge.reset(new MetricsGauge());
+    return entry->gauge.get();
+}
+
+MetricsHistogram* Metrics::AddHistogram(const std::string& name, const std::string& help, const std::vector<double>& bucket_list, const std::string& labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* entry = FindOrAdd(name, labels, help, kTypeHistogram);
+    if (!entry) return nullptr;
+    if (!entry->histogram) entry->histogram.reset(new MetricsHistogram(bucket_list));
+    return entry->histogram.get();
+}
+
+static std::string FormatValue(double value)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+    return buffer;
+}
+
+static std::string FormatLabels(const std::string& labels, const std::string& label_additional = "")
+{
+    if (labels.empty() && label_additional.empty()) return "";
+    if (labels.empty()) return "{" + label_additional + "}";
+    if (label_additional.empty()) return "{" + labels + "}";
+    return "{" + labels + "," + label_additional + "}";
+}
+
+std::string Metrics::Render(void) const
+{
+    static const char* kTypeName[] = { "counter", "gauge", "histogram" };
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    /* Samples of the same name are grouped under one HELP / TYPE */
+    std::vector<const Entry*> sorted_list;
+    for (const auto& entry : entry_list_) sorted_list.push_back(&entry);
+    std::stable_sort(sorted_list.begin(), sorted_list.end(), [](const Entry* a, const Entry* b) { return a->name < b->name; });
+
+    std::string text;
+    const std::string* name_previous = nullptr;
+    for (const Entry* entry : sorted_list) {
+        if (!name_previous || *name_previous != entry->name) {
+            text += "# HELP " + entry->name + " " + entry->help + "\n";
+            text += "# TYPE " + entry->name + " " + kTypeName[entry->type] + "\n";
+            name_previous = &entry->name;
+        }
+        switch (entry->type) {
+        case kTypeCounter:
+            text += entry->name + FormatLabels(entry->labels) + " " + std::to_string(entry->counter->Get()) + "\n";
+            break;
+        case kTypeGauge:
+            text += entry->name + FormatLabels(entry->labels) + " " + FormatValue(entry->gauge->Get()) + "\n";
+            break;
+        case kTypeHistogram:
+        {
+            /* The buckets are read one by one while they are updated, so _count is the sum of them to keep consistency */
+            const MetricsHistogram& histogram = *entry->histogram;
+            const auto& bucket_list = histogram.GetBucketList();
+            uint64_t count_cumulative = 0;
+            for (size_t i = 0; i < bucket_list.size(); i++) {
+                count_cumulative += histogram.GetBucketCount(static_cast<int32_t>(i));
+                text += entry->name + "_bucket" + FormatLabels(entry->labels, "le=\"" + FormatValue(bucket_list[i]) + "\"") + " " + std::to_string(count_cumulative) + "\n";
+            }
+            count_cumulative += histogram.GetBucketCount(static_cast<int32_t>(bucket_list.size()));
+            text += entry->name + "_bucket" + FormatLabels(entry->labels, "le=\"+Inf\"") + " " + std::to_string(count_cumulative) + "\n";
+            text += entry->name + "_sum" + FormatLabels(entry->labels) + " " + FormatValue(histogram.GetSum()) + "\n";
+            text += entry->name + "_count" + FormatLabels(entry->labels) + " " + std::to_string(count_cumulative) + "\n";
+            break;
+        }
+        }
+    }
+    return text;
+}
+
+int32_t Metrics::WriteFile(const std::string& filename) const
+{
+    const std::string text = Render();
+    const std::string filename_tmp = filename + ".tmp";
+    FILE* fp = fopen(filename_tmp.c_str(), "wb");
+    if (!fp) {
+        PRINT_E("Failed to open %s\n", filename_tmp.c_str());
+        return kRetErr;
+    }
+    const bool is_written = (fwrite(text.data(), 1, text.size(), fp) == text.size());
+    fclose(fp);
+    if (!is_written) {
+        PRINT_E("Failed to write %s\n", filename_tmp.c_str());
+        return kRetErr;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());  /* rename doesn't overwrite on Windows */
+#endif
+    if (std::rename(filename_tmp.c_str(), filename.c_str()) != 0) {
+        PRINT_E("Failed to rename %s\n", filename_tmp.c_str());
+        return kRetErr;
+    }
+    return kRetOk;
+}
+
+int32_t Metrics::StartHttpServer(int32_t port)
+{
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        PRINT_E("WSAStartup failed\n");
+        return kRetErr;
+    }
+#endif
+    SocketType sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET_VALUE) {
+        PRINT_E("Failed to create socket\n");
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return kRetErr;
+    }
+    int option = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&option), sizeof(option));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);      /* not exposed to the network */
+    if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(sock, 4) != 0) {
+        PRINT_E("Failed to listen on 127.0.0.1:%d\n", port);
+        CloseSocket(sock);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return kRetErr;
+    }
+
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (server_socket_ >= 0) {
+        PRINT_E("HTTP server is already running\n");
+        CloseSocket(sock);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return kRetErr;
+    }
+    server_socket_ = static_cast<int64_t>(sock);
+    is_running_ = true;
+    thread_list_.push_back(std::thread(&Metrics::ThreadHttpServer, this));
+    PRINT("Serving metrics on http://127.0.0.1:%d/metrics\n", port);
+    return kRetOk;
+}
+
+int32_t Metrics::StartFileExport(const std::string& filename, int32_t interval_ms)
+{
+    if (interval_ms <= 0) {
+        PRINT_E("Invalid interval: %d\n", interval_ms);
+        return kRetErr;
+    }
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    is_running_ = true;
+    thread_list_.push_back(std::thread(&Metrics::ThreadFileExport, this, filename, interval_ms));
+    return kRetOk;
+}
+
+void Metrics::Stop(void)
+{
+    std::vector<std::thread> thread_list;
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        is_running_ = false;
+        thread_list.swap(thread_list_);
+    }
+    thread_cond_.notify_all();
+    for (auto& thread : thread_list) {
+        if (thread.joinable()) thread.join();
+    }
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (server_socket_ >= 0) {
+        CloseSocket(static_cast<SocketType>(server_socket_));
+        server_socket_ = -1;
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+}
+
+void Metrics::ThreadHttpServer(void)
+{
+    SocketType server_socket;
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        server_socket = static_cast<SocketType>(server_socket_);
+    }
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex_);
+            if (!is_running_) break;
+        }
+        /* Wait with timeout, so that Stop is not blocked by accept */
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(server_socket, &fds);
+        timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = kPollIntervalMs * 1000;
+        if (select(static_cast<int>(server_socket) + 1, &fds, nullptr, nullptr, &timeout) <= 0) continue;
+
+        SocketType sock = accept(server_socket, nullptr, nullptr);
+        if (sock == INVALID_SOCKET_VALUE) continue;
+
+        /* Only the request line is used. The rest of the request is ignored */
+        char request[1024];
+        const int request_size = static_cast<int>(recv(sock, request, sizeof(request) - 1, 0));
+        request[(std::max)(request_size, 0)] = '\0';
+        std::string body;
+        std::string status;
+        if (std::strncmp(request, "GET /metrics", 12) == 0 || std::strncmp(request, "GET / ", 6) == 0) {
+            status = "200 OK";
+            body = Render();
+        } else {
+            status = "404 Not Found";
+            body = "Not Found\n";
+        }
+        const std::string response = "HTTP/1.0 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            const int ret = static_cast<int>(send(sock, response.data() + sent, static_cast<int>(response.size() - sent), 0));
+            if (ret <= 0) break;
+            sent += ret;
+        }
+        CloseSocket(sock);
+    }
+}
+
+void Metrics::ThreadFileExport(std::string filename, int32_t interval_ms)
+{
+    std::unique_lock<std::mutex> lock(thread_mutex_);
+    while (is_running_) {
+        lock.unlock();
+        WriteFile(filename);
+        lock.lock();
+        thread_cond_.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return !is_running_; });
+    }
+    lock.unlock();
+    WriteFile(filename);    /* the final values */
+}
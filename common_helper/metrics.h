@@ -0,0 +1,136 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef METRICS_
+#define METRICS_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+/*
+ * Process metrics in Prometheus text format
+ *   - Counter, gauge and histogram with fixed buckets. Updating them is lock-free, so they can be used in the frame loop
+ *   - Metrics are registered to the singleton Metrics once and the returned pointer is kept by the user.
+ *     Registering the same name and labels again returns the same one
+ *   - Exported over HTTP on localhost (GET /metrics) or to a file which is rewritten periodically
+ */
+class MetricsCounter {
+public:
+    MetricsCounter() : value_(0) {}
+    void Add(uint64_t value = 1) { value_.fetch_add(value, std::memory_order_relaxed); }
+    uint64_t Get(void) const { return value_.load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint64_t> value_;
+};
+
+class MetricsGauge {
+public:
+    MetricsGauge() : value_(0) {}
+    void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+    double Get(void) const { return value_.load(std::memory_order_relaxed); }
+private:
+    std::atomic<double> value_;
+};
+
+class MetricsHistogram {
+public:
+    /* bucket_list: upper bounds in ascending order. +Inf is added */
+    explicit MetricsHistogram(const std::vector<double>& bucket_list);
+    void Observe(double value);
+    const std::vector<double>& GetBucketList(void) const { return bucket_list_; }
+    /* not cumulative. index = bucket_list.size() is +Inf */
+    uint64_t GetBucketCount(int32_t index) const { return count_list_[index].load(std::memory_order_relaxed); }
+    uint64_t GetCount(void) const { return count_.load(std::memory_order_relaxed); }
+    double GetSum(void) const { return sum_.load(std::memory_order_relaxed); }
+private:
+    std::vector<double> bucket_list_;
+    std::unique_ptr<std::atomic<uint64_t>[]> count_list_;
+    std::atomic<uint64_t> count_;
+    std::atomic<double> sum_;
+};
+
+class Metrics {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+private:
+    enum Type {
+        kTypeCounter = 0,
+        kTypeGauge,
+        kTypeHistogram,
+    };
+
+    typedef struct Entry_ {
+        std::string name;
+        std::string labels;         // e.g. stage="midasv2"
+        std::string help;
+        Type        type;
+        std::unique_ptr<MetricsCounter>   counter;
+        std::unique_ptr<MetricsGauge>     gauge;
+        std::unique_ptr<MetricsHistogram> histogram;
+        Entry_() : type(kTypeCounter) {}
+    } Entry;
+
+public:
+    static Metrics& GetInstance(void);
+    /* [msec] 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 */
+    static const std::vector<double>& GetLatencyBucketList(void);
+
+    MetricsCounter* AddCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    MetricsGauge* AddGauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    MetricsHistogram* AddHistogram(const std::string& name, const std::string& help, const std::vector<double>& bucket_list, const std::string& labels = "");
+
+    std::string Render(void) const;
+    /* Write to a temporary file and rename it, so that a scraper doesn't read a partial file */
+    int32_t WriteFile(const std::string& filename) const;
+
+    /* Serve GET /metrics on 127.0.0.1:port in a thread */
+    int32_t StartHttpServer(int32_t port);
+    /* Rewrite the file every interval_ms in a thread */
+    int32_t StartFileExport(const std::string& filename, int32_t interval_ms);
+    /* Stop the exporter threads */
+    void Stop(void);
+
+private:
+    Metrics() : is_running_(false), server_socket_(-1) {}
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+    Entry* FindOrAdd(const std::string& name, const std::string& labels, const std::string& help, Type type);
+    void ThreadHttpServer(void);
+    void ThreadFileExport(std::string filename, int32_t interval_ms);
+
+private:
+    mutable std::mutex mutex_;
+    std::deque<Entry> entry_list_;      /* pointers to elements are stable */
+
+    std::mutex thread_mutex_;
+    std::condition_variable thread_cond_;
+    bool is_running_;
+    std::vector<std::thread> thread_list_;
+    int64_t server_socket_;
+};
+
+#endif
@@ -0,0 +1,178 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <map>
+#include <mutex>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "pooled_mat_allocator.h"
+
+/*** Macro ***/
+#define TAG "PooledMatAllocator"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+static constexpr size_t kMinBlockSize = 256;
+
+/*** Function ***/
+PooledMatAllocator& PooledMatAllocator::GetInstance(void)
+{
+    /* Intentionally leaked. See the header */
+    static PooledMatAllocator* instance = new PooledMatAllocator();
+    return *instance;
+}
+
+size_t PooledMatAllocator::RoundUpToSizeClass(size_t size)
+{
+    /* 256, 384, 512, 768, 1024, 1536, ... (waste is less than 1/3) */
+    if (size <= kMinBlockSize) return kMinBlockSize;
+    size_t p = kMinBlockSize;
+    while (p * 2 < size) p *= 2;
+    return (size <= p + p / 2) ? p + p / 2 : p * 2;
+}
+
+cv::UMatData* PooledMatAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag /*flags*/, cv::UMatUsageFlags /*usage_flags*/) const
+{
+    /* The same layout as the standard allocator */
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data0 && step[i] != CV_AUTOSTEP) {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    const size_t block_size = RoundUpToSizeClass(total);
+    void* header = nullptr;
+    void* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_header_list_.empty()) {
+            header = free_header_list_.back();
+            free_header_list_.pop_back();
+        }
+        if (!data0) {
+            auto it = free_list_.find(block_size);
+            if (it != free_list_.end() && !it->second.empty()) {
+                buffer = it->second.back();
+                it->second.pop_back();
+                statistics_.bytes_cached -= block_size;
+                statistics_.hit_num++;
+            } else {
+                statistics_.miss_num++;
+            }
+            statistics_.bytes_in_use += block_size;
+            if (statistics_.bytes_in_use > statistics_.bytes_in_use_peak) statistics_.bytes_in_use_peak = statistics_.bytes_in_use;
+        }
+    }
+
+    if (!data0 && !buffer) {
+        buffer = cv::fastMalloc(block_size);
+    }
+    if (!header) {
+        header = ::operator new(sizeof(cv::UMatData));
+    }
+
+    cv::UMatData* u = new (header) cv::UMatData(this);
+    u->data = u->origdata = static_cast<uint8_t*>(data0 ? data0 : buffer);
+    u->size = total;
+    if (data0) u->flags |= cv::UMatData::USER_ALLOCATED;
+    return u;
+}
+
+bool PooledMatAllocator::allocate(cv::UMatData* u, cv::AccessFlag /*access_flags*/, cv::UMatUsageFlags /*usage_flags*/) const
+{
+    return u != nullptr;
+}
+
+void PooledMatAllocator::deallocate(cv::UMatData* u) const
+{
+    if (!u) return;
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+
+    void* buffer = nullptr;
+    size_t block_size = 0;
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+        buffer = u->origdata;
+        block_size = RoundUpToSizeClass(u->size);
+    }
+    u->~UMatData();
+
+    void* buffer_to_free = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_header_list_.push_back(u);
+        if (buffer) {
+            statistics_.bytes_in_use -= block_size;
+            if (statistics_.bytes_cached + block_size <= max_cached_bytes_) {
+                free_list_[block_size].push_back(buffer);
+                statistics_.bytes_cached += block_size;
+            } else {
+                buffer_to_free = buffer;
+            }
+        }
+    }
+    if (buffer_to_free) cv::fastFree(buffer_to_free);
+}
+
+void PooledMatAllocator::SetMaxCachedBytes(size_t max_cached_bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_cached_bytes_ = max_cached_bytes;
+}
+
+PooledMatAllocator::Statistics PooledMatAllocator::GetStatistics(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+void PooledMatAllocator::ResetStatistics(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics_.hit_num = 0;
+    statistics_.miss_num = 0;
+    statistics_.bytes_in_use_peak = statistics_.bytes_in_use;
+}
+
+void PooledMatAllocator::Trim(void)
+{
+    std::map<size_t, std::vector<void*>> free_list;
+    std::vector<void*> free_header_list;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_list.swap(free_list_);
+        free_header_list.swap(free_header_list_);
+        statistics_.bytes_cached = 0;
+    }
+    for (auto& item : free_list) {
+        for (void* buffer : item.second) cv::fastFree(buffer);
+    }
+    for (void* header : free_header_list) ::operator delete(header);
+}
@@ -0,0 +1,75 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef POOLED_MAT_ALLOCATOR_
+#define POOLED_MAT_ALLOCATOR_
+
+/* for general */
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <mutex>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * cv::MatAllocator which recycles buffers of cv::Mat
+ *   - Buffer sizes are rounded up to size classes (256 x 2^n and 1.5x of them), and released buffers are kept per class
+ *   - UMatData headers are recycled as well, so that a frame loop in steady state doesn't call malloc
+ *   - Install with cv::Mat::setDefaultAllocator(&PooledMatAllocator::GetInstance()). OpenCV has one default allocator
+ *     for the process, so it is used by all threads
+ *   - The instance is never destroyed, because a cv::Mat may be released after main returns
+ */
+class PooledMatAllocator : public cv::MatAllocator {
+public:
+    typedef struct Statistics_ {
+        uint64_t hit_num;               // allocations served from the pool
+        uint64_t miss_num;              // allocations which called malloc
+        uint64_t bytes_in_use;          // [byte] in the size class
+        uint64_t bytes_in_use_peak;
+        uint64_t bytes_cached;          // [byte] kept in the pool
+        Statistics_() : hit_num(0), miss_num(0), bytes_in_use(0), bytes_in_use_peak(0), bytes_cached(0)
+        {}
+    } Statistics;
+
+public:
+    static PooledMatAllocator& GetInstance(void);
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    /* Buffers are freed instead of being kept once the cached size exceeds this */
+    void SetMaxCachedBytes(size_t max_cached_bytes);
+    Statistics GetStatistics(void) const;
+    void ResetStatistics(void);
+    /* Free all the cached buffers */
+    void Trim(void);
+
+private:
+    PooledMatAllocator() : max_cached_bytes_(static_cast<size_t>(512) * 1024 * 1024) {}
+    ~PooledMatAllocator() override {}
+    static size_t RoundUpToSizeClass(size_t size);
+
+private:
+    mutable std::mutex mutex_;
+    mutable std::map<size_t, std::vector<void*>> free_list_;   /* key = size class */
+    mutable std::vector<void*> free_header_list_;               /* storage for UMatData */
+    mutable Statistics statistics_;
+    size_t max_cached_bytes_;
+};
+
+#endif
@@ -0,0 +1,550 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "shm_frame_ring.h"
+#include "depth_codec.h"
+
+/*** Macro ***/
+#define TAG "ShmFrameRing"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Retry when the latest slot is being written (the publisher has just started the next frame) */
+static constexpr int32_t kReadRetryNum = 3;
+
+using namespace ShmFrameFormat;
+
+/* The layout is shared with other processes (and other builds) */
+static_assert(sizeof(Header) == 64, "Invalid layout");
+static_assert(sizeof(StreamHeader) == 128, "Invalid layout");
+static_assert(sizeof(SlotHeader) == 64, "Invalid layout");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "Atomics in shared memory must be lock free");
+
+/*** Function ***/
+static uint64_t Align(uint64_t value)
+{
+    return (value + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+#ifdef _WIN32
+/* "/depth" -> "Local\depth" */
+static std::string CreateMappingName(const std::string& shm_name)
+{
+    return "Local\\" + ((!shm_name.empty() && shm_name[0] == '/') ? shm_name.substr(1) : shm_name);
+}
+#endif
+
+
+ShmFramePublisher::ShmFramePublisher()
+    : mapped_data_(nullptr), mapped_size_(0)
+#ifdef _WIN32
+    , handle_mapping_(nullptr)
+#else
+    , fd_(-1)
+#endif
+{
+}
+
+ShmFramePublisher::~ShmFramePublisher()
+{
+    Close();
+}
+
+int32_t ShmFramePublisher::Open(const std::string& shm_name, const std::vector<StreamConfig>& stream_config_list, int32_t permission)
+{
+    if (mapped_data_) {
+        PRINT_E("Already opened\n");
+        return kRetErr;
+    }
+    if (stream_config_list.empty()) {
+        PRINT_E("No stream\n");
+        return kRetErr;
+    }
+
+    /* Layout */
+    std::vector<StreamHeader> stream_header_list(stream_config_list.size());
+    uint64_t offset = Align(sizeof(Header) + sizeof(StreamHeader) * stream_config_list.size());
+    for (size_t i = 0; i < stream_config_list.size(); i++) {
+        const StreamConfig& config = stream_config_list[i];
+        if (config.name.empty() || config.name.size() >= kStreamNameLength || config.capacity == 0 || config.slot_num < 2
+            || (config.compression != kCompressionNone && config.compression != kCompressionRvl)) {
+            PRINT_E("Invalid stream config: %s\n", config.name.c_str());
+            return kRetErr;
+        }
+        StreamHeader& stream_header = stream_header_list[i];
+        memset(stream_header.name, 0, sizeof(stream_header.name));
+        memcpy(stream_header.name, config.name.c_str(), config.name.size());
+        stream_header.slot_num = static_cast<uint32_t>(config.slot_num);
+        stream_header.slot_offset = offset;
+        stream_header.slot_stride = sizeof(SlotHeader) + Align(config.capacity);
+        stream_header.payload_capacity = config.capacity;
+        offset += stream_header.slot_stride * stream_header.slot_num;
+    }
+    const uint64_t total_size = offset;
+
+#ifdef _WIN32
+    (void)permission;
+    handle_mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(total_size >> 32), static_cast<DWORD>(total_size & 0xFFFFFFFF), CreateMappingName(shm_name).c_str());
+    if (!handle_mapping_ || GetLastError() == ERROR_ALREADY_EXISTS) {
+        /* The named memory lives while any handle is open, so it can't be replaced under the readers */
+        PRINT_E("Unable to create %s (already exists?)\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    mapped_data_ = static_cast<uint8_t*>(MapViewOfFile(handle_mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    if (!mapped_data_) {
+        PRINT_E("Unable to map %s\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+#else
+    /* A new object every time. Readers of the previous one (e.g. the process crashed) keep their mapping until they open again */
+    shm_unlink(shm_name.c_str());
+    fd_ = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, static_cast<mode_t>(permission));
+    if (fd_ < 0) {
+        PRINT_E("Unable to create %s\n", shm_name.c_str());
+        return kRetErr;
+    }
+    shm_name_ = shm_name;
+    if (ftruncate(fd_, static_cast<off_t>(total_size)) != 0) {
+        PRINT_E("Unable to allocate %llu bytes for %s\n", static_cast<unsigned long long>(total_size), shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(total_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        PRINT_E("Unable to map %s\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    mapped_data_ = static_cast<uint8_t*>(p);
+#endif
+    mapped_size_ = total_size;
+
+    /* The memory is zero filled. Magic is written last, so that a reader doesn't see a partial header */
+    Header* header = reinterpret_cast<Header*>(mapped_data_);
+    header->version = kVersion;
+    header->stream_num = static_cast<uint32_t>(stream_config_list.size());
+    header->total_size = total_size;
+    StreamHeader* stream_header_dst = reinterpret_cast<StreamHeader*>(mapped_data_ + sizeof(Header));
+    for (size_t i = 0; i < stream_header_list.size(); i++) {
+        memcpy(stream_header_dst[i].name, stream_header_list[i].name, sizeof(stream_header_list[i].name));
+        stream_header_dst[i].slot_num = stream_header_list[i].slot_num;
+        stream_header_dst[i].slot_offset = stream_header_list[i].slot_offset;
+        stream_header_dst[i].slot_stride = stream_header_list[i].slot_stride;
+        stream_header_dst[i].payload_capacity = stream_header_list[i].payload_capacity;
+        stream_name_list_.push_back(stream_config_list[i].name);
+        stream_compression_list_.push_back(stream_config_list[i].compression);
+    }
+    is_writing_list_.assign(stream_config_list.size(), false);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, kMagic, sizeof(kMagic));
+
+    PRINT("Opened %s (%.1f MB)\n", shm_name.c_str(), total_size / 1024.0 / 1024.0);
+    return kRetOk;
+}
+
+int32_t ShmFramePublisher::Close(void)
+{
+    if (!mapped_data_) {
+        Unmap();
+        return kRetOk;
+    }
+    reinterpret_cast<Header*>(mapped_data_)->is_closed.store(1, std::memory_order_release);
+    Unmap();
+    return kRetOk;
+}
+
+void ShmFramePublisher::Unmap(void)
+{
+#ifdef _WIN32
+    if (mapped_data_) UnmapViewOfFile(mapped_data_);
+    if (handle_mapping_) CloseHandle(handle_mapping_);
+    handle_mapping_ = nullptr;
+#else
+    if (mapped_data_) munmap(mapped_data_, static_cast<size_t>(mapped_size_));
+    if (fd_ >= 0) close(fd_);
+    if (!shm_name_.empty()) shm_unlink(shm_name_.c_str());
+    fd_ = -1;
+#endif
+    mapped_data_ = nullptr;
+    mapped_size_ = 0;
+    shm_name_.clear();
+    stream_name_list_.clear();
+    stream_compression_list_.clear();
+    is_writing_list_.clear();
+}
+
+int32_t ShmFramePublisher::GetStreamId(const std::string& name) const
+{
+    for (size_t i = 0; i < stream_name_list_.size(); i++) {
+        if (stream_name_list_[i] == name) return static_cast<int32_t>(i);
+    }
+    return kRetErr;
+}
+
+StreamHeader* ShmFramePublisher::GetStreamHeader(int32_t stream_id) const
+{
+    if (!mapped_data_ || stream_id < 0 || stream_id >= static_cast<int32_t>(stream_name_list_.size())) return nullptr;
+    return reinterpret_cast<StreamHeader*>(mapped_data_ + sizeof(Header)) + stream_id;
+}
+
+SlotHeader* ShmFramePublisher::GetSlotHeader(int32_t stream_id, uint64_t write_index) const
+{
+    StreamHeader* stream_header = GetStreamHeader(stream_id);
+    return reinterpret_cast<SlotHeader*>(mapped_data_ + stream_header->slot_offset + stream_header->slot_stride * (write_index % stream_header->slot_num));
+}
+
+int32_t ShmFramePublisher::BeginWrite(int32_t stream_id, int32_t rows, int32_t cols, int32_t type, cv::Mat& mat)
+{
+    StreamHeader* stream_header = GetStreamHeader(stream_id);
+    if (!stream_header || is_writing_list_[stream_id]) {
+        PRINT_E("Invalid stream id or not finished: %d\n", stream_id);
+        return kRetErr;
+    }
+    const uint64_t payload_size = static_cast<uint64_t>(rows) * cols * CV_ELEM_SIZE(type);
+    if (rows <= 0 || cols <= 0 || payload_size > stream_header->payload_capacity) {
+        PRINT_E("Frame is larger than the slot: %s %dx%d\n", stream_name_list_[stream_id].c_str(), cols, rows);
+        return kRetErr;
+    }
+
+    const uint64_t write_index = stream_header->write_count.load(std::memory_order_relaxed);
+    SlotHeader* slot_header = GetSlotHeader(stream_id, write_index);
+    const uint64_t sequence = slot_header->sequence.load(std::memory_order_relaxed);
+    slot_header->sequence.store(sequence + 1, std::memory_order_relaxed);     /* odd: being written */
+    std::atomic_thread_fence(std::memory_order_release);
+    slot_header->write_index = write_index;
+    slot_header->rows = rows;
+    slot_header->cols = cols;
+    slot_header->type = type;
+    slot_header->step = static_cast<uint32_t>(cols * CV_ELEM_SIZE(type));
+    slot_header->payload_size = payload_size;
+    slot_header->compression = kCompressionNone;
+    mat = cv::Mat(rows, cols, type, reinterpret_cast<uint8_t*>(slot_header) + sizeof(SlotHeader));
+    is_writing_list_[stream_id] = true;
+    return kRetOk;
+}
+
+int32_t ShmFramePublisher::EndWrite(int32_t stream_id, int64_t timestamp_us, int64_t sequence_num)
+{
+    StreamHeader* stream_header = GetStreamHeader(stream_id);
+    if (!stream_header || !is_writing_list_[stream_id]) {
+        PRINT_E("Invalid stream id or not started: %d\n", stream_id);
+        return kRetErr;
+    }
+    const uint64_t write_index = stream_header->write_count.load(std::memory_order_relaxed);
+    SlotHeader* slot_header = GetSlotHeader(stream_id, write_index);
+    slot_header->timestamp_us = timestamp_us;
+    slot_header->sequence_num = sequence_num;
+    const uint64_t sequence = slot_header->sequence.load(std::memory_order_relaxed);
+    slot_header->sequence.store(sequence + 1, std::memory_order_release);     /* even: done */
+    stream_header->write_count.store(write_index + 1, std::memory_order_release);
+    is_writing_list_[stream_id] = false;
+    return kRetOk;
+}
+
+int32_t ShmFramePublisher::Write(int32_t stream_id, const cv::Mat& mat, int64_t timestamp_us, int64_t sequence_num)
+{
+    cv::Mat mat_slot;
+    if (BeginWrite(stream_id, mat.rows, mat.cols, mat.type(), mat_slot) != kRetOk) return kRetErr;
+    bool is_encoded = false;
+    if (stream_compression_list_[stream_id] == kCompressionRvl && DepthCodec::IsSupported(mat.type())) {
+        /* Encode into the slot. Keep the raw image if it doesn't get smaller */
+        SlotHeader* slot_header = GetSlotHeader(stream_id, GetStreamHeader(stream_id)->write_count.load(std::memory_order_relaxed));
+        size_t encoded_size = 0;
+        if (DepthCodec::Encode(mat, mat_slot.data, static_cast<size_t>(slot_header->payload_size), encoded_size) == DepthCodec::kRetOk
+            && encoded_size < slot_header->payload_size) {
+            slot_header->payload_size = encoded_size;
+            slot_header->compression = kCompressionRvl;
+            is_encoded = true;
+        }
+    }
+    if (!is_encoded) {
+        mat.copyTo(mat_slot);
+    }
+    return EndWrite(stream_id, timestamp_us, sequence_num);
+}
+
+
+ShmFrameReader::ShmFrameReader()
+    : mapped_data_(nullptr), mapped_size_(0)
+#ifdef _WIN32
+    , handle_mapping_(nullptr)
+#else
+    , fd_(-1)
+#endif
+{
+}
+
+ShmFrameReader::~ShmFrameReader()
+{
+    Close();
+}
+
+int32_t ShmFrameReader::Open(const std::string& shm_name)
+{
+    Close();
+#ifdef _WIN32
+    handle_mapping_ = OpenFileMappingA(FILE_MAP_READ, FALSE, CreateMappingName(shm_name).c_str());
+    if (!handle_mapping_) {
+        PRINT_E("Unable to open %s\n", shm_name.c_str());
+        return kRetErr;
+    }
+    mapped_data_ = static_cast<const uint8_t*>(MapViewOfFile(handle_mapping_, FILE_MAP_READ, 0, 0, 0));
+    MEMORY_BASIC_INFORMATION memory_info;
+    if (!mapped_data_ || VirtualQuery(mapped_data_, &memory_info, sizeof(memory_info)) == 0) {
+        PRINT_E("Unable to map %s\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    mapped_size_ = static_cast<uint64_t>(memory_info.RegionSize);
+#else
+    fd_ = shm_open(shm_name.c_str(), O_RDONLY, 0);
+    if (fd_ < 0) {
+        PRINT_E("Unable to open %s\n", shm_name.c_str());
+        return kRetErr;
+    }
+    struct stat shm_stat;
+    if (fstat(fd_, &shm_stat) != 0 || static_cast<uint64_t>(shm_stat.st_size) < sizeof(Header)) {
+        PRINT_E("Invalid size: %s\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(shm_stat.st_size), PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        PRINT_E("Unable to map %s\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    mapped_data_ = static_cast<const uint8_t*>(p);
+    mapped_size_ = static_cast<uint64_t>(shm_stat.st_size);
+#endif
+
+    /* Validate the layout, so that a broken publisher doesn't make the reader access out of the memory */
+    const Header* header = reinterpret_cast<const Header*>(mapped_data_);
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) {
+        PRINT_E("Not initialized or not a frame ring: %s\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->version != kVersion || header->total_size > mapped_size_ || header->stream_num == 0
+        || sizeof(Header) + sizeof(StreamHeader) * static_cast<uint64_t>(header->stream_num) > header->total_size) {
+        PRINT_E("Invalid header: %s\n", shm_name.c_str());
+        Unmap();
+        return kRetErr;
+    }
+    const StreamHeader* stream_header_list = reinterpret_cast<const StreamHeader*>(mapped_data_ + sizeof(Header));
+    for (uint32_t i = 0; i < header->stream_num; i++) {
+        const StreamHeader& stream_header = stream_header_list[i];
+        if (stream_header.slot_num == 0 || stream_header.slot_offset % kAlignment != 0
+            || stream_header.payload_capacity + sizeof(SlotHeader) > stream_header.slot_stride
+            || stream_header.slot_offset + stream_header.slot_stride * stream_header.slot_num > header->total_size) {
+            PRINT_E("Invalid stream header: %s [%u]\n", shm_name.c_str(), i);
+            Unmap();
+            return kRetErr;
+        }
+        char name[kStreamNameLength];
+        memcpy(name, stream_header.name, sizeof(name));
+        name[kStreamNameLength - 1] = '\0';
+        stream_name_list_.push_back(name);
+    }
+    return kRetOk;
+}
+
+int32_t ShmFrameReader::Close(void)
+{
+    Unmap();
+    return kRetOk;
+}
+
+void ShmFrameReader::Unmap(void)
+{
+#ifdef _WIN32
+    if (mapped_data_) UnmapViewOfFile(mapped_data_);
+    if (handle_mapping_) CloseHandle(handle_mapping_);
+    handle_mapping_ = nullptr;
+#else
+    if (mapped_data_) munmap(const_cast<uint8_t*>(mapped_data_), static_cast<size_t>(mapped_size_));
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+#endif
+    mapped_data_ = nullptr;
+    mapped_size_ = 0;
+    stream_name_list_.clear();
+}
+
+bool ShmFrameReader::IsClosed(void) const
+{
+    if (!mapped_data_) return true;
+    return reinterpret_cast<const Header*>(mapped_data_)->is_closed.load(std::memory_order_acquire) != 0;
+}
+
+int32_t ShmFrameReader::GetStreamId(const std::string& name) const
+{
+    for (size_t i = 0; i < stream_name_list_.size(); i++) {
+        if (stream_name_list_[i] == name) return static_cast<int32_t>(i);
+    }
+    return kRetErr;
+}
+
+int32_t ShmFrameReader::GetStreamNum(void) const
+{
+    return static_cast<int32_t>(stream_name_list_.size());
+}
+
+const std::string& ShmFrameReader::GetStreamName(int32_t stream_id) const
+{
+    static const std::string kEmpty;
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(stream_name_list_.size())) return kEmpty;
+    return stream_name_list_[stream_id];
+}
+
+const StreamHeader* ShmFrameReader::GetStreamHeader(int32_t stream_id) const
+{
+    if (!mapped_data_ || stream_id < 0 || stream_id >= static_cast<int32_t>(stream_name_list_.size())) return nullptr;
+    return reinterpret_cast<const StreamHeader*>(mapped_data_ + sizeof(Header)) + stream_id;
+}
+
+const SlotHeader* ShmFrameReader::GetSlotHeader(int32_t stream_id, uint64_t write_index) const
+{
+    const StreamHeader* stream_header = GetStreamHeader(stream_id);
+    return reinterpret_cast<const SlotHeader*>(mapped_data_ + stream_header->slot_offset + stream_header->slot_stride * (write_index % stream_header->slot_num));
+}
+
+uint64_t ShmFrameReader::GetWriteCount(int32_t stream_id) const
+{
+    const StreamHeader* stream_header = GetStreamHeader(stream_id);
+    if (!stream_header) return 0;
+    return stream_header->write_count.load(std::memory_order_acquire);
+}
+
+int32_t ShmFrameReader::GetLatest(int32_t stream_id, Frame& frame) const
+{
+    for (int32_t i = 0; i < kReadRetryNum; i++) {
+        const uint64_t write_count = GetWriteCount(stream_id);
+        if (write_count == 0) return kRetErr;
+        if (Get(stream_id, write_count - 1, frame) == kRetOk) return kRetOk;
+    }
+    return kRetErr;
+}
+
+int32_t ShmFrameReader::Get(int32_t stream_id, uint64_t write_index, Frame& frame) const
+{
+    const StreamHeader* stream_header = GetStreamHeader(stream_id);
+    if (!stream_header) return kRetErr;
+    const uint64_t write_count = stream_header->write_count.load(std::memory_order_acquire);
+    if (write_index >= write_count || write_index + stream_header->slot_num < write_count) {
+        return kRetErr;     /* not yet, or already overwritten */
+    }
+
+    /* Seqlock: copy the header, and use it only if the sequence didn't change */
+    const SlotHeader* slot_header = GetSlotHeader(stream_id, write_index);
+    const uint64_t sequence = slot_header->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) return kRetErr;
+    const uint64_t slot_write_index = slot_header->write_index;
+    const int64_t sequence_num = slot_header->sequence_num;
+    const int64_t timestamp_us = slot_header->timestamp_us;
+    const int32_t rows = slot_header->rows;
+    const int32_t cols = slot_header->cols;
+    const int32_t type = slot_header->type;
+    const uint32_t step = slot_header->step;
+    const uint64_t payload_size = slot_header->payload_size;
+    const uint32_t compression = slot_header->compression;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot_header->sequence.load(std::memory_order_relaxed) != sequence || slot_write_index != write_index) {
+        return kRetErr;
+    }
+    if (rows <= 0 || cols <= 0 || type < 0 || type != CV_MAT_TYPE(type) || step < static_cast<uint64_t>(cols) * CV_ELEM_SIZE(type)
+        || static_cast<uint64_t>(step) * rows > stream_header->payload_capacity || payload_size > stream_header->payload_capacity
+        || (compression != kCompressionNone && compression != kCompressionRvl)) {
+        PRINT_E("Invalid frame: %s [%llu]\n", GetStreamName(stream_id).c_str(), static_cast<unsigned long long>(write_index));
+        return kRetErr;
+    }
+
+    /* cv::Mat needs non-const data. The memory is mapped read only, so writing to it crashes */
+    uint8_t* payload = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(slot_header) + sizeof(SlotHeader));
+    if (compression == kCompressionRvl) {
+        cv::Mat mat;
+        const int32_t ret = DepthCodec::Decode(payload, static_cast<size_t>(payload_size), rows, cols, type, mat);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot_header->sequence.load(std::memory_order_relaxed) != sequence) {
+            return kRetErr;     /* overwritten while decoding */
+        }
+        if (ret != DepthCodec::kRetOk) {
+            PRINT_E("Broken frame: %s [%llu]\n", GetStreamName(stream_id).c_str(), static_cast<unsigned long long>(write_index));
+            return kRetErr;
+        }
+        frame.mat = mat;
+    } else {
+        frame.mat = cv::Mat(rows, cols, type, payload, step);
+    }
+    frame.timestamp_us = timestamp_us;
+    frame.sequence_num = sequence_num;
+    frame.write_index = write_index;
+    frame.stream_id = stream_id;
+    frame.compression = compression;
+    frame.slot_sequence = sequence;
+    return kRetOk;
+}
+
+bool ShmFrameReader::IsValid(const Frame& frame) const
+{
+    if (frame.compression != kCompressionNone) return !frame.mat.empty();
+    if (!GetStreamHeader(frame.stream_id)) return false;
+    const SlotHeader* slot_header = GetSlotHeader(frame.stream_id, frame.write_index);
+    /* the reads of the payload happen before checking the sequence */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot_header->sequence.load(std::memory_order_relaxed) == frame.slot_sequence;
+}
+
+int32_t ShmFrameReader::Copy(const Frame& frame, cv::Mat& dst) const
+{
+    if (frame.mat.empty()) return kRetErr;
+    if (frame.compression != kCompressionNone) {
+        dst = frame.mat;    /* already a copy */
+        return kRetOk;
+    }
+    cv::Mat mat_copy = frame.mat.clone();
+    if (!IsValid(frame)) return kRetErr;    /* overwritten while copying */
+    dst = mat_copy;
+    return kRetOk;
+}
@@ -0,0 +1,190 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef SHM_FRAME_RING_
+#define SHM_FRAME_RING_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Shared memory ring to pass frames to other processes without serialization
+ *   [Header][StreamHeader]...[StreamHeader][Slot]...[Slot]    Slot = SlotHeader + payload (aligned to kAlignment)
+ *   - Each stream has fixed slots. The publisher overwrites the oldest slot, and never waits for readers
+ *   - Each slot is protected by a seqlock: the sequence is odd while the slot is being written.
+ *     Readers don't write to the shared memory, so any number of readers can map it read only
+ *   - Frames are returned as cv::Mat views of the shared memory. A view is overwritten when the publisher
+ *     goes around the ring, so check IsValid after using it (or use Copy)
+ *   - Streams of 8-bit / 16-bit depth can be compressed losslessly (DepthCodec) to save the memory bandwidth.
+ *     Readers get a decoded copy for such frames
+ *   - One publisher per shared memory. Timestamps are of std::chrono::steady_clock (CLOCK_MONOTONIC on Linux)
+ */
+namespace ShmFrameFormat
+{
+static constexpr char kMagic[8] = { 'D', 'A', 'I', 'S', 'H', 'M', '0', '1' };
+static constexpr uint32_t kVersion = 2;      /* 2: compression */
+static constexpr uint64_t kAlignment = 64;
+static constexpr int32_t kStreamNameLength = 56;
+static constexpr uint32_t kCompressionNone = 0;
+static constexpr uint32_t kCompressionRvl = 1;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t stream_num;
+    uint64_t total_size;                // [byte]
+    std::atomic<uint32_t> is_closed;    // set at Close of the publisher. Readers should open again
+    uint8_t  reserved[36];
+} Header;
+
+typedef struct {
+    char     name[kStreamNameLength];
+    uint32_t slot_num;
+    uint32_t reserved0;
+    uint64_t slot_offset;               // [byte] offset of the first slot from the beginning of the shared memory
+    uint64_t slot_stride;               // [byte] SlotHeader + payload capacity
+    uint64_t payload_capacity;          // [byte]
+    std::atomic<uint64_t> write_count;  // number of frames published. frame[i] is in slot[i % slot_num]
+    uint8_t  reserved[32];
+} StreamHeader;
+
+typedef struct {
+    std::atomic<uint64_t> sequence;     // seqlock. odd while being written
+    uint64_t write_index;               // index of the frame in the stream (write_count - 1 at the time)
+    int64_t  sequence_num;
+    int64_t  timestamp_us;
+    int32_t  rows;
+    int32_t  cols;
+    int32_t  type;                      // cv::Mat::type()
+    uint32_t step;                      // [byte]
+    uint64_t payload_size;              // [byte] compressed size if compressed
+    uint32_t compression;               // kCompressionXxx
+    uint8_t  reserved[4];
+} SlotHeader;
+}
+
+class ShmFramePublisher {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct StreamConfig_ {
+        std::string name;
+        size_t      capacity;       // [byte] maximum size of a frame (before compression)
+        int32_t     slot_num;       // readers have (slot_num - 1) frame periods to use a view
+        uint32_t    compression;    // kCompressionRvl for depth (CV_16UC1 / CV_8UC1). Used by Write only
+        StreamConfig_(const std::string& _name = "", size_t _capacity = 0, int32_t _slot_num = 4, uint32_t _compression = ShmFrameFormat::kCompressionNone)
+            : name(_name), capacity(_capacity), slot_num(_slot_num), compression(_compression)
+        {}
+    } StreamConfig;
+
+public:
+    ShmFramePublisher();
+    ~ShmFramePublisher();
+    /* shm_name: e.g. "/depth". permission is for POSIX (0600 = the same user only) */
+    int32_t Open(const std::string& shm_name, const std::vector<StreamConfig>& stream_config_list, int32_t permission = 0600);
+    int32_t Close(void);
+    bool IsOpened(void) const { return mapped_data_ != nullptr; }
+    int32_t GetStreamId(const std::string& name) const;
+    /* Write a frame into the slot directly (not compressed). mat is a view of the slot, which is valid until EndWrite */
+    int32_t BeginWrite(int32_t stream_id, int32_t rows, int32_t cols, int32_t type, cv::Mat& mat);
+    int32_t EndWrite(int32_t stream_id, int64_t timestamp_us, int64_t sequence_num);
+    /* BeginWrite + copy (or encode) + EndWrite */
+    int32_t Write(int32_t stream_id, const cv::Mat& mat, int64_t timestamp_us, int64_t sequence_num);
+
+private:
+    ShmFrameFormat::StreamHeader* GetStreamHeader(int32_t stream_id) const;
+    ShmFrameFormat::SlotHeader* GetSlotHeader(int32_t stream_id, uint64_t write_index) const;
+    void Unmap(void);
+
+private:
+    uint8_t* mapped_data_;
+    uint64_t mapped_size_;
+    std::string shm_name_;
+#ifdef _WIN32
+    void* handle_mapping_;
+#else
+    int32_t fd_;
+#endif
+    std::vector<std::string> stream_name_list_;
+    std::vector<uint32_t> stream_compression_list_;
+    std::vector<bool> is_writing_list_;
+};
+
+
+class ShmFrameReader {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct Frame_ {
+        cv::Mat  mat;               // read only view of the shared memory. do not use it after Close (decoded copy if compressed)
+        int64_t  timestamp_us;
+        int64_t  sequence_num;
+        uint64_t write_index;       // index in the stream. write_index + 1 is the next frame
+        int32_t  stream_id;
+        uint32_t compression;
+        uint64_t slot_sequence;     // for IsValid
+        Frame_() : timestamp_us(0), sequence_num(0), write_index(0), stream_id(-1), compression(ShmFrameFormat::kCompressionNone), slot_sequence(0)
+        {}
+    } Frame;
+
+public:
+    ShmFrameReader();
+    ~ShmFrameReader();
+    int32_t Open(const std::string& shm_name);
+    int32_t Close(void);
+    /* The publisher has closed (or restarted). Open again to follow the new one */
+    bool IsClosed(void) const;
+    int32_t GetStreamId(const std::string& name) const;
+    int32_t GetStreamNum(void) const;
+    const std::string& GetStreamName(int32_t stream_id) const;
+    /* Number of frames published to the stream so far */
+    uint64_t GetWriteCount(int32_t stream_id) const;
+    /* View of the latest frame. kRetErr if no frame or the slot is being written */
+    int32_t GetLatest(int32_t stream_id, Frame& frame) const;
+    /* View of the frame[write_index]. kRetErr if not published yet or already overwritten */
+    int32_t Get(int32_t stream_id, uint64_t write_index, Frame& frame) const;
+    /* The view has not been overwritten since Get. Call after using frame.mat. Always true for a decoded copy */
+    bool IsValid(const Frame& frame) const;
+    /* Copy the view to dst, which is valid after the slot is overwritten */
+    int32_t Copy(const Frame& frame, cv::Mat& dst) const;
+
+private:
+    const ShmFrameFormat::StreamHeader* GetStreamHeader(int32_t stream_id) const;
+    const ShmFrameFormat::SlotHeader* GetSlotHeader(int32_t stream_id, uint64_t write_index) const;
+    void Unmap(void);
+
+private:
+    const uint8_t* mapped_data_;
+    uint64_t mapped_size_;
+#ifdef _WIN32
+    void* handle_mapping_;
+#else
+    int32_t fd_;
+#endif
+    std::vector<std::string> stream_name_list_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "common_helper.h"
+#include "stage_scheduler.h"
+
+/*** Macro ***/
+#define TAG "StageScheduler"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Decay of an estimate per frame while it is not measured (0.95^14 = 0.5) */
+static constexpr double kCostDecay = 0.95;
+
+static const char* kDecisionName[] = { "run", "downscale", "skip" };
+
+/*** Function ***/
+int32_t StageScheduler::AddStage(const std::string& name, bool has_downscale, int32_t max_skip_num)
+{
+    Stage stage;
+    stage.name = name;
+    stage.has_downscale = has_downscale;
+    stage.max_skip_num = max_skip_num;
+    stage_list_.push_back(stage);
+    return static_cast<int32_t>(stage_list_.size()) - 1;
+}
+
+void StageScheduler::BeginFrame(void)
+{
+    time_frame_begin_ = std::chrono::steady_clock::now();
+    frame_cnt_++;
+    for (auto& stage : stage_list_) stage.is_required = true;
+}
+
+void StageScheduler::SetRequired(int32_t stage_id, bool is_required)
+{
+    if (stage_id < 0 || stage_id >= static_cast<int32_t>(stage_list_.size())) {
+        PRINT_E("Invalid stage id: %d\n", stage_id);
+        return;
+    }
+    stage_list_[stage_id].is_required = is_required;
+}
+
+StageScheduler::Decision StageScheduler::Decide(int32_t stage_id)
+{
+    if (stage_id < 0 || stage_id >= static_cast<int32_t>(stage_list_.size())) {
+        PRINT_E("Invalid stage id: %d\n", stage_id);
+        return kDecisionRun;
+    }
+    Stage& stage = stage_list_[stage_id];
+    if (!stage.is_required) {
+        /* Not a skip by the budget. The last result is reused by the caller anyway */
+        stage.count[kDecisionSkip]++;
+        return kDecisionSkip;
+    }
+
+    Decision decision = kDecisionRun;
+    double remaining = 0;
+    if (budget_ms_ > 0) {
+        const double elapsed = static_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - time_frame_begin_).count() * 1000.0;
+        remaining = budget_ms_ - elapsed;
+        /* Reserve the cheapest processing of the following stages, so that a stage doesn't take all the budget */
+        for (size_t i = stage_id + 1; i < stage_list_.size(); i++) {
+            const Stage& s = stage_list_[i];
+            if (!s.is_required) continue;
+            const double cost_min = (s.has_downscale && s.cost[1] >= 0) ? s.cost[1] : s.cost[0];
+            remaining -= (std::max)(cost_min, 0.0);
+        }
+
+        if (stage.cost[0] < 0 || stage.cost[0] <= remaining) {
+            decision = kDecisionRun;            /* includes the first time to measure the cost */
+        } else if (stage.has_downscale && (stage.cost[1] < 0 || stage.cost[1] <= remaining)) {
+            decision = kDecisionDownscale;
+        } else {
+            decision = kDecisionSkip;
+        }
+        if (decision == kDecisionSkip && (!stage.has_result || stage.skip_num >= stage.max_skip_num)) {
+            /* Nothing to reuse, or the result is too old */
+            decision = stage.has_downscale ? kDecisionDownscale : kDecisionRun;
+        }
+
+        /* Estimates which are not measured in this frame decay */
+        if (decision != kDecisionRun && stage.cost[0] >= 0) stage.cost[0] *= kCostDecay;
+        if (decision == kDecisionSkip && stage.cost[1] >= 0) stage.cost[1] *= kCostDecay;
+    }
+
+    stage.count[decision]++;
+    stage.skip_num = (decision == kDecisionSkip) ? stage.skip_num + 1 : 0;
+    if (is_log_enabled_ && decision != kDecisionRun) {
+        PRINT("frame %d: %s -> %s (remaining = %.1f, cost = %.1f / %.1f [msec])\n", frame_cnt_, stage.name.c_str(), kDecisionName[decision], remaining, stage.cost[0], stage.cost[1]);
+    }
+    return decision;
+}
+
+void StageScheduler::Report(int32_t stage_id, Decision decision, double time_ms)
+{
+    if (stage_id < 0 || stage_id >= static_cast<int32_t>(stage_list_.size())) return;
+    if (decision == kDecisionSkip) return;
+    Stage& stage = stage_list_[stage_id];
+    double& cost = stage.cost[(decision == kDecisionDownscale) ? 1 : 0];
+    cost = (cost < 0) ? time_ms : alpha_ * time_ms + (1.0 - alpha_) * cost;
+    stage.has_result = true;
+}
+
+int32_t StageScheduler::GetCount(int32_t stage_id, Decision decision) const
+{
+    if (stage_id < 0 || stage_id >= static_cast<int32_t>(stage_list_.size())) return 0;
+    return stage_list_[stage_id].count[decision];
+}
+
+double StageScheduler::GetCost(int32_t stage_id, Decision decision) const
+{
+    if (stage_id < 0 || stage_id >= static_cast<int32_t>(stage_list_.size())) return 0;
+    if (decision == kDecisionSkip) return 0;
+    return stage_list_[stage_id].cost[(decision == kDecisionDownscale) ? 1 : 0];
+}
+
+void StageScheduler::PrintStatistics(void) const
+{
+    PRINT("budget = %.1f [msec], frame = %d\n", budget_ms_, frame_cnt_);
+    for (const auto& stage : stage_list_) {
+        PRINT("  %-12s run = %d, downscale = %d, skip = %d, cost = %.1f / %.1f [msec]\n", stage.name.c_str(),
+            stage.count[kDecisionRun], stage.count[kDecisionDownscale], stage.count[kDecisionSkip], stage.cost[0], stage.cost[1]);
+    }
+}
@@ -0,0 +1,93 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef STAGE_SCHEDULER_
+#define STAGE_SCHEDULER_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+
+/*
+ * Per-frame scheduler for processing stages with a latency budget
+ *   - Keeps EWMA of the cost of each stage at full and downscaled resolution
+ *   - For each frame, each stage is decided in the order of call to run, downscale, or skip (reuse the last result)
+ *     from the budget left in the frame
+ *   - An estimate which is not measured for a while decays, so that a stage recovers after a load spike
+ *   - A stage which is not required in a frame (e.g. processed every N frames) is skipped, and its cost is not reserved by the stages before it
+ */
+class StageScheduler {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    enum Decision {
+        kDecisionRun = 0,
+        kDecisionDownscale,
+        kDecisionSkip,
+        kDecisionNum,
+    };
+
+private:
+    typedef struct Stage_ {
+        std::string name;
+        bool        has_downscale;
+        int32_t     max_skip_num;               // force to process after this number of skips in a row
+        double      cost[2];                    // [msec] EWMA. [0] = full, [1] = downscaled. negative = not measured yet
+        int32_t     skip_num;                   // skips in a row
+        bool        has_result;
+        bool        is_required;                // in the current frame
+        int32_t     count[kDecisionNum];
+        Stage_() : has_downscale(false), max_skip_num(0), skip_num(0), has_result(false), is_required(true)
+        {
+            cost[0] = cost[1] = -1.0;
+            count[0] = count[1] = count[2] = 0;
+        }
+    } Stage;
+
+public:
+    /* budget_ms <= 0 means no budget (always run) */
+    StageScheduler() : budget_ms_(0), alpha_(0.2), is_log_enabled_(false), frame_cnt_(0) {}
+    ~StageScheduler() {}
+    void SetBudget(double budget_ms) { budget_ms_ = budget_ms; }
+    void SetSmoothing(double alpha) { alpha_ = alpha; }
+    /* Print every decision except run (for debug). Use GetCount or metrics of the caller otherwise */
+    void SetLogEnabled(bool is_log_enabled) { is_log_enabled_ = is_log_enabled; }
+    /* return stage id */
+    int32_t AddStage(const std::string& name, bool has_downscale, int32_t max_skip_num = 5);
+    /* All the stages are required by default in each frame */
+    void BeginFrame(void);
+    /* Call after BeginFrame and before Decide of the stages before it. Decide returns kDecisionSkip for a stage not required */
+    void SetRequired(int32_t stage_id, bool is_required);
+    Decision Decide(int32_t stage_id);
+    /* time_ms: measured cost of the stage with the decision */
+    void Report(int32_t stage_id, Decision decision, double time_ms);
+    int32_t GetCount(int32_t stage_id, Decision decision) const;
+    double GetCost(int32_t stage_id, Decision decision) const;
+    void PrintStatistics(void) const;
+
+private:
+    double budget_ms_;
+    double alpha_;
+    bool is_log_enabled_;
+    int32_t frame_cnt_;
+    std::chrono::steady_clock::time_point time_frame_begin_;
+    std::vector<Stage> stage_list_;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+#include "common_helper.h"
+#include "thread_pool.h"
+#include "cpu_dispatch.h"
+#include "temporal_filter.h"
+
+/*** Macro ***/
+#define TAG "TemporalFilter"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Minimum rows per task of ThreadPool. The kernel is light, so keep small images in one thread */
+static constexpr int32_t kGrainSize = 64;
+
+/*** Function ***/
+int32_t TemporalFilter::Filter(const cv::Mat& mat_src, cv::Mat& mat_dst, float alpha, float reset_ratio, int32_t hole_frame_num)
+{
+    if (mat_src.empty() || mat_src.channels() != 1) {
+        PRINT_E("Invalid image\n");
+        return kRetErr;
+    }
+    const int32_t type = mat_src.type();
+    if (type != CV_8UC1 && type != CV_16UC1 && type != CV_16FC1 && type != CV_32FC1) {
+        PRINT_E("Unsupported type: %d\n", type);
+        return kRetErr;
+    }
+    if (!(alpha > 0.0f && alpha <= 1.0f) || !(reset_ratio >= 0.0f) || hole_frame_num < 0 || hole_frame_num > 255) {
+        PRINT_E("Invalid parameter: alpha = %f, reset_ratio = %f, hole_frame_num = %d\n", alpha, reset_ratio, hole_frame_num);
+        return kRetErr;
+    }
+
+    const cv::Mat* src = &mat_src;
+    if (type != CV_32FC1) {
+        mat_src.convertTo(mat_src_fp_, CV_32FC1);
+        src = &mat_src_fp_;
+    }
+
+    const int32_t width = mat_src.cols;
+    const int32_t height = mat_src.rows;
+    if (mat_history_.rows != height || mat_history_.cols != width) {
+        mat_history_ = cv::Mat::zeros(height, width, CV_32FC1);
+        mat_hole_count_ = cv::Mat::zeros(height, width, CV_8UC1);
+    }
+    mat_dst.create(height, width, CV_32FC1);
+
+    ThreadPool::GetInstance().ParallelFor(0, height, kGrainSize, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            CpuDispatch::TemporalFilter(src->ptr<float>(y), mat_history_.ptr<float>(y), mat_hole_count_.ptr<uint8_t>(y),
+                mat_dst.ptr<float>(y), width, alpha, reset_ratio, hole_frame_num);
+        }
+    });
+
+    return kRetOk;
+}
+
+void TemporalFilter::Reset()
+{
+    mat_history_.release();
+    mat_hole_count_.release();
+}
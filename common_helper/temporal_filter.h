@@ -0,0 +1,58 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef TEMPORAL_FILTER_
+#define TEMPORAL_FILTER_
+
+/* for general */
+#include <cstdint>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Motion aware temporal filter for disparity / depth streams, to suppress flicker frame to frame
+ *   - Each pixel is blended with its history (exponential moving average). The history restarts from the new value
+ *     where the change is larger than reset_ratio, so that moving objects don't leave a trail
+ *   - Invalid pixels (value <= 0) keep the history for hole_frame_num frames, then become invalid
+ *   - The state is one float and one byte per pixel, allocated only when the image size changes.
+ *     The kernel is CpuDispatch::TemporalFilter
+ */
+class TemporalFilter {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+public:
+    TemporalFilter() {}
+    ~TemporalFilter() {}
+    /*
+     * mat_src: CV_8UC1, CV_16UC1, CV_16FC1 or CV_32FC1. The state is reset if the size is different from the previous one
+     * mat_dst: CV_32FC1 (reallocated only if the size is different). Can be the same as mat_src if it's CV_32FC1
+     * alpha: weight of the new value (0.0 - 1.0). Smaller value makes the result more stable but slower to follow
+     * reset_ratio: relative change regarded as motion
+     * hole_frame_num: number of frames to fill a hole with the history (0 - 255)
+     */
+    int32_t Filter(const cv::Mat& mat_src, cv::Mat& mat_dst, float alpha = 0.4f, float reset_ratio = 0.1f, int32_t hole_frame_num = 0);
+    void Reset();
+
+private:
+    cv::Mat mat_src_fp_;
+    cv::Mat mat_history_;       // CV_32FC1
+    cv::Mat mat_hole_count_;    // CV_8UC1
+};
+
+#endif
@@ -0,0 +1,235 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "common_helper.h"
+#include "thread_pool.h"
+
+/*** Macro ***/
+#define TAG "ThreadPool"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Chunks per thread, so that a slow thread doesn't delay the whole range */
+static constexpr int32_t kChunkNumPerThread = 4;
+
+/*** Global variable ***/
+static thread_local bool s_is_worker = false;
+
+/*** Function ***/
+ThreadPool& ThreadPool::GetInstance(void)
+{
+    static ThreadPool instance;
+    return instance;
+}
+
+ThreadPool::~ThreadPool()
+{
+    Finalize();
+}
+
+int32_t ThreadPool::Initialize(int32_t thread_num, const std::vector<int32_t>& cpu_list)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (is_initialized_) {
+        FinalizeWithoutLock(lock);
+    }
+    return InitializeWithoutLock(thread_num, cpu_list);
+}
+
+int32_t ThreadPool::InitializeWithoutLock(int32_t thread_num, const std::vector<int32_t>& cpu_list)
+{
+    if (thread_num <= 0) {
+        thread_num = (std::max)(static_cast<int32_t>(std::thread::hardware_concurrency()), 1);
+    }
+    thread_num_ = thread_num;
+    is_running_ = true;
+    for (int32_t i = 0; i < thread_num - 1; i++) {
+        thread_list_.push_back(std::thread(&ThreadPool::ThreadWorker, this, cpu_list));
+    }
+    is_initialized_ = true;
+    PRINT("thread num = %d, pinned to %d CPUs\n", thread_num_, static_cast<int32_t>(cpu_list.size()));
+    return kRetOk;
+}
+
+void ThreadPool::Finalize(void)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    FinalizeWithoutLock(lock);
+}
+
+void ThreadPool::FinalizeWithoutLock(std::unique_lock<std::mutex>& lock)
+{
+    std::vector<std::thread> thread_list;
+    thread_list.swap(thread_list_);
+    is_running_ = false;
+    cond_.notify_all();
+    lock.unlock();
+    for (auto& thread : thread_list) {
+        if (thread.joinable()) thread.join();
+    }
+    lock.lock();
+    is_initialized_ = false;
+    thread_num_ = 1;
+}
+
+int32_t ThreadPool::GetThreadNum(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return thread_num_;
+}
+
+void ThreadPool::ParallelFor(int32_t begin, int32_t end, int32_t grain_size, const std::function<void(int32_t, int32_t)>& func)
+{
+    const int32_t size = end - begin;
+    if (size <= 0) return;
+    grain_size = (std::max)(grain_size, 1);
+
+    auto job = std::make_shared<Job>();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!is_initialized_) {
+            InitializeWithoutLock(0, std::vector<int32_t>());
+        }
+        if (s_is_worker || thread_num_ <= 1 || size <= grain_size) {
+            job.reset();
+        } else {
+            /* Chunks are decided only from the range, grain size and thread num */
+            const int32_t chunk_num_max = thread_num_ * kChunkNumPerThread;
+            job->chunk_size = (std::max)(grain_size, (size + chunk_num_max - 1) / chunk_num_max);
+            job->chunk_num = (size + job->chunk_size - 1) / job->chunk_size;
+            job->func = &func;
+            job->begin = begin;
+            job->end = end;
+            job_queue_.push_back(job);
+        }
+    }
+    if (!job) {
+        func(begin, end);
+        return;
+    }
+    cond_.notify_all();
+
+    /* The caller works too, and then waits for the chunks taken by the workers */
+    RunChunks(*job);
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->cond.wait(lock, [&job] { return job->chunk_done.load() == job->chunk_num; });
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find(job_queue_.begin(), job_queue_.end(), job);
+    if (it != job_queue_.end()) job_queue_.erase(it);
+}
+
+void ThreadPool::RunChunks(Job& job)
+{
+    while (true) {
+        const int32_t chunk = job.chunk_next.fetch_add(1);
+        if (chunk >= job.chunk_num) break;
+        const int32_t chunk_begin = job.begin + chunk * job.chunk_size;
+        const int32_t chunk_end = (std::min)(chunk_begin + job.chunk_size, job.end);
+        (*job.func)(chunk_begin, chunk_end);
+        if (job.chunk_done.fetch_add(1) + 1 == job.chunk_num) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.cond.notify_all();
+        }
+    }
+}
+
+void ThreadPool::ThreadWorker(std::vector<int32_t> cpu_list)
+{
+    s_is_worker = true;
+    SetThreadAffinity(cpu_list);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cond_.wait(lock, [this] { return !is_running_ || !job_queue_.empty(); });
+        if (!is_running_) break;
+        std::shared_ptr<Job> job = job_queue_.front();
+        lock.unlock();
+        RunChunks(*job);
+        lock.lock();
+        /* All the chunks are taken. The caller is still waiting for the other chunks in process */
+        if (!job_queue_.empty() && job_queue_.front() == job) job_queue_.pop_front();
+    }
+}
+
+int32_t ThreadPool::SetThreadAffinity(const std::vector<int32_t>& cpu_list)
+{
+#if defined(_WIN32)
+    /* A thread starts with the mask of the process. Reset to it when not pinned */
+    DWORD_PTR mask = 0;
+    DWORD_PTR mask_system = 0;
+    if (cpu_list.empty()) {
+        if (GetProcessAffinityMask(GetCurrentProcess(), &mask, &mask_system) == 0) {
+            PRINT_E("Failed to get affinity\n");
+            return kRetErr;
+        }
+    }
+    for (int32_t cpu : cpu_list) {
+        if (cpu < 0 || cpu >= static_cast<int32_t>(sizeof(DWORD_PTR) * 8)) {
+            PRINT_E("Invalid CPU (%d)\n", cpu);
+            return kRetErr;
+        }
+        mask |= (static_cast<DWORD_PTR>(1) << cpu);
+    }
+    if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+        PRINT_E("Failed to set affinity\n");
+        return kRetErr;
+    }
+    return kRetOk;
+#elif defined(__linux__)
+    /* A thread inherits the mask of the creator. Set all the CPUs when not pinned (the kernel drops the CPUs not allowed) */
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (cpu_list.empty()) {
+        for (int32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &cpu_set);
+    }
+    for (int32_t cpu : cpu_list) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            PRINT_E("Invalid CPU (%d)\n", cpu);
+            return kRetErr;
+        }
+        CPU_SET(cpu, &cpu_set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+        PRINT_E("Failed to set affinity\n");
+        return kRetErr;
+    }
+    return kRetOk;
+#else
+    if (cpu_list.empty()) return kRetOk;
+    PRINT_E("CPU affinity is not supported on this platform\n");
+    return kRetErr;
+#endif
+}
@@ -0,0 +1,90 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef THREAD_POOL_
+#define THREAD_POOL_
+
+/* for general */
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+/*
+ * Thread pool shared by the processing helpers in the process
+ *   - ParallelFor splits a range into chunks of at least grain_size items. The caller thread processes chunks too,
+ *     so thread_num threads work on a range in total
+ *   - Runs in the caller when the range is smaller than grain_size, or when called from a worker (nested)
+ *   - Initialize before the first ParallelFor to set the number of threads and CPU affinity.
+ *     Otherwise it is initialized with the number of hardware threads
+ */
+class ThreadPool {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+private:
+    typedef struct Job_ {
+        const std::function<void(int32_t, int32_t)>* func;
+        int32_t begin;
+        int32_t end;
+        int32_t chunk_size;
+        int32_t chunk_num;
+        std::atomic<int32_t> chunk_next;
+        std::atomic<int32_t> chunk_done;
+        std::mutex mutex;
+        std::condition_variable cond;
+        Job_() : func(nullptr), begin(0), end(0), chunk_size(1), chunk_num(0), chunk_next(0), chunk_done(0) {}
+    } Job;
+
+public:
+    static ThreadPool& GetInstance(void);
+    /* thread_num: including the caller of ParallelFor (1 = no worker). cpu_list: CPUs for the workers. empty = all the CPUs */
+    int32_t Initialize(int32_t thread_num, const std::vector<int32_t>& cpu_list = std::vector<int32_t>());
+    void Finalize(void);
+    int32_t GetThreadNum(void);
+    /* func(chunk_begin, chunk_end) is called for each chunk of [begin, end) in parallel. Returns after all the chunks are done */
+    void ParallelFor(int32_t begin, int32_t end, int32_t grain_size, const std::function<void(int32_t, int32_t)>& func);
+
+    /* Pin the calling thread to the CPUs. empty = all the CPUs (undo the mask inherited from the creator) */
+    static int32_t SetThreadAffinity(const std::vector<int32_t>& cpu_list);
+
+private:
+    ThreadPool() : is_initialized_(false), is_running_(false), thread_num_(1) {}
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    int32_t InitializeWithoutLock(int32_t thread_num, const std::vector<int32_t>& cpu_list);
+    void FinalizeWithoutLock(std::unique_lock<std::mutex>& lock);
+    void ThreadWorker(std::vector<int32_t> cpu_list);
+    static void RunChunks(Job& job);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool is_initialized_;
+    bool is_running_;
+    int32_t thread_num_;
+    std::vector<std::thread> thread_list_;
+    std::deque<std::shared_ptr<Job>> job_queue_;
+};
+
+#endif
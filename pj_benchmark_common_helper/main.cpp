@@ -0,0 +1,1830 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*
+ * Golden-output checks and microbenchmarks for the kernels in common_helper
+ *   usage: ./main [check|bench|all] [filter]
+ *          ./main codec recording.rec [filter]
+ *     check : run the checks only. exit code is 1 if any of them fails
+ *     bench : run the benchmarks only
+ *     codec : ratio and speed of DepthCodec on the depth streams of a recording (FrameRecorder)
+ *     filter: run only the items (streams) whose name contains this string
+ *   Run the checks before and after optimizing a kernel. The output must not change
+ *   Kernels of all the ISAs available on the CPU are checked. Set COMMON_HELPER_ISA to benchmark one of them
+ */
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <limits>
+#include <array>
+#include <thread>
+#include <atomic>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper.h"
+#include "common_helper_cv.h"
+#include "mat_ring.h"
+#include "pooled_mat_allocator.h"
+#include "cpu_dispatch.h"
+#include "depth_codec.h"
+#include "frame_recorder.h"
+#include "shm_frame_ring.h"
+#include "temporal_filter.h"
+#include "guided_filter.h"
+#include "depth_alignment.h"
+#include "hole_filling.h"
+#include "depth_roi_stats.h"
+#include "stage_scheduler.h"
+#include "bbox_tracker.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include "depth_sgm_engine.h"
+
+/*** Macro ***/
+#define TAG "main"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Benchmark */
+static constexpr int32_t kWarmupNum = 3;
+static constexpr int32_t kIterationMin = 10;
+static constexpr int32_t kIterationMax = 1000;
+static constexpr double  kTimeMin = 1.0;       /* [sec] per benchmark */
+
+/*** Global variable ***/
+static int32_t s_check_num = 0;
+static int32_t s_fail_num = 0;
+
+/*** Function ***/
+#define EXPECT(cond) do { \
+    s_check_num++; \
+    if (!(cond)) { s_fail_num++; PRINT_E("FAIL: %s (%s:%d)\n", #cond, __FILE__, __LINE__); } \
+} while(0)
+
+#define EXPECT_EQ_INT(expected, actual) do { \
+    s_check_num++; \
+    const int64_t e_ = (expected); const int64_t a_ = (actual); \
+    if (e_ != a_) { s_fail_num++; PRINT_E("FAIL: %s = %lld, expected %lld (%s:%d)\n", #actual, static_cast<long long>(a_), static_cast<long long>(e_), __FILE__, __LINE__); } \
+} while(0)
+
+/* return the number of elements which differ more than tolerance */
+static int32_t CountDiff(const cv::Mat& mat_expected, const cv::Mat& mat_actual, double tolerance = 0)
+{
+    if (mat_expected.size() != mat_actual.size() || mat_expected.type() != mat_actual.type()) {
+        PRINT_E("size or type mismatch: %dx%d (%d) vs %dx%d (%d)\n", mat_expected.cols, mat_expected.rows, mat_expected.type(), mat_actual.cols, mat_actual.rows, mat_actual.type());
+        return -1;
+    }
+    cv::Mat mat_diff;
+    cv::absdiff(mat_expected, mat_actual, mat_diff);
+    mat_diff = mat_diff.reshape(1);
+    return cv::countNonZero(mat_diff > tolerance);
+}
+
+#define EXPECT_MAT(expected, actual, tolerance) do { \
+    s_check_num++; \
+    const int32_t diff_num_ = CountDiff((expected), (actual), (tolerance)); \
+    if (diff_num_ != 0) { s_fail_num++; PRINT_E("FAIL: %s differs at %d elements (%s:%d)\n", #actual, diff_num_, __FILE__, __LINE__); } \
+} while(0)
+
+static cv::Mat CreateRandomImage(int32_t width, int32_t height, int32_t type, double value_min, double value_max, uint64_t seed = 1234)
+{
+    cv::Mat mat(height, width, type);
+    cv::RNG rng(seed);
+    rng.fill(mat, cv::RNG::UNIFORM, value_min, value_max);
+    return mat;
+}
+
+/* Depth-like image: smooth surface with noise and holes (0) */
+static cv::Mat CreateDepthImage(int32_t width, int32_t height, int32_t type, double value_max, uint64_t seed = 1234)
+{
+    cv::Mat mat(height, width, type);
+    cv::RNG rng(seed);
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            double value = value_max * (0.4 + 0.2 * y / height + 0.2 * std::sin(x / 60.0)) + rng.uniform(-2, 3);
+            if ((x / 37 + y / 23) % 7 == 0 || rng.uniform(0, 50) == 0) value = 0;
+            if (type == CV_16UC1) {
+                mat.at<uint16_t>(y, x) = cv::saturate_cast<uint16_t>(value);
+            } else if (type == CV_32FC1) {
+                mat.at<float>(y, x) = static_cast<float>(value);
+            } else {
+                mat.at<uint8_t>(y, x) = cv::saturate_cast<uint8_t>(value);
+            }
+        }
+    }
+    return mat;
+}
+
+/*** Reference implementations (naive and slow. Don't optimize these) ***/
+/* cv::INTER_NEAREST: src = floor(dst / (dst_size / src_size)). The scale is calculated in the same way as OpenCV */
+static cv::Mat RefResizeNearest(const cv::Mat& src, cv::Size dst_size)
+{
+    cv::Mat dst(dst_size, src.type());
+    const double scale_x = 1.0 / (static_cast<double>(dst_size.width) / src.cols);
+    const double scale_y = 1.0 / (static_cast<double>(dst_size.height) / src.rows);
+    const size_t elem_size = src.elemSize();
+    for (int32_t y = 0; y < dst.rows; y++) {
+        const int32_t sy = (std::min)(static_cast<int32_t>(std::floor(y * scale_y)), src.rows - 1);
+        for (int32_t x = 0; x < dst.cols; x++) {
+            const int32_t sx = (std::min)(static_cast<int32_t>(std::floor(x * scale_x)), src.cols - 1);
+            std::memcpy(dst.ptr(y) + x * elem_size, src.ptr(sy) + sx * elem_size, elem_size);
+        }
+    }
+    return dst;
+}
+
+static cv::Mat RefSwapRB(const cv::Mat& src)
+{
+    cv::Mat dst = src.clone();
+    for (int32_t y = 0; y < dst.rows; y++) {
+        for (int32_t x = 0; x < dst.cols; x++) {
+            std::swap(dst.at<cv::Vec3b>(y, x)[0], dst.at<cv::Vec3b>(y, x)[2]);
+        }
+    }
+    return dst;
+}
+
+static cv::Mat RefNormalizeMinMax(const cv::Mat& mat_depth)
+{
+    double depth_min = mat_depth.at<float>(0), depth_max = mat_depth.at<float>(0);
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_depth.total()); i++) {
+        depth_min = (std::min)(depth_min, static_cast<double>(mat_depth.at<float>(i)));
+        depth_max = (std::max)(depth_max, static_cast<double>(mat_depth.at<float>(i)));
+    }
+    cv::Mat mat_out = cv::Mat::zeros(mat_depth.size(), CV_8UC1);
+    if (depth_max <= depth_min) return mat_out;
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_depth.total()); i++) {
+        const double value = 255.0 * (mat_depth.at<float>(i) - depth_min) / (depth_max - depth_min);
+        mat_out.at<uint8_t>(i) = cv::saturate_cast<uint8_t>(value);
+    }
+    return mat_out;
+}
+
+static cv::Mat RefNormalizeDisparity(const cv::Mat& mat_disparity, float max_disparity, float mag)
+{
+    cv::Mat mat_out(mat_disparity.size(), CV_8UC1);
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_disparity.total()); i++) {
+        const float value = mat_disparity.at<float>(i) * (mag * 255.0f / max_disparity);
+        mat_out.at<uint8_t>(i) = static_cast<uint8_t>((std::min)((std::max)(value, 0.0f), 255.0f));
+    }
+    return mat_out;
+}
+
+static cv::Mat RefConvertDisparity2Depth16(const cv::Mat& mat_disparity, float scale)
+{
+    cv::Mat mat_out(mat_disparity.size(), CV_16UC1);
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_disparity.total()); i++) {
+        const uint16_t disparity = mat_disparity.at<uint16_t>(i);
+        const double Z = (disparity > 0) ? static_cast<double>(scale / disparity) : 0.0;
+        mat_out.at<uint16_t>(i) = (Z < 65535.0) ? static_cast<uint16_t>(Z) : 65535;
+    }
+    return mat_out;
+}
+
+static cv::Mat RefConvertDisparity2Depth(const cv::Mat& mat_disparity, float fov, float baseline, float mag)
+{
+    cv::Mat mat_out(mat_disparity.size(), CV_8UC1);
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_disparity.total()); i++) {
+        const float disparity = mat_disparity.at<float>(i);
+        const float Z = (disparity > 0) ? (mag * fov * baseline) / disparity : 256.0f;
+        mat_out.at<uint8_t>(i) = (Z <= 255.0f) ? static_cast<uint8_t>(Z) : 255;
+    }
+    return mat_out;
+}
+
+
+/* Valid pixels in rect (clipped to the image) in ascending order */
+static std::vector<float> RefSortedValidPixel(const cv::Mat& mat_depth, const cv::Rect& rect, float value_min, float value_max)
+{
+    std::vector<float> value_list;
+    const cv::Rect r = rect & cv::Rect(0, 0, mat_depth.cols, mat_depth.rows);
+    cv::Mat mat_float;
+    mat_depth.convertTo(mat_float, CV_32FC1);
+    for (int32_t y = r.y; y < r.y + r.height; y++) {
+        for (int32_t x = r.x; x < r.x + r.width; x++) {
+            const float value = mat_float.at<float>(y, x);
+            if (value >= value_min && value <= value_max) value_list.push_back(value);
+        }
+    }
+    std::sort(value_list.begin(), value_list.end());
+    return value_list;
+}
+
+/* The element at the rank of percentile (the same definition as DepthRoiStats, without the histogram) */
+static float RefPercentile(const std::vector<float>& value_list, float percentile)
+{
+    const int32_t index = static_cast<int32_t>(std::ceil(percentile * value_list.size())) - 1;
+    return value_list[(std::min)((std::max)(index, 0), static_cast<int32_t>(value_list.size()) - 1)];
+}
+
+/* Guided filter with the validity mask, by the window sums of each pixel. The border is cv::BORDER_REFLECT */
+static cv::Mat RefGuidedFilter(const cv::Mat& mat_guide, const cv::Mat& mat_src, int32_t radius, float eps, float value_scale)
+{
+    const int32_t width = mat_src.cols;
+    const int32_t height = mat_src.rows;
+    const auto Reflect = [](int32_t i, int32_t n) { return (i < 0) ? -i - 1 : (i >= n) ? 2 * n - i - 1 : i; };
+    const auto BoxMean = [&](const std::vector<double>& value_list, int32_t x, int32_t y) {
+        double sum = 0;
+        for (int32_t dy = -radius; dy <= radius; dy++) {
+            for (int32_t dx = -radius; dx <= radius; dx++) {
+                sum += value_list[Reflect(y + dy, height) * width + Reflect(x + dx, width)];
+            }
+        }
+        return sum / ((2 * radius + 1) * (2 * radius + 1));
+    };
+
+    cv::Mat mat_src_fp;
+    mat_src.convertTo(mat_src_fp, CV_32FC1);
+    std::vector<double> I(width * height), m(width * height), p(width * height), im(width * height), iim(width * height), ip(width * height);
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            const int32_t i = y * width + x;
+            const double value = mat_src_fp.at<float>(y, x);
+            I[i] = mat_guide.at<uint8_t>(y, x) / 255.0;
+            m[i] = (value > 0) ? 1.0 : 0.0;
+            p[i] = (value > 0) ? value : 0.0;
+            im[i] = I[i] * m[i];
+            iim[i] = I[i] * I[i] * m[i];
+            ip[i] = I[i] * p[i];
+        }
+    }
+    std::vector<double> ac(width * height), bc(width * height), c(width * height);
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            const double w = BoxMean(m, x, y);
+            if (w * (2 * radius + 1) * (2 * radius + 1) < 0.5) continue;   /* no valid pixel in the window */
+            const double mean_i = BoxMean(im, x, y) / w;
+            const double mean_p = BoxMean(p, x, y) / w;
+            const double a = (BoxMean(ip, x, y) / w - mean_i * mean_p) / (BoxMean(iim, x, y) / w - mean_i * mean_i + eps);
+            ac[y * width + x] = a;
+            bc[y * width + x] = mean_p - a * mean_i;
+            c[y * width + x] = 1.0;
+        }
+    }
+    cv::Mat mat_out(height, width, CV_32FC1, cv::Scalar(0.0f));
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            if (m[y * width + x] == 0) continue;
+            mat_out.at<float>(y, x) = static_cast<float>((BoxMean(ac, x, y) * I[y * width + x] + BoxMean(bc, x, y)) / BoxMean(c, x, y) * value_scale);
+        }
+    }
+    return mat_out;
+}
+
+/*** Checks ***/
+static void CheckCropRect(const char* name, cv::Size org_size, cv::Rect crop, cv::Size dst_size, int32_t crop_type, cv::Rect expected)
+{
+    cv::Mat org = cv::Mat::zeros(org_size, CV_8UC3);
+    cv::Mat dst = cv::Mat::zeros(dst_size, CV_8UC3);
+    int32_t crop_x = crop.x, crop_y = crop.y, crop_w = crop.width, crop_h = crop.height;
+    CommonHelper::CropResizeCvt(org, dst, crop_x, crop_y, crop_w, crop_h, true, crop_type);
+    const int32_t fail_num = s_fail_num;
+    EXPECT_EQ_INT(expected.x, crop_x);
+    EXPECT_EQ_INT(expected.y, crop_y);
+    EXPECT_EQ_INT(expected.width, crop_w);
+    EXPECT_EQ_INT(expected.height, crop_h);
+    EXPECT(dst.size() == dst_size);
+    if (fail_num != s_fail_num) PRINT_E("  in %s\n", name);
+}
+
+static void CheckCropResizeCvtRect(void)
+{
+    /* Production: 1080p color camera to 384x384 model input */
+    CheckCropRect("stretch 1080p", cv::Size(1920, 1080), cv::Rect(0, 0, 1920, 1080), cv::Size(384, 384), CommonHelper::kCropTypeStretch, cv::Rect(0, 0, 1920, 1080));
+    CheckCropRect("cut 1080p", cv::Size(1920, 1080), cv::Rect(0, 0, 1920, 1080), cv::Size(384, 384), CommonHelper::kCropTypeCut, cv::Rect(420, 0, 1080, 1080));
+    CheckCropRect("expand 1080p", cv::Size(1920, 1080), cv::Rect(0, 0, 1920, 1080), cv::Size(384, 384), CommonHelper::kCropTypeExpand, cv::Rect(0, -420, 1920, 1920));
+    /* Production: 480x480 preview to 384x384 (same aspect ratio) */
+    CheckCropRect("cut square", cv::Size(480, 480), cv::Rect(0, 0, 480, 480), cv::Size(384, 384), CommonHelper::kCropTypeCut, cv::Rect(0, 0, 480, 480));
+    CheckCropRect("expand square", cv::Size(480, 480), cv::Rect(0, 0, 480, 480), cv::Size(384, 384), CommonHelper::kCropTypeExpand, cv::Rect(0, 0, 480, 480));
+    /* Crop offset is kept */
+    CheckCropRect("cut offset", cv::Size(640, 480), cv::Rect(100, 50, 400, 200), cv::Size(300, 300), CommonHelper::kCropTypeCut, cv::Rect(200, 50, 200, 200));
+    CheckCropRect("cut tall", cv::Size(640, 480), cv::Rect(10, 20, 100, 200), cv::Size(64, 64), CommonHelper::kCropTypeCut, cv::Rect(10, 70, 100, 100));
+    CheckCropRect("expand tall", cv::Size(640, 480), cv::Rect(0, 0, 100, 200), cv::Size(64, 64), CommonHelper::kCropTypeExpand, cv::Rect(-50, 0, 200, 200));
+    /* Edge sizes */
+    CheckCropRect("stretch 1x1", cv::Size(1, 1), cv::Rect(0, 0, 1, 1), cv::Size(1, 1), CommonHelper::kCropTypeStretch, cv::Rect(0, 0, 1, 1));
+    CheckCropRect("stretch 1x1 up", cv::Size(1, 1), cv::Rect(0, 0, 1, 1), cv::Size(384, 384), CommonHelper::kCropTypeStretch, cv::Rect(0, 0, 1, 1));
+    CheckCropRect("cut odd", cv::Size(7, 5), cv::Rect(0, 0, 7, 5), cv::Size(3, 3), CommonHelper::kCropTypeCut, cv::Rect(1, 0, 5, 5));
+    CheckCropRect("expand odd", cv::Size(7, 5), cv::Rect(0, 0, 7, 5), cv::Size(3, 3), CommonHelper::kCropTypeExpand, cv::Rect(0, 0, 7, 7));
+}
+
+static void CheckCropResizeCvtPixel(void)
+{
+    const cv::Vec3b kColorBgr(10, 20, 30);
+    const cv::Vec3b kColorRgb(30, 20, 10);
+    const cv::Vec3b kColorBand(255, 0, 255);
+
+    /* Stretch: compare with the naive nearest neighbor + R/B swap */
+    for (const auto& size_pair : { std::make_pair(cv::Size(1920, 1080), cv::Size(384, 384)), std::make_pair(cv::Size(480, 480), cv::Size(384, 384)),
+                                   std::make_pair(cv::Size(7, 5), cv::Size(3, 3)), std::make_pair(cv::Size(3, 3), cv::Size(8, 8)), std::make_pair(cv::Size(1, 1), cv::Size(4, 4)) }) {
+        cv::Mat org = CreateRandomImage(size_pair.first.width, size_pair.first.height, CV_8UC3, 0, 256);
+        cv::Mat dst = cv::Mat::zeros(size_pair.second, CV_8UC3);
+        int32_t crop_x = 0, crop_y = 0, crop_w = org.cols, crop_h = org.rows;
+        CommonHelper::CropResizeCvt(org, dst, crop_x, crop_y, crop_w, crop_h, true, CommonHelper::kCropTypeStretch, false);
+        EXPECT_MAT(RefSwapRB(RefResizeNearest(org, dst.size())), dst, 0);
+
+        /* is_rgb = false keeps the channel order */
+        dst = cv::Mat::zeros(size_pair.second, CV_8UC3);
+        CommonHelper::CropResizeCvt(org, dst, crop_x, crop_y, crop_w, crop_h, false, CommonHelper::kCropTypeStretch, false);
+        EXPECT_MAT(RefResizeNearest(org, dst.size()), dst, 0);
+    }
+
+    /* Stretch with a crop rect: only the rect is used */
+    {
+        cv::Mat org(480, 640, CV_8UC3, kColorBand);
+        org(cv::Rect(100, 50, 300, 200)).setTo(kColorBgr);
+        cv::Mat dst = cv::Mat::zeros(96, 96, CV_8UC3);
+        int32_t crop_x = 100, crop_y = 50, crop_w = 300, crop_h = 200;
+        CommonHelper::CropResizeCvt(org, dst, crop_x, crop_y, crop_w, crop_h, true, CommonHelper::kCropTypeStretch, true);
+        EXPECT_MAT(cv::Mat(dst.size(), CV_8UC3, kColorRgb), dst, 0);
+    }
+
+    /* Cut: the bands at both sides are cut off */
+    for (bool resize_by_linear : { false, true }) {
+        cv::Mat org(1080, 1920, CV_8UC3, kColorBand);
+        org(cv::Rect(420, 0, 1080, 1080)).setTo(kColorBgr);
+        cv::Mat dst = cv::Mat::zeros(384, 384, CV_8UC3);
+        int32_t crop_x = 0, crop_y = 0, crop_w = org.cols, crop_h = org.rows;
+        CommonHelper::CropResizeCvt(org, dst, crop_x, crop_y, crop_w, crop_h, true, CommonHelper::kCropTypeCut, resize_by_linear);
+        EXPECT_MAT(cv::Mat(dst.size(), CV_8UC3, kColorRgb), dst, 0);
+    }
+
+    /* Expand: the image is placed at the center, and the margin is untouched */
+    for (bool resize_by_linear : { false, true }) {
+        cv::Mat org(1080, 1920, CV_8UC3, kColorBgr);
+        cv::Mat dst = cv::Mat::zeros(384, 384, CV_8UC3);
+        int32_t crop_x = 0, crop_y = 0, crop_w = org.cols, crop_h = org.rows;
+        CommonHelper::CropResizeCvt(org, dst, crop_x, crop_y, crop_w, crop_h, true, CommonHelper::kCropTypeExpand, resize_by_linear);
+        cv::Mat mat_expected = cv::Mat::zeros(dst.size(), CV_8UC3);
+        mat_expected(cv::Rect(0, 84, 384, 216)).setTo(kColorRgb);
+        EXPECT_MAT(mat_expected, dst, 0);
+    }
+}
+
+static void CheckNormalizeMinMax(void)
+{
+    /* ramp: 0, 1, ..., 255 -> identity regardless of offset and scale */
+    {
+        cv::Mat mat_depth(16, 16, CV_32FC1);
+        for (int32_t i = 0; i < 256; i++) mat_depth.at<float>(i) = -3.0f + i * 0.5f;
+        cv::Mat mat_expected(16, 16, CV_8UC1);
+        for (int32_t i = 0; i < 256; i++) mat_expected.at<uint8_t>(i) = static_cast<uint8_t>(i);
+        EXPECT_MAT(mat_expected, CommonHelper::NormalizeMinMax(mat_depth), 0);
+    }
+    /* Production size (MiDaS output and stereo disparity). convertTo rounds, the reference saturate_cast rounds too */
+    for (const auto& size : { cv::Size(384, 384), cv::Size(640, 480), cv::Size(3, 7), cv::Size(1, 1) }) {
+        cv::Mat mat_depth = CreateRandomImage(size.width, size.height, CV_32FC1, -10.0, 1000.0);
+        EXPECT_MAT(RefNormalizeMinMax(mat_depth), CommonHelper::NormalizeMinMax(mat_depth), 1);
+    }
+    /* flat input doesn't divide by zero */
+    {
+        cv::Mat mat_depth(480, 640, CV_32FC1, cv::Scalar(5.0f));
+        EXPECT_MAT(cv::Mat::zeros(mat_depth.size(), CV_8UC1), CommonHelper::NormalizeMinMax(mat_depth), 0);
+    }
+}
+
+static void CheckNormalizeDisparity(void)
+{
+    /* golden */
+    {
+        const float kDisparity[] = { -1.0f, 0.0f, 0.5f, 1.0f, 63.9f, 64.0f, 127.0f, 128.0f, 200.0f };
+        const uint8_t kExpected[] = { 0, 0, 0, 1, 127, 127, 253, 255, 255 };   /* max_disparity = 128, truncated */
+        cv::Mat mat_disparity(1, 9, CV_32FC1, const_cast<float*>(kDisparity));
+        cv::Mat mat_out = CommonHelper::NormalizeDisparity(mat_disparity, 128.0f, 1.0f);
+        for (int32_t i = 0; i < 9; i++) EXPECT_EQ_INT(kExpected[i], mat_out.at<uint8_t>(i));
+    }
+    for (const auto& size : { cv::Size(640, 480), cv::Size(320, 240), cv::Size(3, 7), cv::Size(1, 1) }) {
+        cv::Mat mat_disparity = CreateRandomImage(size.width, size.height, CV_32FC1, -10.0, 450.0);
+        EXPECT_MAT(RefNormalizeDisparity(mat_disparity, 400.0f, 1.0f), CommonHelper::NormalizeDisparity(mat_disparity, 400.0f, 1.0f), 0);
+        EXPECT_MAT(RefNormalizeDisparity(mat_disparity, 400.0f, 2.0f), CommonHelper::NormalizeDisparity(mat_disparity, 400.0f, 2.0f), 0);
+    }
+}
+
+static void CheckConvertDisparity2Depth(void)
+{
+    /* golden: scale = 500 * 0.2 * 50 = 5000 */
+    {
+        const float kDisparity[] = { -1.0f, 0.0f, 1.0f, 19.0f, 20.0f, 100.0f, 5000.0f, 10000.0f };
+        const uint8_t kExpected[] = { 255, 255, 255, 255, 250, 50, 1, 0 };
+        cv::Mat mat_disparity(1, 8, CV_32FC1, const_cast<float*>(kDisparity));
+        cv::Mat mat_out = CommonHelper::ConvertDisparity2Depth(mat_disparity, 500.0f, 0.2f, 50.0f);
+        for (int32_t i = 0; i < 8; i++) EXPECT_EQ_INT(kExpected[i], mat_out.at<uint8_t>(i));
+    }
+    for (const auto& size : { cv::Size(640, 480), cv::Size(3, 7), cv::Size(1, 1) }) {
+        cv::Mat mat_disparity = CreateRandomImage(size.width, size.height, CV_32FC1, -10.0, 400.0);
+        EXPECT_MAT(RefConvertDisparity2Depth(mat_disparity, 500.0f, 0.2f, 50.0f), CommonHelper::ConvertDisparity2Depth(mat_disparity, 500.0f, 0.2f, 50.0f), 0);
+    }
+}
+
+static void CheckConvertDisparity2Depth16(void)
+{
+    /* golden: 1/8 px disparity to [mm]. scale = 500 [px] * 75 [mm] * 8 = 300000 */
+    {
+        const uint16_t kDisparity[] = { 0, 1, 4, 5, 8, 759, 760, 65535 };
+        const uint16_t kExpected[] = { 0, 65535, 65535, 60000, 37500, 395, 394, 4 };
+        cv::Mat mat_disparity(1, 8, CV_16UC1, const_cast<uint16_t*>(kDisparity));
+        cv::Mat mat_out = CommonHelper::ConvertDisparity2Depth16(mat_disparity, 300000.0f);
+        for (int32_t i = 0; i < 8; i++) EXPECT_EQ_INT(kExpected[i], mat_out.at<uint16_t>(i));
+    }
+    for (const auto& size : { cv::Size(640, 480), cv::Size(3, 7), cv::Size(1, 1) }) {
+        cv::Mat mat_disparity = CreateDepthImage(size.width, size.height, CV_16UC1, 760.0);
+        EXPECT_MAT(RefConvertDisparity2Depth16(mat_disparity, 300000.0f), CommonHelper::ConvertDisparity2Depth16(mat_disparity, 300000.0f), 0);
+    }
+}
+
+static void CheckWarpDisparity(void)
+{
+    cv::Mat mat_disparity_l;
+
+    /* A slanted plane has no gap and no jump between the first d_min columns (no match) and the last column, in px (steps of 1 px) and in subpixel */
+    cv::Mat mat_plane_8u(8, 200, CV_8UC1);
+    cv::Mat mat_plane_16u(8, 200, CV_16UC1);
+    for (int32_t x = 0; x < mat_plane_8u.cols; x++) {
+        mat_plane_8u.col(x).setTo(20 + x / 4);
+        mat_plane_16u.col(x).setTo(static_cast<int32_t>((20.0f + x * 0.3f) * 8.0f + 0.5f));
+    }
+    const cv::Rect rect_covered(20, 0, 179, 8);
+    CommonHelper::WarpDisparityRightToLeft(mat_plane_8u, 1.0f, mat_disparity_l);
+    EXPECT(mat_disparity_l.type() == CV_32FC1 && mat_disparity_l.size() == mat_plane_8u.size());
+    EXPECT(CommonHelper::ComputeDisparityUnreliableRatio(mat_disparity_l, rect_covered, 2.0f) == 0.0f);
+    EXPECT_EQ_INT(0, cv::countNonZero(mat_disparity_l(cv::Rect(0, 0, 20, 8))));
+    CommonHelper::WarpDisparityRightToLeft(mat_plane_16u, 1.0f / 8, mat_disparity_l);
+    EXPECT(CommonHelper::ComputeDisparityUnreliableRatio(mat_disparity_l, rect_covered, 2.0f) == 0.0f);
+
+    /* Occlusion behind a step stays invalid, and the nearer one wins at collision. An invalid pixel of 1 px is filled */
+    cv::Mat mat_step(4, 200, CV_32FC1, cv::Scalar(20.0f));
+    mat_step(cv::Rect(100, 0, 100, 4)).setTo(40.0f);
+    mat_step.at<float>(0, 121) = 0.0f;
+    CommonHelper::WarpDisparityRightToLeft(mat_step, 1.0f, mat_disparity_l);
+    EXPECT_EQ_INT(0, cv::countNonZero(mat_disparity_l(cv::Rect(120, 0, 20, 4))));
+    EXPECT(mat_disparity_l.at<float>(0, 119) == 20.0f && mat_disparity_l.at<float>(0, 140) == 40.0f);
+    EXPECT(mat_disparity_l.at<float>(0, 161) == 40.0f && mat_disparity_l.at<float>(1, 180) == 40.0f);
+    EXPECT(CommonHelper::ComputeDisparityUnreliableRatio(mat_disparity_l, cv::Rect(40, 0, 60, 4), 2.0f) == 0.0f);
+    EXPECT(CommonHelper::ComputeDisparityUnreliableRatio(mat_disparity_l, cv::Rect(110, 0, 40, 4), 2.0f) >= 0.5f);
+}
+
+static void CheckDepthRoiStats(void)
+{
+    DepthRoiStats depth_roi_stats;
+    float mean = 0;
+    float value = 0;
+    int32_t valid_num = 0;
+
+    /* Mean is exact for any rectangle. Percentile is in the same bin as the reference for rectangles on the grid */
+    const float value_min = 100.0f;
+    const float value_max = 10000.0f;
+    const int32_t bin_num = 128;
+    const float bin_width = (value_max - value_min) / bin_num;
+    const cv::Mat mat_depth = CreateDepthImage(163, 121, CV_16UC1, 4000.0);
+    EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.Build(mat_depth, value_min, value_max, bin_num, 8));
+    const cv::Rect rect_list[] = {
+        cv::Rect(0, 0, 163, 121), cv::Rect(16, 8, 64, 40), cv::Rect(80, 64, 83, 57),   /* on the grid, and to the border */
+        cv::Rect(43, 29, 5, 3), cv::Rect(150, 110, 20, 20), cv::Rect(-4, -4, 10, 10), cv::Rect(41, 27, 1, 1),   /* -4: no valid pixel */
+    };
+    for (size_t i = 0; i < sizeof(rect_list) / sizeof(rect_list[0]); i++) {
+        const cv::Rect& rect = rect_list[i];
+        const std::vector<float> value_list = RefSortedValidPixel(mat_depth, rect, value_min, value_max);
+        if (value_list.empty()) {
+            EXPECT_EQ_INT(DepthRoiStats::kRetErr, depth_roi_stats.GetMean(rect, mean, valid_num));
+            continue;
+        }
+        double sum = 0;
+        for (float v : value_list) sum += v;
+        EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.GetMean(rect, mean, valid_num));
+        EXPECT_EQ_INT(value_list.size(), valid_num);
+        EXPECT(std::abs(mean - sum / value_list.size()) < 1e-2);
+        if (i >= 3) continue;
+        for (float percentile : { 0.0f, 0.1f, 0.5f, 0.9f, 1.0f }) {
+            EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.GetPercentile(rect, percentile, value));
+            EXPECT(std::abs(value - RefPercentile(value_list, percentile)) <= bin_width);
+        }
+        DepthRoiStats::Stats stats;
+        EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.Query(rect, stats));
+        EXPECT(stats.valid_num == valid_num && stats.mean == mean && std::abs(stats.median - RefPercentile(value_list, 0.5f)) <= bin_width);
+        EXPECT(std::abs(stats.valid_ratio - static_cast<float>(valid_num) / (rect & cv::Rect(0, 0, mat_depth.cols, mat_depth.rows)).area()) < 1e-6f);
+    }
+
+    /* Percentile of a rectangle smaller than a cell, or at the border (partial cells), comes from the cells around it. Blocks of 16 px have different values */
+    cv::Mat mat_block(75, 100, CV_32FC1);
+    for (int32_t y = 0; y < mat_block.rows; y++) {
+        for (int32_t x = 0; x < mat_block.cols; x++) mat_block.at<float>(y, x) = 10.0f + 3.0f * ((x / 16) + 7 * (y / 16));
+    }
+    EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.Build(mat_block, 0.0f, 256.0f, 256, 8));
+    const cv::Rect rect_small_list[] = { cv::Rect(35, 19, 3, 3), cv::Rect(97, 70, 10, 10), cv::Rect(-5, 66, 8, 30), cv::Rect(50, 2, 1, 1) };
+    for (const auto& rect : rect_small_list) {
+        const std::vector<float> value_list = RefSortedValidPixel(mat_block, rect, 0.0f, 256.0f);
+        EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.GetPercentile(rect, 0.5f, value));
+        EXPECT(std::abs(value - RefPercentile(value_list, 0.5f)) <= 1.0f);
+        EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.GetMean(rect, mean, valid_num));
+        EXPECT(mean == value_list[0] && valid_num == static_cast<int32_t>(value_list.size()));
+    }
+
+    /* No pixel, or no valid pixel */
+    EXPECT_EQ_INT(DepthRoiStats::kRetErr, depth_roi_stats.GetPercentile(cv::Rect(100, 0, 10, 10), 0.5f, value));
+    EXPECT_EQ_INT(DepthRoiStats::kRetErr, depth_roi_stats.GetMean(cv::Rect(0, 0, 0, 10), mean, valid_num));
+    EXPECT_EQ_INT(DepthRoiStats::kRetOk, depth_roi_stats.Build(cv::Mat(16, 16, CV_8UC1, cv::Scalar(0)), 1.0f, 255.0f));
+    EXPECT_EQ_INT(DepthRoiStats::kRetErr, depth_roi_stats.GetPercentile(cv::Rect(0, 0, 16, 16), 0.5f, value));
+    EXPECT_EQ_INT(DepthRoiStats::kRetErr, depth_roi_stats.Build(cv::Mat(16, 16, CV_8UC3), 1.0f, 255.0f));
+}
+
+static void CheckBboxTracker(void)
+{
+    BboxTracker tracker(0.3f, 2, 30);
+    std::vector<BboxTracker::Bbox> bbox_list;
+    std::vector<BboxTracker::Track> track_list;
+
+    /* An object moving at constant velocity, detected every 2 frames. The track appears at the second hit, keeps its ID, and is extrapolated between detections */
+    for (int64_t sequence_num = 0; sequence_num <= 20; sequence_num += 2) {
+        bbox_list.assign(1, BboxTracker::Bbox(1, 0.9f, 0.1f + 0.005f * sequence_num, 0.2f, 0.2f, 0.3f));
+        tracker.Update(bbox_list, sequence_num);
+        tracker.GetTrackList(sequence_num, track_list);
+        EXPECT_EQ_INT((sequence_num == 0) ? 0 : 1, track_list.size());
+    }
+    tracker.GetTrackList(21, track_list);
+    EXPECT_EQ_INT(1, track_list.size());
+    if (track_list.size() == 1) {
+        const BboxTracker::Track& track = track_list[0];
+        EXPECT(track.id == 0 && track.hit_num == 11 && track.lost_frame_num == 1 && track.lost_update_num == 0);
+        EXPECT(std::abs(track.bbox.x - (0.1f + 0.005f * 21)) < 0.002f && std::abs(track.bbox.y - 0.2f) < 0.002f);
+        EXPECT(std::abs(track.bbox.w - 0.2f) < 0.002f && std::abs(track.bbox.h - 0.3f) < 0.002f);
+    }
+
+    /* Missed updates are counted. The track is not returned after max_lost_frame_num frames even before the next Update deletes it */
+    bbox_list.clear();
+    tracker.Update(bbox_list, 22);
+    tracker.Update(bbox_list, 24);
+    tracker.GetTrackList(24, track_list);
+    EXPECT(track_list.size() == 1 && track_list[0].lost_update_num == 2 && track_list[0].lost_frame_num == 4);
+    tracker.GetTrackList(50, track_list);
+    EXPECT_EQ_INT(1, track_list.size());
+    tracker.GetTrackList(51, track_list);
+    EXPECT_EQ_INT(0, track_list.size());
+    tracker.Update(bbox_list, 51);
+    bbox_list.assign(1, BboxTracker::Bbox(1, 0.9f, 0.3f, 0.2f, 0.2f, 0.3f));
+    tracker.Update(bbox_list, 52);
+    tracker.Update(bbox_list, 54);
+    tracker.GetTrackList(54, track_list);
+    EXPECT(track_list.size() == 1 && track_list[0].id == 1);
+
+    /* Detections of another class are not associated */
+    tracker.Reset();
+    bbox_list.assign(1, BboxTracker::Bbox(1, 0.9f, 0.3f, 0.2f, 0.2f, 0.3f));
+    bbox_list.push_back(BboxTracker::Bbox(2, 0.9f, 0.3f, 0.2f, 0.2f, 0.3f));
+    tracker.Update(bbox_list, 0);
+    tracker.Update(bbox_list, 1);
+    tracker.GetTrackList(1, track_list);
+    EXPECT(track_list.size() == 2 && track_list[0].hit_num == 2 && track_list[1].hit_num == 2);
+
+    /* Detections over the storage are dropped */
+    tracker.Reset();
+    bbox_list.clear();
+    for (int32_t i = 0; i < BboxTracker::kMaxTrackNum + 8; i++) {
+        bbox_list.push_back(BboxTracker::Bbox(1, 0.9f, (i % 9) * 0.1f, (i / 9) * 0.1f, 0.05f, 0.05f));
+    }
+    tracker.Update(bbox_list, 0);
+    tracker.Update(bbox_list, 1);
+    tracker.GetTrackList(1, track_list);
+    EXPECT_EQ_INT(BboxTracker::kMaxTrackNum, track_list.size());
+}
+
+static void CheckStageScheduler(void)
+{
+    /* Costs in the checks are much larger than the time spent in the checks, so that the elapsed time in a frame doesn't change the decisions */
+    StageScheduler scheduler;
+    const int32_t id_0 = scheduler.AddStage("stage0", true);
+    const int32_t id_1 = scheduler.AddStage("stage1", false, 2);
+    EXPECT(id_0 == 0 && id_1 == 1);
+
+    /* No budget. Always run */
+    scheduler.BeginFrame();
+    EXPECT_EQ_INT(StageScheduler::kDecisionRun, scheduler.Decide(id_0));
+    EXPECT_EQ_INT(StageScheduler::kDecisionRun, scheduler.Decide(id_1));
+    scheduler.Report(id_0, StageScheduler::kDecisionRun, 600.0);
+    scheduler.Report(id_0, StageScheduler::kDecisionDownscale, 100.0);
+    scheduler.Report(id_1, StageScheduler::kDecisionRun, 500.0);
+    EXPECT(scheduler.GetCost(id_0, StageScheduler::kDecisionRun) == 600.0 && scheduler.GetCost(id_0, StageScheduler::kDecisionDownscale) == 100.0);
+
+    /* The cost of the following stage is reserved, so the first stage is downscaled */
+    scheduler.SetBudget(1000.0);
+    scheduler.BeginFrame();
+    EXPECT_EQ_INT(StageScheduler::kDecisionDownscale, scheduler.Decide(id_0));
+    EXPECT_EQ_INT(StageScheduler::kDecisionRun, scheduler.Decide(id_1));
+
+    /* The following stage is not required in this frame. Its cost is not reserved, and it's skipped */
+    scheduler.BeginFrame();
+    scheduler.SetRequired(id_1, false);
+    EXPECT_EQ_INT(StageScheduler::kDecisionRun, scheduler.Decide(id_0));
+    EXPECT_EQ_INT(StageScheduler::kDecisionSkip, scheduler.Decide(id_1));
+    EXPECT(scheduler.GetCost(id_1, StageScheduler::kDecisionRun) == 500.0);     /* not decayed */
+
+    /* Over the budget. Skipped until max_skip_num, then forced to run (stage1 has no downscaled model) */
+    scheduler.SetBudget(400.0);
+    for (int32_t frame = 0; frame < 3; frame++) {
+        scheduler.BeginFrame();
+        EXPECT_EQ_INT(StageScheduler::kDecisionSkip, scheduler.Decide(id_0));
+        EXPECT_EQ_INT((frame < 2) ? StageScheduler::kDecisionSkip : StageScheduler::kDecisionRun, scheduler.Decide(id_1));
+    }
+    EXPECT(scheduler.GetCost(id_1, StageScheduler::kDecisionRun) < 500.0);      /* decayed while not measured */
+
+    /* The counts include the skips of the stage not required */
+    EXPECT(scheduler.GetCount(id_0, StageScheduler::kDecisionRun) == 2 && scheduler.GetCount(id_0, StageScheduler::kDecisionDownscale) == 1 && scheduler.GetCount(id_0, StageScheduler::kDecisionSkip) == 3);
+    EXPECT(scheduler.GetCount(id_1, StageScheduler::kDecisionRun) == 3 && scheduler.GetCount(id_1, StageScheduler::kDecisionDownscale) == 0 && scheduler.GetCount(id_1, StageScheduler::kDecisionSkip) == 3);
+    EXPECT_EQ_INT(0, scheduler.GetCount(5, StageScheduler::kDecisionRun));
+}
+
+static void CheckFrameRecorderRead(const std::string& filename, const std::vector<cv::Mat>& mat_color_list, const std::vector<cv::Mat>& mat_disparity_list, const char* name_color, const char* name_disparity)
+{
+    FrameReader reader;
+    EXPECT_EQ_INT(FrameReader::kRetOk, reader.Open(filename));
+    EXPECT_EQ_INT(2, reader.GetStreamNum());
+    EXPECT(reader.GetStreamName(0) == name_color && reader.GetStreamName(1) == name_disparity);
+    EXPECT_EQ_INT(1, reader.GetStreamId(name_disparity));
+    EXPECT_EQ_INT(static_cast<int32_t>(mat_color_list.size()), reader.GetFrameNum(0));
+    EXPECT_EQ_INT(static_cast<int32_t>(mat_disparity_list.size()), reader.GetFrameNum(1));
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_color_list.size()); i++) {
+        FrameReader::Frame frame;
+        EXPECT_EQ_INT(FrameReader::kRetOk, reader.GetFrame(0, i, frame));
+        EXPECT_MAT(mat_color_list[i], frame.mat, 0);
+        EXPECT_EQ_INT(1000 + i * 33333, frame.timestamp_us);
+        EXPECT_EQ_INT(10 + i, frame.sequence_num);
+    }
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_disparity_list.size()); i++) {
+        FrameReader::Frame frame;
+        EXPECT_EQ_INT(FrameReader::kRetOk, reader.GetFrame(1, i, frame));
+        EXPECT_MAT(mat_disparity_list[i], frame.mat, 0);
+        EXPECT_EQ_INT(10 + i * 2, frame.sequence_num);
+    }
+    /* The disparity stream has every other sequence number */
+    EXPECT_EQ_INT(2, reader.FindFrameBySequenceNum(1, 14));
+    EXPECT_EQ_INT(FrameReader::kRetErr, reader.FindFrameBySequenceNum(1, 15));
+    EXPECT_EQ_INT(FrameReader::kRetErr, reader.FindFrameBySequenceNum(2, 10));
+    FrameReader::Frame frame;
+    EXPECT_EQ_INT(FrameReader::kRetErr, reader.GetFrame(0, static_cast<int32_t>(mat_color_list.size()), frame));
+    EXPECT_EQ_INT(FrameReader::kRetOk, reader.Close());
+}
+
+static void CheckFrameRecorder(void)
+{
+    const std::string filename = "check_frame_recorder.bin";
+    const std::string filename_killed = "check_frame_recorder_killed.bin";
+    std::vector<cv::Mat> mat_color_list;
+    std::vector<cv::Mat> mat_disparity_list;
+
+    /* Chunks smaller than a frame, so that the chunks are grown and recycled */
+    FrameRecorder recorder;
+    EXPECT_EQ_INT(FrameRecorder::kRetOk, recorder.Open(filename, 64 * 1024, 2));
+    const int32_t stream_color = recorder.AddStream("color");
+    const int32_t stream_disparity = recorder.AddStream("disparity", FrameRecordFormat::kCompressionRvl);
+    EXPECT(stream_color == 0 && stream_disparity == 1);
+    EXPECT_EQ_INT(FrameRecorder::kRetErr, recorder.AddStream(std::string(FrameRecordFormat::kStreamNameLength, 'a')));
+    for (int32_t i = 0; i < 6; i++) {
+        /* not continuous */
+        mat_color_list.push_back(CreateRandomImage(330, 240, CV_8UC3, 0, 256, 1234 + i)(cv::Rect(5, 0, 320, 240)));
+        EXPECT_EQ_INT(FrameRecorder::kRetOk, recorder.Write(stream_color, mat_color_list.back(), 1000 + i * 33333, 10 + i));
+        if (i % 2 == 0) {
+            /* Every other frame, and a random one which doesn't get smaller is stored as it is */
+            mat_disparity_list.push_back(i == 4 ? CreateRandomImage(320, 240, CV_16UC1, 0, 65536) : CreateDepthImage(320, 240, CV_16UC1, 95.0 * 8, 1234 + i));
+            EXPECT_EQ_INT(FrameRecorder::kRetOk, recorder.Write(stream_disparity, mat_disparity_list.back(), 1000 + i * 33333, 10 + i));
+        }
+    }
+    EXPECT_EQ_INT(FrameRecorder::kRetErr, recorder.Write(2, mat_color_list[0], 0, 0));
+    EXPECT_EQ_INT(FrameRecorder::kRetErr, recorder.Write(stream_color, cv::Mat(), 0, 0));
+    const FrameRecorder::Statistics statistics = recorder.GetStatistics();
+    EXPECT_EQ_INT(9, statistics.frame_num);
+    EXPECT(statistics.byte_written < statistics.byte_raw + 9 * 128);
+    EXPECT_EQ_INT(FrameRecorder::kRetOk, recorder.Close());
+    CheckFrameRecorderRead(filename, mat_color_list, mat_disparity_list, "color", "disparity");
+
+    /* A recording whose recorder was killed: only the records are left. The index is rebuilt, but the stream names are lost */
+    std::vector<uint8_t> file_data;
+    FILE* fp = fopen(filename.c_str(), "rb");
+    EXPECT(fp != nullptr);
+    if (fp) {
+        fseek(fp, 0, SEEK_END);
+        file_data.resize(static_cast<size_t>(ftell(fp)));
+        fseek(fp, 0, SEEK_SET);
+        EXPECT(fread(file_data.data(), 1, file_data.size(), fp) == file_data.size());
+        fclose(fp);
+    }
+    if (file_data.size() > sizeof(FrameRecordFormat::Footer)) {
+        FrameRecordFormat::Footer footer;
+        memcpy(&footer, file_data.data() + file_data.size() - sizeof(footer), sizeof(footer));
+        EXPECT(footer.stream_name_offset < file_data.size());
+        fp = fopen(filename_killed.c_str(), "wb");
+        if (fp) {
+            fwrite(file_data.data(), 1, static_cast<size_t>((std::min)(static_cast<uint64_t>(file_data.size()), footer.stream_name_offset)), fp);
+            fclose(fp);
+        }
+        CheckFrameRecorderRead(filename_killed, mat_color_list, mat_disparity_list, "stream_0", "stream_1");
+    }
+    std::remove(filename.c_str());
+    std::remove(filename_killed.c_str());
+
+    FrameReader reader;
+    EXPECT_EQ_INT(FrameReader::kRetErr, reader.Open(filename));
+}
+
+static void CheckMetrics(void)
+{
+    /* The singleton may have the metrics of the other modules. Only the lines of the metrics here are checked */
+    Metrics& metrics = Metrics::GetInstance();
+    MetricsCounter* counter = metrics.AddCounter("check_metrics_frames_total", "Frames");
+    EXPECT(counter != nullptr && counter == metrics.AddCounter("check_metrics_frames_total", "Frames"));
+    EXPECT(metrics.AddGauge("check_metrics_frames_total", "Frames") == nullptr);
+    MetricsGauge* gauge = metrics.AddGauge("check_metrics_fps", "FPS");
+    /* Buckets are sorted, and a value on a bound is counted in the bucket (le) */
+    MetricsHistogram* histogram_a = metrics.AddHistogram("check_metrics_latency_ms", "Latency", { 5, 1, 2 }, "stage=\"a\"");
+    MetricsHistogram* histogram_b = metrics.AddHistogram("check_metrics_latency_ms", "Latency", { 1, 2, 5 }, "stage=\"b\"");
+    if (!counter || !gauge || !histogram_a || !histogram_b) return;
+    counter->Add();
+    counter->Add(2);
+    gauge->Set(29.5);
+    for (double value : { 1.0, 1.5, 5.0, 7.0 }) histogram_a->Observe(value);
+    histogram_b->Observe(0.5);
+    EXPECT_EQ_INT(4, histogram_a->GetCount());
+    EXPECT_EQ_INT(1, histogram_a->GetBucketCount(1));
+
+    const std::string text = metrics.Render();
+    const auto CountLine = [&text](const std::string& line) {
+        int32_t num = 0;
+        for (size_t pos = text.find(line + "\n"); pos != std::string::npos; pos = text.find(line + "\n", pos + 1)) {
+            if (pos == 0 || text[pos - 1] == '\n') num++;
+        }
+        return num;
+    };
+    EXPECT_EQ_INT(1, CountLine("# HELP check_metrics_frames_total Frames"));
+    EXPECT_EQ_INT(1, CountLine("# TYPE check_metrics_frames_total counter"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_frames_total 3"));
+    EXPECT_EQ_INT(1, CountLine("# TYPE check_metrics_fps gauge"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_fps 29.5"));
+    /* Samples of the same name are under one HELP / TYPE. The buckets are cumulative */
+    EXPECT_EQ_INT(1, CountLine("# TYPE check_metrics_latency_ms histogram"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_latency_ms_bucket{stage=\"a\",le=\"1\"} 1"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_latency_ms_bucket{stage=\"a\",le=\"2\"} 2"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_latency_ms_bucket{stage=\"a\",le=\"5\"} 3"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_latency_ms_bucket{stage=\"a\",le=\"+Inf\"} 4"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_latency_ms_sum{stage=\"a\"} 14.5"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_latency_ms_count{stage=\"a\"} 4"));
+    EXPECT_EQ_INT(1, CountLine("check_metrics_latency_ms_bucket{stage=\"b\",le=\"+Inf\"} 1"));
+    EXPECT(text.find("# TYPE check_metrics_latency_ms histogram") < text.find("check_metrics_latency_ms_bucket{stage=\"a\""));
+    EXPECT(text.find("check_metrics_latency_ms_count{stage=\"a\"}") < text.find("check_metrics_latency_ms_bucket{stage=\"b\""));
+
+    /* The file has the same text */
+    const std::string filename = "check_metrics.prom";
+    EXPECT_EQ_INT(Metrics::kRetOk, metrics.WriteFile(filename));
+    std::string text_file;
+    FILE* fp = fopen(filename.c_str(), "rb");
+    EXPECT(fp != nullptr);
+    if (fp) {
+        char buffer[1024];
+        size_t size = 0;
+        while ((size = fread(buffer, 1, sizeof(buffer), fp)) > 0) text_file.append(buffer, size);
+        fclose(fp);
+    }
+    EXPECT(text_file == metrics.Render());
+    EXPECT(std::remove((filename + ".tmp").c_str()) != 0);
+    std::remove(filename.c_str());
+}
+
+static void CheckThreadPool(void)
+{
+    /* 4 threads whatever the CPUs are, so that the parallel path is used. Finalized at the end, so that the next user initializes it by default */
+    ThreadPool& thread_pool = ThreadPool::GetInstance();
+    EXPECT_EQ_INT(ThreadPool::kRetOk, thread_pool.Initialize(4));
+    EXPECT_EQ_INT(4, thread_pool.GetThreadNum());
+    const std::thread::id caller_id = std::this_thread::get_id();
+
+    /* Every index is processed exactly once, in chunks of at least grain_size but the last one. A small range is one call in the caller */
+    for (const auto& range : std::vector<std::array<int32_t, 3>>{ { -5, 1000, 7 }, { 0, 1000, 1000 }, { 0, 3, 1 }, { 0, 100, 0 }, { 10, 10, 1 }, { 10, 0, 1 } }) {
+        const int32_t begin = range[0];
+        const int32_t end = range[1];
+        const int32_t grain_size = (std::max)(range[2], 1);
+        const int32_t size = (std::max)(end - begin, 0);
+        std::unique_ptr<std::atomic<int32_t>[]> count_list(new std::atomic<int32_t>[size + 1]);
+        for (int32_t i = 0; i < size; i++) count_list[i] = 0;
+        std::atomic<int32_t> call_num(0);
+        std::atomic<int32_t> invalid_chunk_num(0);
+        std::atomic<int32_t> caller_call_num(0);
+        thread_pool.ParallelFor(begin, end, range[2], [&](int32_t chunk_begin, int32_t chunk_end) {
+            call_num++;
+            if (std::this_thread::get_id() == caller_id) caller_call_num++;
+            if (chunk_begin < begin || chunk_end > end || chunk_begin >= chunk_end || (chunk_end - chunk_begin < grain_size && chunk_end != end)) invalid_chunk_num++;
+            for (int32_t i = (std::max)(chunk_begin, begin); i < (std::min)(chunk_end, end); i++) count_list[i - begin]++;
+        });
+        EXPECT_EQ_INT(0, invalid_chunk_num.load());
+        int32_t wrong_count_num = 0;
+        for (int32_t i = 0; i < size; i++) wrong_count_num += (count_list[i] != 1);
+        EXPECT_EQ_INT(0, wrong_count_num);
+        if (size == 0) {
+            EXPECT_EQ_INT(0, call_num.load());
+        } else if (size <= grain_size) {
+            EXPECT(call_num == 1 && caller_call_num == 1);
+        }
+    }
+
+    /* Nested: a ParallelFor called in a worker runs inline in the worker with the whole range. In the caller, it is parallel again */
+    std::atomic<int32_t> nested_error_num(0);
+    thread_pool.ParallelFor(0, 64, 1, [&](int32_t chunk_begin, int32_t chunk_end) {
+        const std::thread::id outer_id = std::this_thread::get_id();
+        for (int32_t i = chunk_begin; i < chunk_end; i++) {
+            std::atomic<int32_t> inner_call_num(0);
+            std::atomic<int32_t> inner_size(0);
+            thread_pool.ParallelFor(0, 100, 1, [&](int32_t inner_begin, int32_t inner_end) {
+                inner_call_num++;
+                inner_size += inner_end - inner_begin;
+                if (outer_id != caller_id && std::this_thread::get_id() != outer_id) nested_error_num++;
+            });
+            if (inner_size != 100 || (outer_id != caller_id && inner_call_num != 1)) nested_error_num++;
+        }
+    });
+    EXPECT_EQ_INT(0, nested_error_num.load());
+
+    /* Callers in several threads at the same time */
+    std::atomic<int64_t> sum(0);
+    std::vector<std::thread> caller_list;
+    for (int32_t t = 0; t < 3; t++) {
+        caller_list.push_back(std::thread([&thread_pool, &sum] {
+            for (int32_t n = 0; n < 20; n++) {
+                thread_pool.ParallelFor(0, 1000, 10, [&sum](int32_t chunk_begin, int32_t chunk_end) {
+                    for (int32_t i = chunk_begin; i < chunk_end; i++) sum += i;
+                });
+            }
+        }));
+    }
+    for (auto& caller : caller_list) caller.join();
+    EXPECT_EQ_INT(3 * 20 * (999 * 1000 / 2), sum.load());
+
+    thread_pool.Finalize();
+    EXPECT_EQ_INT(1, thread_pool.GetThreadNum());
+}
+
+static void CheckShmFrameRing(void)
+{
+    const std::string shm_name = "/check_shm_frame_ring";
+    ShmFramePublisher publisher;
+    const std::vector<ShmFramePublisher::StreamConfig> stream_config_list = {
+        ShmFramePublisher::StreamConfig("color", 64 * 48 * 3, 3),
+        ShmFramePublisher::StreamConfig("depth", 64 * 48 * 2, 3, ShmFrameFormat::kCompressionRvl),
+    };
+    EXPECT_EQ_INT(ShmFramePublisher::kRetOk, publisher.Open(shm_name, stream_config_list));
+    ShmFrameReader reader;
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.Open(shm_name));
+    if (!publisher.IsOpened() || reader.GetStreamNum() != 2) return;
+    EXPECT(reader.GetStreamName(0) == "color" && reader.GetStreamName(1) == "depth");
+    EXPECT_EQ_INT(1, reader.GetStreamId("depth"));
+    EXPECT(!reader.IsClosed());
+    ShmFrameReader::Frame frame;
+    EXPECT_EQ_INT(ShmFrameReader::kRetErr, reader.GetLatest(0, frame));
+
+    /* The ring of 3 slots keeps the last 3 frames */
+    std::vector<cv::Mat> mat_color_list;
+    for (int32_t i = 0; i < 4; i++) {
+        mat_color_list.push_back(CreateRandomImage(64, 48, CV_8UC3, 0, 256, 1234 + i));
+        EXPECT_EQ_INT(ShmFramePublisher::kRetOk, publisher.Write(0, mat_color_list.back(), 1000 + i, 10 + i));
+    }
+    EXPECT_EQ_INT(4, reader.GetWriteCount(0));
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.GetLatest(0, frame));
+    EXPECT_MAT(mat_color_list[3], frame.mat, 0);
+    EXPECT(frame.write_index == 3 && frame.timestamp_us == 1003 && frame.sequence_num == 13 && reader.IsValid(frame));
+    EXPECT_EQ_INT(ShmFrameReader::kRetErr, reader.Get(0, 0, frame));
+    EXPECT_EQ_INT(ShmFrameReader::kRetErr, reader.Get(0, 4, frame));
+
+    /* A view is invalidated when its slot is overwritten, but a copy is kept */
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.Get(0, 1, frame));
+    cv::Mat mat_copy;
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.Copy(frame, mat_copy));
+    cv::Mat mat_slot;
+    EXPECT_EQ_INT(ShmFramePublisher::kRetOk, publisher.BeginWrite(0, 48, 64, CV_8UC3, mat_slot));
+    mat_slot.setTo(cv::Scalar(1, 2, 3));
+    EXPECT_EQ_INT(ShmFramePublisher::kRetOk, publisher.EndWrite(0, 1004, 14));
+    EXPECT(!reader.IsValid(frame));
+    EXPECT_EQ_INT(ShmFrameReader::kRetErr, reader.Copy(frame, mat_copy));
+    EXPECT_MAT(mat_color_list[1], mat_copy, 0);
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.GetLatest(0, frame));
+    EXPECT_MAT(cv::Mat(48, 64, CV_8UC3, cv::Scalar(1, 2, 3)), frame.mat, 0);
+
+    /* Depth is compressed unless it doesn't get smaller. Readers get the decoded image */
+    const cv::Mat mat_depth = CreateDepthImage(64, 48, CV_16UC1, 3000.0);
+    EXPECT_EQ_INT(ShmFramePublisher::kRetOk, publisher.Write(1, mat_depth, 2000, 20));
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.GetLatest(1, frame));
+    EXPECT(frame.compression == ShmFrameFormat::kCompressionRvl && reader.IsValid(frame));
+    EXPECT_MAT(mat_depth, frame.mat, 0);
+    const cv::Mat mat_noise = CreateRandomImage(64, 48, CV_16UC1, 0, 65536);
+    EXPECT_EQ_INT(ShmFramePublisher::kRetOk, publisher.Write(1, mat_noise, 2001, 21));
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.GetLatest(1, frame));
+    EXPECT(frame.compression == ShmFrameFormat::kCompressionNone);
+    EXPECT_MAT(mat_noise, frame.mat, 0);
+
+    /* Frames larger than the slot and unknown streams are rejected */
+    EXPECT_EQ_INT(ShmFramePublisher::kRetErr, publisher.Write(0, cv::Mat(49, 64, CV_8UC3, cv::Scalar(0)), 0, 0));
+    EXPECT_EQ_INT(ShmFramePublisher::kRetErr, publisher.Write(2, mat_depth, 0, 0));
+    EXPECT_EQ_INT(ShmFramePublisher::kRetErr, publisher.EndWrite(0, 0, 0));
+
+    /* The reader is notified of the close of the publisher */
+    EXPECT_EQ_INT(ShmFramePublisher::kRetOk, publisher.Close());
+    EXPECT(reader.IsClosed());
+    EXPECT_EQ_INT(ShmFrameReader::kRetOk, reader.Close());
+    EXPECT_EQ_INT(ShmFrameReader::kRetErr, reader.Open(shm_name));
+}
+
+/* Textured stereo pair of a fronto-parallel background (disparity_bg) and a box in front of it (disparity_fg) */
+static void CreateStereoPair(int32_t width, int32_t height, int32_t disparity_bg, int32_t disparity_fg, const cv::Rect& rect_fg, cv::Mat& image_l, cv::Mat& image_r, cv::Mat& disparity_l)
+{
+    image_r = CreateRandomImage(width, height, CV_8UC1, 0, 256, 1);
+    const cv::Mat mat_occluded = CreateRandomImage(width, height, CV_8UC1, 0, 256, 2);
+    image_l.create(height, width, CV_8UC1);
+    disparity_l.create(height, width, CV_32FC1);
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            const int32_t disparity = (rect_fg & cv::Rect(x, y, 1, 1)).area() > 0 ? disparity_fg : disparity_bg;
+            image_l.at<uint8_t>(y, x) = (x - disparity >= 0) ? image_r.at<uint8_t>(y, x - disparity) : mat_occluded.at<uint8_t>(y, x);
+            disparity_l.at<float>(y, x) = static_cast<float>(disparity);
+        }
+    }
+}
+
+static void CheckDepthSgmEngine(void)
+{
+    cv::Mat image_l, image_r, disparity_expected;
+    const cv::Rect rect_fg(96, 32, 64, 48);
+    CreateStereoPair(224, 112, 12, 36, rect_fg, image_l, image_r, disparity_expected);
+    /* Left border without the corresponding pixels, and the edges of the box (occlusion) are excluded */
+    cv::Mat mat_measured(image_l.size(), CV_8UC1, cv::Scalar(255));
+    mat_measured(cv::Rect(0, 0, 36 + 4, image_l.rows)).setTo(0);
+    mat_measured(cv::Rect(rect_fg.x - 36 - 4, rect_fg.y - 4, rect_fg.width + 36 + 8, rect_fg.height + 8)).setTo(0);
+    mat_measured(cv::Rect(rect_fg.x + 4, rect_fg.y + 4, rect_fg.width - 8, rect_fg.height - 8)).setTo(255);
+
+    for (bool is_downscaled : { false, true }) {
+        const int32_t scale = is_downscaled ? 2 : 1;
+        for (int32_t path_num : { DepthSgmEngine::kPathNum8, DepthSgmEngine::kPathNum4 }) {
+            DepthSgmEngine engine;
+            DepthSgmEngine::Result result;
+            EXPECT_EQ_INT(DepthSgmEngine::kRetErr, engine.Process(image_l, image_r, result));
+            EXPECT_EQ_INT(DepthSgmEngine::kRetOk, engine.Initialize("", 0, is_downscaled));
+            EXPECT_EQ_INT(DepthSgmEngine::kRetOk, engine.SetPathNum(path_num));
+            EXPECT_EQ_INT(DepthSgmEngine::kRetOk, engine.Process(image_l, image_r, result));
+            EXPECT(result.image.type() == CV_32FC1 && result.image.cols == image_l.cols / scale && result.image.rows == image_l.rows / scale);
+            EXPECT(result.crop.w == image_l.cols && result.crop.h == image_l.rows && result.max_disparity == engine.GetMaxDisparity());
+
+            /* Almost all the measured pixels have the disparity within 1 px, and few pixels have wrong disparity */
+            int32_t measured_num = 0, correct_num = 0, wrong_num = 0;
+            for (int32_t y = 0; y < result.image.rows; y++) {
+                for (int32_t x = 0; x < result.image.cols; x++) {
+                    if (mat_measured.at<uint8_t>(y * scale, x * scale) == 0) continue;
+                    const float disparity = result.image.at<float>(y, x);
+                    const float disparity_true = disparity_expected.at<float>(y * scale, x * scale) / scale;
+                    measured_num++;
+                    if (std::abs(disparity - disparity_true) <= 1.0f) {
+                        correct_num++;
+                    } else if (disparity > 0) {
+                        wrong_num++;
+                    }
+                }
+            }
+            EXPECT(correct_num > measured_num * 0.9);
+            EXPECT(wrong_num < measured_num * 0.01);
+
+            /* A color image with the same channels has the same result as gray */
+            cv::Mat image_l_color, image_r_color;
+            cv::cvtColor(image_l, image_l_color, cv::COLOR_GRAY2BGR);
+            cv::cvtColor(image_r, image_r_color, cv::COLOR_GRAY2BGR);
+            DepthSgmEngine::Result result_color;
+            EXPECT_EQ_INT(DepthSgmEngine::kRetOk, engine.Process(image_l_color, image_r_color, result_color));
+            EXPECT_MAT(result.image, result_color.image, 0);
+
+            EXPECT_EQ_INT(DepthSgmEngine::kRetErr, engine.Process(image_l, image_r(cv::Rect(0, 0, 200, 112)), result_color));
+            EXPECT_EQ_INT(DepthSgmEngine::kRetErr, engine.SetPathNum(2));
+            result.image.release();
+            result_color.image.release();
+            EXPECT_EQ_INT(DepthSgmEngine::kRetOk, engine.Finalize());
+        }
+    }
+}
+
+static void CheckMatRing(void)
+{
+    MatRing ring(2);
+    cv::Mat mat0, mat1, mat2;
+    EXPECT_EQ_INT(MatRing::kRetOk, ring.Acquire(480, 640, CV_32FC1, mat0, 0));
+    EXPECT_EQ_INT(MatRing::kRetOk, ring.Acquire(480, 640, CV_32FC1, mat1, 0));
+    EXPECT(mat0.data != mat1.data);
+    EXPECT_EQ_INT(2, ring.GetLeasedNum());
+
+    /* all the slots are leased. a copy of the header keeps the lease */
+    cv::Mat mat0_copy = mat0;
+    mat0.release();
+    EXPECT_EQ_INT(MatRing::kRetErr, ring.Acquire(480, 640, CV_32FC1, mat2, 10));
+    EXPECT(mat2.empty());
+
+    /* the slot returns when the last reference is released, and its buffer is reused */
+    const uint8_t* data0 = mat0_copy.data;
+    mat0_copy.release();
+    EXPECT_EQ_INT(1, ring.GetLeasedNum());
+    EXPECT_EQ_INT(MatRing::kRetOk, ring.Acquire(240, 320, CV_16FC1, mat2, 0));
+    EXPECT(mat2.data == data0);
+    EXPECT(mat2.size() == cv::Size(320, 240) && mat2.type() == CV_16FC1);
+
+    /* clone doesn't hold a lease */
+    cv::Mat mat_clone = mat1.clone();
+    mat1.release();
+    mat2.release();
+    EXPECT_EQ_INT(0, ring.GetLeasedNum());
+    EXPECT(ring.WaitAllReleased(0));
+    EXPECT(!mat_clone.empty());
+}
+
+static void CheckApplyColorMap(void)
+{
+    for (const auto& size : { cv::Size(384, 384), cv::Size(640, 480), cv::Size(3, 7), cv::Size(1, 1) }) {
+        cv::Mat mat = CreateRandomImage(size.width, size.height, CV_8UC1, 0, 256);
+        for (int32_t colormap : { cv::COLORMAP_MAGMA, cv::COLORMAP_JET }) {
+            cv::Mat mat_expected;
+            cv::applyColorMap(mat, mat_expected, colormap);
+            cv::Mat mat_actual;
+            CommonHelper::ApplyColorMap(mat, mat_actual, colormap);
+            EXPECT_MAT(mat_expected, mat_actual, 0);
+            /* in place */
+            cv::Mat mat_in_place = mat.clone();
+            CommonHelper::ApplyColorMap(mat_in_place, mat_in_place, colormap);
+            EXPECT_MAT(mat_expected, mat_in_place, 0);
+        }
+    }
+    /* 16-bit disparity (1/8 px, up to 95 px) with the multiplier of DepthAI. The index is truncated */
+    for (const auto& size : { cv::Size(640, 480), cv::Size(3, 7), cv::Size(1, 1) }) {
+        cv::Mat mat = CreateRandomImage(size.width, size.height, CV_16UC1, 0, 1000);
+        const float scale = 255.0f / (95 * 8);
+        const uint32_t scale_q12 = static_cast<uint32_t>(std::round(scale * 4096.0f));
+        cv::Mat mat_index(mat.size(), CV_8UC1);
+        for (int32_t i = 0; i < static_cast<int32_t>(mat.total()); i++) {
+            mat_index.at<uint8_t>(i) = static_cast<uint8_t>((std::min)((mat.at<uint16_t>(i) * scale_q12) >> 12, 255u));
+        }
+        cv::Mat mat_expected;
+        cv::applyColorMap(mat_index, mat_expected, cv::COLORMAP_JET);
+        cv::Mat mat_actual;
+        CommonHelper::ApplyColorMap(mat, mat_actual, cv::COLORMAP_JET, scale);
+        EXPECT_MAT(mat_expected, mat_actual, 0);
+    }
+}
+
+static void CheckDepthCodecRoundTrip(const cv::Mat& mat)
+{
+    std::vector<uint8_t> buffer(DepthCodec::GetMaxEncodedSize(static_cast<int32_t>(mat.total())));
+    size_t encoded_size = 0;
+    EXPECT_EQ_INT(DepthCodec::kRetOk, DepthCodec::Encode(mat, buffer.data(), buffer.size(), encoded_size));
+    cv::Mat mat_decoded;
+    EXPECT_EQ_INT(DepthCodec::kRetOk, DepthCodec::Decode(buffer.data(), encoded_size, mat.rows, mat.cols, mat.type(), mat_decoded));
+    EXPECT_MAT(mat, mat_decoded, 0);
+
+    /* broken input is an error, not a crash */
+    if (encoded_size >= 4) {
+        EXPECT_EQ_INT(DepthCodec::kRetErr, DepthCodec::Decode(buffer.data(), encoded_size - 4, mat.rows, mat.cols, mat.type(), mat_decoded));
+        size_t encoded_size_small = 0;
+        EXPECT_EQ_INT(DepthCodec::kRetErr, DepthCodec::Encode(mat, buffer.data(), encoded_size - 1, encoded_size_small));
+    }
+    EXPECT_EQ_INT(DepthCodec::kRetErr, DepthCodec::Decode(buffer.data(), encoded_size, mat.rows, mat.cols + 1, mat.type(), mat_decoded));
+}
+
+static void CheckDepthCodec(void)
+{
+    /* The format must not change: recordings are decoded by other builds */
+    const uint16_t kGoldenInput[] = { 0, 0, 100, 101, 99, 0, 65535, 1, 1, 0 };
+    const uint8_t kGoldenOutput[] = { 0x32, 0x98, 0x23, 0x13, 0x83, 0xCF, 0xFF, 0xB3, 0xFF, 0xFF, 0x03, 0x01 };
+    uint8_t buffer[64];
+    size_t encoded_size = 0;
+    EXPECT_EQ_INT(DepthCodec::kRetOk, DepthCodec::Encode(kGoldenInput, 10, buffer, sizeof(buffer), encoded_size));
+    EXPECT_EQ_INT(sizeof(kGoldenOutput), encoded_size);
+    EXPECT(memcmp(buffer, kGoldenOutput, sizeof(kGoldenOutput)) == 0);
+
+    for (int32_t type : { CV_16UC1, CV_8UC1 }) {
+        const double value_max = (type == CV_16UC1) ? 65535.0 : 255.0;
+        for (const auto& size : { cv::Size(640, 480), cv::Size(1, 1), cv::Size(3, 7), cv::Size(17, 1) }) {
+            CheckDepthCodecRoundTrip(CreateDepthImage(size.width, size.height, type, 1000.0));
+            CheckDepthCodecRoundTrip(CreateRandomImage(size.width, size.height, type, 0, value_max + 1));
+            CheckDepthCodecRoundTrip(cv::Mat::zeros(size, type));
+            CheckDepthCodecRoundTrip(cv::Mat(size, type, cv::Scalar(value_max)));
+        }
+        /* worst case: the largest deltas */
+        cv::Mat mat_worst(1, 1001, type);
+        for (int32_t i = 0; i < mat_worst.cols; i++) {
+            if (type == CV_16UC1) {
+                mat_worst.at<uint16_t>(i) = (i % 2) ? 65535 : 1;
+            } else {
+                mat_worst.at<uint8_t>(i) = (i % 2) ? 255 : 1;
+            }
+        }
+        CheckDepthCodecRoundTrip(mat_worst);
+        /* not continuous */
+        CheckDepthCodecRoundTrip(CreateDepthImage(640, 480, type, 200.0)(cv::Rect(1, 2, 300, 200)));
+    }
+}
+
+static void CheckPooledMatAllocator(void)
+{
+    /* Installed only during this check, so that the other checks run with the allocator of OpenCV */
+    cv::MatAllocator* allocator_previous = cv::Mat::getDefaultAllocator();
+    PooledMatAllocator& allocator = PooledMatAllocator::GetInstance();
+    cv::Mat::setDefaultAllocator(&allocator);
+    allocator.ResetStatistics();
+    const uint64_t bytes_in_use_baseline = allocator.GetStatistics().bytes_in_use;
+
+    /* Frame loop: images of the same sizes are created and released in every frame, and the filters keep their state */
+    const auto RunFrameLoop = [] {
+        TemporalFilter temporal_filter;
+        HoleFilling hole_filling;
+        for (int32_t frame = 0; frame < 8; frame++) {
+            cv::Mat mat_disparity = CreateDepthImage(320, 240, CV_16UC1, 64.0 * 8, 1234 + frame);
+            cv::Mat mat_depth = CommonHelper::ConvertDisparity2Depth16(mat_disparity, 1000.0f);
+            EXPECT(mat_depth.size() == mat_disparity.size());
+            cv::Mat mat_filtered;
+            EXPECT_EQ_INT(TemporalFilter::kRetOk, temporal_filter.Filter(mat_disparity, mat_filtered, 0.5f, 0.2f, 2));
+            cv::Mat mat_dense;
+            cv::Mat mat_valid;
+            EXPECT_EQ_INT(HoleFilling::kRetOk, hole_filling.Fill(mat_filtered, mat_dense, mat_valid));
+            cv::Mat mat_colored;
+            CommonHelper::ApplyColorMap(mat_disparity, mat_colored, cv::COLORMAP_JET, 255.0f / (64 * 8));
+        }
+    };
+    RunFrameLoop();
+    const PooledMatAllocator::Statistics statistics_first = allocator.GetStatistics();
+    const uint64_t bytes_in_use_first = statistics_first.bytes_in_use;
+    RunFrameLoop();
+    const PooledMatAllocator::Statistics statistics_second = allocator.GetStatistics();
+    cv::Mat::setDefaultAllocator(allocator_previous);
+
+    /* The second pass is served from the pool only, and everything is returned after each pass */
+    EXPECT(statistics_first.miss_num > 0);
+    EXPECT_EQ_INT(statistics_first.miss_num, statistics_second.miss_num);
+    EXPECT(statistics_second.hit_num > statistics_first.hit_num);
+    EXPECT_EQ_INT(bytes_in_use_baseline, bytes_in_use_first);
+    EXPECT_EQ_INT(bytes_in_use_baseline, statistics_second.bytes_in_use);
+}
+
+static void CheckTemporalFilter(void)
+{
+    /* pixel: stable, moving, hole, hole for long time, invalid from the start */
+    TemporalFilter temporal_filter;
+    const float kInput[4][5] = {
+        { 100.0f, 100.0f, 100.0f, 100.0f, 0.0f },
+        { 110.0f, 200.0f,   0.0f,   0.0f, 0.0f },
+        { 110.0f, 200.0f,  90.0f,   0.0f, 0.0f },
+        { 110.0f,  50.0f,  90.0f,   0.0f, 0.0f },
+    };
+    const float kExpected[4][5] = {
+        { 100.0f, 100.0f, 100.0f, 100.0f, 0.0f },
+        { 105.0f, 200.0f, 100.0f, 100.0f, 0.0f },
+        { 107.5f, 200.0f,  95.0f, 100.0f, 0.0f },
+        { 108.75f, 50.0f,  92.5f,   0.0f, 0.0f },
+    };
+    for (int32_t frame = 0; frame < 4; frame++) {
+        const cv::Mat mat_src(1, 5, CV_32FC1, const_cast<float*>(kInput[frame]));
+        cv::Mat mat_dst;
+        EXPECT_EQ_INT(TemporalFilter::kRetOk, temporal_filter.Filter(mat_src, mat_dst, 0.5f, 0.2f, 2));
+        EXPECT_MAT(cv::Mat(1, 5, CV_32FC1, const_cast<float*>(kExpected[frame])), mat_dst, 0);
+    }
+
+    /* The state is reset when the size changes */
+    cv::Mat mat_dst;
+    EXPECT_EQ_INT(TemporalFilter::kRetOk, temporal_filter.Filter(cv::Mat(2, 3, CV_8UC1, cv::Scalar(10)), mat_dst, 0.5f, 0.2f, 2));
+    EXPECT(mat_dst.type() == CV_32FC1 && mat_dst.rows == 2 && mat_dst.cols == 3);
+    EXPECT_MAT(cv::Mat(2, 3, CV_32FC1, cv::Scalar(10.0f)), mat_dst, 0);
+    EXPECT_EQ_INT(TemporalFilter::kRetErr, temporal_filter.Filter(cv::Mat(2, 3, CV_8UC3), mat_dst));
+    EXPECT_EQ_INT(TemporalFilter::kRetErr, temporal_filter.Filter(cv::Mat(2, 3, CV_8UC1, cv::Scalar(10)), mat_dst, 0.0f));
+}
+
+static void CheckGuidedFilter(void)
+{
+    GuidedFilter guided_filter;
+    cv::Mat mat_dst;
+
+    /* Odd sizes, holes and a tiny image whose window is wider than the image with the border */
+    for (const auto& size : { cv::Size(61, 47), cv::Size(7, 5) }) {
+        const int32_t radius = (size.width > 10) ? 4 : 2;
+        const cv::Mat mat_guide = CreateRandomImage(size.width, size.height, CV_8UC1, 0, 256);
+        const cv::Mat mat_src = CreateDepthImage(size.width, size.height, CV_16UC1, 95.0 * 8);
+        EXPECT_EQ_INT(GuidedFilter::kRetOk, guided_filter.Filter(mat_guide, mat_src, mat_dst, radius, 1e-2f, 1.0f / 8));
+        EXPECT_MAT(RefGuidedFilter(mat_guide, mat_src, radius, 1e-2f, 1.0f / 8), mat_dst, 1e-2);
+    }
+
+    /* A step edge in the guide keeps the same edge in src */
+    cv::Mat mat_guide(32, 32, CV_8UC1, cv::Scalar(50));
+    mat_guide(cv::Rect(16, 0, 16, 32)).setTo(200);
+    cv::Mat mat_src(32, 32, CV_32FC1, cv::Scalar(100.0f));
+    mat_src(cv::Rect(16, 0, 16, 32)).setTo(300.0f);
+    EXPECT_EQ_INT(GuidedFilter::kRetOk, guided_filter.Filter(mat_guide, mat_src, mat_dst, 4, 1e-4f));
+    EXPECT_MAT(mat_src, mat_dst, 1.0);
+
+    /* In place, and a color guide is the same as its gray */
+    const cv::Mat mat_guide_color = CreateRandomImage(40, 30, CV_8UC3, 0, 256);
+    cv::Mat mat_guide_gray;
+    cv::cvtColor(mat_guide_color, mat_guide_gray, cv::COLOR_BGR2GRAY);
+    mat_src = CreateDepthImage(40, 30, CV_32FC1, 500.0);
+    cv::Mat mat_expected;
+    EXPECT_EQ_INT(GuidedFilter::kRetOk, guided_filter.Filter(mat_guide_gray, mat_src, mat_expected));
+    EXPECT_EQ_INT(GuidedFilter::kRetOk, guided_filter.Filter(mat_guide_color, mat_src, mat_src));
+    EXPECT_MAT(mat_expected, mat_src, 0);
+
+    EXPECT_EQ_INT(GuidedFilter::kRetErr, guided_filter.Filter(mat_guide, cv::Mat(31, 32, CV_32FC1, cv::Scalar(1.0f)), mat_dst));
+    EXPECT_EQ_INT(GuidedFilter::kRetErr, guided_filter.Filter(cv::Mat(32, 32, CV_16UC1, cv::Scalar(1)), mat_dst, mat_dst));
+    EXPECT_EQ_INT(GuidedFilter::kRetErr, guided_filter.Filter(mat_guide, mat_guide, mat_dst, 0));
+}
+
+static void CheckDepthAlignment(void)
+{
+    /* disparity = 40 * relative + 3 with the holes of the depth image */
+    const cv::Mat mat_relative = CreateRandomImage(97, 61, CV_32FC1, 0.1, 1.0);
+    const cv::Mat mat_hole = CreateDepthImage(97, 61, CV_32FC1, 100.0);
+    cv::Mat mat_disparity(mat_relative.size(), CV_32FC1);
+    int32_t sample_num = 0;
+    for (int32_t y = 0; y < mat_relative.rows; y++) {
+        for (int32_t x = 0; x < mat_relative.cols; x++) {
+            const bool is_valid = mat_hole.at<float>(y, x) > 0;
+            mat_disparity.at<float>(y, x) = is_valid ? 40.0f * mat_relative.at<float>(y, x) + 3.0f : 0.0f;
+            if (is_valid && y % 4 == 0 && x % 4 == 0) sample_num++;
+        }
+    }
+    DepthAlignment depth_alignment;
+    EXPECT(!depth_alignment.IsValid());
+    EXPECT_EQ_INT(DepthAlignment::kRetOk, depth_alignment.Fit(mat_relative, mat_disparity, 4));
+    EXPECT(depth_alignment.IsValid());
+    EXPECT(std::abs(depth_alignment.GetScale() - 40.0f) < 1e-3f && std::abs(depth_alignment.GetShift() - 3.0f) < 1e-3f);
+    EXPECT_EQ_INT(sample_num, depth_alignment.GetSampleNum());
+
+    /* 5 % outliers (e.g. mismatches of stereo) are suppressed by the iterations */
+    cv::Mat mat_disparity_outlier = mat_disparity.clone();
+    for (int32_t y = 0; y < mat_relative.rows; y += 4) {
+        for (int32_t x = 0; x < mat_relative.cols; x += 4) {
+            if ((x / 4 + y / 4) % 20 == 0 && mat_disparity_outlier.at<float>(y, x) > 0) mat_disparity_outlier.at<float>(y, x) += 50.0f;
+        }
+    }
+    EXPECT_EQ_INT(DepthAlignment::kRetOk, depth_alignment.Fit(mat_relative, mat_disparity_outlier, 4, 1));
+    const float error_ols = std::abs(depth_alignment.GetShift() - 3.0f);
+    EXPECT_EQ_INT(DepthAlignment::kRetOk, depth_alignment.Fit(mat_relative, mat_disparity_outlier, 4, 5));
+    const float error_irls = std::abs(depth_alignment.GetShift() - 3.0f);
+    EXPECT(error_irls < error_ols * 0.5f && std::abs(depth_alignment.GetScale() - 40.0f) < 2.0f);
+
+    /* Apply and Fuse: measured disparity where it is valid, otherwise aligned relative depth. Negative is invalid */
+    EXPECT_EQ_INT(DepthAlignment::kRetOk, depth_alignment.Fit(mat_relative, mat_disparity));
+    cv::Mat mat_aligned;
+    EXPECT_EQ_INT(DepthAlignment::kRetOk, depth_alignment.Apply(mat_relative, mat_aligned));
+    cv::Mat mat_expected(mat_relative.size(), CV_32FC1);
+    for (int32_t i = 0; i < static_cast<int32_t>(mat_relative.total()); i++) mat_expected.at<float>(i) = 40.0f * mat_relative.at<float>(i) + 3.0f;
+    EXPECT_MAT(mat_expected, mat_aligned, 1e-3);
+    cv::Mat mat_relative_negative = mat_relative.clone();
+    mat_relative_negative.at<float>(0, 1) = -1.0f;
+    cv::Mat mat_disparity_measured(mat_relative.size(), CV_32FC1, cv::Scalar(0.0f));
+    mat_disparity_measured.at<float>(0, 0) = 10.0f;
+    cv::Mat mat_depth;
+    EXPECT_EQ_INT(DepthAlignment::kRetOk, depth_alignment.Fuse(mat_relative_negative, mat_disparity_measured, 500.0f, 0.1f, mat_depth));
+    EXPECT(std::abs(mat_depth.at<float>(0, 0) - 5.0f) < 1e-4f);
+    EXPECT_EQ_INT(0, mat_depth.at<float>(0, 1));
+    EXPECT(std::abs(mat_depth.at<float>(5, 7) - 50.0f / mat_expected.at<float>(5, 7)) < 1e-4f);
+    EXPECT_EQ_INT(DepthAlignment::kRetOk, depth_alignment.Fuse(mat_relative, cv::Mat(), 500.0f, 0.1f, mat_depth));
+    EXPECT(std::abs(mat_depth.at<float>(0, 0) - 50.0f / mat_expected.at<float>(0, 0)) < 1e-4f);
+    EXPECT_EQ_INT(DepthAlignment::kRetErr, depth_alignment.Fuse(mat_relative, cv::Mat(2, 3, CV_32FC1), 500.0f, 0.1f, mat_depth));
+
+    /* A failed fit keeps the last parameters: no valid disparity, flat relative depth, negative scale, size mismatch */
+    EXPECT_EQ_INT(DepthAlignment::kRetErr, depth_alignment.Fit(mat_relative, cv::Mat(mat_relative.size(), CV_32FC1, cv::Scalar(0.0f))));
+    EXPECT_EQ_INT(DepthAlignment::kRetErr, depth_alignment.Fit(cv::Mat(mat_relative.size(), CV_32FC1, cv::Scalar(0.5f)), mat_disparity));
+    cv::Mat mat_disparity_negative;
+    mat_relative.convertTo(mat_disparity_negative, CV_32FC1, -40.0, 50.0);
+    EXPECT_EQ_INT(DepthAlignment::kRetErr, depth_alignment.Fit(mat_relative, mat_disparity_negative));
+    EXPECT_EQ_INT(DepthAlignment::kRetErr, depth_alignment.Fit(mat_relative, mat_disparity(cv::Rect(0, 0, 96, 61))));
+    EXPECT(depth_alignment.IsValid() && std::abs(depth_alignment.GetScale() - 40.0f) < 1e-3f);
+
+    depth_alignment.Reset();
+    EXPECT(!depth_alignment.IsValid());
+    EXPECT_EQ_INT(DepthAlignment::kRetErr, depth_alignment.Apply(mat_relative, mat_aligned));
+    EXPECT_EQ_INT(DepthAlignment::kRetErr, depth_alignment.Fuse(mat_relative, mat_disparity, 500.0f, 0.1f, mat_depth));
+}
+
+static void CheckGuidedFilterUpsample(void)
+{
+    GuidedFilter guided_filter;
+    const cv::Mat mat_guide = CreateRandomImage(64, 48, CV_8UC1, 0, 256);
+
+    /* A flat surface stays flat whatever the guide is, and the values are scaled */
+    cv::Mat mat_src(12, 16, CV_32FC1, cv::Scalar(10.0f));
+    cv::Mat mat_dst;
+    EXPECT_EQ_INT(GuidedFilter::kRetOk, guided_filter.Upsample(mat_guide, mat_src, mat_dst, 2, 1e-3f, 4.0f));
+    EXPECT(mat_dst.type() == CV_32FC1 && mat_dst.size() == mat_guide.size());
+    EXPECT_MAT(cv::Mat(48, 64, CV_32FC1, cv::Scalar(40.0f)), mat_dst, 1e-3);
+
+    /* Holes stay holes at the output resolution */
+    mat_src(cv::Rect(4, 4, 2, 2)).setTo(0.0f);
+    EXPECT_EQ_INT(GuidedFilter::kRetOk, guided_filter.Upsample(mat_guide, mat_src, mat_dst, 2, 1e-3f, 4.0f));
+    EXPECT_EQ_INT(0, cv::countNonZero(mat_dst(cv::Rect(16, 16, 8, 8))));
+    EXPECT_EQ_INT(48 * 64 - 8 * 8, cv::countNonZero(mat_dst));
+
+    /* The source must not be larger than the guide */
+    EXPECT_EQ_INT(GuidedFilter::kRetErr, guided_filter.Upsample(mat_guide, cv::Mat(48, 128, CV_32FC1, cv::Scalar(1.0f)), mat_dst));
+    EXPECT_EQ_INT(GuidedFilter::kRetErr, guided_filter.Upsample(cv::Mat(), mat_src, mat_dst));
+}
+
+static void CheckHoleFilling(void)
+{
+    HoleFilling hole_filling;
+    cv::Mat mat_dst;
+    cv::Mat mat_valid;
+
+    /* Valid pixels are kept, and a hole in a ramp is filled within the range of the ramp (odd size for the pyramid) */
+    cv::Mat mat_src(23, 37, CV_32FC1);
+    for (int32_t x = 0; x < mat_src.cols; x++) mat_src.col(x).setTo(10.0f + x);
+    mat_src(cv::Rect(10, 5, 12, 10)).setTo(0.0f);
+    EXPECT_EQ_INT(HoleFilling::kRetOk, hole_filling.Fill(mat_src, mat_dst, mat_valid));
+    EXPECT(mat_dst.type() == CV_32FC1 && mat_valid.type() == CV_8UC1 && mat_dst.size() == mat_src.size());
+    EXPECT_EQ_INT(mat_src.total() - 12 * 10, cv::countNonZero(mat_valid));
+    cv::Mat mat_dst_measured;
+    mat_dst.copyTo(mat_dst_measured, mat_valid);
+    EXPECT_MAT(mat_src, mat_dst_measured, 0);
+    double value_min = 0, value_max = 0;
+    cv::minMaxLoc(mat_dst(cv::Rect(10, 5, 12, 10)), &value_min, &value_max);
+    EXPECT(value_min >= 19.0 && value_max <= 32.0);
+
+    /* One valid pixel fills the image. No valid pixel leaves the image invalid */
+    mat_src.setTo(0.0f);
+    mat_src.at<float>(3, 30) = 7.0f;
+    EXPECT_EQ_INT(HoleFilling::kRetOk, hole_filling.Fill(mat_src, mat_dst, mat_valid));
+    EXPECT_MAT(cv::Mat(mat_src.size(), CV_32FC1, cv::Scalar(7.0f)), mat_dst, 1e-4);
+    EXPECT_EQ_INT(1, cv::countNonZero(mat_valid));
+    mat_src.setTo(0.0f);
+    EXPECT_EQ_INT(HoleFilling::kRetOk, hole_filling.Fill(mat_src, mat_dst, mat_valid));
+    EXPECT_EQ_INT(0, cv::countNonZero(mat_dst));
+
+    /* Holes farther than the levels stay invalid */
+    mat_src = CreateDepthImage(128, 128, CV_8UC1, 200.0);
+    mat_src(cv::Rect(48, 48, 32, 32)).setTo(0);
+    EXPECT_EQ_INT(HoleFilling::kRetOk, hole_filling.Fill(mat_src, mat_dst, mat_valid, 2));
+    EXPECT(mat_dst.at<float>(64, 64) == 0.0f && mat_dst.at<float>(48, 60) > 0.0f);
+    EXPECT_EQ_INT(HoleFilling::kRetErr, hole_filling.Fill(cv::Mat(2, 3, CV_8UC3), mat_dst, mat_valid));
+}
+
+/* Every ISA must return exactly the same output as the generic one, including the remainder of SIMD loops */
+static void CheckCpuDispatch(void)
+{
+    const CpuDispatch::Isa isa_org = CpuDispatch::GetIsa();
+    cv::Mat mat_float = CreateRandomImage(1000, 1, CV_32FC1, -50.0, 600.0);
+    mat_float.at<float>(3) = std::numeric_limits<float>::quiet_NaN();
+    mat_float.at<float>(4) = std::numeric_limits<float>::infinity();
+    mat_float.at<float>(5) = -std::numeric_limits<float>::infinity();
+    mat_float.at<float>(6) = 0.0f;
+    mat_float.at<float>(7) = -0.0f;
+    mat_float.at<float>(8) = 1e-30f;
+    const cv::Mat mat_uint8 = CreateRandomImage(4000, 1, CV_8UC1, 0, 256);
+    const cv::Mat mat_lut = CreateRandomImage(256, 1, CV_8UC3, 0, 256);
+    cv::Mat mat_uint16 = CreateRandomImage(1000, 1, CV_16UC1, 0, 65536);
+    mat_uint16.colRange(0, 200).setTo(0, mat_uint16.colRange(0, 200) < 20000);
+    mat_uint16.at<uint16_t>(10) = 65535;
+    mat_uint16.at<uint16_t>(11) = 1;
+    const float* src_float = mat_float.ptr<float>();
+    const uint8_t* src_uint8 = mat_uint8.ptr<uint8_t>();
+    const uint16_t* src_uint16 = mat_uint16.ptr<uint16_t>();
+
+    for (int32_t i = 0; i < CpuDispatch::kIsaNum; i++) {
+        const CpuDispatch::Isa isa = static_cast<CpuDispatch::Isa>(i);
+        if (!CpuDispatch::IsAvailable(isa)) continue;
+        PRINT("ISA: %s\n", CpuDispatch::GetIsaName(isa));
+        for (int32_t num : { 0, 1, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 999 }) {
+            for (float scale : { 0.5f, 1.0f / 255.0f, 5000.0f }) {
+                cv::Mat mat_expected(1, num + 1, CV_8UC1, cv::Scalar(123));
+                cv::Mat mat_actual(1, num + 1, CV_8UC1, cv::Scalar(123));
+                CpuDispatch::SetIsa(CpuDispatch::kIsaGeneric);
+                CpuDispatch::ScaleToUint8(src_float, mat_expected.ptr<uint8_t>(), num, scale);
+                CpuDispatch::SetIsa(isa);
+                CpuDispatch::ScaleToUint8(src_float, mat_actual.ptr<uint8_t>(), num, scale);
+                EXPECT_MAT(mat_expected, mat_actual, 0);
+
+                CpuDispatch::SetIsa(CpuDispatch::kIsaGeneric);
+                CpuDispatch::ReciprocalToUint8(src_float, mat_expected.ptr<uint8_t>(), num, scale);
+                CpuDispatch::SetIsa(isa);
+                CpuDispatch::ReciprocalToUint8(src_float, mat_actual.ptr<uint8_t>(), num, scale);
+                EXPECT_MAT(mat_expected, mat_actual, 0);
+            }
+            for (uint16_t scale_q12 : { 0, 1374, 4096, 65535 }) {
+                cv::Mat mat_expected(1, num + 1, CV_8UC1, cv::Scalar(123));
+                cv::Mat mat_actual(1, num + 1, CV_8UC1, cv::Scalar(123));
+                CpuDispatch::SetIsa(CpuDispatch::kIsaGeneric);
+                CpuDispatch::ScaleUint16ToUint8(src_uint16, mat_expected.ptr<uint8_t>(), num, scale_q12);
+                CpuDispatch::SetIsa(isa);
+                CpuDispatch::ScaleUint16ToUint8(src_uint16, mat_actual.ptr<uint8_t>(), num, scale_q12);
+                EXPECT_MAT(mat_expected, mat_actual, 0);
+            }
+            for (float scale : { 0.0f, -1.0f, 300000.0f, 1e10f }) {
+                cv::Mat mat_expected(1, num + 1, CV_16UC1, cv::Scalar(123));
+                cv::Mat mat_actual(1, num + 1, CV_16UC1, cv::Scalar(123));
+                CpuDispatch::SetIsa(CpuDispatch::kIsaGeneric);
+                CpuDispatch::ReciprocalToUint16(src_uint16, mat_expected.ptr<uint16_t>(), num, scale);
+                CpuDispatch::SetIsa(isa);
+                CpuDispatch::ReciprocalToUint16(src_uint16, mat_actual.ptr<uint16_t>(), num, scale);
+                EXPECT_MAT(mat_expected, mat_actual, 0);
+            }
+            for (int32_t stride : { 1, 2, 3, 4 }) {
+                cv::Mat mat_expected(1, num + 1, CV_32FC1, cv::Scalar(-1.0f));
+                cv::Mat mat_actual(1, num + 1, CV_32FC1, cv::Scalar(-1.0f));
+                CpuDispatch::SetIsa(CpuDispatch::kIsaGeneric);
+                CpuDispatch::PackUint8ToFloat(src_uint8 + 1, stride, mat_expected.ptr<float>(), num, 1.0f / 255.0f);
+                CpuDispatch::SetIsa(isa);
+                CpuDispatch::PackUint8ToFloat(src_uint8 + 1, stride, mat_actual.ptr<float>(), num, 1.0f / 255.0f);
+                EXPECT_MAT(mat_expected, mat_actual, 0);
+            }
+            {
+                /* Some frames to go through all the states (blend, motion, hole). The history includes NaN and inf from src */
+                cv::Mat mat_history_expected = cv::Mat::zeros(1, num + 1, CV_32FC1);
+                cv::Mat mat_history_actual = cv::Mat::zeros(1, num + 1, CV_32FC1);
+                cv::Mat mat_count_expected = cv::Mat::zeros(1, num + 1, CV_8UC1);
+                cv::Mat mat_count_actual = cv::Mat::zeros(1, num + 1, CV_8UC1);
+                cv::Mat mat_expected(1, num + 1, CV_32FC1, cv::Scalar(-1.0f));
+                cv::Mat mat_actual(1, num + 1, CV_32FC1, cv::Scalar(-1.0f));
+                for (int32_t frame = 0; frame < 8; frame++) {
+                    const float* src = src_float + (frame * 37) % (mat_float.cols - num);
+                    CpuDispatch::SetIsa(CpuDispatch::kIsaGeneric);
+                    CpuDispatch::TemporalFilter(src, mat_history_expected.ptr<float>(), mat_count_expected.ptr<uint8_t>(), mat_expected.ptr<float>(), num, 0.3f, 0.5f, 2);
+                    CpuDispatch::SetIsa(isa);
+                    CpuDispatch::TemporalFilter(src, mat_history_actual.ptr<float>(), mat_count_actual.ptr<uint8_t>(), mat_actual.ptr<float>(), num, 0.3f, 0.5f, 2);
+                }
+                EXPECT(std::memcmp(mat_history_expected.data, mat_history_actual.data, mat_history_expected.total() * sizeof(float)) == 0);
+                EXPECT(std::memcmp(mat_expected.data, mat_actual.data, mat_expected.total() * sizeof(float)) == 0);
+                EXPECT_MAT(mat_count_expected, mat_count_actual, 0);
+            }
+            {
+                cv::Mat mat_expected(1, num + 1, CV_8UC3, cv::Scalar(1, 2, 3));
+                cv::Mat mat_actual(1, num + 1, CV_8UC3, cv::Scalar(1, 2, 3));
+                CpuDispatch::SetIsa(CpuDispatch::kIsaGeneric);
+                CpuDispatch::ApplyLut3(src_uint8, mat_expected.ptr<uint8_t>(), num, mat_lut.ptr<uint8_t>());
+                CpuDispatch::SetIsa(isa);
+                CpuDispatch::ApplyLut3(src_uint8, mat_actual.ptr<uint8_t>(), num, mat_lut.ptr<uint8_t>());
+                EXPECT_MAT(mat_expected, mat_actual, 0);
+            }
+        }
+        /* SGM kernels. 20 is not a multiple of 16, for the scalar fallback */
+        for (int32_t disparity_num : { 16, 48, 96, 256, 20 }) {
+            for (int32_t width : { 1, 15, 16, 17, 100, 640 }) {
+                const int32_t row_size = width * disparity_num;
+                const cv::Mat mat_census_l = CreateRandomImage(width, 1, CV_32SC1, 0, 1 << 24, 1);
+                const cv::Mat mat_census_r = CreateRandomImage(width, 1, CV_32SC1, 0, 1 << 24, 2);
+                const cv::Mat mat_path_prev = CreateRandomImage(row_size, 1, CV_16UC1, 0, 300);
+                /* small costs for ties in the disparity selection */
+                const cv::Mat mat_sum = CreateRandomImage(row_size, 1, CV_16UC1, 0, 40);
+                cv::Mat mat_cost[2];
+                cv::Mat mat_path[2];
+                cv::Mat mat_path_sum[2];
+                cv::Mat mat_disparity_l[2];
+                cv::Mat mat_disparity_r[2];
+                for (int32_t j = 0; j < 2; j++) {
+                    CpuDispatch::SetIsa(j == 0 ? CpuDispatch::kIsaGeneric : isa);
+                    mat_cost[j] = cv::Mat(1, row_size, CV_8UC1);
+                    CpuDispatch::SgmCensusCost(mat_census_l.ptr<uint32_t>(), mat_census_r.ptr<uint32_t>(), mat_cost[j].ptr<uint8_t>(), width, disparity_num, 24);
+
+                    /* From the previous row, then along the row in both directions */
+                    mat_path[j] = cv::Mat(1, row_size, CV_16UC1);
+                    mat_path_sum[j] = CreateRandomImage(row_size, 1, CV_16UC1, 0, 65536);
+                    const uint8_t* cost = mat_cost[j].ptr<uint8_t>();
+                    uint16_t* path = mat_path[j].ptr<uint16_t>();
+                    uint16_t* sum = mat_path_sum[j].ptr<uint16_t>();
+                    const int32_t last = (width - 1) * disparity_num;
+                    CpuDispatch::SgmAggregate(cost, mat_path_prev.ptr<uint16_t>(), path, sum, width, disparity_num, disparity_num, 7, 3000);
+                    CpuDispatch::SgmAggregate(cost, mat_path_prev.ptr<uint16_t>(), path, sum, width, disparity_num, disparity_num, 4, 48);
+                    CpuDispatch::SgmAggregate(cost, nullptr, path, sum, 1, disparity_num, disparity_num, 4, 48);
+                    CpuDispatch::SgmAggregate(cost + disparity_num, path, path + disparity_num, sum + disparity_num, width - 1, disparity_num, disparity_num, 4, 48);
+                    CpuDispatch::SgmAggregate(cost + last, nullptr, path + last, nullptr, 1, -disparity_num, disparity_num, 4, 48);
+                    if (width > 1) CpuDispatch::SgmAggregate(cost + last - disparity_num, path + last, path + last - disparity_num, sum + last - disparity_num, width - 1, -disparity_num, disparity_num, 4, 48);
+
+                    mat_disparity_l[j] = cv::Mat(1, width, CV_16SC1);
+                    mat_disparity_r[j] = cv::Mat(1, width, CV_16SC1);
+                    cv::Mat mat_work(1, width, CV_16UC1);
+                    CpuDispatch::SgmSelectDisparity(mat_sum.ptr<uint16_t>(), mat_disparity_l[j].ptr<int16_t>(), mat_disparity_r[j].ptr<int16_t>(), mat_work.ptr<uint16_t>(), width, disparity_num, 5);
+                }
+                EXPECT_MAT(mat_cost[0], mat_cost[1], 0);
+                EXPECT_MAT(mat_path[0], mat_path[1], 0);
+                EXPECT_MAT(mat_path_sum[0], mat_path_sum[1], 0);
+                EXPECT_MAT(mat_disparity_l[0], mat_disparity_l[1], 0);
+                EXPECT_MAT(mat_disparity_r[0], mat_disparity_r[1], 0);
+            }
+        }
+        CpuDispatch::SetIsa(isa);
+
+        /* the golden checks of the helpers with this ISA */
+        CheckNormalizeDisparity();
+        CheckConvertDisparity2Depth();
+        CheckConvertDisparity2Depth16();
+        CheckApplyColorMap();
+        CheckTemporalFilter();
+    }
+    CpuDispatch::SetIsa(isa_org);
+}
+
+
+/*** Benchmarks ***/
+static void RunBenchmark(const std::string& name, const std::function<void(void)>& func)
+{
+    for (int32_t i = 0; i < kWarmupNum; i++) func();
+
+    std::vector<double> time_list;
+    const auto t_start = std::chrono::steady_clock::now();
+    while (static_cast<int32_t>(time_list.size()) < kIterationMax) {
+        const auto t0 = std::chrono::steady_clock::now();
+        func();
+        const auto t1 = std::chrono::steady_clock::now();
+        time_list.push_back(static_cast<std::chrono::duration<double>>(t1 - t0).count() * 1000.0);
+        if (static_cast<int32_t>(time_list.size()) >= kIterationMin && static_cast<std::chrono::duration<double>>(t1 - t_start).count() > kTimeMin) break;
+    }
+
+    std::sort(time_list.begin(), time_list.end());
+    double time_sum = 0;
+    for (double t : time_list) time_sum += t;
+    printf("%-44s %8d %10.3f %10.3f %10.3f\n", name.c_str(), static_cast<int32_t>(time_list.size()),
+        time_sum / time_list.size(), time_list[time_list.size() / 2], time_list.front());
+}
+
+static void RunBenchmarkList(const std::string& filter)
+{
+    printf("ISA: %s\n", CpuDispatch::GetIsaName(CpuDispatch::GetIsa()));
+    printf("%-44s %8s %10s %10s %10s\n", "Benchmark", "Iter", "Mean[ms]", "Median[ms]", "Min[ms]");
+
+    std::vector<std::pair<std::string, std::function<void(void)>>> benchmark_list;
+
+    /* CropResizeCvt: 1080p video and 480x480 preview to 384x384 model input */
+    static const char* kCropTypeName[] = { "Stretch", "Cut", "Expand" };
+    for (int32_t crop_type : { CommonHelper::kCropTypeStretch, CommonHelper::kCropTypeCut, CommonHelper::kCropTypeExpand }) {
+        for (const auto& size : { cv::Size(1920, 1080), cv::Size(480, 480) }) {
+            cv::Mat org = CreateRandomImage(size.width, size.height, CV_8UC3, 0, 256);
+            cv::Mat dst = cv::Mat::zeros(384, 384, CV_8UC3);
+            const std::string name = std::string("CropResizeCvt/") + kCropTypeName[crop_type] + "/" + std::to_string(size.width) + "x" + std::to_string(size.height) + "->384x384";
+            benchmark_list.push_back(std::make_pair(name, [org, dst, crop_type]() mutable {
+                int32_t crop_x = 0, crop_y = 0, crop_w = org.cols, crop_h = org.rows;
+                CommonHelper::CropResizeCvt(org, dst, crop_x, crop_y, crop_w, crop_h, true, crop_type, true);
+            }));
+        }
+    }
+
+    /* MiDaS output (384x384) and stereo disparity (640x480) */
+    for (const auto& size : { cv::Size(384, 384), cv::Size(640, 480) }) {
+        cv::Mat mat = CreateRandomImage(size.width, size.height, CV_32FC1, 0.0, 400.0);
+        const std::string size_str = std::to_string(size.width) + "x" + std::to_string(size.height);
+        benchmark_list.push_back(std::make_pair("NormalizeMinMax/" + size_str, [mat]() {
+            cv::Mat mat_out = CommonHelper::NormalizeMinMax(mat);
+        }));
+        benchmark_list.push_back(std::make_pair("NormalizeDisparity/" + size_str, [mat]() {
+            cv::Mat mat_out = CommonHelper::NormalizeDisparity(mat, 400.0f, 1.0f);
+        }));
+        benchmark_list.push_back(std::make_pair("ConvertDisparity2Depth/" + size_str, [mat]() {
+            cv::Mat mat_out = CommonHelper::ConvertDisparity2Depth(mat, 500.0f, 0.2f, 50.0f);
+        }));
+        cv::Mat mat_uint8 = CommonHelper::NormalizeMinMax(mat);
+        benchmark_list.push_back(std::make_pair("ApplyColorMap/" + size_str, [mat_uint8]() {
+            cv::Mat mat_out;
+            CommonHelper::ApplyColorMap(mat_uint8, mat_out, cv::COLORMAP_MAGMA);
+        }));
+        benchmark_list.push_back(std::make_pair("cv::applyColorMap/" + size_str, [mat_uint8]() {
+            cv::Mat mat_out;
+            cv::applyColorMap(mat_uint8, mat_out, cv::COLORMAP_MAGMA);
+        }));
+    }
+
+    /* 16-bit subpixel disparity by DepthAI (1/8 px, up to 95 px) */
+    {
+        const cv::Mat mat = CreateDepthImage(640, 480, CV_16UC1, 760.0);
+        const float scale = 255.0f / (95 * 8);
+        benchmark_list.push_back(std::make_pair("ApplyColorMap/16U/640x480", [mat, scale]() {
+            cv::Mat mat_out;
+            CommonHelper::ApplyColorMap(mat, mat_out, cv::COLORMAP_JET, scale);
+        }));
+        benchmark_list.push_back(std::make_pair("convertTo+cv::applyColorMap/16U/640x480", [mat, scale]() {
+            cv::Mat mat_uint8;
+            cv::Mat mat_out;
+            mat.convertTo(mat_uint8, CV_8UC1, scale);
+            cv::applyColorMap(mat_uint8, mat_out, cv::COLORMAP_JET);
+        }));
+        benchmark_list.push_back(std::make_pair("ConvertDisparity2Depth16/640x480", [mat]() {
+            cv::Mat mat_out = CommonHelper::ConvertDisparity2Depth16(mat, 300000.0f);
+        }));
+    }
+
+    /* Disparity by DepthAI (640x480) and HITNET / MiDaS at 1080p after upsampling */
+    for (const auto& size : { cv::Size(640, 480), cv::Size(1920, 1080) }) {
+        const std::string size_str = std::to_string(size.width) + "x" + std::to_string(size.height);
+        const cv::Mat mat0 = CreateDepthImage(size.width, size.height, CV_32FC1, 200.0, 1);
+        const cv::Mat mat1 = CreateDepthImage(size.width, size.height, CV_32FC1, 200.0, 2);
+        auto temporal_filter = std::make_shared<TemporalFilter>();
+        auto frame_cnt = std::make_shared<int32_t>(0);
+        benchmark_list.push_back(std::make_pair("TemporalFilter/" + size_str, [mat0, mat1, temporal_filter, frame_cnt]() {
+            cv::Mat mat_out;
+            temporal_filter->Filter(((*frame_cnt)++ % 2) ? mat1 : mat0, mat_out, 0.4f, 0.1f, 2);
+        }));
+    }
+
+    /* HITNET (320x240) to the camera image, and MiDaS (384x384) to 1080p */
+    for (const auto& size_pair : { std::make_pair(cv::Size(320, 240), cv::Size(640, 480)), std::make_pair(cv::Size(384, 384), cv::Size(1920, 1080)) }) {
+        const std::string size_str = std::to_string(size_pair.first.width) + "x" + std::to_string(size_pair.first.height)
+            + "->" + std::to_string(size_pair.second.width) + "x" + std::to_string(size_pair.second.height);
+        const cv::Mat mat_src = CreateDepthImage(size_pair.first.width, size_pair.first.height, CV_32FC1, 100.0);
+        const cv::Mat mat_guide = CreateRandomImage(size_pair.second.width, size_pair.second.height, CV_8UC3, 0, 256);
+        auto guided_filter = std::make_shared<GuidedFilter>();
+        benchmark_list.push_back(std::make_pair("GuidedFilter/Upsample/" + size_str, [mat_src, mat_guide, guided_filter]() {
+            cv::Mat mat_out;
+            guided_filter->Upsample(mat_guide, mat_src, mat_out, 2, 1e-3f, 2.0f);
+        }));
+        benchmark_list.push_back(std::make_pair("cv::resize/" + size_str, [mat_src, mat_guide]() {
+            cv::Mat mat_out;
+            cv::resize(mat_src, mat_out, mat_guide.size());
+        }));
+    }
+
+    /* Disparity by DepthAI after the filters */
+    {
+        const cv::Mat mat = CreateDepthImage(640, 480, CV_32FC1, 200.0);
+        auto hole_filling = std::make_shared<HoleFilling>();
+        benchmark_list.push_back(std::make_pair("HoleFilling/640x480", [mat, hole_filling]() {
+            cv::Mat mat_out;
+            cv::Mat mat_valid;
+            hole_filling->Fill(mat, mat_out, mat_valid);
+        }));
+        const cv::Mat mat_uint8 = CreateDepthImage(640, 480, CV_8UC1, 200.0);
+        benchmark_list.push_back(std::make_pair("cv::inpaint/640x480", [mat_uint8]() {
+            cv::Mat mat_out;
+            cv::inpaint(mat_uint8, mat_uint8 == 0, mat_out, 3, cv::INPAINT_TELEA);
+        }));
+    }
+
+    /* SGM kernels for a row of the mono camera (640) with the disparity range of DepthSgmEngine */
+    {
+        const int32_t width = 640;
+        const int32_t disparity_num = 96;
+        const int32_t row_size = width * disparity_num;
+        const cv::Mat mat_census_l = CreateRandomImage(width, 1, CV_32SC1, 0, 1 << 24, 1);
+        const cv::Mat mat_census_r = CreateRandomImage(width, 1, CV_32SC1, 0, 1 << 24, 2);
+        const cv::Mat mat_cost = CreateRandomImage(row_size, 1, CV_8UC1, 0, 25);
+        const cv::Mat mat_path_prev = CreateRandomImage(row_size, 1, CV_16UC1, 0, 100);
+        const cv::Mat mat_sum = CreateRandomImage(row_size, 1, CV_16UC1, 0, 600);
+        benchmark_list.push_back(std::make_pair("Sgm/CensusCost/640x96", [mat_census_l, mat_census_r, row_size, width, disparity_num]() {
+            cv::Mat mat_out(1, row_size, CV_8UC1);
+            CpuDispatch::SgmCensusCost(mat_census_l.ptr<uint32_t>(), mat_census_r.ptr<uint32_t>(), mat_out.ptr<uint8_t>(), width, disparity_num, 24);
+        }));
+        cv::Mat mat_path_sum = mat_sum.clone();
+        benchmark_list.push_back(std::make_pair("Sgm/Aggregate/640x96", [mat_cost, mat_path_prev, mat_path_sum, row_size, width, disparity_num]() mutable {
+            cv::Mat mat_out(1, row_size, CV_16UC1);
+            CpuDispatch::SgmAggregate(mat_cost.ptr<uint8_t>(), mat_path_prev.ptr<uint16_t>(), mat_out.ptr<uint16_t>(), mat_path_sum.ptr<uint16_t>(), width, disparity_num, disparity_num, 4, 48);
+        }));
+        benchmark_list.push_back(std::make_pair("Sgm/SelectDisparity/640x96", [mat_sum, width, disparity_num]() {
+            cv::Mat mat_disparity_l(1, width, CV_16SC1);
+            cv::Mat mat_disparity_r(1, width, CV_16SC1);
+            cv::Mat mat_work(1, width, CV_16UC1);
+            CpuDispatch::SgmSelectDisparity(mat_sum.ptr<uint16_t>(), mat_disparity_l.ptr<int16_t>(), mat_disparity_r.ptr<int16_t>(), mat_work.ptr<uint16_t>(), width, disparity_num, 5);
+        }));
+    }
+
+    /* Disparity by DepthAI (8-bit, or 16-bit with subpixel) and HITNET in fixed point */
+    for (int32_t type : { CV_16UC1, CV_8UC1 }) {
+        const cv::Mat mat = CreateDepthImage(640, 480, type, (type == CV_16UC1) ? 3000.0 : 200.0);
+        const std::string type_str = (type == CV_16UC1) ? "16U" : "8U";
+        auto buffer = std::make_shared<std::vector<uint8_t>>(DepthCodec::GetMaxEncodedSize(static_cast<int32_t>(mat.total())));
+        size_t encoded_size = 0;
+        DepthCodec::Encode(mat, buffer->data(), buffer->size(), encoded_size);
+        benchmark_list.push_back(std::make_pair("DepthCodec/Encode/640x480/" + type_str, [mat, buffer]() {
+            size_t encoded_size = 0;
+            DepthCodec::Encode(mat, buffer->data(), buffer->size(), encoded_size);
+        }));
+        benchmark_list.push_back(std::make_pair("DepthCodec/Decode/640x480/" + type_str, [mat, buffer, encoded_size]() {
+            cv::Mat mat_out;
+            DepthCodec::Decode(buffer->data(), encoded_size, mat.rows, mat.cols, mat.type(), mat_out);
+        }));
+    }
+
+    for (const auto& benchmark : benchmark_list) {
+        if (!filter.empty() && benchmark.first.find(filter) == std::string::npos) continue;
+        RunBenchmark(benchmark.first, benchmark.second);
+    }
+}
+
+/* Encode and decode every frame of the depth streams, and check the round trip */
+static int32_t RunCodecBenchmark(const std::string& filename, const std::string& filter)
+{
+    FrameReader reader;
+    if (reader.Open(filename) != FrameReader::kRetOk) {
+        PRINT_E("Unable to open %s\n", filename.c_str());
+        return -1;
+    }
+    printf("%-24s %8s %10s %10s %8s %12s %12s\n", "Stream", "Frames", "Raw[MB]", "RVL[MB]", "Ratio", "Enc[MB/s]", "Dec[MB/s]");
+    for (int32_t stream_id = 0; stream_id < reader.GetStreamNum(); stream_id++) {
+        const std::string& name = reader.GetStreamName(stream_id);
+        if (!filter.empty() && name.find(filter) == std::string::npos) continue;
+
+        uint64_t size_raw = 0;
+        uint64_t size_encoded = 0;
+        double time_encode = 0;
+        double time_decode = 0;
+        int32_t frame_num = 0;
+        std::vector<uint8_t> buffer;
+        cv::Mat mat_decoded;
+        for (int32_t frame_index = 0; frame_index < reader.GetFrameNum(stream_id); frame_index++) {
+            FrameReader::Frame frame;
+            if (reader.GetFrame(stream_id, frame_index, frame) != FrameReader::kRetOk) break;
+            if (!DepthCodec::IsSupported(frame.mat.type())) break;
+            buffer.resize(DepthCodec::GetMaxEncodedSize(static_cast<int32_t>(frame.mat.total())));
+            size_t encoded_size = 0;
+            const auto t0 = std::chrono::steady_clock::now();
+            DepthCodec::Encode(frame.mat, buffer.data(), buffer.size(), encoded_size);
+            const auto t1 = std::chrono::steady_clock::now();
+            DepthCodec::Decode(buffer.data(), encoded_size, frame.mat.rows, frame.mat.cols, frame.mat.type(), mat_decoded);
+            const auto t2 = std::chrono::steady_clock::now();
+            EXPECT_MAT(frame.mat, mat_decoded, 0);
+            time_encode += static_cast<std::chrono::duration<double>>(t1 - t0).count();
+            time_decode += static_cast<std::chrono::duration<double>>(t2 - t1).count();
+            size_raw += frame.mat.total() * frame.mat.elemSize();
+            size_encoded += encoded_size;
+            frame_num++;
+        }
+        if (frame_num == 0) {
+            printf("%-24s (not a depth stream)\n", name.c_str());
+            continue;
+        }
+        const double mb_raw = size_raw / 1024.0 / 1024.0;
+        printf("%-24s %8d %10.2f %10.2f %8.2f %12.1f %12.1f\n", name.c_str(), frame_num, mb_raw, size_encoded / 1024.0 / 1024.0,
+            static_cast<double>(size_raw) / (std::max)(size_encoded, static_cast<uint64_t>(1)), mb_raw / time_encode, mb_raw / time_decode);
+    }
+    return 0;
+}
+
+static void RunCheckList(const std::string& filter)
+{
+    const std::vector<std::pair<std::string, std::function<void(void)>>> check_list = {
+        { "CropResizeCvtRect", CheckCropResizeCvtRect },
+        { "CropResizeCvtPixel", CheckCropResizeCvtPixel },
+        { "NormalizeMinMax", CheckNormalizeMinMax },
+        { "NormalizeDisparity", CheckNormalizeDisparity },
+        { "ConvertDisparity2Depth", CheckConvertDisparity2Depth },
+        { "ConvertDisparity2Depth16", CheckConvertDisparity2Depth16 },
+        { "WarpDisparity", CheckWarpDisparity },
+        { "DepthRoiStats", CheckDepthRoiStats },
+        { "BboxTracker", CheckBboxTracker },
+        { "StageScheduler", CheckStageScheduler },
+        { "FrameRecorder", CheckFrameRecorder },
+        { "Metrics", CheckMetrics },
+        { "ThreadPool", CheckThreadPool },
+        { "ShmFrameRing", CheckShmFrameRing },
+        { "DepthSgmEngine", CheckDepthSgmEngine },
+        { "MatRing", CheckMatRing },
+        { "PooledMatAllocator", CheckPooledMatAllocator },
+        { "ApplyColorMap", CheckApplyColorMap },
+        { "CpuDispatch", CheckCpuDispatch },
+        { "DepthCodec", CheckDepthCodec },
+        { "TemporalFilter", CheckTemporalFilter },
+        { "DepthAlignment", CheckDepthAlignment },
+        { "GuidedFilter", CheckGuidedFilter },
+        { "GuidedFilterUpsample", CheckGuidedFilterUpsample },
+        { "HoleFilling", CheckHoleFilling },
+    };
+    for (const auto& check : check_list) {
+        if (!filter.empty() && check.first.find(filter) == std::string::npos) continue;
+        const int32_t fail_num = s_fail_num;
+        check.second();
+        printf("[%s] %s\n", (fail_num == s_fail_num) ? "PASS" : "FAIL", check.first.c_str());
+    }
+    printf("%d / %d checks passed\n", s_check_num - s_fail_num, s_check_num);
+}
+
+int32_t main(int argc, char* argv[])
+{
+    const std::string mode = (argc > 1) ? argv[1] : "all";
+    if (mode == "codec" && argc > 2) {
+        const int32_t ret = RunCodecBenchmark(argv[2], (argc > 3) ? argv[3] : "");
+        return (ret == 0 && s_fail_num == 0) ? 0 : 1;
+    }
+    const std::string filter = (argc > 2) ? argv[2] : "";
+    if (mode != "all" && mode != "check" && mode != "bench") {
+        printf("usage: %s [check|bench|all] [filter]\n", argv[0]);
+        printf("       %s codec recording.rec [filter]\n", argv[0]);
+        return -1;
+    }
+
+    if (mode == "all" || mode == "check") {
+        RunCheckList(filter);
+    }
+    if (mode == "all" || mode == "bench") {
+        RunBenchmarkList(filter);
+    }
+
+    return (s_fail_num == 0) ? 0 : 1;
+}
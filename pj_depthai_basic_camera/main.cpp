@@ -25,9 +25,12 @@ limitations under the License.
 #include "depthai/depthai.hpp"
 
 /* for My modules */
-
+#include "common_helper_cv.h"
+#include "frame_recorder.h"
 
 /*** Macro ***/
+#define USE_STEREO_SUBPIXEL                     /* disparity in CV_16UC1 of 1/8 px instead of CV_8UC1 of px */
+//#define USE_STEREO_EXTENDED                     /* disparity up to 190 px instead of 95 px, for close objects */
 
 /*** Function ***/
 class DepthAiWrapper
@@ -74,8 +77,18 @@ public:
         stereo->setRectifyEdgeFillColor(0);
         stereo->initialConfig.setMedianFilter(dai::MedianFilter::KERNEL_7x7);
         stereo->setLeftRightCheck(true);
-        stereo->setExtendedDisparity(false);
-        stereo->setSubpixel(false);
+#ifdef USE_STEREO_EXTENDED
+        const bool is_extended = true;
+#else
+        const bool is_extended = false;
+#endif
+#ifdef USE_STEREO_SUBPIXEL
+        const bool is_subpixel = true;
+#else
+        const bool is_subpixel = false;
+#endif
+        stereo->setExtendedDisparity(is_extended);
+        stereo->setSubpixel(is_subpixel);
 
         /*** Linking ***/
         /* Color Camera */
@@ -99,40 +112,61 @@ public:
         queue_mono_camera_rectified_right = device->getOutputQueue("mono_camera_rectified_right", 4, false);
         queue_mono_camera_rectified_left = device->getOutputQueue("mono_camera_rectified_left", 4, false);
         queue_disparity = device->getOutputQueue("disparity", 4, false);
-        disparity_multiplier = 255 / stereo->initialConfig.getMaxDisparity();
+
+        /*** Scale of the raw disparity by the modes set above, instead of getMaxDisparity() ***/
+        disparity_multiplier = 255 * CommonHelper::GetStereoDisparityScale(is_subpixel) / CommonHelper::GetStereoMaxDisparity(is_extended);
     }
     ~DepthAiWrapper() {}
 
-    cv::Mat GetColorCameraVideo()
+    typedef struct FrameInfo_ {
+        int64_t timestamp_us;
+        int64_t sequence_num;
+        FrameInfo_() : timestamp_us(0), sequence_num(0)
+        {}
+    } FrameInfo;
+
+    cv::Mat GetColorCameraVideo(FrameInfo* frame_info = nullptr)
     {
-        return queue_color_camera_video->get<dai::ImgFrame>()->getCvFrame();
+        return GetFrame(queue_color_camera_video, frame_info);
     }
 
-    cv::Mat GetColorCameraPreview()
+    cv::Mat GetColorCameraPreview(FrameInfo* frame_info = nullptr)
     {
-        return queue_color_camera_preview->get<dai::ImgFrame>()->getCvFrame();
+        return GetFrame(queue_color_camera_preview, frame_info);
     }
 
-    cv::Mat GetMonoCameraRectifiedRight()
+    cv::Mat GetMonoCameraRectifiedRight(FrameInfo* frame_info = nullptr)
     {
-        return queue_mono_camera_rectified_right->get<dai::ImgFrame>()->getCvFrame();
+        return GetFrame(queue_mono_camera_rectified_right, frame_info);
     }
 
-    cv::Mat GetMonoCameraRectifiedLeft()
+    cv::Mat GetMonoCameraRectifiedLeft(FrameInfo* frame_info = nullptr)
     {
-        return queue_mono_camera_rectified_left->get<dai::ImgFrame>()->getCvFrame();
+        return GetFrame(queue_mono_camera_rectified_left, frame_info);
     }
 
-    cv::Mat GetDisparity()
+    cv::Mat GetDisparity(FrameInfo* frame_info = nullptr)
     {
-        return queue_disparity->get<dai::ImgFrame>()->getCvFrame();
+        return GetFrame(queue_disparity, frame_info);
     }
 
+    /* raw disparity -> 0 - 255 */
     float GetDisparityMultiplier()
     {
         return disparity_multiplier;
     }
 
+private:
+    static cv::Mat GetFrame(std::shared_ptr<dai::DataOutputQueue>& queue, FrameInfo* frame_info)
+    {
+        auto img_frame = queue->get<dai::ImgFrame>();
+        if (frame_info) {
+            frame_info->timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(img_frame->getTimestamp().time_since_epoch()).count();
+            frame_info->sequence_num = img_frame->getSequenceNum();
+        }
+        return img_frame->getCvFrame();
+    }
+
 private:
     dai::Pipeline pipeline;
     std::unique_ptr<dai::Device> device;
@@ -154,37 +188,65 @@ int32_t main(int argc, char* argv[])
     double total_time_all = 0;
     double total_time_cap = 0;
     double total_time_image_process = 0;
+    double total_time_record = 0;
 
     DepthAiWrapper depth_ai;
 
+    /* Record all the streams if the output filename is specified */
+    FrameRecorder recorder;
+    bool is_recording = false;
+    enum { kStreamVideo = 0, kStreamPreview, kStreamRight, kStreamLeft, kStreamDisparity };
+    if (argc > 1) {
+        if (recorder.Open(argv[1]) != FrameRecorder::kRetOk) {
+            printf("Unable to open %s\n", argv[1]);
+            return -1;
+        }
+        recorder.AddStream("color_camera_video");
+        recorder.AddStream("color_camera_preview");
+        recorder.AddStream("mono_camera_rectified_right");
+        recorder.AddStream("mono_camera_rectified_left");
+        recorder.AddStream("disparity");
+        is_recording = true;
+    }
+
     /*** Process for each frame ***/
     int32_t frame_cnt = 0;
     for (frame_cnt = 0; ; frame_cnt++) {
         const auto& time_all0 = std::chrono::steady_clock::now();
         /* Read image */
         const auto& time_cap0 = std::chrono::steady_clock::now();
-        cv::Mat image_color_camera_video = depth_ai.GetColorCameraVideo();
-        cv::Mat image_color_camera_preview = depth_ai.GetColorCameraPreview();
-        cv::Mat image_mono_camera_rectified_right = depth_ai.GetMonoCameraRectifiedRight();
-        cv::Mat image_mono_camera_rectified_left = depth_ai.GetMonoCameraRectifiedLeft();
-        cv::Mat image_disparity = depth_ai.GetDisparity();
+        DepthAiWrapper::FrameInfo info_video, info_preview, info_right, info_left, info_disparity;
+        cv::Mat image_color_camera_video = depth_ai.GetColorCameraVideo(&info_video);
+        cv::Mat image_color_camera_preview = depth_ai.GetColorCameraPreview(&info_preview);
+        cv::Mat image_mono_camera_rectified_right = depth_ai.GetMonoCameraRectifiedRight(&info_right);
+        cv::Mat image_mono_camera_rectified_left = depth_ai.GetMonoCameraRectifiedLeft(&info_left);
+        cv::Mat image_disparity = depth_ai.GetDisparity(&info_disparity);
         const auto& time_cap1 = std::chrono::steady_clock::now();
+
+        /* Record raw images */
+        const auto& time_record0 = std::chrono::steady_clock::now();
+        if (is_recording) {
+            recorder.Write(kStreamVideo, image_color_camera_video, info_video.timestamp_us, info_video.sequence_num);
+            recorder.Write(kStreamPreview, image_color_camera_preview, info_preview.timestamp_us, info_preview.sequence_num);
+            recorder.Write(kStreamRight, image_mono_camera_rectified_right, info_right.timestamp_us, info_right.sequence_num);
+            recorder.Write(kStreamLeft, image_mono_camera_rectified_left, info_left.timestamp_us, info_left.sequence_num);
+            recorder.Write(kStreamDisparity, image_disparity, info_disparity.timestamp_us, info_disparity.sequence_num);
+        }
+        const auto& time_record1 = std::chrono::steady_clock::now();
         
         /* Call image processor library */
         const auto& time_image_process0 = std::chrono::steady_clock::now();
         const auto& time_image_process1 = std::chrono::steady_clock::now();
 
-        /* Extend disparity range */
+        /* Extend disparity range. The 16-bit disparity is converted to the index of the colormap in integer */
         cv::Mat image_disparity_colored;
-        image_disparity.convertTo(image_disparity_colored, CV_8UC1, depth_ai.GetDisparityMultiplier());
-        cv::applyColorMap(image_disparity_colored, image_disparity_colored, cv::COLORMAP_JET);
+        CommonHelper::ApplyColorMap(image_disparity, image_disparity_colored, cv::COLORMAP_JET, depth_ai.GetDisparityMultiplier());
 
         /* Display result */
         cv::imshow("image_color_camera_video", image_color_camera_video);
         cv::imshow("image_color_camera_preview", image_color_camera_preview);
         cv::imshow("image_mono_camera_rectified_right", image_mono_camera_rectified_right);
         cv::imshow("image_mono_camera_rectified_left", image_mono_camera_rectified_left);
-        cv::imshow("image_disparity", image_disparity);
         cv::imshow("image_disparity_colored", image_disparity_colored);
 
         /* Input key command */
@@ -198,15 +260,18 @@ int32_t main(int argc, char* argv[])
         double time_all = (time_all1 - time_all0).count() / 1000000.0;
         double time_cap = (time_cap1 - time_cap0).count() / 1000000.0;
         double time_image_process = (time_image_process1 - time_image_process0).count() / 1000000.0;
+        double time_record = (time_record1 - time_record0).count() / 1000000.0;
         printf("Total:               %9.3lf [msec]\n", time_all);
         printf("  Capture:           %9.3lf [msec]\n", time_cap);
         printf("  Image processing:  %9.3lf [msec]\n", time_image_process);
+        printf("  Record:            %9.3lf [msec]\n", time_record);
         printf("=== Finished %d frame ===\n\n", frame_cnt);
 
         if (frame_cnt > 0) {    /* do not count the first process because it may include initialize process */
             total_time_all += time_all;
             total_time_cap += time_cap;
             total_time_image_process += time_image_process;
+            total_time_record += time_record;
         }
     }
     
@@ -218,6 +283,17 @@ int32_t main(int argc, char* argv[])
         printf("Total:               %9.3lf [msec]\n", total_time_all / frame_cnt);
         printf("  Capture:           %9.3lf [msec]\n", total_time_cap / frame_cnt);
         printf("  Image processing:  %9.3lf [msec]\n", total_time_image_process / frame_cnt);
+        printf("  Record:            %9.3lf [msec]\n", total_time_record / frame_cnt);
+    }
+
+    /* Finalize recorder */
+    if (is_recording) {
+        FrameRecorder::Statistics statistics = recorder.GetStatistics();
+        recorder.Close();
+        printf("=== Recording ===\n");
+        printf("Frames:              %9llu\n", static_cast<unsigned long long>(statistics.frame_num));
+        printf("Size:                %9.3lf [MByte]\n", statistics.byte_written / 1024.0 / 1024.0);
+        printf("Stall:               %9llu\n", static_cast<unsigned long long>(statistics.stall_num));
     }
 
     cv::waitKey(-1);
@@ -0,0 +1,216 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include "bbox_tracker.h"
+
+/*** Macro ***/
+/* Noise parameters for normalized coordinate */
+static constexpr float kProcessNoise = 4e-6f;       // variance of acceleration [/frame^2]
+static constexpr float kMeasurementNoise = 2.5e-5f; // variance of detected position (about 0.5% of the image)
+static constexpr float kInitialVelocityVariance = 1e-3f;
+
+/*** Function ***/
+void BboxTracker::KalmanFilter1D::Initialize(float position)
+{
+    p = position;
+    v = 0.0f;
+    cov[0][0] = kMeasurementNoise;
+    cov[0][1] = 0.0f;
+    cov[1][0] = 0.0f;
+    cov[1][1] = kInitialVelocityVariance;
+}
+
+void BboxTracker::KalmanFilter1D::Predict(float dt)
+{
+    /* x = F x, P = F P F^T + Q, where F = [1 dt; 0 1] */
+    p += v * dt;
+    const float c00 = cov[0][0] + dt * (cov[1][0] + cov[0][1]) + dt * dt * cov[1][1];
+    const float c01 = cov[0][1] + dt * cov[1][1];
+    const float c10 = cov[1][0] + dt * cov[1][1];
+    const float c11 = cov[1][1];
+    const float dt2 = dt * dt;
+    cov[0][0] = c00 + kProcessNoise * dt2 * dt / 3.0f;
+    cov[0][1] = c01 + kProcessNoise * dt2 / 2.0f;
+    cov[1][0] = c10 + kProcessNoise * dt2 / 2.0f;
+    cov[1][1] = c11 + kProcessNoise * dt;
+}
+
+void BboxTracker::KalmanFilter1D::Update(float measurement)
+{
+    /* H = [1 0] */
+    const float s = cov[0][0] + kMeasurementNoise;
+    const float k0 = cov[0][0] / s;
+    const float k1 = cov[1][0] / s;
+    const float y = measurement - p;
+    p += k0 * y;
+    v += k1 * y;
+    const float c00 = (1.0f - k0) * cov[0][0];
+    const float c01 = (1.0f - k0) * cov[0][1];
+    const float c10 = cov[1][0] - k1 * cov[0][0];
+    const float c11 = cov[1][1] - k1 * cov[0][1];
+    cov[0][0] = c00;
+    cov[0][1] = c01;
+    cov[1][0] = c10;
+    cov[1][1] = c11;
+}
+
+
+BboxTracker::BboxTracker(float threshold_iou, int32_t min_hit_num, int64_t max_lost_frame_num)
+    : threshold_iou_(threshold_iou), min_hit_num_(min_hit_num), max_lost_frame_num_(max_lost_frame_num)
+{
+    predicted_bbox_list_.reserve(kMaxTrackNum);
+    Reset();
+}
+
+void BboxTracker::Reset(void)
+{
+    for (auto& track : track_state_list_) {
+        track.is_active = false;
+    }
+    track_id_next_ = 0;
+}
+
+float BboxTracker::CalculateIoU(const Bbox& a, const Bbox& b)
+{
+    const float x0 = (std::max)(a.x, b.x);
+    const float y0 = (std::max)(a.y, b.y);
+    const float x1 = (std::min)(a.x + a.w, b.x + b.w);
+    const float y1 = (std::min)(a.y + a.h, b.y + b.h);
+    if (x1 <= x0 || y1 <= y0) return 0.0f;
+    const float area_intersection = (x1 - x0) * (y1 - y0);
+    const float area_union = a.w * a.h + b.w * b.h - area_intersection;
+    return (area_union > 0.0f) ? area_intersection / area_union : 0.0f;
+}
+
+BboxTracker::Bbox BboxTracker::GetBbox(const TrackState& track, float dt)
+{
+    const float cx = track.filter_cx.p + track.filter_cx.v * dt;
+    const float cy = track.filter_cy.p + track.filter_cy.v * dt;
+    const float w = (std::max)(0.0f, track.filter_w.p + track.filter_w.v * dt);
+    const float h = (std::max)(0.0f, track.filter_h.p + track.filter_h.v * dt);
+    return Bbox(track.class_id, track.score, cx - w / 2, cy - h / 2, w, h);
+}
+
+void BboxTracker::Update(const std::vector<Bbox>& detection_list, int64_t sequence_num)
+{
+    /* Predict all the tracks to the frame of the detections */
+    predicted_bbox_list_.resize(kMaxTrackNum);
+    for (int32_t i = 0; i < kMaxTrackNum; i++) {
+        TrackState& track = track_state_list_[i];
+        if (!track.is_active) continue;
+        const float dt = static_cast<float>(sequence_num - track.sequence_num_state);
+        if (dt > 0) {
+            track.filter_cx.Predict(dt);
+            track.filter_cy.Predict(dt);
+            track.filter_w.Predict(dt);
+            track.filter_h.Predict(dt);
+            track.sequence_num_state = sequence_num;
+        }
+        predicted_bbox_list_[i] = GetBbox(track, 0.0f);
+    }
+
+    /* Associate detections to tracks greedily in descending order of IoU. Allocated only when more detections than ever arrive */
+    candidate_list_.clear();
+    candidate_list_.reserve(kMaxTrackNum * detection_list.size());
+    for (int32_t i = 0; i < kMaxTrackNum; i++) {
+        if (!track_state_list_[i].is_active) continue;
+        for (int32_t j = 0; j < static_cast<int32_t>(detection_list.size()); j++) {
+            if (detection_list[j].class_id != track_state_list_[i].class_id) continue;
+            const float iou = CalculateIoU(predicted_bbox_list_[i], detection_list[j]);
+            if (iou >= threshold_iou_) {
+                candidate_list_.push_back({ iou, i, j });
+            }
+        }
+    }
+    std::sort(candidate_list_.begin(), candidate_list_.end(), [](const Candidate& a, const Candidate& b) { return a.iou > b.iou; });
+
+    std::array<bool, kMaxTrackNum> is_track_matched_list;
+    is_track_matched_list.fill(false);
+    is_detection_matched_list_.assign(detection_list.size(), false);
+    for (const auto& candidate : candidate_list_) {
+        if (is_track_matched_list[candidate.track_index] || is_detection_matched_list_[candidate.detection_index]) continue;
+        is_track_matched_list[candidate.track_index] = true;
+        is_detection_matched_list_[candidate.detection_index] = true;
+
+        TrackState& track = track_state_list_[candidate.track_index];
+        const Bbox& detection = detection_list[candidate.detection_index];
+        track.filter_cx.Update(detection.x + detection.w / 2);
+        track.filter_cy.Update(detection.y + detection.h / 2);
+        track.filter_w.Update(detection.w);
+        track.filter_h.Update(detection.h);
+        track.score = detection.score;
+        track.hit_num++;
+        track.lost_update_num = 0;
+        track.sequence_num_last_update = sequence_num;
+    }
+
+    /* Tracks which missed this detection update */
+    for (int32_t i = 0; i < kMaxTrackNum; i++) {
+        if (track_state_list_[i].is_active && !is_track_matched_list[i]) track_state_list_[i].lost_update_num++;
+    }
+
+    /* Start new tracks for unmatched detections */
+    int32_t index_free = 0;
+    for (int32_t j = 0; j < static_cast<int32_t>(detection_list.size()); j++) {
+        if (is_detection_matched_list_[j]) continue;
+        while (index_free < kMaxTrackNum && track_state_list_[index_free].is_active) index_free++;
+        if (index_free >= kMaxTrackNum) break;     /* storage is full. drop the rest */
+
+        const Bbox& detection = detection_list[j];
+        TrackState& track = track_state_list_[index_free];
+        track.is_active = true;
+        track.id = track_id_next_++;
+        track.class_id = detection.class_id;
+        track.score = detection.score;
+        track.hit_num = 1;
+        track.lost_update_num = 0;
+        track.sequence_num_last_update = sequence_num;
+        track.sequence_num_state = sequence_num;
+        track.filter_cx.Initialize(detection.x + detection.w / 2);
+        track.filter_cy.Initialize(detection.y + detection.h / 2);
+        track.filter_w.Initialize(detection.w);
+        track.filter_h.Initialize(detection.h);
+    }
+
+    /* Delete lost tracks */
+    for (auto& track : track_state_list_) {
+        if (track.is_active && sequence_num - track.sequence_num_last_update > max_lost_frame_num_) {
+            track.is_active = false;
+        }
+    }
+}
+
+void BboxTracker::GetTrackList(int64_t sequence_num, std::vector<Track>& track_list) const
+{
+    track_list.clear();
+    for (const auto& track : track_state_list_) {
+        if (!track.is_active || track.hit_num < min_hit_num_) continue;
+        if (sequence_num - track.sequence_num_last_update > max_lost_frame_num_) continue;    /* deleted at the next Update */
+        Track t;
+        t.id = track.id;
+        t.bbox = GetBbox(track, static_cast<float>(sequence_num - track.sequence_num_state));
+        t.hit_num = track.hit_num;
+        t.lost_frame_num = sequence_num - track.sequence_num_last_update;
+        t.lost_update_num = track.lost_update_num;
+        track_list.push_back(t);
+    }
+}
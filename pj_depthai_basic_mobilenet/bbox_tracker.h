@@ -0,0 +1,112 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef BBOX_TRACKER_
+#define BBOX_TRACKER_
+
+/* for general */
+#include <cstdint>
+#include <vector>
+#include <array>
+
+/*
+ * SORT-style multi object tracker
+ *   - Each track has constant velocity Kalman filters for center x, center y, width and height (axes are treated independently)
+ *   - Time is measured in frame sequence numbers, so that a track can be extrapolated to any frame between detections
+ *   - Detections are associated to tracks greedily by IoU
+ *   - Track storage is preallocated (kMaxTrackNum)
+ */
+class BboxTracker {
+public:
+    static constexpr int32_t kMaxTrackNum = 64;
+
+    typedef struct Bbox_ {
+        int32_t class_id;
+        float   score;
+        float   x;      // top left. normalized coordinate (0.0 - 1.0)
+        float   y;
+        float   w;
+        float   h;
+        Bbox_() : class_id(0), score(0), x(0), y(0), w(0), h(0)
+        {}
+        Bbox_(int32_t _class_id, float _score, float _x, float _y, float _w, float _h) : class_id(_class_id), score(_score), x(_x), y(_y), w(_w), h(_h)
+        {}
+    } Bbox;
+
+    typedef struct Track_ {
+        int32_t id;
+        Bbox    bbox;           // extrapolated to the requested sequence number
+        int32_t hit_num;        // number of detections associated
+        int64_t lost_frame_num; // frames since the last associated detection. Not 0 between detections even if tracked (NN_FRAME_SKIP)
+        int32_t lost_update_num;    // detection updates (Update) missed since the last associated detection. 0 while tracked
+        Track_() : id(0), hit_num(0), lost_frame_num(0), lost_update_num(0)
+        {}
+    } Track;
+
+public:
+    BboxTracker(float threshold_iou = 0.3f, int32_t min_hit_num = 2, int64_t max_lost_frame_num = 30);
+    ~BboxTracker() {}
+    void Reset(void);
+    void Update(const std::vector<Bbox>& detection_list, int64_t sequence_num);
+    void GetTrackList(int64_t sequence_num, std::vector<Track>& track_list) const;
+
+private:
+    typedef struct KalmanFilter1D_ {
+        float p;        // position
+        float v;        // velocity [/frame]
+        float cov[2][2];
+        void Initialize(float position);
+        void Predict(float dt);
+        void Update(float measurement);
+    } KalmanFilter1D;
+
+    typedef struct TrackState_ {
+        bool    is_active;
+        int32_t id;
+        int32_t class_id;
+        float   score;
+        int32_t hit_num;
+        int32_t lost_update_num;
+        int64_t sequence_num_last_update;
+        int64_t sequence_num_state;     // sequence number which the filter state corresponds to
+        KalmanFilter1D filter_cx;
+        KalmanFilter1D filter_cy;
+        KalmanFilter1D filter_w;
+        KalmanFilter1D filter_h;
+    } TrackState;
+
+    typedef struct Candidate_ {
+        float   iou;
+        int32_t track_index;
+        int32_t detection_index;
+    } Candidate;
+
+private:
+    static float CalculateIoU(const Bbox& a, const Bbox& b);
+    static Bbox GetBbox(const TrackState& track, float dt);
+
+private:
+    std::array<TrackState, kMaxTrackNum> track_state_list_;
+    int32_t track_id_next_;
+    float threshold_iou_;
+    int32_t min_hit_num_;
+    int64_t max_lost_frame_num_;
+
+    /* work buffers to avoid allocation in Update */
+    std::vector<Bbox> predicted_bbox_list_;
+    std::vector<Candidate> candidate_list_;
+    std::vector<bool> is_detection_matched_list_;
+};
+
+#endif
@@ -19,17 +19,37 @@ limitations under the License.
 #include <string>
 #include <algorithm>
 #include <chrono>
+#include <deque>
 
 /* for OpenCV */
 //#include <opencv2/opencv.hpp>
 #include "depthai/depthai.hpp"
 
 /* for My modules */
-
+#include "depth_roi_stats.h"
+#include "bbox_tracker.h"
 
 /*** Macro ***/
 #define MODEL_FILENAME RESOURCE_DIR"/model/mobilenet-ssd_openvino_2021.2_6shave.blob"
 
+/* Run NN for every N frames. Boxes on the other frames are interpolated by the host side tracker */
+#define NN_FRAME_SKIP           2
+#define NN_INFERENCE_THREADS    1
+
+/* Number of preview (and depth) frames kept to find the frame which detections (and the preview) come from */
+#define FRAME_HISTORY_NUM       16
+/* Depth is paired with the preview frame by the nearest timestamp within this [usec]. Sequence numbers of the mono and color cameras are independent */
+#define DEPTH_SYNC_TOLERANCE    15000
+
+/* Depth by DepthAI. Subpixel makes far depth finer (disparity in 1/8 px), and extended disparity makes the minimum depth half */
+#define USE_STEREO_SUBPIXEL
+//#define USE_STEREO_EXTENDED
+
+/* Depth range used for distance of each object [mm] */
+#define DEPTH_MIN               100
+#define DEPTH_MAX               10000
+#define DEPTH_BIN_NUM           128
+
 /*** Function ***/
 class DepthAiWrapper
 {
@@ -41,7 +61,12 @@ public:
         auto color_camera = pipeline.create<dai::node::ColorCamera>();
         auto manip = pipeline.create<dai::node::ImageManip>();
         /* MobileNet */
+        auto script_frame_skip = pipeline.create<dai::node::Script>();
         auto nn = pipeline.create<dai::node::MobileNetDetectionNetwork>();
+        /* Stereo Camera */
+        auto mono_camera_right = pipeline.create<dai::node::MonoCamera>();
+        auto mono_camera_left = pipeline.create<dai::node::MonoCamera>();
+        auto stereo = pipeline.create<dai::node::StereoDepth>();
 
         /*** Define output ***/
         /* Color Camera */
@@ -50,6 +75,9 @@ public:
         /* MobileNet */
         auto nnOut = pipeline.create<dai::node::XLinkOut>();
         nnOut->setStreamName("nn");
+        /* Stereo Camera */
+        auto xout_depth = pipeline.create<dai::node::XLinkOut>();
+        xout_depth->setStreamName("depth");
 
         /*** Properties ***/
         /* Color Camera */
@@ -63,10 +91,41 @@ public:
         manip->initialConfig.setResize(300, 300);
         manip->initialConfig.setFrameType(dai::ImgFrame::Type::BGR888p);
         /* MobileNet */
+        /* Forward every NN_FRAME_SKIP-th frame to NN. Sequence number is kept, so that detections can be paired with preview frames */
+        script_frame_skip->setScript(
+            "count = 0\n"
+            "while True:\n"
+            "    frame = node.io['in'].get()\n"
+            "    if count % " + std::to_string(NN_FRAME_SKIP) + " == 0:\n"
+            "        node.io['out'].send(frame)\n"
+            "    count += 1\n");
+        script_frame_skip->inputs["in"].setBlocking(false);
+        script_frame_skip->inputs["in"].setQueueSize(2);
         nn->setConfidenceThreshold(0.5);
         nn->setBlobPath(MODEL_FILENAME);
-        nn->setNumInferenceThreads(2);
+        nn->setNumInferenceThreads(NN_INFERENCE_THREADS);
         nn->input.setBlocking(false);
+        nn->input.setQueueSize(1);
+        /* Stereo Camera */
+        mono_camera_right->setBoardSocket(dai::CameraBoardSocket::RIGHT);
+        mono_camera_right->setResolution(dai::MonoCameraProperties::SensorResolution::THE_400_P);
+        mono_camera_left->setBoardSocket(dai::CameraBoardSocket::LEFT);
+        mono_camera_left->setResolution(dai::MonoCameraProperties::SensorResolution::THE_400_P);
+        stereo->setDefaultProfilePreset(dai::node::StereoDepth::PresetMode::HIGH_DENSITY);
+        stereo->setRectifyEdgeFillColor(0);
+        stereo->initialConfig.setMedianFilter(dai::MedianFilter::KERNEL_7x7);
+        stereo->setLeftRightCheck(true);
+#ifdef USE_STEREO_EXTENDED
+        stereo->setExtendedDisparity(true);
+#else
+        stereo->setExtendedDisparity(false);
+#endif
+#ifdef USE_STEREO_SUBPIXEL
+        stereo->setSubpixel(true);
+#else
+        stereo->setSubpixel(false);
+#endif
+        stereo->setDepthAlign(dai::CameraBoardSocket::RGB);     /* so that normalized bbox can be used for depth */
 
         /*** Linking ***/
         /* Color Camera */
@@ -75,8 +134,13 @@ public:
         /* MobileNet */
         //color_camera->preview.link(nn->input);
         color_camera->preview.link(manip->inputImage);
-        manip->out.link(nn->input);
+        manip->out.link(script_frame_skip->inputs["in"]);
+        script_frame_skip->outputs["out"].link(nn->input);
         nn->out.link(nnOut->input);
+        /* Stereo Camera */
+        mono_camera_right->out.link(stereo->right);
+        mono_camera_left->out.link(stereo->left);
+        stereo->depth.link(xout_depth->input);
 
         /*** Connect to deviceand start pipeline ***/
         device = std::make_unique<dai::Device>(pipeline, dai::UsbSpeed::SUPER);
@@ -86,17 +150,44 @@ public:
         queue_color_camera_preview = device->getOutputQueue("color_camera_preview", 4, false);
         /* MobileNet */
         queue_mobilenet = device->getOutputQueue("nn", 4, false);
+        /* Stereo Camera */
+        queue_depth = device->getOutputQueue("depth", 4, false);
     }
     ~DepthAiWrapper() {}
 
-    cv::Mat GetColorCameraPreview()
+    typedef struct FrameInfo_ {
+        int64_t timestamp_us;
+        int64_t sequence_num;
+        FrameInfo_() : timestamp_us(0), sequence_num(0)
+        {}
+    } FrameInfo;
+
+    cv::Mat GetColorCameraPreview(FrameInfo* frame_info = nullptr)
     {
-        return queue_color_camera_preview->get<dai::ImgFrame>()->getCvFrame();
+        auto img_frame = queue_color_camera_preview->get<dai::ImgFrame>();
+        if (frame_info) {
+            frame_info->timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(img_frame->getTimestamp().time_since_epoch()).count();
+            frame_info->sequence_num = img_frame->getSequenceNum();
+        }
+        return img_frame->getCvFrame();
+    }
+
+    /* Depth in [mm] (CV_16UC1). 0 means invalid. Doesn't wait, and returns an empty Mat if no frame has arrived */
+    cv::Mat TryGetDepth(FrameInfo* frame_info = nullptr)
+    {
+        auto img_frame = queue_depth->tryGet<dai::ImgFrame>();
+        if (!img_frame) return cv::Mat();
+        if (frame_info) {
+            frame_info->timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(img_frame->getTimestamp().time_since_epoch()).count();
+            frame_info->sequence_num = img_frame->getSequenceNum();
+        }
+        return img_frame->getFrame(true);
     }
 
-    std::shared_ptr<dai::ImgDetections> GetDetection()
+    /* Return all the detections arrived so far (not only the latest one), so that no result is dropped */
+    std::vector<std::shared_ptr<dai::ImgDetections>> GetDetectionList()
     {
-        return queue_mobilenet->tryGet<dai::ImgDetections>();
+        return queue_mobilenet->tryGetAll<dai::ImgDetections>();
     }
 
 private:
@@ -107,6 +198,8 @@ private:
     std::shared_ptr<dai::DataOutputQueue> queue_color_camera_preview;
     /* MobileNet */
     std::shared_ptr<dai::DataOutputQueue> queue_mobilenet;
+    /* Stereo Camera */
+    std::shared_ptr<dai::DataOutputQueue> queue_depth;
 };
 
 int32_t main(int argc, char* argv[])
@@ -119,33 +212,103 @@ int32_t main(int argc, char* argv[])
 
     DepthAiWrapper depth_ai;
 
+    /* Preview frames waiting for detections. Detections arrive later than the frame because of NN latency */
+    std::deque<std::pair<int64_t, cv::Mat>> frame_history;
+    /* Depth frames to find the one which has the nearest timestamp to the preview frame */
+    std::deque<std::pair<int64_t, cv::Mat>> depth_history;
+    BboxTracker tracker;
+    std::vector<BboxTracker::Bbox> bbox_list;
+    std::vector<BboxTracker::Track> track_list;
+    bbox_list.reserve(BboxTracker::kMaxTrackNum);
+    track_list.reserve(BboxTracker::kMaxTrackNum);
+    cv::Mat image_detection;
+    DepthRoiStats depth_roi_stats;
+
     /*** Process for each frame ***/
     int32_t frame_cnt = 0;
     for (frame_cnt = 0; ; frame_cnt++) {
         const auto& time_all0 = std::chrono::steady_clock::now();
         /* Read image */
         const auto& time_cap0 = std::chrono::steady_clock::now();
-        cv::Mat image_color_camera_preview = depth_ai.GetColorCameraPreview();
+        DepthAiWrapper::FrameInfo frame_info;
+        cv::Mat image_color_camera_preview = depth_ai.GetColorCameraPreview(&frame_info);
+        frame_history.push_back(std::make_pair(frame_info.sequence_num, image_color_camera_preview.clone()));  /* clone because tracks are drawn on the current frame */
+        if (frame_history.size() > FRAME_HISTORY_NUM) frame_history.pop_front();
+        /* Take depth frames arrived so far without waiting. Depth frames ahead of the preview are kept for the next frames */
+        while (true) {
+            DepthAiWrapper::FrameInfo depth_info;
+            cv::Mat image = depth_ai.TryGetDepth(&depth_info);
+            if (image.empty()) break;
+            depth_history.push_back(std::make_pair(depth_info.timestamp_us, image));
+            if (depth_history.size() > FRAME_HISTORY_NUM) depth_history.pop_front();
+        }
+        cv::Mat image_depth;    /* empty if the depth of this frame has not arrived yet or was dropped by the queue */
+        const int64_t timestamp_us_preview = frame_info.timestamp_us;
+        const auto& it_depth = std::min_element(depth_history.begin(), depth_history.end(), [timestamp_us_preview](const std::pair<int64_t, cv::Mat>& a, const std::pair<int64_t, cv::Mat>& b) {
+            return std::abs(a.first - timestamp_us_preview) < std::abs(b.first - timestamp_us_preview);
+        });
+        if (it_depth != depth_history.end() && std::abs(it_depth->first - timestamp_us_preview) <= DEPTH_SYNC_TOLERANCE) image_depth = it_depth->second;
         const auto& time_cap1 = std::chrono::steady_clock::now();
 
         /* Call image processor library */
         const auto& time_image_process0 = std::chrono::steady_clock::now();
+        /* Decode detections and pair them with the frame which has the same sequence number */
+        for (const auto& detections : depth_ai.GetDetectionList()) {
+            const int64_t sequence_num = detections->getSequenceNum();
+            bbox_list.clear();
+            for (const auto& detection : detections->detections) {
+                bbox_list.push_back(BboxTracker::Bbox(detection.label, detection.confidence, detection.xmin, detection.ymin, detection.xmax - detection.xmin, detection.ymax - detection.ymin));
+            }
+            tracker.Update(bbox_list, sequence_num);
+
+            const auto& it = std::find_if(frame_history.begin(), frame_history.end(), [sequence_num](const std::pair<int64_t, cv::Mat>& frame) { return frame.first == sequence_num; });
+            if (it != frame_history.end()) {
+                image_detection = it->second.clone();
+                for (const auto& bbox : bbox_list) {
+                    cv::Rect rect(static_cast<int32_t>(bbox.x * image_detection.cols), static_cast<int32_t>(bbox.y * image_detection.rows), static_cast<int32_t>(bbox.w * image_detection.cols), static_cast<int32_t>(bbox.h * image_detection.rows));
+                    cv::rectangle(image_detection, rect, cv::Scalar(0, 255, 0), 2);
+                }
+            }
+        }
+
+        /* Get tracks interpolated to the current frame */
+        tracker.GetTrackList(frame_info.sequence_num, track_list);
+
+        /* Get distance of each track. Use the center half of bbox to reduce background pixels */
+        std::vector<float> distance_list(track_list.size(), -1.0f);
+        if (!track_list.empty() && !image_depth.empty() && depth_roi_stats.Build(image_depth, DEPTH_MIN, DEPTH_MAX, DEPTH_BIN_NUM) == DepthRoiStats::kRetOk) {
+            for (size_t i = 0; i < track_list.size(); i++) {
+                const auto& bbox = track_list[i].bbox;
+                cv::Rect rect(static_cast<int32_t>((bbox.x + bbox.w / 4) * image_depth.cols), static_cast<int32_t>((bbox.y + bbox.h / 4) * image_depth.rows), static_cast<int32_t>(bbox.w / 2 * image_depth.cols), static_cast<int32_t>(bbox.h / 2 * image_depth.rows));
+                float depth_median = 0;
+                if (depth_roi_stats.GetPercentile(rect, 0.5f, depth_median) == DepthRoiStats::kRetOk) {
+                    distance_list[i] = depth_median / 1000.0f;
+                }
+            }
+        }
         const auto& time_image_process1 = std::chrono::steady_clock::now();
 
-        /* Decode detections */
-        auto detections = depth_ai.GetDetection();
-        if (detections) {
-            for (auto& detection : detections->detections) {
-                int x1 = detection.xmin * image_color_camera_preview.cols;
-                int y1 = detection.ymin * image_color_camera_preview.rows;
-                int x2 = detection.xmax * image_color_camera_preview.cols;
-                int y2 = detection.ymax * image_color_camera_preview.rows;
-                cv::rectangle(image_color_camera_preview, cv::Rect(cv::Point(x1, y1), cv::Point(x2, y2)), cv::Scalar(0, 255, 0), cv::FONT_HERSHEY_SIMPLEX);
+        /* Draw tracks */
+        for (size_t i = 0; i < track_list.size(); i++) {
+            const auto& track = track_list[i];
+            const auto& bbox = track.bbox;
+            cv::Rect rect(static_cast<int32_t>(bbox.x * image_color_camera_preview.cols), static_cast<int32_t>(bbox.y * image_color_camera_preview.rows), static_cast<int32_t>(bbox.w * image_color_camera_preview.cols), static_cast<int32_t>(bbox.h * image_color_camera_preview.rows));
+            const cv::Scalar color = (track.lost_update_num == 0) ? cv::Scalar(0, 255, 0) : cv::Scalar(0, 255, 255);
+            cv::rectangle(image_color_camera_preview, rect, color, 2);
+            char text[32];
+            if (distance_list[i] > 0) {
+                snprintf(text, sizeof(text), "%d: %.2f m", track.id, distance_list[i]);
+            } else {
+                snprintf(text, sizeof(text), "%d", track.id);
             }
+            cv::putText(image_color_camera_preview, text, rect.tl(), cv::FONT_HERSHEY_SIMPLEX, 0.5, color, 1);
         }
 
         /* Display result */
         cv::imshow("image_color_camera_preview", image_color_camera_preview);
+        if (!image_detection.empty()) {
+            cv::imshow("image_detection", image_detection);
+        }
 
         /* Input key command */
         int key = cv::waitKey(1);
@@ -24,6 +24,10 @@ limitations under the License.
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
@@ -32,6 +36,10 @@ limitations under the License.
 #include "common_helper.h"
 #include "common_helper_cv.h"
 #include "inference_helper.h"
+#include "thread_pool.h"
+#include "cpu_dispatch.h"
+#include "mat_ring.h"
+#include "depth_alignment.h"
 #include "depth_midasv2_engine.h"
 
 /*** Macro ***/
@@ -40,25 +48,86 @@ limitations under the License.
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
 /* Model parameters */
+/* uint8 BGR NHWC input. Cast, normalization, color order and transpose are folded into the model, so host pre-process is only resize */
+//#define USE_UINT8_INPUT
+#ifdef USE_UINT8_INPUT
+#define MODEL_NAME  "midasv2_384x384_uint8.onnx"
+#define MODEL_NAME_DOWNSCALED  "midasv2_256x256_uint8.onnx"
+#define INPUT_NAME  "0"
+#define INPUT_DIMS  { 1, 384, 384, 3 }
+#define INPUT_DIMS_DOWNSCALED  { 1, 256, 256, 3 }
+#define IS_NCHW     false
+#else
 #define MODEL_NAME  "midasv2_384x384.onnx"
+#define MODEL_NAME_DOWNSCALED  "midasv2_256x256.onnx"
 #define INPUT_NAME  "0"
 #define INPUT_DIMS  { 1, 3, 384, 384 }
+#define INPUT_DIMS_DOWNSCALED  { 1, 3, 256, 256 }
 #define IS_NCHW     true
+#endif
 #define IS_RGB      true
 #define OUTPUT_NAME "1080"
 #define TENSORTYPE  TensorInfo::kTensorTypeFp32
+#ifdef USE_UINT8_INPUT
+#define INPUT_TENSORTYPE  TensorInfo::kTensorTypeUint8
+#else
+#define INPUT_TENSORTYPE  TENSORTYPE
+#endif
+/* Minimum rows per task of ThreadPool for packing the input */
+#define GRAIN_SIZE           16
+/* Frames in flight (input tensors). 2 = pre-process of the next frame overlaps inference of the current frame */
+#define INPUT_SLOT_NUM       2
+/* Output buffers which can be leased at the same time, including the ones in flight. Submit waits for a free one up to RESULT_WAIT_TIMEOUT [msec] */
+#define RESULT_SLOT_NUM      (INPUT_SLOT_NUM + 2)
+#define RESULT_WAIT_TIMEOUT  1000
+/* Tiled mode. Tiles overlap at least TILE_OVERLAP_MIN [px in the input image], and are aligned to each other and blended in the overlap */
+#define TILE_OVERLAP_MIN     64
+#define TILE_ALIGNMENT_SAMPLE_STEP  4
+/* Tiles per inference in tiled mode. > 1 requires the models exported with the batch size */
+#define TILE_BATCH_NUM       1
+#define MODEL_NAME_TILED             MODEL_NAME
+#define MODEL_NAME_DOWNSCALED_TILED  MODEL_NAME_DOWNSCALED
 
 /*** Function ***/
-int32_t DepthMidasv2Engine::Initialize(const std::string& work_dir, const int32_t num_threads)
+/* Blending weight along an axis for the index-th tile: ramps up / down over the overlap with the previous / next tile */
+static void ComputeTileWeight(const std::vector<int32_t>& position_list, int32_t index, int32_t tile_size, std::vector<float>& weight_list)
+{
+    const int32_t num = static_cast<int32_t>(position_list.size());
+    const int32_t overlap_prev = (index > 0) ? position_list[index - 1] + tile_size - position_list[index] : 0;
+    const int32_t overlap_next = (index < num - 1) ? position_list[index] + tile_size - position_list[index + 1] : 0;
+    weight_list.resize(tile_size);
+    for (int32_t i = 0; i < tile_size; i++) {
+        const float weight_prev = (std::min)(1.0f, static_cast<float>(i + 1) / (overlap_prev + 1));
+        const float weight_next = (std::min)(1.0f, static_cast<float>(tile_size - i) / (overlap_next + 1));
+        weight_list[i] = weight_prev * weight_next;
+    }
+}
+
+int32_t DepthMidasv2Engine::Initialize(const std::string& work_dir, const int32_t num_threads, bool is_downscaled, bool is_tiled)
 {
+    StopThread();
+    is_tiled_ = is_tiled;
+    batch_num_ = is_tiled ? TILE_BATCH_NUM : 1;
     /* Set model information */
-    std::string model_filename = work_dir + "/model/" + MODEL_NAME;
+    std::string model_filename = work_dir + "/model/";
+    if (batch_num_ > 1) {
+        model_filename += is_downscaled ? MODEL_NAME_DOWNSCALED_TILED : MODEL_NAME_TILED;
+    } else {
+        model_filename += is_downscaled ? MODEL_NAME_DOWNSCALED : MODEL_NAME;
+    }
 
     /* Set input tensor info */
     input_tensor_info_list_.clear();
-    InputTensorInfo input_tensor_info(INPUT_NAME, TENSORTYPE, IS_NCHW);
-    input_tensor_info.tensor_dims = INPUT_DIMS;
-    input_tensor_info.data_type = InputTensorInfo::kDataTypeImage;
+    InputTensorInfo input_tensor_info(INPUT_NAME, INPUT_TENSORTYPE, IS_NCHW);
+    input_tensor_info.tensor_dims = is_downscaled ? std::vector<int32_t>(INPUT_DIMS_DOWNSCALED) : std::vector<int32_t>(INPUT_DIMS);
+    input_tensor_info.tensor_dims[0] = batch_num_;
+#ifdef USE_UINT8_INPUT
+    input_tensor_info.data_type = InputTensorInfo::kDataTypeBlobNhwc;
+#else
+    /* Packed into NCHW blob on the host in Submit, so that it's done out of the inference thread */
+    input_tensor_info.data_type = InputTensorInfo::kDataTypeBlobNchw;
+#endif
+    /* Not used for blob input. Normalization on the host is value / 255 (mean = 0, norm = 1) */
     input_tensor_info.normalize.mean[0] = 0.0f;
     input_tensor_info.normalize.mean[1] = 0.0f;
     input_tensor_info.normalize.mean[2] = 0.0f;
@@ -92,79 +161,359 @@ int32_t DepthMidasv2Engine::Initialize(const std::string& work_dir, const int32_
         return kRetErr;
     }
 
+    result_ring_.reset(new MatRing(RESULT_SLOT_NUM));
+
+    slot_list_.resize(INPUT_SLOT_NUM);
+    for (int32_t i = 0; i < INPUT_SLOT_NUM; i++) slot_free_list_.push_back(i);
+    is_thread_running_ = true;
+    thread_inference_ = std::thread(&DepthMidasv2Engine::ThreadInference, this);
+
     return kRetOk;
 }
 
+void DepthMidasv2Engine::StopThread(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_thread_running_ = false;
+    }
+    cond_.notify_all();
+    if (thread_inference_.joinable()) thread_inference_.join();
+
+    /* Frames in flight are dropped, and their result buffers are returned */
+    slot_submitted_list_.clear();
+    slot_in_flight_list_.clear();
+    slot_free_list_.clear();
+    slot_list_.clear();
+}
+
 int32_t DepthMidasv2Engine::Finalize()
 {
     if (!inference_helper_) {
         PRINT_E("Inference helper is not created\n");
         return kRetErr;
     }
+    StopThread();
     inference_helper_->Finalize();
+    if (result_ring_ && !result_ring_->WaitAllReleased(RESULT_WAIT_TIMEOUT)) {
+        /* Results are still used. Leave the buffers to them */
+        PRINT_E("%d results are still leased\n", result_ring_->GetLeasedNum());
+        result_ring_.release();
+    }
+    result_ring_.reset();
     return kRetOk;
 }
 
 
+int32_t DepthMidasv2Engine::GetInFlightNum(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int32_t>(slot_in_flight_list_.size());
+}
+
 int32_t DepthMidasv2Engine::Process(const cv::Mat& original_mat, Result& result)
 {
-    if (!inference_helper_) {
+    if (GetInFlightNum() > 0) {
+        PRINT_E("Frames submitted by Submit are in flight\n");
+        return kRetErr;
+    }
+    if (Submit(original_mat) != kRetOk) {
+        return kRetErr;
+    }
+    return Poll(result, -1);
+}
+
+int32_t DepthMidasv2Engine::Submit(const cv::Mat& original_mat)
+{
+    if (!inference_helper_ || !result_ring_) {
         PRINT_E("Inference helper is not created\n");
         return kRetErr;
     }
+
+    int32_t slot_index = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slot_free_list_.empty()) {
+            PRINT_E("Too many frames in flight\n");
+            return kRetErr;
+        }
+        slot_index = slot_free_list_.back();
+        slot_free_list_.pop_back();
+    }
+    /* The slot belongs to this thread until it's pushed to the submitted list */
+    Slot& slot = slot_list_[slot_index];
+    Result& result = slot.result;
+    result = Result();
+
+    /* Tiles. One tile of the whole image unless tiled */
+    const InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+    const int32_t model_height = input_tensor_info.GetHeight();
+    const int32_t model_width = input_tensor_info.GetWidth();
+    slot.tile_x_list.assign(1, 0);
+    slot.tile_y_list.assign(1, 0);
+    int32_t tile_width = original_mat.cols;
+    int32_t tile_height = original_mat.rows;
+    if (is_tiled_) {
+        CommonHelper::ComputeTilePosition(original_mat.cols, model_width, TILE_OVERLAP_MIN, slot.tile_x_list);
+        CommonHelper::ComputeTilePosition(original_mat.rows, model_height, TILE_OVERLAP_MIN, slot.tile_y_list);
+        tile_width = (std::min)(original_mat.cols, model_width);
+        tile_height = (std::min)(original_mat.rows, model_height);
+    }
+    slot.tile_rect_list.clear();
+    for (int32_t tile_y : slot.tile_y_list) {
+        for (int32_t tile_x : slot.tile_x_list) {
+            slot.tile_rect_list.push_back(cv::Rect(tile_x, tile_y, tile_width, tile_height));
+        }
+    }
+
+    /* Lease the output buffer first, so that the engine waits for consumers before spending time on inference */
+    const int32_t output_height = is_tiled_ ? original_mat.rows : model_height;
+    const int32_t output_width = is_tiled_ ? original_mat.cols : model_width;
+    if (result_ring_->Acquire(output_height, output_width, CV_32FC1, result.mat_out, RESULT_WAIT_TIMEOUT) != MatRing::kRetOk) {
+        PRINT_E("All the result buffers are in use\n");
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot_free_list_.push_back(slot_index);
+        return kRetErr;
+    }
+
     /*** PreProcess ***/
     const auto& t_pre_process0 = std::chrono::steady_clock::now();
-    InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
-    /* do resize and color conversion here because some inference engine doesn't support these operations */
-    int32_t crop_x = 0;
-    int32_t crop_y = 0;
-    int32_t crop_w = original_mat.cols;
-    int32_t crop_h = original_mat.rows;
-    cv::Mat img_src = cv::Mat::zeros(input_tensor_info.GetHeight(), input_tensor_info.GetWidth(), CV_8UC3);
-    CommonHelper::CropResizeCvt(original_mat, img_src, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeStretch);
-    //CommonHelper::CropResizeCvt(original_mat, img_src, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeCut);
-    //CommonHelper::CropResizeCvt(original_mat, img_src, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeExpand);
-
-    input_tensor_info.data = img_src.data;
-    input_tensor_info.data_type = InputTensorInfo::kDataTypeImage;
-    input_tensor_info.image_info.width = img_src.cols;
-    input_tensor_info.image_info.height = img_src.rows;
-    input_tensor_info.image_info.channel = img_src.channels();
-    input_tensor_info.image_info.crop_x = 0;
-    input_tensor_info.image_info.crop_y = 0;
-    input_tensor_info.image_info.crop_width = img_src.cols;
-    input_tensor_info.image_info.crop_height = img_src.rows;
-    input_tensor_info.image_info.is_bgr = false;
-    input_tensor_info.image_info.swap_color = false;
-    if (inference_helper_->PreProcess(input_tensor_info_list_) != InferenceHelper::kRetOk) {
-        return kRetErr;
+    /* Blob of all the tiles. The last batch is padded, and the output of the padding is ignored */
+    const int32_t tile_num = static_cast<int32_t>(slot.tile_rect_list.size());
+    const size_t blob_size = static_cast<size_t>((tile_num + batch_num_ - 1) / batch_num_) * batch_num_ * model_width * model_height * 3;
+#if defined(USE_UINT8_INPUT)
+    slot.input_buffer_uint8.resize(blob_size);
+#else
+    slot.input_buffer_fp32.resize(blob_size);
+#endif
+    for (int32_t tile = 0; tile < tile_num; tile++) {
+        PackTile(original_mat, slot.tile_rect_list[tile], slot, tile);
     }
     const auto& t_pre_process1 = std::chrono::steady_clock::now();
+    result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
+    if (is_tiled_) {
+        result.time_tiling = result.time_pre_process;    /* pre-process is cutting the tiles and packing them */
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot.status = kRetOk;
+        slot.is_done = false;
+        slot_submitted_list_.push_back(slot_index);
+        slot_in_flight_list_.push_back(slot_index);
+    }
+    cond_.notify_all();
+    return kRetOk;
+}
 
-    /*** Inference ***/
-    const auto& t_inference0 = std::chrono::steady_clock::now();
-    if (inference_helper_->Process(output_tensor_info_list_) != InferenceHelper::kRetOk) {
+int32_t DepthMidasv2Engine::Poll(Result& result, int32_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (slot_in_flight_list_.empty()) {
+        PRINT_E("No frame in flight\n");
         return kRetErr;
     }
-    const auto& t_inference1 = std::chrono::steady_clock::now();
-
-    /*** PostProcess ***/
-    const auto& t_post_process0 = std::chrono::steady_clock::now();
-    /* Retrieve the result */
-    int32_t output_height = input_tensor_info_list_[0].tensor_dims[2];
-    int32_t output_width = input_tensor_info_list_[0].tensor_dims[3];
-    int32_t output_channel = 1;
-    float* values = output_tensor_info_list_[0].GetDataAsFloat();
-    //printf("%f, %f, %f\n", values[0], values[100], values[400]);
-    cv::Mat mat_out = cv::Mat(output_height, output_width, CV_32FC1, values);  /* value has no specific range */
-    const auto& t_post_process1 = std::chrono::steady_clock::now();
-
-    /* Return the results */
-    result.mat_out = mat_out;
-    result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
-    result.time_inference = static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
-    result.time_post_process = static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0;;
+    const int32_t slot_index = slot_in_flight_list_.front();
+    Slot& slot = slot_list_[slot_index];
+    const auto is_done = [&slot] { return slot.is_done; };
+    if (timeout_ms < 0) {
+        cond_.wait(lock, is_done);
+    } else if (!cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), is_done)) {
+        return kRetErr;     /* not yet */
+    }
+    slot_in_flight_list_.pop_front();
+    const int32_t status = slot.status;
+    if (status == kRetOk) {
+        result = slot.result;
+    }
+    slot.result = Result();     /* the caller has the lease now (or it's returned to the ring if failed) */
+    slot_free_list_.push_back(slot_index);
+    return status;
+}
 
-    return kRetOk;
+void DepthMidasv2Engine::ThreadInference(void)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cond_.wait(lock, [this] { return !is_thread_running_ || !slot_submitted_list_.empty(); });
+        if (!is_thread_running_) break;
+        const int32_t slot_index = slot_submitted_list_.front();
+        slot_submitted_list_.pop_front();
+        lock.unlock();
+        RunInference(slot_list_[slot_index]);
+        lock.lock();
+        slot_list_[slot_index].is_done = true;
+        cond_.notify_all();
+    }
+}
+
+/* Resize the tile to the model, and pack it into the blob of the slot at tile_index */
+void DepthMidasv2Engine::PackTile(const cv::Mat& original_mat, const cv::Rect& rect, Slot& slot, int32_t tile_index)
+{
+    const InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+    const int32_t image_width = input_tensor_info.GetWidth();
+    const int32_t image_height = input_tensor_info.GetHeight();
+    const int32_t image_size = image_width * image_height;
+    const size_t blob_offset = static_cast<size_t>(tile_index) * image_size * 3;
+#ifdef USE_UINT8_INPUT
+    /* The model takes the resized image as it is. Resize directly into the blob */
+    cv::Mat mat_input(image_height, image_width, CV_8UC3, slot.input_buffer_uint8.data() + blob_offset);
+    cv::resize(original_mat(rect), mat_input, mat_input.size());
+#else
+    /* do resize and color conversion here because some inference engine doesn't support these operations */
+    int32_t crop_x = rect.x;
+    int32_t crop_y = rect.y;
+    int32_t crop_w = rect.width;
+    int32_t crop_h = rect.height;
+    slot.mat_input.create(image_height, image_width, CV_8UC3);
+    slot.mat_input.setTo(cv::Scalar(0, 0, 0));     /* border for kCropTypeExpand */
+    CommonHelper::CropResizeCvt(original_mat, slot.mat_input, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeStretch);
+    //CommonHelper::CropResizeCvt(original_mat, slot.mat_input, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeCut);
+    //CommonHelper::CropResizeCvt(original_mat, slot.mat_input, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeExpand);
+
+    /* Pack into planar blob of the slot. Rows are independent, so write directly in the tensor type */
+    const cv::Mat& mat_input = slot.mat_input;
+    float* data = slot.input_buffer_fp32.data() + blob_offset;
+    ThreadPool::GetInstance().ParallelFor(0, image_height, GRAIN_SIZE, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            for (int32_t c = 0; c < 3; c++) {
+                CpuDispatch::PackUint8ToFloat(mat_input.ptr<uint8_t>(y) + c, 3, data + c * image_size + y * image_width, image_width, 1.0f / 255.0f);
+            }
+        }
+    });
+#endif
 }
 
+/* Called in the inference thread, which is the only user of the inference helper while running */
+void DepthMidasv2Engine::RunInference(Slot& slot)
+{
+    Result& result = slot.result;
+    slot.status = kRetErr;
+
+    const int32_t tile_num = static_cast<int32_t>(slot.tile_rect_list.size());
+    const size_t blob_size_per_tile = static_cast<size_t>(input_tensor_info_list_[0].GetWidth()) * input_tensor_info_list_[0].GetHeight() * 3;
+    if (is_tiled_) {
+        slot.tile_out_list.resize(tile_num);
+    }
+    for (int32_t tile_begin = 0; tile_begin < tile_num; tile_begin += batch_num_) {
+        const auto& t_pre_process0 = std::chrono::steady_clock::now();
+        const size_t blob_offset = static_cast<size_t>(tile_begin) * blob_size_per_tile;
+#if defined(USE_UINT8_INPUT)
+        input_tensor_info_list_[0].data = slot.input_buffer_uint8.data() + blob_offset;
+#else
+        input_tensor_info_list_[0].data = slot.input_buffer_fp32.data() + blob_offset;
+#endif
+        if (inference_helper_->PreProcess(input_tensor_info_list_) != InferenceHelper::kRetOk) {
+            return;
+        }
+        const auto& t_pre_process1 = std::chrono::steady_clock::now();
+
+        /*** Inference ***/
+        const auto& t_inference0 = std::chrono::steady_clock::now();
+        if (inference_helper_->Process(output_tensor_info_list_) != InferenceHelper::kRetOk) {
+            return;
+        }
+        const auto& t_inference1 = std::chrono::steady_clock::now();
+
+        /*** PostProcess ***/
+        const auto& t_post_process0 = std::chrono::steady_clock::now();
+        /* Copy the result out of the tensor, so that it stays valid during the next inference */
+        const int32_t tile_end = (std::min)(tile_begin + batch_num_, tile_num);
+        for (int32_t tile = tile_begin; tile < tile_end; tile++) {
+            cv::Mat& mat_out = is_tiled_ ? slot.tile_out_list[tile] : result.mat_out;
+            if (is_tiled_) {
+                mat_out.create(input_tensor_info_list_[0].GetHeight(), input_tensor_info_list_[0].GetWidth(), CV_32FC1);
+            }
+            const size_t output_offset = static_cast<size_t>(tile - tile_begin) * mat_out.total();
+            const float* values = output_tensor_info_list_[0].GetDataAsFloat() + output_offset;
+            std::memcpy(mat_out.data, values, sizeof(float) * mat_out.total());
+        }
+        /* value has no specific range */
+        const auto& t_post_process1 = std::chrono::steady_clock::now();
+
+        result.time_pre_process += static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
+        result.time_inference += static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
+        result.time_post_process += static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0;
+    }
+
+    if (is_tiled_) {
+        const auto& t_stitching0 = std::chrono::steady_clock::now();
+        StitchTiles(slot);
+        const auto& t_stitching1 = std::chrono::steady_clock::now();
+        result.time_stitching = static_cast<std::chrono::duration<double>>(t_stitching1 - t_stitching0).count() * 1000.0;
+        result.time_post_process += result.time_stitching;
+    }
+    slot.status = kRetOk;
+}
+
+/*
+ * Stitch the tile outputs into Result::mat_out
+ *   MiDaS output has unknown scale and shift for each tile. Each tile is aligned to the tiles already stitched
+ *   (scale and shift fitted in the overlap), and blended with weight ramping over the overlap so that seams don't appear
+ */
+void DepthMidasv2Engine::StitchTiles(Slot& slot)
+{
+    cv::Mat& mat_out = slot.result.mat_out;     /* weighted sum, then normalized */
+    const int32_t tile_x_num = static_cast<int32_t>(slot.tile_x_list.size());
+    mat_out.setTo(0);
+    mat_stitch_weight_.create(mat_out.rows, mat_out.cols, CV_32FC1);
+    mat_stitch_weight_.setTo(0);
+
+    for (int32_t tile = 0; tile < static_cast<int32_t>(slot.tile_rect_list.size()); tile++) {
+        const cv::Rect& rect = slot.tile_rect_list[tile];
+        const cv::Mat* mat_tile = &slot.tile_out_list[tile];
+        if (mat_tile->size() != rect.size()) {
+            cv::resize(*mat_tile, mat_tile_resized_, rect.size());
+            mat_tile = &mat_tile_resized_;
+        }
+        ComputeTileWeight(slot.tile_x_list, tile % tile_x_num, rect.width, weight_x_list_);
+        ComputeTileWeight(slot.tile_y_list, tile / tile_x_num, rect.height, weight_y_list_);
+
+        /* Alignment to the stitched values in the overlap. The first tile is the reference */
+        float scale = 1.0f;
+        float shift = 0.0f;
+        if (tile > 0) {
+            mat_tile_reference_.create(rect.height, rect.width, CV_32FC1);
+            ThreadPool::GetInstance().ParallelFor(0, rect.height, GRAIN_SIZE, [&](int32_t y_begin, int32_t y_end) {
+                for (int32_t y = y_begin; y < y_end; y++) {
+                    const float* sum = mat_out.ptr<float>(rect.y + y) + rect.x;
+                    const float* weight = mat_stitch_weight_.ptr<float>(rect.y + y) + rect.x;
+                    float* reference = mat_tile_reference_.ptr<float>(y);
+                    for (int32_t x = 0; x < rect.width; x++) {
+                        reference[x] = (weight[x] > 0) ? sum[x] / weight[x] : 0.0f;     /* 0 = not stitched yet */
+                    }
+                }
+            });
+            DepthAlignment alignment;
+            if (alignment.Fit(*mat_tile, mat_tile_reference_, TILE_ALIGNMENT_SAMPLE_STEP) == DepthAlignment::kRetOk) {
+                scale = alignment.GetScale();
+                shift = alignment.GetShift();
+            }
+        }
+
+        ThreadPool::GetInstance().ParallelFor(0, rect.height, GRAIN_SIZE, [&](int32_t y_begin, int32_t y_end) {
+            for (int32_t y = y_begin; y < y_end; y++) {
+                const float* value = mat_tile->ptr<float>(y);
+                float* sum = mat_out.ptr<float>(rect.y + y) + rect.x;
+                float* weight = mat_stitch_weight_.ptr<float>(rect.y + y) + rect.x;
+                const float weight_y = weight_y_list_[y];
+                for (int32_t x = 0; x < rect.width; x++) {
+                    const float w = weight_x_list_[x] * weight_y;
+                    sum[x] += w * (scale * value[x] + shift);
+                    weight[x] += w;
+                }
+            }
+        });
+    }
+
+    /* Tiles cover the whole image, so weight > 0 everywhere */
+    ThreadPool::GetInstance().ParallelFor(0, mat_out.rows, GRAIN_SIZE, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            float* sum = mat_out.ptr<float>(y);
+            const float* weight = mat_stitch_weight_.ptr<float>(y);
+            for (int32_t x = 0; x < mat_out.cols; x++) {
+                sum[x] /= weight[x];
+            }
+        }
+    });
+}
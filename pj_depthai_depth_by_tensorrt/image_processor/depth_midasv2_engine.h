@@ -22,12 +22,17 @@ limitations under the License.
 #include <vector>
 #include <array>
 #include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
 
 /* for My modules */
 #include "inference_helper.h"
+#include "mat_ring.h"
 
 
 class DepthMidasv2Engine {
@@ -38,26 +43,85 @@ public:
     };
 
     typedef struct Result_ {
-        cv::Mat           mat_out;              // [height, width, 1]. value is 0 - 255
+        cv::Mat           mat_out;              // [height, width, 1]. CV_32FC1. value has no specific range. Leased from the engine until released
         double            time_pre_process;		// [msec]
         double            time_inference;		// [msec]
         double            time_post_process;	// [msec]
-        Result_() : time_pre_process(0), time_inference(0), time_post_process(0)
+        double            time_tiling;          // [msec] cutting and packing the tiles in tiled mode. Included in time_pre_process
+        double            time_stitching;       // [msec] aligning and blending the tiles in tiled mode. Included in time_post_process
+        Result_() : time_pre_process(0), time_inference(0), time_post_process(0), time_tiling(0), time_stitching(0)
         {}
     } Result;
 
+private:
+    /* Input tensor and result of a frame in flight */
+    typedef struct Slot_ {
+        cv::Mat mat_input;      // resized tile (RGB) before packing into the blob
+        std::vector<uint8_t> input_buffer_uint8;
+        std::vector<float> input_buffer_fp32;
+        std::vector<int32_t> tile_x_list;       // tile positions in the input image. One tile of the whole image unless tiled
+        std::vector<int32_t> tile_y_list;
+        std::vector<cv::Rect> tile_rect_list;   // in raster order. Blobs of the tiles are packed in this order
+        std::vector<cv::Mat> tile_out_list;     // output of each tile in the model resolution (tiled mode only)
+        Result  result;         // mat_out is leased at Submit, and filled by the inference thread
+        int32_t status;         // kRetOk / kRetErr, valid when is_done
+        bool    is_done;
+        Slot_() : status(kRetOk), is_done(false) {}
+    } Slot;
+
 public:
-    DepthMidasv2Engine() {}
-    ~DepthMidasv2Engine() {}
-    int32_t Initialize(const std::string& work_dir, const int32_t num_threads);
+    DepthMidasv2Engine() : is_tiled_(false), batch_num_(1), is_thread_running_(false) {}
+    ~DepthMidasv2Engine() { StopThread(); }
+    /*
+     * is_downscaled: use the lower resolution model
+     * is_tiled: split the input image into overlapping tiles of the model input size instead of resizing it to the model,
+     *           and stitch the outputs into Result::mat_out of the input resolution. For high resolution input (e.g. 1080p)
+     */
+    int32_t Initialize(const std::string& work_dir, const int32_t num_threads, bool is_downscaled = false, bool is_tiled = false);
     int32_t Finalize(void);
+    /* Synchronous version of Submit + Poll. Don't call while frames submitted by Submit are in flight */
     int32_t Process(const cv::Mat& original_mat, Result& result);
+    /*
+     * Asynchronous API. Pre-process runs in the caller, and inference and post-process run in the inference thread,
+     * so pre-process of the next frame overlaps inference of the current frame
+     *   Submit: kRetErr if all the input slots are in flight (Poll first), or the result buffer is not available
+     *   Poll: the result of the oldest frame in flight (in the order of Submit). timeout_ms < 0: wait forever
+     *         kRetErr if nothing is in flight, no result within timeout_ms (the frame stays in flight), or the frame failed
+     */
+    int32_t Submit(const cv::Mat& original_mat);
+    int32_t Poll(Result& result, int32_t timeout_ms = -1);
+    int32_t GetInFlightNum(void);
 
+private:
+    void StopThread(void);
+    void ThreadInference(void);
+    void RunInference(Slot& slot);
+    void PackTile(const cv::Mat& original_mat, const cv::Rect& rect, Slot& slot, int32_t tile_index);
+    void StitchTiles(Slot& slot);
 
 private:
     std::unique_ptr<InferenceHelper> inference_helper_;
     std::vector<InputTensorInfo> input_tensor_info_list_;
     std::vector<OutputTensorInfo> output_tensor_info_list_;
+    std::unique_ptr<MatRing> result_ring_;     /* buffers for Result::mat_out */
+    bool is_tiled_;
+    int32_t batch_num_;                         /* tiles per inference */
+    /* Work buffers for stitching, used only in the inference thread */
+    cv::Mat mat_stitch_weight_;
+    cv::Mat mat_tile_resized_;
+    cv::Mat mat_tile_reference_;
+    std::vector<float> weight_x_list_;
+    std::vector<float> weight_y_list_;
+
+    /* Slots keep input blob across frames to avoid allocation. Slot indices are in one of the lists */
+    std::vector<Slot> slot_list_;
+    std::vector<int32_t> slot_free_list_;
+    std::deque<int32_t> slot_submitted_list_;  /* waiting for the inference thread */
+    std::deque<int32_t> slot_in_flight_list_;  /* submitted and not polled yet, in the order of Submit */
+    std::thread thread_inference_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool is_thread_running_;
 };
 
 #endif
@@ -0,0 +1,318 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper.h"
+#include "thread_pool.h"
+#include "cpu_dispatch.h"
+#include "mat_ring.h"
+#include "depth_sgm_engine.h"
+
+/*** Macro ***/
+#define TAG "DepthSgmEngine"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/* Disparity range [px] of the full resolution. Multiple of 32, so that the half for the downscaled engine is a multiple of 16 for SIMD */
+#define DISPARITY_NUM        96
+/* Census window. 24 bits */
+#define CENSUS_RADIUS        2
+#define CENSUS_BITS          ((CENSUS_RADIUS * 2 + 1) * (CENSUS_RADIUS * 2 + 1) - 1)
+/* Penalties of disparity change by 1 and more along a path. 10 / 120 for 64-bit census, scaled to 24 bits */
+#define PENALTY_1            4
+#define PENALTY_2            48
+/* Rows of a strip, and rows above and below a strip where vertical and diagonal paths start */
+#define STRIP_HEIGHT         32
+#define STRIP_OVERLAP        16
+/* [%] The best cost must be lower than the second best (except the neighbors) by this */
+#define UNIQUENESS_RATIO     5
+/* [px] Max difference between the left and right disparity */
+#define LR_CHECK_THRESHOLD   1
+/* Minimum rows per task of ThreadPool for census transform */
+#define GRAIN_SIZE           16
+/* Output buffers which can be leased at the same time. Process waits for a free one up to RESULT_WAIT_TIMEOUT [msec] */
+#define RESULT_SLOT_NUM      3
+#define RESULT_WAIT_TIMEOUT  1000
+
+/*** Function ***/
+int32_t DepthSgmEngine::Initialize(const std::string& work_dir, const int32_t num_threads, bool is_downscaled)
+{
+    is_downscaled_ = is_downscaled;
+    disparity_num_ = is_downscaled ? DISPARITY_NUM / 2 : DISPARITY_NUM;
+    width_ = 0;
+    height_ = 0;
+    result_ring_.reset(new MatRing(RESULT_SLOT_NUM));
+    PRINT("disparity num = %d, path num = %d\n", disparity_num_, path_num_.load());
+    return kRetOk;
+}
+
+int32_t DepthSgmEngine::Finalize()
+{
+    if (!result_ring_) {
+        PRINT_E("Not initialized\n");
+        return kRetErr;
+    }
+    if (!result_ring_->WaitAllReleased(RESULT_WAIT_TIMEOUT)) {
+        /* Results are still used. Leave the buffers to them */
+        PRINT_E("%d results are still leased\n", result_ring_->GetLeasedNum());
+        result_ring_.release();
+    }
+    result_ring_.reset();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        strip_buffer_free_list_.clear();
+        strip_buffer_list_.clear();
+    }
+    census_l_.clear();
+    census_r_.clear();
+    mat_gray_l_.release();
+    mat_gray_r_.release();
+    mat_padded_.release();
+    return kRetOk;
+}
+
+int32_t DepthSgmEngine::SetPathNum(int32_t path_num)
+{
+    if (path_num != kPathNum4 && path_num != kPathNum8) {
+        PRINT_E("Path num(%d) is not supported\n", path_num);
+        return kRetErr;
+    }
+    path_num_ = path_num;
+    return kRetOk;
+}
+
+float DepthSgmEngine::GetMaxDisparity(void)
+{
+    return static_cast<float>(disparity_num_);
+}
+
+int32_t DepthSgmEngine::Process(const cv::Mat& image_src_l, const cv::Mat& image_src_r, Result& result)
+{
+    if (!result_ring_) {
+        PRINT_E("Not initialized\n");
+        return kRetErr;
+    }
+    if (image_src_l.size() != image_src_r.size() || image_src_l.type() != image_src_r.type() || image_src_l.empty()) {
+        PRINT_E("Invalid input image\n");
+        return kRetErr;
+    }
+    result = Result();
+
+    /*** PreProcess ***/
+    const auto& t_pre_process0 = std::chrono::steady_clock::now();
+    /* rectified images from the mono cameras are grayscale */
+    const cv::Mat* image_list[2] = { &image_src_l, &image_src_r };
+    cv::Mat* gray_list[2] = { &mat_gray_l_, &mat_gray_r_ };
+    for (int32_t i = 0; i < 2; i++) {
+        cv::Mat image = *image_list[i];
+        if (image.channels() == 3) {
+            cv::cvtColor(image, *gray_list[i], cv::COLOR_BGR2GRAY);
+            image = *gray_list[i];
+        }
+        if (is_downscaled_) {
+            cv::resize(image, *gray_list[i], cv::Size(image.cols / 2, image.rows / 2), 0, 0, cv::INTER_AREA);
+        } else {
+            *gray_list[i] = image;
+        }
+    }
+    width_ = mat_gray_l_.cols;
+    height_ = mat_gray_l_.rows;
+    CensusTransform(mat_gray_l_, census_l_);
+    CensusTransform(mat_gray_r_, census_r_);
+    const auto& t_pre_process1 = std::chrono::steady_clock::now();
+
+    /*** Inference ***/
+    const auto& t_inference0 = std::chrono::steady_clock::now();
+    if (result_ring_->Acquire(height_, width_, CV_32FC1, result.image, RESULT_WAIT_TIMEOUT) != MatRing::kRetOk) {
+        PRINT_E("All the result buffers are in use\n");
+        return kRetErr;
+    }
+    const int32_t path_num = path_num_;
+    const int32_t strip_num = (height_ + STRIP_HEIGHT - 1) / STRIP_HEIGHT;
+    ThreadPool::GetInstance().ParallelFor(0, strip_num, 1, [&](int32_t strip_begin, int32_t strip_end) {
+        StripBuffer* buffer = AcquireStripBuffer();
+        for (int32_t strip = strip_begin; strip < strip_end; strip++) {
+            ProcessStrip(strip, path_num, *buffer, result.image);
+        }
+        ReleaseStripBuffer(buffer);
+    });
+    const auto& t_inference1 = std::chrono::steady_clock::now();
+
+    result.crop.x = 0;
+    result.crop.y = 0;
+    result.crop.w = image_src_l.cols;
+    result.crop.h = image_src_l.rows;
+    result.max_disparity = static_cast<float>(disparity_num_);
+    result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
+    result.time_inference = static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
+    result.time_post_process = 0;
+    return kRetOk;
+}
+
+void DepthSgmEngine::CensusTransform(const cv::Mat& image, std::vector<uint32_t>& census)
+{
+    cv::copyMakeBorder(image, mat_padded_, CENSUS_RADIUS, CENSUS_RADIUS, CENSUS_RADIUS, CENSUS_RADIUS, cv::BORDER_REPLICATE);
+    census.resize(static_cast<size_t>(width_) * height_);
+    const int32_t width = width_;
+    ThreadPool::GetInstance().ParallelFor(0, height_, GRAIN_SIZE, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            uint32_t* code = census.data() + static_cast<size_t>(y) * width;
+            const uint8_t* center = mat_padded_.ptr<uint8_t>(y + CENSUS_RADIUS) + CENSUS_RADIUS;
+            std::fill(code, code + width, 0u);
+            /* A neighbor at a time for all the pixels in the row, so that the loop over x is vectorized */
+            for (int32_t dy = -CENSUS_RADIUS; dy <= CENSUS_RADIUS; dy++) {
+                const uint8_t* neighbor_row = mat_padded_.ptr<uint8_t>(y + CENSUS_RADIUS + dy) + CENSUS_RADIUS;
+                for (int32_t dx = -CENSUS_RADIUS; dx <= CENSUS_RADIUS; dx++) {
+                    if (dx == 0 && dy == 0) continue;
+                    const uint8_t* neighbor = neighbor_row + dx;
+                    for (int32_t x = 0; x < width; x++) {
+                        code[x] = (code[x] << 1) | static_cast<uint32_t>(neighbor[x] < center[x]);
+                    }
+                }
+            }
+        }
+    });
+}
+
+DepthSgmEngine::StripBuffer* DepthSgmEngine::AcquireStripBuffer(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (strip_buffer_free_list_.empty()) {
+        strip_buffer_list_.push_back(std::unique_ptr<StripBuffer>(new StripBuffer()));
+        return strip_buffer_list_.back().get();
+    }
+    StripBuffer* buffer = strip_buffer_free_list_.back();
+    strip_buffer_free_list_.pop_back();
+    return buffer;
+}
+
+void DepthSgmEngine::ReleaseStripBuffer(StripBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    strip_buffer_free_list_.push_back(buffer);
+}
+
+void DepthSgmEngine::ProcessStrip(int32_t strip, int32_t path_num, StripBuffer& buffer, cv::Mat& mat_disparity)
+{
+    const int32_t width = width_;
+    const int32_t disparity_num = disparity_num_;
+    const int32_t row_size = width * disparity_num;
+    const int32_t y_begin = strip * STRIP_HEIGHT;
+    const int32_t y_end = (std::min)(y_begin + STRIP_HEIGHT, height_);
+    const int32_t y_ext_begin = (std::max)(y_begin - STRIP_OVERLAP, 0);
+    const int32_t y_ext_end = (std::min)(y_end + STRIP_OVERLAP, height_);
+
+    /* Sizes don't change between frames of a stream, so resize doesn't allocate */
+    buffer.cost.resize(static_cast<size_t>(STRIP_HEIGHT + STRIP_OVERLAP * 2) * row_size);
+    buffer.sum.resize(static_cast<size_t>(STRIP_HEIGHT) * row_size);
+    buffer.path_prev.resize(row_size);
+    buffer.path_cur.resize(row_size);
+
+    for (int32_t y = y_ext_begin; y < y_ext_end; y++) {
+        const size_t offset = static_cast<size_t>(y) * width;
+        CpuDispatch::SgmCensusCost(census_l_.data() + offset, census_r_.data() + offset, buffer.cost.data() + static_cast<size_t>(y - y_ext_begin) * row_size, width, disparity_num, CENSUS_BITS);
+    }
+    std::fill(buffer.sum.begin(), buffer.sum.begin() + static_cast<size_t>(y_end - y_begin) * row_size, static_cast<uint16_t>(0));
+    auto cost_row = [&](int32_t y) { return buffer.cost.data() + static_cast<size_t>(y - y_ext_begin) * row_size; };
+    auto sum_row = [&](int32_t y) { return (y >= y_begin && y < y_end) ? buffer.sum.data() + static_cast<size_t>(y - y_begin) * row_size : nullptr; };
+
+    /* Paths along the row: the previous pixel is in the same buffer */
+    uint16_t* path = buffer.path_cur.data();
+    const int32_t last = (width - 1) * disparity_num;
+    for (int32_t y = y_begin; y < y_end; y++) {
+        const uint8_t* cost = cost_row(y);
+        uint16_t* sum = sum_row(y);
+        CpuDispatch::SgmAggregate(cost, nullptr, path, sum, 1, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+        CpuDispatch::SgmAggregate(cost + disparity_num, path, path + disparity_num, sum + disparity_num, width - 1, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+        CpuDispatch::SgmAggregate(cost + last, nullptr, path + last, sum + last, 1, -disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+        CpuDispatch::SgmAggregate(cost + last - disparity_num, path + last, path + last - disparity_num, sum + last - disparity_num, width - 1, -disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+    }
+
+    /* Paths from the previous row. dx: the path comes from x - dx */
+    static const int32_t kDxList[] = { 0, 1, -1 };
+    const int32_t dx_num = (path_num == kPathNum8) ? 3 : 1;
+    for (int32_t dy : { 1, -1 }) {
+        for (int32_t i = 0; i < dx_num; i++) {
+            const int32_t dx = kDxList[i];
+            /* Top to bottom stops at the end of the strip, and bottom to top at the beginning */
+            const int32_t y_start = (dy > 0) ? y_ext_begin : y_ext_end - 1;
+            const int32_t y_stop = (dy > 0) ? y_end : y_begin - 1;
+            uint16_t* path_prev = buffer.path_prev.data();
+            uint16_t* path_cur = buffer.path_cur.data();
+            for (int32_t y = y_start; y != y_stop; y += dy) {
+                const uint8_t* cost = cost_row(y);
+                uint16_t* sum = sum_row(y);
+                uint16_t* sum_last = sum ? sum + last : nullptr;
+                uint16_t* sum_second = sum ? sum + disparity_num : nullptr;
+                if (y == y_start) {
+                    CpuDispatch::SgmAggregate(cost, nullptr, path_cur, sum, width, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+                } else if (dx == 0) {
+                    CpuDispatch::SgmAggregate(cost, path_prev, path_cur, sum, width, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+                } else if (dx > 0) {
+                    CpuDispatch::SgmAggregate(cost, nullptr, path_cur, sum, 1, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+                    CpuDispatch::SgmAggregate(cost + disparity_num, path_prev, path_cur + disparity_num, sum_second, width - 1, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+                } else {
+                    CpuDispatch::SgmAggregate(cost, path_prev + disparity_num, path_cur, sum, width - 1, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+                    CpuDispatch::SgmAggregate(cost + last, nullptr, path_cur + last, sum_last, 1, disparity_num, disparity_num, PENALTY_1, PENALTY_2);
+                }
+                std::swap(path_prev, path_cur);
+            }
+        }
+    }
+
+    for (int32_t y = y_begin; y < y_end; y++) {
+        SelectDisparity(sum_row(y), buffer, mat_disparity.ptr<float>(y));
+    }
+}
+
+void DepthSgmEngine::SelectDisparity(const uint16_t* sum, StripBuffer& buffer, float* disparity)
+{
+    const int32_t width = width_;
+    const int32_t disparity_num = disparity_num_;
+    buffer.disparity_l.resize(width);
+    buffer.disparity_r.resize(width);
+    buffer.cost_min_r.resize(width);
+    CpuDispatch::SgmSelectDisparity(sum, buffer.disparity_l.data(), buffer.disparity_r.data(), buffer.cost_min_r.data(), width, disparity_num, UNIQUENESS_RATIO);
+
+    for (int32_t x = 0; x < width; x++) {
+        const int32_t d = buffer.disparity_l[x];
+        if (d <= 0 || std::abs(buffer.disparity_r[x - d] - d) > LR_CHECK_THRESHOLD) {
+            disparity[x] = 0.0f;
+            continue;
+        }
+        /* Parabola through the costs at d - 1, d, d + 1 */
+        const uint16_t* s = sum + static_cast<size_t>(x) * disparity_num;
+        float offset = 0.0f;
+        if (d + 1 < (std::min)(disparity_num, x + 1)) {
+            const int32_t denominator = s[d - 1] + s[d + 1] - 2 * s[d];
+            if (denominator > 0) offset = static_cast<float>(s[d - 1] - s[d + 1]) / (2.0f * denominator);
+        }
+        disparity[x] = static_cast<float>(d) + offset;
+    }
+}
@@ -0,0 +1,118 @@
+/* Copyright 2022 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef DEPTH_SGM_ENGINE_H_
+#define DEPTH_SGM_ENGINE_H_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "mat_ring.h"
+
+/*
+ * Stereo depth by semi-global matching on CPU. The same interface as DepthStereoEngine, without model file and TensorRT
+ *   - Matching cost is the Hamming distance of 5x5 census, and path costs are aggregated in uint16 (CpuDispatch)
+ *   - The image is processed in strips of rows in parallel. Vertical and diagonal paths start in the overlap above and
+ *     below a strip, so the work buffers are per thread and bounded by strip rows x width x disparity range
+ *   - Winner-takes-all with uniqueness and left-right check, and parabola fitting for subpixel disparity
+ */
+class DepthSgmEngine {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    enum {
+        kPathNum4 = 4,      // left, right, top, bottom
+        kPathNum8 = 8,      // and diagonals
+    };
+
+    typedef struct Result_ {
+        cv::Mat           image;                // [height, width, 1]. CV_32FC1, 0 = invalid. Leased from the engine until released
+        struct crop_ {
+            int32_t x;
+            int32_t y;
+            int32_t w;
+            int32_t h;
+            crop_() : x(0), y(0), w(0), h(0) {}
+        } crop;
+        double            time_pre_process;		// [msec] census transform
+        double            time_inference;		// [msec] matching cost, aggregation and disparity selection
+        double            time_post_process;	// [msec]
+        float             max_disparity;        // in the pixel of image
+        Result_() : time_pre_process(0), time_inference(0), time_post_process(0), max_disparity(0)
+        {}
+    } Result;
+
+private:
+    /* Work buffers of a strip. Used by a thread at a time */
+    typedef struct StripBuffer_ {
+        std::vector<uint8_t>  cost;         /* [row][x][disparity] of the strip and the overlap */
+        std::vector<uint16_t> sum;          /* [row][x][disparity] of the strip */
+        std::vector<uint16_t> path_prev;    /* [x][disparity] */
+        std::vector<uint16_t> path_cur;
+        std::vector<int16_t>  disparity_l;  /* [x] of a row */
+        std::vector<int16_t>  disparity_r;
+        std::vector<uint16_t> cost_min_r;
+    } StripBuffer;
+
+public:
+    DepthSgmEngine() : is_downscaled_(false), disparity_num_(0), path_num_(kPathNum8) {}
+    ~DepthSgmEngine() {}
+    /* work_dir and num_threads are not used (no model). is_downscaled: process in half resolution */
+    int32_t Initialize(const std::string& work_dir, const int32_t num_threads, bool is_downscaled = false);
+    int32_t Finalize(void);
+    int32_t Process(const cv::Mat& image_l, const cv::Mat& image_r, Result& result);
+    /* kPathNum4 / kPathNum8. Thread safe. Applied at the next Process */
+    int32_t SetPathNum(int32_t path_num);
+    int32_t GetPathNum(void) const { return path_num_; }
+    float GetMaxDisparity(void);
+
+private:
+    void CensusTransform(const cv::Mat& image, std::vector<uint32_t>& census);
+    void ProcessStrip(int32_t strip, int32_t path_num, StripBuffer& buffer, cv::Mat& mat_disparity);
+    void SelectDisparity(const uint16_t* sum, StripBuffer& buffer, float* disparity);
+    StripBuffer* AcquireStripBuffer(void);
+    void ReleaseStripBuffer(StripBuffer* buffer);
+
+private:
+    bool is_downscaled_;
+    int32_t disparity_num_;
+    std::atomic<int32_t> path_num_;
+    int32_t width_;
+    int32_t height_;
+    cv::Mat mat_gray_l_;
+    cv::Mat mat_gray_r_;
+    cv::Mat mat_padded_;
+    std::vector<uint32_t> census_l_;    /* [y][x] */
+    std::vector<uint32_t> census_r_;
+    std::unique_ptr<MatRing> result_ring_;     /* buffers for Result::image */
+
+    /* Allocated when a thread needs one, so the number is up to the number of threads */
+    std::vector<std::unique_ptr<StripBuffer>> strip_buffer_list_;
+    std::vector<StripBuffer*> strip_buffer_free_list_;
+    std::mutex mutex_;
+};
+
+#endif
@@ -10,6 +10,10 @@
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
@@ -19,6 +23,9 @@
 #include "common_helper_cv.h"
 #include "inference_helper.h"
 #include "inference_helper_tensorrt.h"      // to call SetDlaCore
+#include "thread_pool.h"
+#include "cpu_dispatch.h"
+#include "mat_ring.h"
 #include "depth_stereo_engine.h"
 
 /*** Macro ***/
@@ -27,155 +34,523 @@
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
 /* Model parameters */
-//#define MODEL_NAME   "hitnet_eth3d_480x640.onnx"
-//#define IS_GRAYSCALE
-//#define MAX_DISPLARITY 128
-//#define MODEL_NAME   "hitnet_flyingthings_finalpass_xl_480x640.onnx"
-//#undef IS_GRAYSCALE
-//#define MAX_DISPLARITY 320
-#define MODEL_NAME   "hitnet_middlebury_d400_480x640.onnx"
-#undef IS_GRAYSCALE
-#define MAX_DISPLARITY 400
-
-#ifdef IS_GRAYSCALE
-#define INPUT_DIMS    { 1, 2, 480, 640 }
-#else
-#define INPUT_DIMS    { 1, 6, 480, 640 }
-#endif
+/* All models are loaded at Initialize, and can be switched at runtime by SetModel */
+static const struct {
+    const char* model_name;
+    const char* model_name_downscaled;
+    const char* model_name_cascade;     /* tile model with batch size = CASCADE_BATCH_NUM */
+    bool        is_grayscale;
+    float       max_disparity;      /* in the pixel of the full resolution model input */
+} kModelParamList[DepthStereoEngine::kModelNum] = {
+    { "hitnet_eth3d_480x640.onnx", "hitnet_eth3d_240x320.onnx", "hitnet_eth3d_240x320.onnx", true, 128 },
+    { "hitnet_flyingthings_finalpass_xl_480x640.onnx", "hitnet_flyingthings_finalpass_xl_240x320.onnx", "hitnet_flyingthings_finalpass_xl_240x320.onnx", false, 320 },
+    { "hitnet_middlebury_d400_480x640.onnx", "hitnet_middlebury_d400_240x320.onnx", "hitnet_middlebury_d400_240x320.onnx", false, 400 },
+};
+#define DEFAULT_MODEL DepthStereoEngine::kModelMiddlebury
+
+#define INPUT_DIMS            { 1, 6, 480, 640 }    /* channel = 2 for grayscale model */
+#define INPUT_DIMS_DOWNSCALED { 1, 6, 240, 320 }
+#define INPUT_DIMS_CASCADE    { 1, 6, 240, 320 }    /* tile size */
 #define IS_NCHW       true
 #define INPUT_NAME   "input"
 #define OUTPUT_NAME  "reference_output_disparity"
 #define TENSORTYPE    TensorInfo::kTensorTypeFp32
+/* Minimum rows per task of ThreadPool for packing the input */
+#define GRAIN_SIZE           16
+/* Frames in flight (input tensors). 2 = pre-process of the next frame overlaps inference of the current frame */
+#define INPUT_SLOT_NUM       2
+/* Output buffers which can be leased at the same time, including the ones in flight. Submit waits for a free one up to RESULT_WAIT_TIMEOUT [msec] */
+#define RESULT_SLOT_NUM      (INPUT_SLOT_NUM + 2)
+#define RESULT_WAIT_TIMEOUT  1000
+/*
+ * Cascade mode. Tiles have CASCADE_MARGIN [px] on the left of the part written to the result, so that its match is in the tile.
+ * Set the max disparity of the prior (95 for DepthAI, 190 with extended disparity)
+ */
+#define CASCADE_MARGIN           96
+#define CASCADE_OVERLAP_Y        0          /* [px] tiles overlap vertically at least this */
+#define CASCADE_SCORE_THRESHOLD  0.1f       /* a tile is processed by the model if the ratio of invalid or unreliable pixels exceeds this */
+#define CASCADE_JUMP_THRESHOLD   2.0f       /* [px] difference from the neighbor regarded as unreliable (noise, edges of objects) */
+/* Tiles per inference in cascade mode. > 1 requires the tile models exported with the batch size. The last batch is padded */
+#define CASCADE_BATCH_NUM        1
 
 /*** Function ***/
-int32_t DepthStereoEngine::Initialize(const std::string& work_dir, const int32_t num_threads)
+/*
+ * Tiles of the cascade mode in raster order. The cores partition the image, and each core is written by its tile
+ *   x: the core starts CASCADE_MARGIN after the tile (except the first column). tile_width > CASCADE_MARGIN
+ *   y: the boundary of the cores is in the middle of the overlap
+ */
+static void ComputeCascadeTiles(int32_t width, int32_t height, int32_t tile_width, int32_t tile_height, std::vector<cv::Rect>& tile_list, std::vector<cv::Rect>& core_list)
 {
-    /* Set model information */
-    std::string model_filename = work_dir + "/model/" + MODEL_NAME;
+    std::vector<int32_t> tile_x_list;
+    std::vector<int32_t> core_x_list(1, 0);     /* boundaries */
+    while (core_x_list.back() < width) {
+        const int32_t tile_x = (std::min)((std::max)(core_x_list.back() - CASCADE_MARGIN, 0), width - tile_width);
+        tile_x_list.push_back(tile_x);
+        core_x_list.push_back((std::min)(tile_x + tile_width, width));
+    }
+    std::vector<int32_t> tile_y_list;
+    CommonHelper::ComputeTilePosition(height, tile_height, CASCADE_OVERLAP_Y, tile_y_list);
+    std::vector<int32_t> core_y_list(1, 0);
+    for (size_t i = 1; i < tile_y_list.size(); i++) {
+        core_y_list.push_back((tile_y_list[i - 1] + tile_height + tile_y_list[i]) / 2);
+    }
+    core_y_list.push_back(height);
 
-    /* Set input tensor info */
-    input_tensor_info_list_.clear();
-    InputTensorInfo input_tensor_info(INPUT_NAME, TENSORTYPE, IS_NCHW);
-    input_tensor_info.tensor_dims = INPUT_DIMS;
-    input_tensor_info.data_type = InputTensorInfo::kDataTypeBlobNchw;
-    input_tensor_info_list_.push_back(input_tensor_info);
+    tile_list.clear();
+    core_list.clear();
+    for (size_t j = 0; j < tile_y_list.size(); j++) {
+        for (size_t i = 0; i < tile_x_list.size(); i++) {
+            tile_list.push_back(cv::Rect(tile_x_list[i], tile_y_list[j], tile_width, tile_height));
+            core_list.push_back(cv::Rect(core_x_list[i], core_y_list[j], core_x_list[i + 1] - core_x_list[i], core_y_list[j + 1] - core_y_list[j]));
+        }
+    }
+}
 
-    /* Set output tensor info */
-    output_tensor_info_list_.clear();
-    output_tensor_info_list_.push_back(OutputTensorInfo(OUTPUT_NAME, TENSORTYPE));
+int32_t DepthStereoEngine::Initialize(const std::string& work_dir, const int32_t num_threads, bool is_downscaled, bool is_cascade)
+{
+    StopThread();
+    is_cascade_ = is_cascade;
+    batch_num_ = is_cascade ? CASCADE_BATCH_NUM : 1;
+    int32_t model_num = 0;
+    for (int32_t i = 0; i < kModelNum; i++) {
+        Model& model = model_list_[i];
+        /* Set model information. Tiles of the cascade mode are in the pixel of the input image */
+        const char* model_name = is_cascade ? kModelParamList[i].model_name_cascade : (is_downscaled ? kModelParamList[i].model_name_downscaled : kModelParamList[i].model_name);
+        std::string model_filename = work_dir + "/model/" + model_name;
+        model.is_grayscale = kModelParamList[i].is_grayscale;
+        model.max_disparity = (is_downscaled && !is_cascade) ? kModelParamList[i].max_disparity / 2.0f : kModelParamList[i].max_disparity;     /* in the pixel of the model input */
 
-    /* Create and Initialize Inference Helper */
-    inference_helper_.reset(InferenceHelper::Create(InferenceHelper::kTensorrt));
-    if (!inference_helper_) {
-        return kRetErr;
+        /* Set input tensor info */
+        model.input_tensor_info_list.clear();
+        InputTensorInfo input_tensor_info(INPUT_NAME, TENSORTYPE, IS_NCHW);
+        if (is_cascade) {
+            input_tensor_info.tensor_dims = std::vector<int32_t>(INPUT_DIMS_CASCADE);
+        } else {
+            input_tensor_info.tensor_dims = is_downscaled ? std::vector<int32_t>(INPUT_DIMS_DOWNSCALED) : std::vector<int32_t>(INPUT_DIMS);
+        }
+        input_tensor_info.tensor_dims[0] = batch_num_;
+        if (model.is_grayscale) input_tensor_info.tensor_dims[1] = 2;
+        input_tensor_info.data_type = InputTensorInfo::kDataTypeBlobNchw;
+        model.input_tensor_info_list.push_back(input_tensor_info);
+
+        /* Set output tensor info */
+        model.output_tensor_info_list.clear();
+        model.output_tensor_info_list.push_back(OutputTensorInfo(OUTPUT_NAME, TENSORTYPE));
+
+        /* Create and Initialize Inference Helper */
+        model.inference_helper.reset(InferenceHelper::Create(InferenceHelper::kTensorrt));
+        if (!model.inference_helper) {
+            continue;
+        }
+        InferenceHelperTensorRt* p = dynamic_cast<InferenceHelperTensorRt*>(model.inference_helper.get());
+        if (p) p->SetDlaCore(-1);  /* Use GPU */
+        if (model.inference_helper->SetNumThreads(num_threads) != InferenceHelper::kRetOk) {
+            model.inference_helper.reset();
+            continue;
+        }
+        if (model.inference_helper->Initialize(model_filename, model.input_tensor_info_list, model.output_tensor_info_list) != InferenceHelper::kRetOk) {
+            PRINT("%s is not available\n", model_filename.c_str());
+            model.inference_helper.reset();
+            continue;
+        }
+        if (is_cascade) {
+            const std::vector<int32_t>& output_dims = model.output_tensor_info_list[0].tensor_dims;
+            if (output_dims.size() < 3 || output_dims[1] != input_tensor_info.GetHeight() || output_dims[2] != input_tensor_info.GetWidth() || input_tensor_info.GetWidth() <= CASCADE_MARGIN) {
+                PRINT_E("%s can't be used for cascade\n", model_filename.c_str());
+                model.inference_helper->Finalize();
+                model.inference_helper.reset();
+                continue;
+            }
+        }
+        model_num++;
     }
-    InferenceHelperTensorRt* p = dynamic_cast<InferenceHelperTensorRt*>(inference_helper_.get());
-    if (p) p->SetDlaCore(-1);  /* Use GPU */
-    if (inference_helper_->SetNumThreads(num_threads) != InferenceHelper::kRetOk) {
-        inference_helper_.reset();
+    if (model_num == 0) {
+        PRINT_E("No model is available\n");
         return kRetErr;
     }
-    if (inference_helper_->Initialize(model_filename, input_tensor_info_list_, output_tensor_info_list_) != InferenceHelper::kRetOk) {
-        inference_helper_.reset();
-        return kRetErr;
+
+    /* Activate the default model, or the first available one */
+    model_active_ = -1;
+    model_pending_ = -1;
+    if (model_list_[DEFAULT_MODEL].inference_helper) {
+        model_active_ = DEFAULT_MODEL;
+    } else {
+        for (int32_t i = 0; i < kModelNum; i++) {
+            if (model_list_[i].inference_helper) {
+                model_active_ = i;
+                break;
+            }
+        }
     }
 
+    result_ring_.reset(new MatRing(RESULT_SLOT_NUM));
+
+    slot_list_.resize(INPUT_SLOT_NUM);
+    for (int32_t i = 0; i < INPUT_SLOT_NUM; i++) slot_free_list_.push_back(i);
+    is_thread_running_ = true;
+    thread_inference_ = std::thread(&DepthStereoEngine::ThreadInference, this);
+
     return kRetOk;
 }
 
+void DepthStereoEngine::StopThread(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_thread_running_ = false;
+    }
+    cond_.notify_all();
+    if (thread_inference_.joinable()) thread_inference_.join();
+
+    /* Frames in flight are dropped, and their result buffers are returned */
+    slot_submitted_list_.clear();
+    slot_in_flight_list_.clear();
+    slot_free_list_.clear();
+    slot_list_.clear();
+}
+
 int32_t DepthStereoEngine::Finalize()
 {
-    if (!inference_helper_) {
+    if (model_active_ < 0) {
         PRINT_E("Inference helper is not created\n");
         return kRetErr;
     }
-    inference_helper_->Finalize();
+    StopThread();
+    for (auto& model : model_list_) {
+        if (model.inference_helper) {
+            model.inference_helper->Finalize();
+            model.inference_helper.reset();
+        }
+    }
+    model_active_ = -1;
+    if (result_ring_ && !result_ring_->WaitAllReleased(RESULT_WAIT_TIMEOUT)) {
+        /* Results are still used. Leave the buffers to them */
+        PRINT_E("%d results are still leased\n", result_ring_->GetLeasedNum());
+        result_ring_.release();
+    }
+    result_ring_.reset();
     return kRetOk;
 }
 
+int32_t DepthStereoEngine::SetModel(int32_t model)
+{
+    if (model < 0 || model >= kModelNum || !model_list_[model].inference_helper) {
+        PRINT_E("Model(%d) is not available\n", model);
+        return kRetErr;
+    }
+    model_pending_ = model;
+    return kRetOk;
+}
+
+float DepthStereoEngine::GetMaxDisparity(void)
+{
+    if (model_active_ < 0) return 0;
+    return model_list_[model_active_].max_disparity;
+}
+
+
+int32_t DepthStereoEngine::GetInFlightNum(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int32_t>(slot_in_flight_list_.size());
+}
 
 int32_t DepthStereoEngine::Process(const cv::Mat& image_src_l, const cv::Mat& image_src_r, Result& result)
 {
-    if (!inference_helper_) {
-        PRINT_E("Inference helper is not created\n");
+    return Process(image_src_l, image_src_r, cv::Mat(), 1.0f, result);
+}
+
+int32_t DepthStereoEngine::Process(const cv::Mat& image_src_l, const cv::Mat& image_src_r, const cv::Mat& disparity_prior, float disparity_prior_scale, Result& result)
+{
+    if (GetInFlightNum() > 0) {
+        PRINT_E("Frames submitted by Submit are in flight\n");
+        return kRetErr;
+    }
+    if (Submit(image_src_l, image_src_r, disparity_prior, disparity_prior_scale) != kRetOk) {
         return kRetErr;
     }
+    return Poll(result, -1);
+}
 
-    /*** PreProcess ***/
-    const auto& t_pre_process0 = std::chrono::steady_clock::now();
-    
-    InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
-    /* Do preprocess here and set input data as nchw blob because InferenceHelper cannot handle Grayscale x 2 input */
-    cv::Mat image_l;
-    cv::Mat image_r;
-    cv::resize(image_src_l, image_l, cv::Size(input_tensor_info.GetWidth(), input_tensor_info.GetHeight()));
-    cv::resize(image_src_r, image_r, cv::Size(input_tensor_info.GetWidth(), input_tensor_info.GetHeight()));
-    int32_t image_size = input_tensor_info.GetWidth() * input_tensor_info.GetHeight();
-    
-#ifdef IS_GRAYSCALE
-    const int32_t image_channel = 1;
-    cv::cvtColor(image_l, image_l, cv::COLOR_BGR2GRAY);
-    cv::cvtColor(image_r, image_r, cv::COLOR_BGR2GRAY);
-#else
-    const int32_t image_channel = 3;
-    cv::cvtColor(image_l, image_l, cv::COLOR_BGR2RGB);
-    cv::cvtColor(image_r, image_r, cv::COLOR_BGR2RGB);
-#endif
-    
-    auto data = std::make_unique<float[]>(image_size * image_channel * 2);
-#pragma omp parallel for
-    for (int32_t c = 0; c < image_channel; c++) {
-        for (int32_t i = 0; i < image_size; i++) {
-            data[i + c * image_size] = image_l.data[i * image_channel + c] / 255.0f;
+int32_t DepthStereoEngine::Submit(const cv::Mat& image_src_l, const cv::Mat& image_src_r)
+{
+    return Submit(image_src_l, image_src_r, cv::Mat(), 1.0f);
+}
+
+int32_t DepthStereoEngine::Submit(const cv::Mat& image_src_l, const cv::Mat& image_src_r, const cv::Mat& disparity_prior, float disparity_prior_scale)
+{
+    if (model_active_ < 0 || !result_ring_) {
+        PRINT_E("Inference helper is not created\n");
+        return kRetErr;
+    }
+    if (is_cascade_) {
+        const InputTensorInfo& input_tensor_info = model_list_[model_active_].input_tensor_info_list[0];
+        if (image_src_l.cols < input_tensor_info.GetWidth() || image_src_l.rows < input_tensor_info.GetHeight()) {
+            PRINT_E("Image (%d x %d) is smaller than the tile\n", image_src_l.cols, image_src_l.rows);
+            return kRetErr;
+        }
+        if (!disparity_prior.empty() && (disparity_prior.size() != image_src_l.size() || (disparity_prior.type() != CV_8UC1 && disparity_prior.type() != CV_16UC1 && disparity_prior.type() != CV_32FC1))) {
+            PRINT_E("Invalid disparity prior\n");
+            return kRetErr;
         }
     }
 
-    const int32_t offset_for_right_image = image_size * image_channel;
-#pragma omp parallel for
-    for (int32_t c = 0; c < image_channel; c++) {
-        for (int32_t i = 0; i < image_size; i++) {
-            data[i + c * image_size + offset_for_right_image] = image_r.data[i * image_channel + c] / 255.0f;
-        }
+    /* Switch the model between frames. Models are already loaded, so this doesn't stall. Frames in flight keep their model */
+    const int32_t model_pending = model_pending_.exchange(-1);
+    if (model_pending >= 0 && model_pending != model_active_) {
+        PRINT("Switch model: %d -> %d\n", model_active_, model_pending);
+        model_active_ = model_pending;
     }
+    Model& model = model_list_[model_active_];
 
-    input_tensor_info.data = data.get();
-   
-    if (inference_helper_->PreProcess(input_tensor_info_list_) != InferenceHelper::kRetOk) {
-        return kRetErr;
+    int32_t slot_index = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slot_free_list_.empty()) {
+            PRINT_E("Too many frames in flight\n");
+            return kRetErr;
+        }
+        slot_index = slot_free_list_.back();
+        slot_free_list_.pop_back();
     }
-    const auto& t_pre_process1 = std::chrono::steady_clock::now();
+    /* The slot belongs to this thread until it's pushed to the submitted list */
+    Slot& slot = slot_list_[slot_index];
+    Result& result = slot.result;
+    result = Result();
 
-    /*** Inference ***/
-    const auto& t_inference0 = std::chrono::steady_clock::now();
-    if (inference_helper_->Process(output_tensor_info_list_) != InferenceHelper::kRetOk) {
+    /* Lease the output buffer first, so that the engine waits for consumers before spending time on inference */
+    int32_t output_height = model.output_tensor_info_list[0].tensor_dims[1];
+    int32_t output_width = model.output_tensor_info_list[0].tensor_dims[2];
+    int32_t output_type = CV_32FC1;
+    if (is_cascade_) {
+        /* Tiles are merged into the prior in the input resolution */
+        output_height = image_src_l.rows;
+        output_width = image_src_l.cols;
+        output_type = CV_32FC1;
+    }
+    if (result_ring_->Acquire(output_height, output_width, output_type, result.image, RESULT_WAIT_TIMEOUT) != MatRing::kRetOk) {
+        PRINT_E("All the result buffers are in use\n");
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot_free_list_.push_back(slot_index);
         return kRetErr;
     }
-    const auto& t_inference1 = std::chrono::steady_clock::now();
-
-    /*** PostProcess ***/
-    const auto& t_post_process0 = std::chrono::steady_clock::now();
-    int32_t output_height = output_tensor_info_list_[0].tensor_dims[1];
-    int32_t output_width = output_tensor_info_list_[0].tensor_dims[2];
-    float* values = output_tensor_info_list_[0].GetDataAsFloat();
 
-    cv::Mat out_fp = cv::Mat(output_height, output_width, CV_32FC1, values);
+    /*** PreProcess ***/
+    const auto& t_pre_process0 = std::chrono::steady_clock::now();
+    /* Tiles to process. The whole image unless cascade mode */
+    if (is_cascade_) {
+        SelectTiles(image_src_l, disparity_prior, disparity_prior_scale, model, slot);
+    } else {
+        slot.tile_rect_list.assign(1, cv::Rect(0, 0, image_src_l.cols, image_src_l.rows));
+        slot.tile_core_list.clear();
+    }
 
-    const auto& t_post_process1 = std::chrono::steady_clock::now();
+    /* Blob of all the tiles. The last batch is padded, and the output of the padding is ignored */
+    const InputTensorInfo& input_tensor_info = model.input_tensor_info_list[0];
+    const int32_t tile_num = static_cast<int32_t>(slot.tile_rect_list.size());
+    const size_t blob_size = static_cast<size_t>((tile_num + batch_num_ - 1) / batch_num_) * batch_num_ * input_tensor_info.GetWidth() * input_tensor_info.GetHeight() * (model.is_grayscale ? 1 : 3) * 2;
+    slot.input_buffer_fp32.resize(blob_size);
+    for (int32_t tile = 0; tile < tile_num; tile++) {
+        PackTile(image_src_l, image_src_r, slot.tile_rect_list[tile], model, slot, tile);
+    }
+    const auto& t_pre_process1 = std::chrono::steady_clock::now();
 
-    /* Return the results */
-    result.image = out_fp;
     result.crop.x = 0;
     result.crop.y = 0;
     result.crop.w = image_src_l.cols;
     result.crop.h = image_src_l.rows;
+    result.model = model_active_;
+    result.max_disparity = model.max_disparity;
     result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
-    result.time_inference = static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
-    result.time_post_process = static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0;;
 
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot.status = kRetOk;
+        slot.is_done = false;
+        slot_submitted_list_.push_back(slot_index);
+        slot_in_flight_list_.push_back(slot_index);
+    }
+    cond_.notify_all();
     return kRetOk;
 }
 
-float DepthStereoEngine::GetMaxDisparity(void)
+int32_t DepthStereoEngine::Poll(Result& result, int32_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (slot_in_flight_list_.empty()) {
+        PRINT_E("No frame in flight\n");
+        return kRetErr;
+    }
+    const int32_t slot_index = slot_in_flight_list_.front();
+    Slot& slot = slot_list_[slot_index];
+    const auto is_done = [&slot] { return slot.is_done; };
+    if (timeout_ms < 0) {
+        cond_.wait(lock, is_done);
+    } else if (!cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), is_done)) {
+        return kRetErr;     /* not yet */
+    }
+    slot_in_flight_list_.pop_front();
+    const int32_t status = slot.status;
+    if (status == kRetOk) {
+        result = slot.result;
+    }
+    slot.result = Result();     /* the caller has the lease now (or it's returned to the ring if failed) */
+    slot_free_list_.push_back(slot_index);
+    return status;
+}
+
+void DepthStereoEngine::ThreadInference(void)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cond_.wait(lock, [this] { return !is_thread_running_ || !slot_submitted_list_.empty(); });
+        if (!is_thread_running_) break;
+        const int32_t slot_index = slot_submitted_list_.front();
+        slot_submitted_list_.pop_front();
+        lock.unlock();
+        RunInference(slot_list_[slot_index]);
+        lock.lock();
+        slot_list_[slot_index].is_done = true;
+        cond_.notify_all();
+    }
+}
+
+/*
+ * Cascade mode: the prior warped to the left image is the base of Result::image, and the tiles where it's not reliable are listed
+ * in the slot to be processed by the model
+ */
+void DepthStereoEngine::SelectTiles(const cv::Mat& image_l, const cv::Mat& disparity_prior, float disparity_prior_scale, const Model& model, Slot& slot)
+{
+    Result& result = slot.result;
+    const InputTensorInfo& input_tensor_info = model.input_tensor_info_list[0];
+    std::vector<cv::Rect> tile_list;
+    std::vector<cv::Rect> core_list;
+    ComputeCascadeTiles(image_l.cols, image_l.rows, input_tensor_info.GetWidth(), input_tensor_info.GetHeight(), tile_list, core_list);
+    const int32_t tile_num = static_cast<int32_t>(tile_list.size());
+    result.tile_num = tile_num;
+
+    slot.tile_rect_list.clear();
+    slot.tile_core_list.clear();
+    if (disparity_prior.empty()) {
+        result.image.setTo(0);
+        slot.tile_rect_list = tile_list;
+        slot.tile_core_list = core_list;
+    } else {
+        CommonHelper::WarpDisparityRightToLeft(disparity_prior, disparity_prior_scale, result.image);
+        std::vector<float> score_list(tile_num);
+        ThreadPool::GetInstance().ParallelFor(0, tile_num, 1, [&](int32_t tile_begin, int32_t tile_end) {
+            for (int32_t tile = tile_begin; tile < tile_end; tile++) {
+                score_list[tile] = CommonHelper::ComputeDisparityUnreliableRatio(result.image, core_list[tile], CASCADE_JUMP_THRESHOLD);
+            }
+        });
+        for (int32_t tile = 0; tile < tile_num; tile++) {
+            if (score_list[tile] > CASCADE_SCORE_THRESHOLD) {
+                slot.tile_rect_list.push_back(tile_list[tile]);
+                slot.tile_core_list.push_back(core_list[tile]);
+            }
+        }
+    }
+    result.tile_refined_num = static_cast<int32_t>(slot.tile_rect_list.size());
+}
+
+/* Resize the tile to the model (tiles of the cascade mode are in the model size), and pack the pair into the blob of the slot at tile_index */
+void DepthStereoEngine::PackTile(const cv::Mat& image_src_l, const cv::Mat& image_src_r, const cv::Rect& rect, const Model& model, Slot& slot, int32_t tile_index)
+{
+    const InputTensorInfo& input_tensor_info = model.input_tensor_info_list[0];
+    const int32_t image_width = input_tensor_info.GetWidth();
+    const int32_t image_height = input_tensor_info.GetHeight();
+    const int32_t image_size = image_width * image_height;
+    const int32_t image_channel = model.is_grayscale ? 1 : 3;
+    const size_t blob_offset = static_cast<size_t>(tile_index) * image_size * image_channel * 2;
+
+    /* Do preprocess here and set input data as nchw blob because InferenceHelper cannot handle Grayscale x 2 input */
+    cv::Mat image_l;
+    cv::Mat image_r;
+    if (rect.width == image_width && rect.height == image_height) {
+        image_l = image_src_l(rect);
+        image_r = image_src_r(rect);
+    } else {
+        cv::resize(image_src_l(rect), image_l, cv::Size(image_width, image_height));
+        cv::resize(image_src_r(rect), image_r, cv::Size(image_width, image_height));
+    }
+    if (image_l.channels() != image_channel || image_channel == 3) {
+        /* rectified images from the mono cameras are grayscale. Converted into new buffers, because image_l may be a view of the input */
+        const int32_t code = model.is_grayscale ? cv::COLOR_BGR2GRAY : ((image_l.channels() == 1) ? cv::COLOR_GRAY2RGB : cv::COLOR_BGR2RGB);
+        cv::Mat image_converted_l;
+        cv::Mat image_converted_r;
+        cv::cvtColor(image_l, image_converted_l, code);
+        cv::cvtColor(image_r, image_converted_r, code);
+        image_l = image_converted_l;
+        image_r = image_converted_r;
+    }
+
+    /* Pack into planar blob of the slot. Rows are independent, so write directly in the tensor type */
+    const int32_t offset_for_right_image = image_size * image_channel;
+    float* data = slot.input_buffer_fp32.data() + blob_offset;
+    ThreadPool::GetInstance().ParallelFor(0, image_height, GRAIN_SIZE, [&](int32_t y_begin, int32_t y_end) {
+        for (int32_t y = y_begin; y < y_end; y++) {
+            const uint8_t* src_l = image_l.ptr<uint8_t>(y);
+            const uint8_t* src_r = image_r.ptr<uint8_t>(y);
+            for (int32_t c = 0; c < image_channel; c++) {
+                float* dst_l = data + c * image_size + y * image_width;
+                float* dst_r = dst_l + offset_for_right_image;
+                CpuDispatch::PackUint8ToFloat(src_l + c, image_channel, dst_l, image_width, 1.0f / 255.0f);
+                CpuDispatch::PackUint8ToFloat(src_r + c, image_channel, dst_r, image_width, 1.0f / 255.0f);
+            }
+        }
+    });
+}
+
+/* Called in the inference thread, which is the only user of the inference helpers while running */
+void DepthStereoEngine::RunInference(Slot& slot)
 {
-    return MAX_DISPLARITY;
-}
\ No newline at end of file
+    Result& result = slot.result;
+    Model& model = model_list_[result.model];
+    slot.status = kRetErr;
+
+    /* Nothing to do in cascade mode if the prior is reliable everywhere */
+    const int32_t tile_num = static_cast<int32_t>(slot.tile_rect_list.size());
+    const size_t blob_size_per_tile = static_cast<size_t>(model.input_tensor_info_list[0].GetWidth()) * model.input_tensor_info_list[0].GetHeight() * (model.is_grayscale ? 1 : 3) * 2;
+    for (int32_t tile_begin = 0; tile_begin < tile_num; tile_begin += batch_num_) {
+        const auto& t_pre_process0 = std::chrono::steady_clock::now();
+        const size_t blob_offset = static_cast<size_t>(tile_begin) * blob_size_per_tile;
+        model.input_tensor_info_list[0].data = slot.input_buffer_fp32.data() + blob_offset;
+        if (model.inference_helper->PreProcess(model.input_tensor_info_list) != InferenceHelper::kRetOk) {
+            return;
+        }
+        const auto& t_pre_process1 = std::chrono::steady_clock::now();
+
+        /*** Inference ***/
+        const auto& t_inference0 = std::chrono::steady_clock::now();
+        if (model.inference_helper->Process(model.output_tensor_info_list) != InferenceHelper::kRetOk) {
+            return;
+        }
+        const auto& t_inference1 = std::chrono::steady_clock::now();
+
+        /*** PostProcess ***/
+        const auto& t_post_process0 = std::chrono::steady_clock::now();
+        /* Copy the result out of the tensor, so that it stays valid during the next inference */
+        if (!is_cascade_) {
+            const float* values = model.output_tensor_info_list[0].GetDataAsFloat();
+            std::memcpy(result.image.data, values, result.image.total() * result.image.elemSize());
+        } else {
+            /* Core of each tile into the prior. The output of a tile has the size of the tile */
+            const int32_t tile_end = (std::min)(tile_begin + batch_num_, tile_num);
+            for (int32_t tile = tile_begin; tile < tile_end; tile++) {
+                const cv::Rect& rect = slot.tile_rect_list[tile];
+                const cv::Rect& core = slot.tile_core_list[tile];
+                const size_t output_offset = static_cast<size_t>(tile - tile_begin) * rect.area();
+                for (int32_t y = core.y; y < core.y + core.height; y++) {
+                    const size_t offset = output_offset + static_cast<size_t>(y - rect.y) * rect.width + (core.x - rect.x);
+                    std::memcpy(result.image.ptr<float>(y) + core.x, model.output_tensor_info_list[0].GetDataAsFloat() + offset, sizeof(float) * core.width);
+                }
+            }
+        }
+        const auto& t_post_process1 = std::chrono::steady_clock::now();
+
+        result.time_pre_process += static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
+        result.time_inference += static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
+        result.time_post_process += static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0;
+    }
+    slot.status = kRetOk;
+}
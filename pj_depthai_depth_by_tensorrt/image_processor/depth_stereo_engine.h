@@ -8,12 +8,18 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
 
 /* for My modules */
 #include "inference_helper.h"
+#include "mat_ring.h"
 
 
 class DepthStereoEngine {
@@ -23,8 +29,15 @@ public:
         kRetErr = -1,
     };
 
+    enum {
+        kModelEth3d = 0,        // grayscale, max disparity = 128
+        kModelFlyingthings,     // max disparity = 320
+        kModelMiddlebury,       // max disparity = 400
+        kModelNum,
+    };
+
     typedef struct Result_ {
-        cv::Mat           image;                // [height, width, 1]. CV_32FC1
+        cv::Mat           image;                // [height, width, 1]. CV_32FC1. Leased from the engine until released
         struct crop_ {
             int32_t x;
             int32_t y;
@@ -35,23 +48,96 @@ public:
         double            time_pre_process;		// [msec]
         double            time_inference;		// [msec]
         double            time_post_process;	// [msec]
-        Result_() : time_pre_process(0), time_inference(0), time_post_process(0)
+        int32_t           model;                // model used for this result
+        float             max_disparity;        // of the model used for this result
+        int32_t           tile_num;             // tiles of the image in cascade mode. 0 otherwise
+        int32_t           tile_refined_num;     // tiles processed by the model in cascade mode
+        Result_() : time_pre_process(0), time_inference(0), time_post_process(0), model(0), max_disparity(0), tile_num(0), tile_refined_num(0)
         {}
     } Result;
 
+private:
+    typedef struct Model_ {
+        std::unique_ptr<InferenceHelper> inference_helper;
+        std::vector<InputTensorInfo> input_tensor_info_list;
+        std::vector<OutputTensorInfo> output_tensor_info_list;
+        bool  is_grayscale;
+        float max_disparity;
+        Model_() : is_grayscale(false), max_disparity(0) {}
+    } Model;
+
+    /* Input tensor and result of a frame in flight */
+    typedef struct Slot_ {
+        std::vector<float> input_buffer_fp32;
+        std::vector<cv::Rect> tile_rect_list;   // crops packed into the blob in this order. The whole image unless cascade mode
+        std::vector<cv::Rect> tile_core_list;   // part of each tile written to the result in cascade mode
+        Result  result;     // image is leased at Submit, and filled by the inference thread
+        int32_t status;     // kRetOk / kRetErr, valid when is_done
+        bool    is_done;
+        Slot_() : status(kRetOk), is_done(false) {}
+    } Slot;
+
 public:
-    DepthStereoEngine() {}
-    ~DepthStereoEngine() {}
-    int32_t Initialize(const std::string& work_dir, const int32_t num_threads);
+    DepthStereoEngine() : model_pending_(-1), model_active_(-1), is_cascade_(false), batch_num_(1), is_thread_running_(false) {}
+    ~DepthStereoEngine() { StopThread(); }
+    /*
+     * All the available models are loaded, and the default model is activated
+     *   is_downscaled: use the lower resolution models
+     *   is_cascade: run the model only on the tiles where the disparity prior (e.g. by DepthAI) is invalid or unreliable,
+     *               and use the prior on the other tiles. Tiles are cut from the input image in full resolution (no resize)
+     */
+    int32_t Initialize(const std::string& work_dir, const int32_t num_threads, bool is_downscaled = false, bool is_cascade = false);
     int32_t Finalize(void);
+    /* Synchronous version of Submit + Poll. Don't call while frames submitted by Submit are in flight */
     int32_t Process(const cv::Mat& image_l, const cv::Mat& image_r, Result& result);
+    int32_t Process(const cv::Mat& image_l, const cv::Mat& image_r, const cv::Mat& disparity_prior, float disparity_prior_scale, Result& result);
+    /*
+     * Asynchronous API. Pre-process runs in the caller, and inference and post-process run in the inference thread,
+     * so pre-process of the next frame overlaps inference of the current frame
+     *   Submit: kRetErr if all the input slots are in flight (Poll first), or the result buffer is not available
+     *   Poll: the result of the oldest frame in flight (in the order of Submit). timeout_ms < 0: wait forever
+     *         kRetErr if nothing is in flight, no result within timeout_ms (the frame stays in flight), or the frame failed
+     */
+    int32_t Submit(const cv::Mat& image_l, const cv::Mat& image_r);
+    /*
+     * disparity_prior: disparity of the same pair aligned to the right image as DepthAI outputs. CV_8UC1, CV_16UC1 or CV_32FC1, 0 = invalid
+     *   Used in cascade mode only. Empty = all the tiles are processed by the model
+     * disparity_prior_scale: [px] per unit of disparity_prior (e.g. 1 / 8 for subpixel disparity by DepthAI)
+     */
+    int32_t Submit(const cv::Mat& image_l, const cv::Mat& image_r, const cv::Mat& disparity_prior, float disparity_prior_scale = 1.0f);
+    int32_t Poll(Result& result, int32_t timeout_ms = -1);
+    int32_t GetInFlightNum(void);
+    /* Request to switch the model. Thread safe. Applied at the beginning of the next Process, so a frame in process is not affected */
+    int32_t SetModel(int32_t model);
+    int32_t GetModel(void) const { return model_active_; }
+    /* of the active model. Use Result::max_disparity for a result */
     float GetMaxDisparity(void);
 
 
 private:
-    std::unique_ptr<InferenceHelper> inference_helper_;
-    std::vector<InputTensorInfo> input_tensor_info_list_;
-    std::vector<OutputTensorInfo> output_tensor_info_list_;
+    void StopThread(void);
+    void ThreadInference(void);
+    void RunInference(Slot& slot);
+    void PackTile(const cv::Mat& image_l, const cv::Mat& image_r, const cv::Rect& rect, const Model& model, Slot& slot, int32_t tile_index);
+    void SelectTiles(const cv::Mat& image_l, const cv::Mat& disparity_prior, float disparity_prior_scale, const Model& model, Slot& slot);
+
+private:
+    std::array<Model, kModelNum> model_list_;
+    std::atomic<int32_t> model_pending_;
+    int32_t model_active_;
+    std::unique_ptr<MatRing> result_ring_;     /* buffers for Result::image */
+    bool is_cascade_;
+    int32_t batch_num_;                         /* tiles per inference */
+
+    /* Slots keep input blob across frames to avoid allocation. Slot indices are in one of the lists */
+    std::vector<Slot> slot_list_;
+    std::vector<int32_t> slot_free_list_;
+    std::deque<int32_t> slot_submitted_list_;  /* waiting for the inference thread */
+    std::deque<int32_t> slot_in_flight_list_;  /* submitted and not polled yet, in the order of Submit */
+    std::thread thread_inference_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool is_thread_running_;
 };
 
 #endif
@@ -18,7 +18,14 @@
 /* for My modules */
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "depth_roi_stats.h"
+#include "guided_filter.h"
+#include "temporal_filter.h"
+#include "depth_alignment.h"
+#include "stage_scheduler.h"
+#include "metrics.h"
 #include "depth_stereo_engine.h"
+#include "depth_sgm_engine.h"
 #include "depth_midasv2_engine.h"
 #include "image_processor.h"
 
@@ -27,23 +34,170 @@
 #define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
+/* Print the decisions of the scheduler other than run in every frame (for debug). The counts are in the metrics */
+//#define USE_STAGE_SCHEDULER_LOG
+
+/* Edge preserving filter for HITNET output using the left image as guide */
+#define USE_GUIDED_FILTER
+#define GUIDED_FILTER_RADIUS 4
+#define GUIDED_FILTER_EPS    1e-2f
+
+/* Edge aware upsampling of the model outputs to the input image resolution using the image as guide (fast guided filter), instead of cv::resize */
+#define USE_GUIDED_UPSAMPLING
+#define GUIDED_UPSAMPLING_RADIUS 2          /* in the pixel of the model output */
+#define GUIDED_UPSAMPLING_EPS    1e-3f
+
+/* Temporal filter for HITNET output against flicker. Applied on frames where HITNET runs */
+#define USE_TEMPORAL_FILTER
+#define TEMPORAL_FILTER_ALPHA       0.4f
+#define TEMPORAL_FILTER_RESET_RATIO 0.1f    /* relative change regarded as motion */
+#define TEMPORAL_FILTER_HOLE_FRAME  2
+
+/* Dense metric depth by aligning MiDaS to HITNET. MiDaS takes the left image so that both results have the same geometry */
+#define USE_DEPTH_FUSION
+#define DEPTH_FUSION_STEREO_INTERVAL 3       /* HITNET runs every N frames, and aligned MiDaS is used in between */
+#define DEPTH_FUSION_SAMPLE_STEP     4
+#define DEPTH_FUSION_DEPTH_MAX       10.0f   /* [m] for visualization */
+
+/* MiDaS on the high resolution color image (1080p video) in overlapping tiles, instead of the image resized to the model. Set the same in main.cpp
+ * The downscale decision of the scheduler runs MiDaS on the whole image resized to the model instead.
+ * The color camera has different geometry from the mono cameras, so it can't be used with USE_DEPTH_FUSION */
+//#define USE_MIDAS_TILED
+#if defined(USE_MIDAS_TILED) && defined(USE_DEPTH_FUSION)
+#error "USE_MIDAS_TILED can't be used with USE_DEPTH_FUSION"
+#endif
+
+/* Stereo depth by semi-global matching on CPU instead of HITNET, for nodes without TensorRT or the HITNET models.
+ * The rest of the pipeline (filters, fusion, scheduler) is the same. The model switch commands are not available */
+//#define USE_STEREO_SGM
+#ifdef USE_STEREO_SGM
+typedef DepthSgmEngine StereoEngine;
+#define STEREO_ENGINE_NAME "SGM"
+#else
+typedef DepthStereoEngine StereoEngine;
+#define STEREO_ENGINE_NAME "HITNET"
+#endif
+
+/* HITNET only on the tiles where disparity by DepthAI is invalid or unreliable, and disparity by DepthAI on the other tiles.
+ * The downscaled model still runs on the whole image when the frame is late */
+//#define USE_STEREO_CASCADE
+#if defined(USE_STEREO_CASCADE) && defined(USE_STEREO_SGM)
+#error "USE_STEREO_CASCADE can't be used with USE_STEREO_SGM"
+#endif
+
 /*** Global variable ***/
-std::unique_ptr<DepthStereoEngine> s_depth_stereo_engine;
+std::unique_ptr<StereoEngine> s_depth_stereo_engine;
 std::unique_ptr<DepthMidasv2Engine> s_depth_midasv2_engine;
+/* Lower resolution models used when the frame is late. Optional (null if the model is not available) */
+std::unique_ptr<StereoEngine> s_depth_stereo_engine_downscaled;
+std::unique_ptr<DepthMidasv2Engine> s_depth_midasv2_engine_downscaled;
+
+static StageScheduler s_stage_scheduler;
+static int32_t s_stage_id_midasv2 = 0;
+static int32_t s_stage_id_stereo = 0;
+static cv::Mat s_mat_midasv2_last;          /* output of MiDaS, reused while MiDaS is skipped */
+static cv::Mat s_mat_depth_midasv2_last;    /* visualized result of MiDaS */
+static float s_max_disparity_last = 0.0f;
+
+/* Disparity of the last frame for GetRoiDepth. Acceleration structure is built at the first query for each frame */
+static cv::Mat s_mat_disparity_last;
+static float s_disparity_scale_x = 1.0f;
+static float s_disparity_scale_y = 1.0f;
+static bool s_is_roi_stats_built = false;
+static DepthRoiStats s_depth_roi_stats;
+
+static GuidedFilter s_guided_filter;
+static cv::Mat s_mat_guide;
+static cv::Mat s_mat_disparity_filtered;
+static GuidedFilter s_guided_filter_midasv2;
+static cv::Mat s_mat_midasv2_upsampled;
+static TemporalFilter s_temporal_filter;
+static cv::Mat s_mat_disparity_temporal;
+static float s_disparity_max_visualize = 0.0f;  /* in ratio to the width, to keep it when the resolution changes */
+
+static float s_focal_length = 0.0f;
+static float s_baseline = 0.0f;
+static float s_disparity_prior_scale = 1.0f;
+static int32_t s_frame_cnt = 0;
+static cv::Mat s_mat_depth_stereo_last;     /* visualized result of HITNET, reused while HITNET is skipped */
+static DepthAlignment s_depth_alignment;
+static cv::Mat s_mat_midas_input;
+static cv::Mat s_mat_relative;
+static cv::Mat s_mat_depth_fused;
+
+/* Metrics. Exporting them is up to the application (see Metrics) */
+enum {
+    kMetricsStageMidasv2 = 0,
+    kMetricsStageStereo,
+    kMetricsStageFusion,
+    kMetricsStageNum,
+};
+static const char* kMetricsStageName[kMetricsStageNum] = { "midasv2", "stereo", "fusion" };
+static const char* kMetricsDecisionName[StageScheduler::kDecisionNum] = { "run", "downscale", "skip" };
+static MetricsHistogram* s_metrics_stage_latency[kMetricsStageNum];
+static MetricsHistogram* s_metrics_inference_latency[kMetricsStageNum];
+static MetricsCounter* s_metrics_stage_decision[kMetricsStageNum][StageScheduler::kDecisionNum];
+static MetricsCounter* s_metrics_frame_num;
+static MetricsCounter* s_metrics_frame_dropped_num;
+static MetricsHistogram* s_metrics_frame_latency;
+static MetricsHistogram* s_metrics_frame_interval;
+static MetricsGauge* s_metrics_fps;
+static MetricsGauge* s_metrics_stereo_tile_refined;
+static MetricsGauge* s_metrics_alignment_scale;
+static MetricsGauge* s_metrics_alignment_shift;
+static double s_frame_interval_average = 0;     /* [msec] EWMA for FPS */
+static std::chrono::steady_clock::time_point s_time_frame_previous;
 
 /*** Function ***/
 static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
 {
     char text[64];
-    static auto time_previous = std::chrono::steady_clock::now();
-    auto time_now = std::chrono::steady_clock::now();
-    double fps = 1e9 / (time_now - time_previous).count();
-    fps = 0;
-    time_previous = time_now;
-    snprintf(text, sizeof(text), "FPS: %.1f, Inference: %.1f [ms]", fps, time_inference);
+    snprintf(text, sizeof(text), "FPS: %.1f, Inference: %.1f [ms]", s_metrics_fps->Get(), time_inference);
     CommonHelper::DrawText(mat, text, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 }
 
+static void RegisterMetrics(void)
+{
+    Metrics& metrics = Metrics::GetInstance();
+    const std::vector<double>& bucket_list = Metrics::GetLatencyBucketList();
+    for (int32_t i = 0; i < kMetricsStageNum; i++) {
+        const std::string label_stage = std::string("stage=\"") + kMetricsStageName[i] + "\"";
+        s_metrics_stage_latency[i] = metrics.AddHistogram("image_processor_stage_latency_ms", "Processing time of each stage including pre and post process", bucket_list, label_stage);
+        if (i == kMetricsStageFusion) continue;     /* no model, and always run */
+        s_metrics_inference_latency[i] = metrics.AddHistogram("image_processor_inference_latency_ms", "Inference time of each model", bucket_list, label_stage);
+        for (int32_t d = 0; d < StageScheduler::kDecisionNum; d++) {
+            s_metrics_stage_decision[i][d] = metrics.AddCounter("image_processor_stage_decision_total", "Frames by the decision of the scheduler (skip reuses the last result)",
+                label_stage + ",decision=\"" + kMetricsDecisionName[d] + "\"");
+        }
+    }
+    s_metrics_frame_num = metrics.AddCounter("image_processor_frames_total", "Frames processed");
+    s_metrics_frame_dropped_num = metrics.AddCounter("image_processor_frames_dropped_total", "Frames without result because of an error in a model");
+    s_metrics_frame_latency = metrics.AddHistogram("image_processor_frame_latency_ms", "Processing time of a frame", bucket_list);
+    s_metrics_frame_interval = metrics.AddHistogram("image_processor_frame_interval_ms", "Interval between frames", bucket_list);
+    s_metrics_fps = metrics.AddGauge("image_processor_fps", "Frames per second (moving average)");
+    s_metrics_fps->Set(0);
+    s_metrics_stereo_tile_refined = metrics.AddGauge("image_processor_stereo_tiles_refined", "Tiles processed by HITNET in the last frame of the cascade mode");
+    s_metrics_stereo_tile_refined->Set(0);
+    s_metrics_alignment_scale = metrics.AddGauge("image_processor_alignment_scale", "Scale from MiDaS to disparity, fitted on the last frame with HITNET");
+    s_metrics_alignment_scale->Set(0);
+    s_metrics_alignment_shift = metrics.AddGauge("image_processor_alignment_shift", "Shift from MiDaS to disparity, fitted on the last frame with HITNET");
+    s_metrics_alignment_shift->Set(0);
+    s_frame_interval_average = 0;
+    s_time_frame_previous = std::chrono::steady_clock::time_point();
+}
+
+static void UpdateFrameMetrics(const std::chrono::steady_clock::time_point& time_frame)
+{
+    s_metrics_frame_num->Add();
+    if (s_time_frame_previous != std::chrono::steady_clock::time_point()) {
+        const double interval = static_cast<std::chrono::duration<double>>(time_frame - s_time_frame_previous).count() * 1000.0;
+        s_metrics_frame_interval->Observe(interval);
+        s_frame_interval_average = (s_frame_interval_average <= 0) ? interval : 0.1 * interval + 0.9 * s_frame_interval_average;
+        if (s_frame_interval_average > 0) s_metrics_fps->Set(1000.0 / s_frame_interval_average);
+    }
+    s_time_frame_previous = time_frame;
+}
+
 int32_t ImageProcessor::Initialize(const InputParam& input_param)
 {
     if (s_depth_stereo_engine) {
@@ -51,18 +205,55 @@ int32_t ImageProcessor::Initialize(const InputParam& input_param)
         return -1;
     }
 
+    RegisterMetrics();
+
+#ifdef USE_MIDAS_TILED
+    const bool is_midasv2_tiled = true;
+#else
+    const bool is_midasv2_tiled = false;
+#endif
     s_depth_midasv2_engine.reset(new DepthMidasv2Engine());
-    if (s_depth_midasv2_engine->Initialize(input_param.work_dir, input_param.num_threads) != DepthMidasv2Engine::kRetOk) {
+    if (s_depth_midasv2_engine->Initialize(input_param.work_dir, input_param.num_threads, false, is_midasv2_tiled) != DepthMidasv2Engine::kRetOk) {
         s_depth_midasv2_engine->Finalize();
         s_depth_midasv2_engine.reset();
         return -1;
     }
-    s_depth_stereo_engine.reset(new DepthStereoEngine());
-    if (s_depth_stereo_engine->Initialize(input_param.work_dir, input_param.num_threads) != DepthStereoEngine::kRetOk) {
+    s_depth_stereo_engine.reset(new StereoEngine());
+#ifdef USE_STEREO_CASCADE
+    const int32_t ret_stereo = s_depth_stereo_engine->Initialize(input_param.work_dir, input_param.num_threads, false, true);
+#else
+    const int32_t ret_stereo = s_depth_stereo_engine->Initialize(input_param.work_dir, input_param.num_threads);
+#endif
+    if (ret_stereo != StereoEngine::kRetOk) {
         s_depth_stereo_engine->Finalize();
         s_depth_stereo_engine.reset();
         return -1;
     }
+    s_depth_midasv2_engine_downscaled.reset(new DepthMidasv2Engine());
+    /* In tiled mode, the full resolution model on the whole image (one inference instead of all the tiles) */
+    if (s_depth_midasv2_engine_downscaled->Initialize(input_param.work_dir, input_param.num_threads, !is_midasv2_tiled) != DepthMidasv2Engine::kRetOk) {
+        PRINT("Downscaled model for MiDaS is not available\n");
+        s_depth_midasv2_engine_downscaled.reset();
+    }
+    s_depth_stereo_engine_downscaled.reset(new StereoEngine());
+    if (s_depth_stereo_engine_downscaled->Initialize(input_param.work_dir, input_param.num_threads, true) != StereoEngine::kRetOk) {
+        PRINT("Downscaled model for " STEREO_ENGINE_NAME " is not available\n");
+        s_depth_stereo_engine_downscaled.reset();
+    }
+
+    s_stage_scheduler = StageScheduler();
+    s_stage_scheduler.SetBudget(input_param.frame_budget);
+#ifdef USE_STAGE_SCHEDULER_LOG
+    s_stage_scheduler.SetLogEnabled(true);
+#endif
+    s_stage_id_midasv2 = s_stage_scheduler.AddStage("MiDaS", static_cast<bool>(s_depth_midasv2_engine_downscaled));
+    s_stage_id_stereo = s_stage_scheduler.AddStage(STEREO_ENGINE_NAME, static_cast<bool>(s_depth_stereo_engine_downscaled));
+
+    s_focal_length = input_param.focal_length;
+    s_baseline = input_param.baseline;
+    s_disparity_prior_scale = (input_param.disparity_scale > 0.0f) ? input_param.disparity_scale : 1.0f;
+    s_frame_cnt = 0;
+    s_depth_alignment.Reset();
 
     return 0;
 }
@@ -74,12 +265,32 @@ int32_t ImageProcessor::Finalize(void)
         return -1;
     }
 
+    /* Return the results leased from the engines before finalizing them */
+    s_mat_disparity_last.release();
+    s_is_roi_stats_built = false;
+    s_temporal_filter.Reset();
+    s_mat_disparity_temporal.release();
+    s_disparity_max_visualize = 0.0f;
+    s_mat_depth_stereo_last.release();
+    s_mat_midasv2_last.release();
+    s_mat_midasv2_upsampled.release();
+    s_mat_depth_midasv2_last.release();
+
     if (s_depth_midasv2_engine->Finalize() != DepthMidasv2Engine::kRetOk) {
         return -1;
     }
-    if (s_depth_stereo_engine->Finalize() != DepthStereoEngine::kRetOk) {
+    if (s_depth_stereo_engine->Finalize() != StereoEngine::kRetOk) {
         return -1;
     }
+    if (s_depth_midasv2_engine_downscaled) {
+        s_depth_midasv2_engine_downscaled->Finalize();
+        s_depth_midasv2_engine_downscaled.reset();
+    }
+    if (s_depth_stereo_engine_downscaled) {
+        s_depth_stereo_engine_downscaled->Finalize();
+        s_depth_stereo_engine_downscaled.reset();
+    }
+    s_stage_scheduler.PrintStatistics();
 
     return 0;
 }
@@ -93,92 +304,308 @@ int32_t ImageProcessor::Command(int32_t cmd)
     }
 
     switch (cmd) {
-    case 0:
-    default:
-        PRINT_E("command(%d) is not supported\n", cmd);
+    case kCommandStereoModelEth3d:
+    case kCommandStereoModelFlyingthings:
+    case kCommandStereoModelMiddlebury:
+    {
+#ifdef USE_STEREO_SGM
+        PRINT_E("No model to switch for " STEREO_ENGINE_NAME "\n");
         return -1;
-    }
-}
-
-static cv::Mat ConvertDisparity2Depth(const cv::Mat& mat_disparity, float fov, float baseline, float mag = 1.0f)
-{
-    cv::Mat mat_depth(mat_disparity.size(), CV_8UC1);
-    const float scale = mag * fov * baseline;
-#pragma omp parallel for
-    for (int32_t i = 0; i < mat_disparity.total(); i++) {
-        if (mat_disparity.at<float>(i) > 0) {
-            float Z = scale / mat_disparity.at<float>(i);   // [meter]
-            if (Z <= 255.0f) {
-                mat_depth.at<uint8_t>(i) = static_cast<uint8_t>(Z);
-            } else {
-                mat_depth.at<uint8_t>(i) = 255;
-            }
-        } else {
-            mat_depth.at<uint8_t>(i) = 255;
+#else
+        /* Models are preloaded, and the switch is applied at the next Process */
+        const int32_t model = DepthStereoEngine::kModelEth3d + (cmd - kCommandStereoModelEth3d);
+        if (s_depth_stereo_engine->SetModel(model) != StereoEngine::kRetOk) {
+            return -1;
+        }
+        if (s_depth_stereo_engine_downscaled) {
+            s_depth_stereo_engine_downscaled->SetModel(model);  /* ignore error because the downscaled model is optional */
         }
+        return 0;
+#endif
     }
-    return mat_depth;
-}
-
-static cv::Mat NormalizeDisparity(const cv::Mat& mat_disparity, float max_disparity, float mag = 1.0f)
-{
-    cv::Mat mat_depth(mat_disparity.size(), CV_8UC1);
-    const float scale = mag * 255.0f / max_disparity;
-#pragma omp parallel for
-    for (int32_t i = 0; i < mat_disparity.total(); i++) {
-        mat_depth.at<uint8_t>(i) = static_cast<uint8_t>(mat_disparity.at<float>(i) * scale);
+    default:
+        PRINT_E("command(%d) is not supported\n", cmd);
+        return -1;
     }
-    return mat_depth;
 }
 
-cv::Mat NormalizeMinMax(cv::Mat& mat_depth)
+static cv::Mat VisualizeDepth(const cv::Mat& mat_depth, float depth_max)
 {
-    /* (255 * (prediction - depth_min) / (depth_max - depth_min)) */
+    /* near = bright. 0 (invalid) = black */
     cv::Mat mat_out;
-    double depth_min, depth_max;
-    cv::minMaxLoc(mat_depth, &depth_min, &depth_max);
-    mat_depth.convertTo(mat_out, CV_8UC1, 255. / (depth_max - depth_min), (-255. * depth_min) / (depth_max - depth_min));
+    mat_depth.convertTo(mat_out, CV_8UC1, -255.0 / depth_max, 255.0);
+    mat_out.setTo(0, mat_depth <= 0);
     return mat_out;
 }
 
-int32_t ImageProcessor::Process(cv::Mat& mat_color, cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat& mat_result_0, cv::Mat& mat_result_1, Result& result)
+int32_t ImageProcessor::Process(cv::Mat& mat_color, cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat& mat_disparity, cv::Mat& mat_result_0, cv::Mat& mat_result_1, cv::Mat& mat_result_2, Result& result)
 {
     if (!s_depth_stereo_engine) {
         PRINT_E("Not initialized\n");
         return -1;
     }
 
+    const auto& t_frame0 = std::chrono::steady_clock::now();
+    UpdateFrameMetrics(t_frame0);
+    s_stage_scheduler.BeginFrame();
+    bool is_stereo_required = true;
+#ifdef USE_DEPTH_FUSION
+    is_stereo_required = (s_frame_cnt % DEPTH_FUSION_STEREO_INTERVAL == 0) || !s_depth_alignment.IsValid() || s_mat_disparity_last.empty();
+#endif
+    s_frame_cnt++;
+    s_stage_scheduler.SetRequired(s_stage_id_stereo, is_stereo_required);
+
     /* Mono depth by Midas V2 */
+    const cv::Mat* mat_midas_input = &mat_color;
+#ifdef USE_DEPTH_FUSION
+    if (mat_left.channels() == 1) {
+        cv::cvtColor(mat_left, s_mat_midas_input, cv::COLOR_GRAY2BGR);
+        mat_midas_input = &s_mat_midas_input;
+    } else {
+        mat_midas_input = &mat_left;
+    }
+#endif
     DepthMidasv2Engine::Result result_depth_midasv2_engine;
-    if (s_depth_midasv2_engine->Process(mat_color, result_depth_midasv2_engine) != DepthStereoEngine::kRetOk) {
-        return -1;
+    const StageScheduler::Decision decision_midasv2 = s_stage_scheduler.Decide(s_stage_id_midasv2);
+    s_metrics_stage_decision[kMetricsStageMidasv2][decision_midasv2]->Add();
+    if (decision_midasv2 != StageScheduler::kDecisionSkip) {
+        const auto& t_stage0 = std::chrono::steady_clock::now();
+        DepthMidasv2Engine* engine = (decision_midasv2 == StageScheduler::kDecisionDownscale) ? s_depth_midasv2_engine_downscaled.get() : s_depth_midasv2_engine.get();
+        if (engine->Process(*mat_midas_input, result_depth_midasv2_engine) != DepthMidasv2Engine::kRetOk) {
+            s_metrics_frame_dropped_num->Add();
+            return -1;
+        }
+        s_metrics_inference_latency[kMetricsStageMidasv2]->Observe(result_depth_midasv2_engine.time_inference);
+        s_mat_midasv2_last = result_depth_midasv2_engine.mat_out;   /* keeps the lease on the engine output */
+#ifdef USE_GUIDED_UPSAMPLING
+        const cv::Mat& mat_midasv2_out = result_depth_midasv2_engine.mat_out;
+        if (mat_midasv2_out.size() != mat_midas_input->size() && mat_midasv2_out.cols <= mat_midas_input->cols && mat_midasv2_out.rows <= mat_midas_input->rows) {
+            const auto& t_upsample0 = std::chrono::steady_clock::now();
+            if (s_guided_filter_midasv2.Upsample(*mat_midas_input, mat_midasv2_out, s_mat_midasv2_upsampled, GUIDED_UPSAMPLING_RADIUS, GUIDED_UPSAMPLING_EPS) == GuidedFilter::kRetOk) {
+                s_mat_midasv2_last = s_mat_midasv2_upsampled;
+            }
+            const auto& t_upsample1 = std::chrono::steady_clock::now();
+            result_depth_midasv2_engine.time_post_process += static_cast<std::chrono::duration<double>>(t_upsample1 - t_upsample0).count() * 1000.0;
+        }
+#endif
+
+        cv::Mat mat_depth_midasv2 = CommonHelper::NormalizeMinMax(s_mat_midasv2_last);
+        CommonHelper::ApplyColorMap(mat_depth_midasv2, mat_depth_midasv2, cv::COLORMAP_MAGMA);
+        cv::resize(mat_depth_midasv2, mat_depth_midasv2, mat_midas_input->size());
+        DrawFps(mat_depth_midasv2, result_depth_midasv2_engine.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+        s_mat_depth_midasv2_last = mat_depth_midasv2;
+        const auto& t_stage1 = std::chrono::steady_clock::now();
+        const double time_stage = static_cast<std::chrono::duration<double>>(t_stage1 - t_stage0).count() * 1000.0;
+        s_stage_scheduler.Report(s_stage_id_midasv2, decision_midasv2, time_stage);
+        s_metrics_stage_latency[kMetricsStageMidasv2]->Observe(time_stage);
     }
-    
-    cv::Mat mat_depth_midasv2 = NormalizeMinMax(result_depth_midasv2_engine.mat_out);
-    cv::applyColorMap(mat_depth_midasv2, mat_depth_midasv2, cv::COLORMAP_MAGMA);
-    cv::resize(mat_depth_midasv2, mat_depth_midasv2, mat_color.size());
-    DrawFps(mat_depth_midasv2, result_depth_midasv2_engine.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
-  
 
     /* Stereo depth by HITNET */
-    DepthStereoEngine::Result result_depth_stereo_engine;
-    if (s_depth_stereo_engine->Process(mat_left, mat_right, result_depth_stereo_engine) != DepthStereoEngine::kRetOk) {
-        return -1;
+    StereoEngine::Result result_depth_stereo_engine;
+    const StageScheduler::Decision decision_stereo = s_stage_scheduler.Decide(s_stage_id_stereo);
+    s_metrics_stage_decision[kMetricsStageStereo][decision_stereo]->Add();
+    if (decision_stereo != StageScheduler::kDecisionSkip) {
+        const auto& t_stage0 = std::chrono::steady_clock::now();
+        StereoEngine* engine = (decision_stereo == StageScheduler::kDecisionDownscale) ? s_depth_stereo_engine_downscaled.get() : s_depth_stereo_engine.get();
+#ifdef USE_STEREO_CASCADE
+        /* The downscaled engine is not in cascade mode, and ignores the prior */
+        const int32_t ret_stereo = engine->Process(mat_left, mat_right, mat_disparity, s_disparity_prior_scale, result_depth_stereo_engine);
+#else
+        const int32_t ret_stereo = engine->Process(mat_left, mat_right, result_depth_stereo_engine);
+#endif
+        if (ret_stereo != StereoEngine::kRetOk) {
+            s_metrics_frame_dropped_num->Add();
+            return -1;
+        }
+#ifdef USE_STEREO_CASCADE
+        s_metrics_stereo_tile_refined->Set(result_depth_stereo_engine.tile_refined_num);
+#endif
+        s_metrics_inference_latency[kMetricsStageStereo]->Observe(result_depth_stereo_engine.time_inference);
+#ifdef USE_GUIDED_FILTER
+        const auto& t_guided_filter0 = std::chrono::steady_clock::now();
+        bool is_filtered = false;
+#ifdef USE_GUIDED_UPSAMPLING
+        if (result_depth_stereo_engine.image.cols < mat_left.cols && result_depth_stereo_engine.image.rows <= mat_left.rows) {
+            /* Output of the downscaled model. Disparity is scaled to the pixel of mat_left too */
+            const float disparity_scale = static_cast<float>(mat_left.cols) / result_depth_stereo_engine.image.cols;
+            if (s_guided_filter.Upsample(mat_left, result_depth_stereo_engine.image, s_mat_disparity_filtered, GUIDED_UPSAMPLING_RADIUS, GUIDED_UPSAMPLING_EPS, disparity_scale) == GuidedFilter::kRetOk) {
+                result_depth_stereo_engine.image = s_mat_disparity_filtered;
+                result_depth_stereo_engine.max_disparity *= disparity_scale;
+                is_filtered = true;
+            }
+        }
+#endif
+        if (!is_filtered) {
+            const cv::Mat* mat_guide = &mat_left;
+            if (mat_left.size() != result_depth_stereo_engine.image.size()) {
+                cv::resize(mat_left, s_mat_guide, result_depth_stereo_engine.image.size());
+                mat_guide = &s_mat_guide;
+            }
+            if (s_guided_filter.Filter(*mat_guide, result_depth_stereo_engine.image, s_mat_disparity_filtered, GUIDED_FILTER_RADIUS, GUIDED_FILTER_EPS) == GuidedFilter::kRetOk) {
+                result_depth_stereo_engine.image = s_mat_disparity_filtered;
+            }
+        }
+        const auto& t_guided_filter1 = std::chrono::steady_clock::now();
+        result_depth_stereo_engine.time_post_process += static_cast<std::chrono::duration<double>>(t_guided_filter1 - t_guided_filter0).count() * 1000.0;
+#endif
+#ifdef USE_TEMPORAL_FILTER
+        const auto& t_temporal_filter0 = std::chrono::steady_clock::now();
+        /* The state is reset when the resolution changes (the downscaled engine without upsampling) */
+        if (s_temporal_filter.Filter(result_depth_stereo_engine.image, s_mat_disparity_temporal, TEMPORAL_FILTER_ALPHA, TEMPORAL_FILTER_RESET_RATIO, TEMPORAL_FILTER_HOLE_FRAME) == TemporalFilter::kRetOk) {
+            result_depth_stereo_engine.image = s_mat_disparity_temporal;
+        }
+        const auto& t_temporal_filter1 = std::chrono::steady_clock::now();
+        result_depth_stereo_engine.time_post_process += static_cast<std::chrono::duration<double>>(t_temporal_filter1 - t_temporal_filter0).count() * 1000.0;
+#endif
+        s_mat_disparity_last = result_depth_stereo_engine.image;
+        s_disparity_scale_x = static_cast<float>(result_depth_stereo_engine.image.cols) / mat_left.cols;
+        s_disparity_scale_y = static_cast<float>(result_depth_stereo_engine.image.rows) / mat_left.rows;
+        s_is_roi_stats_built = false;
+        //cv::Mat mat_depth = CommonHelper::ConvertDisparity2Depth(result_depth_stereo_engine.image, 500.0f, 0.2f, 50);
+        //cv::Mat mat_depth_stereo = CommonHelper::NormalizeDisparity(result_depth_stereo_engine.image, s_depth_stereo_engine->GetMaxDisparity(), 1.0f);
+#ifdef USE_TEMPORAL_FILTER
+        /* Min-max normalization per frame changes the colors frame to frame even if the disparity is stable. Smooth the range too */
+        double disparity_max = 0.0;
+        cv::minMaxLoc(result_depth_stereo_engine.image, nullptr, &disparity_max);
+        const float disparity_max_ratio = static_cast<float>(disparity_max) / result_depth_stereo_engine.image.cols;
+        if (s_disparity_max_visualize > 0.0f) {
+            s_disparity_max_visualize += TEMPORAL_FILTER_ALPHA * (disparity_max_ratio - s_disparity_max_visualize);
+        } else {
+            s_disparity_max_visualize = disparity_max_ratio;
+        }
+        cv::Mat mat_depth_stereo;
+        if (s_disparity_max_visualize > 0.0f) {
+            mat_depth_stereo = CommonHelper::NormalizeDisparity(result_depth_stereo_engine.image, s_disparity_max_visualize * result_depth_stereo_engine.image.cols, 1.0f);
+        } else {
+            mat_depth_stereo = cv::Mat::zeros(result_depth_stereo_engine.image.size(), CV_8UC1);
+        }
+#else
+        cv::Mat mat_depth_stereo = CommonHelper::NormalizeMinMax(result_depth_stereo_engine.image);
+#endif
+        CommonHelper::ApplyColorMap(mat_depth_stereo, mat_depth_stereo, cv::COLORMAP_MAGMA);
+        cv::resize(mat_depth_stereo, mat_depth_stereo, mat_left.size());
+        DrawFps(mat_depth_stereo, result_depth_stereo_engine.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+        s_mat_depth_stereo_last = mat_depth_stereo;
+        s_max_disparity_last = result_depth_stereo_engine.max_disparity;
+        const auto& t_stage1 = std::chrono::steady_clock::now();
+        const double time_stage = static_cast<std::chrono::duration<double>>(t_stage1 - t_stage0).count() * 1000.0;
+        s_stage_scheduler.Report(s_stage_id_stereo, decision_stereo, time_stage);
+        s_metrics_stage_latency[kMetricsStageStereo]->Observe(time_stage);
+    }
+    const bool is_stereo_processed = (decision_stereo != StageScheduler::kDecisionSkip);
+
+    /* Fusion: fit scale and shift on frames with HITNET, and reuse them on the other frames */
+    cv::Mat mat_depth_fused;
+#ifdef USE_DEPTH_FUSION
+    const auto& t_fusion0 = std::chrono::steady_clock::now();
+    cv::resize(s_mat_midasv2_last, s_mat_relative, s_mat_disparity_last.size());
+    if (is_stereo_processed) {
+        s_depth_alignment.Fit(s_mat_relative, s_mat_disparity_last, DEPTH_FUSION_SAMPLE_STEP);   /* keep the previous parameters if failed */
+        s_metrics_alignment_scale->Set(s_depth_alignment.GetScale());
+        s_metrics_alignment_shift->Set(s_depth_alignment.GetShift());
     }
-    //cv::Mat mat_depth = ConvertDisparity2Depth(result_depth_stereo_engine.image, 500.0f, 0.2f, 50);
-    //cv::Mat mat_depth_stereo = NormalizeDisparity(result_depth_stereo_engine.image, s_depth_stereo_engine->GetMaxDisparity(), 1.0f);
-    cv::Mat mat_depth_stereo = NormalizeMinMax(result_depth_stereo_engine.image);
-    cv::applyColorMap(mat_depth_stereo, mat_depth_stereo, cv::COLORMAP_MAGMA);
-    cv::resize(mat_depth_stereo, mat_depth_stereo, mat_left.size());
-    DrawFps(mat_depth_stereo, result_depth_stereo_engine.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+    /* disparity is in the resolution of HITNET, so is the focal length */
+    if (s_depth_alignment.Fuse(s_mat_relative, is_stereo_processed ? s_mat_disparity_last : cv::Mat(), s_focal_length * s_disparity_scale_x, s_baseline, s_mat_depth_fused) == DepthAlignment::kRetOk) {
+        mat_depth_fused = VisualizeDepth(s_mat_depth_fused, DEPTH_FUSION_DEPTH_MAX);
+        CommonHelper::ApplyColorMap(mat_depth_fused, mat_depth_fused, cv::COLORMAP_MAGMA);
+        cv::resize(mat_depth_fused, mat_depth_fused, mat_left.size());
+    }
+    const auto& t_fusion1 = std::chrono::steady_clock::now();
+    const double time_fusion = static_cast<std::chrono::duration<double>>(t_fusion1 - t_fusion0).count() * 1000.0;
+    result_depth_midasv2_engine.time_post_process += time_fusion;
+    s_metrics_stage_latency[kMetricsStageFusion]->Observe(time_fusion);
+#endif
 
     /* Return the results */
-    mat_result_0 = mat_depth_midasv2;
-    mat_result_1 = mat_depth_stereo;
+    mat_result_0 = s_mat_depth_midasv2_last;
+    mat_result_1 = s_mat_depth_stereo_last;
+    mat_result_2 = mat_depth_fused;
     result.time_pre_process = result_depth_midasv2_engine.time_pre_process + result_depth_stereo_engine.time_pre_process;
+    result.time_pre_process_midas = result_depth_midasv2_engine.time_pre_process;
+    result.time_pre_process_stereo = result_depth_stereo_engine.time_pre_process;
+    result.time_tiling_midas = result_depth_midasv2_engine.time_tiling;
+    result.time_stitching_midas = result_depth_midasv2_engine.time_stitching;
     result.time_inference = result_depth_midasv2_engine.time_inference + result_depth_stereo_engine.time_inference;
     result.time_post_process = result_depth_midasv2_engine.time_post_process + result_depth_stereo_engine.time_post_process;
+    result.is_stereo_processed = is_stereo_processed;
+    result.decision_midasv2 = decision_midasv2;
+    result.decision_stereo = decision_stereo;
+#ifdef USE_STEREO_CASCADE
+    result.stereo_tile_num = result_depth_stereo_engine.tile_num;
+    result.stereo_tile_refined_num = result_depth_stereo_engine.tile_refined_num;
+#else
+    result.stereo_tile_num = 0;
+    result.stereo_tile_refined_num = 0;
+#endif
+    result.alignment_scale = s_depth_alignment.GetScale();
+    result.alignment_shift = s_depth_alignment.GetShift();
+
+    s_metrics_frame_latency->Observe(static_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - t_frame0).count() * 1000.0);
+
+    return 0;
+}
+
+int32_t ImageProcessor::GetRoiDepth(std::vector<RoiDepth>& roi_depth_list)
+{
+    if (!s_depth_stereo_engine) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    if (s_mat_disparity_last.empty()) {
+        PRINT_E("No result\n");
+        return -1;
+    }
+
+    if (!s_is_roi_stats_built) {
+        /* disparity <= 0 is invalid */
+        if (s_depth_roi_stats.Build(s_mat_disparity_last, 0.1f, s_max_disparity_last, 128) != DepthRoiStats::kRetOk) {
+            return -1;
+        }
+        s_is_roi_stats_built = true;
+    }
+
+    for (auto& roi_depth : roi_depth_list) {
+        cv::Rect rect(static_cast<int32_t>(roi_depth.x * s_disparity_scale_x), static_cast<int32_t>(roi_depth.y * s_disparity_scale_y),
+            static_cast<int32_t>(roi_depth.width * s_disparity_scale_x), static_cast<int32_t>(roi_depth.height * s_disparity_scale_y));
+        DepthRoiStats::Stats stats;
+        s_depth_roi_stats.Query(rect, stats);
+        roi_depth.disparity_mean = stats.mean / s_disparity_scale_x;     /* disparity in the coordinate of mat_left */
+        roi_depth.disparity_median = stats.median / s_disparity_scale_x;
+        roi_depth.valid_ratio = stats.valid_ratio;
+    }
 
     return 0;
 }
 
+int32_t ImageProcessor::GetDepth(cv::Mat& mat_disparity, cv::Mat& mat_depth)
+{
+    if (!s_depth_stereo_engine) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    if (s_mat_disparity_last.empty()) {
+        PRINT_E("No result\n");
+        return -1;
+    }
+    /* No copy. The next Process writes into the same buffers (see image_processor.h) */
+    mat_disparity = s_mat_disparity_last;
+#ifdef USE_DEPTH_FUSION
+    mat_depth = s_mat_depth_fused;
+#else
+    mat_depth = cv::Mat();
+#endif
+    return 0;
+}
+
+int32_t ImageProcessor::GetEngineThreadNum(void)
+{
+    int32_t thread_num = 0;
+    if (s_depth_midasv2_engine) thread_num++;
+    if (s_depth_midasv2_engine_downscaled) thread_num++;
+#ifndef USE_STEREO_SGM
+    /* SGM runs in the caller of Process and the thread pool */
+    if (s_depth_stereo_engine) thread_num++;
+    if (s_depth_stereo_engine_downscaled) thread_num++;
+#endif
+    return thread_num;
+}
@@ -15,21 +15,59 @@ namespace cv {
 namespace ImageProcessor
 {
 
+enum {
+    kCommandStereoModelEth3d = 0,           // HITNET model for accuracy / latency trade-off
+    kCommandStereoModelFlyingthings,
+    kCommandStereoModelMiddlebury,
+};
+
 typedef struct {
     char     work_dir[256];
     int32_t  num_threads;
+    float    focal_length;      // [px] of the rectified mono image
+    float    baseline;          // [m]
+    double   frame_budget;      // [msec] latency budget for Process. 0 = always run all models at full resolution
+    float    disparity_scale;   // [px] per unit of mat_disparity of Process (e.g. 1/8 for subpixel disparity by DepthAI). 0 = 1
 } InputParam;
 
 typedef struct {
     double time_pre_process;   // [msec]
+    double time_pre_process_midas;     // [msec] included in time_pre_process
+    double time_pre_process_stereo;    // [msec] included in time_pre_process
+    double time_tiling_midas;          // [msec] included in time_pre_process_midas. 0 unless MiDaS runs in tiles
+    double time_stitching_midas;       // [msec] included in time_post_process. 0 unless MiDaS runs in tiles
     double time_inference;    // [msec]
     double time_post_process;  // [msec]
+    bool   is_stereo_processed;    // false if HITNET is skipped and the depth is from aligned MiDaS only
+    float  alignment_scale;        // disparity = scale * MiDaS + shift
+    float  alignment_shift;
+    int32_t decision_midasv2;      // 0: run, 1: downscaled model, 2: skipped (the last result is reused)
+    int32_t decision_stereo;
+    int32_t stereo_tile_num;           // tiles of the image in the stereo cascade mode. 0 otherwise
+    int32_t stereo_tile_refined_num;   // tiles processed by HITNET in the stereo cascade mode
 } Result;
 
+typedef struct {
+    int32_t x;                  // [px] ROI in the coordinate of mat_left
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    float   disparity_mean;     // [px]
+    float   disparity_median;   // [px]
+    float   valid_ratio;        // ratio of pixels which have valid disparity
+} RoiDepth;
+
 int32_t Initialize(const InputParam& input_param);
-int32_t Process(cv::Mat& mat_color, cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat& mat_result_0, cv::Mat& mat_result_1, Result& result);
+/* mat_disparity: disparity by DepthAI aligned to mat_right (CV_8UC1 or CV_16UC1 in InputParam::disparity_scale, 0 = invalid). Used by the stereo cascade mode only, and can be empty */
+int32_t Process(cv::Mat& mat_color, cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat& mat_disparity, cv::Mat& mat_result_0, cv::Mat& mat_result_1, cv::Mat& mat_result_2, Result& result);
 int32_t Finalize(void);
 int32_t Command(int32_t cmd);
+int32_t GetRoiDepth(std::vector<RoiDepth>& roi_depth_list);     /* statistics of disparity by HITNET in the last Process */
+/* Raw results of the last Process: disparity by HITNET [px] in the resolution of HITNET (CV_32FC1), and fused depth [m] (CV_32FC1, empty without fusion)
+ * The returned Mats share the buffers of ImageProcessor. Don't modify them. They are valid until the next Process, which overwrites them. clone() to keep them longer */
+int32_t GetDepth(cv::Mat& mat_disparity, cv::Mat& mat_depth);
+/* Threads created by the engines in Initialize (one per model). They inherit the CPU mask of the caller of Initialize */
+int32_t GetEngineThreadNum(void);
 
 }
 
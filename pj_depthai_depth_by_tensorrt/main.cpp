@@ -18,17 +18,52 @@ limitations under the License.
 #include <cstdlib>
 #include <string>
 #include <algorithm>
+#include <vector>
 #include <chrono>
+#include <thread>
 
 /* for OpenCV */
 //#include <opencv2/opencv.hpp>
 #include "depthai/depthai.hpp"
 
 /* for My modules */
+#include "common_helper_cv.h"
+#include "guided_filter.h"
+#include "temporal_filter.h"
+#include "hole_filling.h"
+#include "pooled_mat_allocator.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include "shm_frame_ring.h"
+#include "frame_recorder.h"
 #include "image_processor.h"
 
 /*** Macro ***/
 #define WORK_DIR                      RESOURCE_DIR
+#define FRAME_BUDGET                  100.0     /* [msec] latency budget for image processing. 0 = always run all models */
+#define USE_STEREO_SUBPIXEL                     /* disparity by DepthAI in CV_16UC1 of 1/8 px instead of CV_8UC1 of px */
+//#define USE_STEREO_EXTENDED                     /* disparity by DepthAI up to 190 px instead of 95 px, for close objects. Set CASCADE_MARGIN to 192 for USE_STEREO_CASCADE */
+#define USE_POOLED_MAT_ALLOCATOR                /* recycle buffers of cv::Mat created in every frame */
+#define USE_TEMPORAL_FILTER                     /* blend disparity by DepthAI with the previous frames against flicker */
+#define TEMPORAL_FILTER_ALPHA         0.4f      /* weight of the new frame */
+#define TEMPORAL_FILTER_RESET_RATIO   0.1f      /* relative change regarded as motion, where the history is discarded */
+#define TEMPORAL_FILTER_HOLE_FRAME    2         /* frames to fill a hole with the history */
+#define USE_HOLE_FILLING                        /* fill invalid disparity by DepthAI from the neighbors (push-pull) for display and the dense stream */
+#define HOLE_FILLING_LEVEL            0         /* pyramid levels. holes up to 2^level [px] away from valid pixels are filled. 0 = all */
+#define METRICS_HTTP_PORT             9110      /* serve metrics on http://127.0.0.1:port/metrics. 0 = disabled */
+//#define METRICS_FILE                  "metrics.prom"    /* rewrite the file every METRICS_FILE_INTERVAL [msec] instead (e.g. for node_exporter textfile collector) */
+#define METRICS_FILE_INTERVAL         5000
+#define THREAD_POOL_NUM               0         /* threads for pre/post processing including the main thread. 0 = CPUs left by the inference backend and the engines */
+#define INFERENCE_THREAD_NUM          4         /* threads of the inference backend (used by CPU backends) */
+#define CPU_LIST_MAIN                 {}        /* CPUs for the main thread (capture, pre/post processing and display). e.g. {0}. {} = not pinned */
+#define CPU_LIST_POOL                 {}        /* CPUs for the workers of the thread pool. e.g. {1, 2, 3}. {} = not pinned */
+#define CPU_LIST_INFERENCE            {}        /* CPUs for the inference threads of the engines and the inference backend. e.g. {4, 5}. {} = not pinned */
+//#define SHM_NAME                      "/depthai_depth_by_tensorrt"  /* publish frames to other processes via shared memory (ShmFrameReader) */
+#define SHM_SLOT_NUM                  4         /* frames kept for each stream. readers have (SHM_SLOT_NUM - 1) frames time to use a frame */
+#define SHM_COMPRESSION               ShmFrameFormat::kCompressionNone  /* kCompressionRvl: compress disparity streams losslessly. readers get decoded copies instead of views */
+//#define RECORD_FILE                   "depthai_depth_by_tensorrt.rec"   /* record the streams (FrameReader). disparity is compressed losslessly */
+#define HITNET_DISPARITY_SCALE        32.0      /* HITNET disparity [px] is stored as CV_16UC1 in 1/32 px for compression */
+//#define USE_MIDAS_TILED                         /* MiDaS on the 1080p video in tiles instead of the preview. Set the same in image_processor.cpp */
 
 /*** Function ***/
 class DepthAiWrapper
@@ -48,6 +83,10 @@ public:
         /* Color Camera */
         auto xout_color_camera_preview = pipeline.create<dai::node::XLinkOut>();
         xout_color_camera_preview->setStreamName("color_camera_preview");
+#ifdef USE_MIDAS_TILED
+        auto xout_color_camera_video = pipeline.create<dai::node::XLinkOut>();
+        xout_color_camera_video->setStreamName("color_camera_video");
+#endif
         /* Stereo Camera */
         auto xout_mono_camera_rectified_right = pipeline.create<dai::node::XLinkOut>();
         xout_mono_camera_rectified_right->setStreamName("mono_camera_rectified_right");
@@ -73,12 +112,25 @@ public:
         stereo->setRectifyEdgeFillColor(0);
         stereo->initialConfig.setMedianFilter(dai::MedianFilter::KERNEL_7x7);
         stereo->setLeftRightCheck(true);
-        stereo->setExtendedDisparity(false);
-        stereo->setSubpixel(false);
+#ifdef USE_STEREO_EXTENDED
+        const bool is_extended = true;
+#else
+        const bool is_extended = false;
+#endif
+#ifdef USE_STEREO_SUBPIXEL
+        const bool is_subpixel = true;
+#else
+        const bool is_subpixel = false;
+#endif
+        stereo->setExtendedDisparity(is_extended);
+        stereo->setSubpixel(is_subpixel);
 
         /*** Linking ***/
         /* Color Camera */
         color_camera->preview.link(xout_color_camera_preview->input);
+#ifdef USE_MIDAS_TILED
+        color_camera->video.link(xout_color_camera_video->input);
+#endif
         /* Stereo Camera */
         mono_camera_right->out.link(stereo->right);
         mono_camera_left->out.link(stereo->left);
@@ -92,11 +144,23 @@ public:
         /*** Get Output Queue ***/
         /* Color Camera */
         queue_color_camera_preview = device->getOutputQueue("color_camera_preview", 4, false);
+#ifdef USE_MIDAS_TILED
+        queue_color_camera_video = device->getOutputQueue("color_camera_video", 4, false);
+#endif
         /* Stereo Camera */
         queue_mono_camera_rectified_right = device->getOutputQueue("mono_camera_rectified_right", 4, false);
         queue_mono_camera_rectified_left = device->getOutputQueue("mono_camera_rectified_left", 4, false);
         queue_disparity = device->getOutputQueue("disparity", 4, false);
-        disparity_multiplier = 255 / stereo->initialConfig.getMaxDisparity();
+
+        /*** Scale of the raw disparity by the modes set above, instead of getMaxDisparity() ***/
+        disparity_scale = CommonHelper::GetStereoDisparityScale(is_subpixel);
+        max_disparity = CommonHelper::GetStereoMaxDisparity(is_extended);
+        disparity_multiplier = 255 * disparity_scale / max_disparity;
+
+        /*** Calibration for metric depth ***/
+        dai::CalibrationHandler calibration = device->readCalibration();
+        focal_length = calibration.getCameraIntrinsics(dai::CameraBoardSocket::RIGHT, 640, 480)[0][0];
+        baseline = calibration.getBaselineDistance() / 100.0f;     /* [cm] -> [m] */
     }
     ~DepthAiWrapper() {}
 
@@ -105,6 +169,13 @@ public:
         return queue_color_camera_preview->get<dai::ImgFrame>()->getCvFrame();
     }
 
+#ifdef USE_MIDAS_TILED
+    cv::Mat GetColorCameraVideo()
+    {
+        return queue_color_camera_video->get<dai::ImgFrame>()->getCvFrame();
+    }
+#endif
+
     cv::Mat GetMonoCameraRectifiedRight()
     {
         return queue_mono_camera_rectified_right->get<dai::ImgFrame>()->getCvFrame();
@@ -120,27 +191,114 @@ public:
         return queue_disparity->get<dai::ImgFrame>()->getCvFrame();
     }
 
+    /* [px] per unit of the raw disparity */
+    float GetDisparityScale()
+    {
+        return disparity_scale;
+    }
+
+    /* [px] */
+    float GetMaxDisparity()
+    {
+        return max_disparity;
+    }
+
+    /* raw disparity -> 0 - 255 */
     float GetDisparityMultiplier()
     {
         return disparity_multiplier;
     }
 
+    float GetFocalLength()
+    {
+        return focal_length;
+    }
+
+    float GetBaseline()
+    {
+        return baseline;
+    }
+
 private:
     dai::Pipeline pipeline;
     std::unique_ptr<dai::Device> device;
 
     /* Color Camera */
     std::shared_ptr<dai::DataOutputQueue> queue_color_camera_preview;
+#ifdef USE_MIDAS_TILED
+    std::shared_ptr<dai::DataOutputQueue> queue_color_camera_video;
+#endif
     /* Stereo Camera */
     std::shared_ptr<dai::DataOutputQueue> queue_mono_camera_rectified_right;
     std::shared_ptr<dai::DataOutputQueue> queue_mono_camera_rectified_left;
     std::shared_ptr<dai::DataOutputQueue> queue_disparity;
+    float disparity_scale;
+    float max_disparity;
     float disparity_multiplier;
+    float focal_length;
+    float baseline;
 };
 
+#ifdef SHM_NAME
+static void OpenShmPublisher(ShmFramePublisher& shm_publisher, const cv::Mat& image_color, const cv::Mat& image_mono, const cv::Mat& image_disparity)
+{
+    /* Results of ImageProcessor are at most the size of the mono image */
+    const size_t size_color = image_color.total() * image_color.elemSize();
+    const size_t size_mono = image_mono.total() * image_mono.elemSize();
+    const size_t size_disparity = image_disparity.total() * image_disparity.elemSize();
+    const size_t area_mono = image_mono.total();
+    std::vector<ShmFramePublisher::StreamConfig> stream_config_list = {
+        ShmFramePublisher::StreamConfig("color", size_color, SHM_SLOT_NUM),
+        ShmFramePublisher::StreamConfig("left", size_mono, SHM_SLOT_NUM),
+        ShmFramePublisher::StreamConfig("right", size_mono, SHM_SLOT_NUM),
+        ShmFramePublisher::StreamConfig("disparity", size_disparity, SHM_SLOT_NUM, SHM_COMPRESSION),    /* raw disparity by DepthAI */
+        ShmFramePublisher::StreamConfig("depth_device", image_disparity.total() * sizeof(uint16_t), SHM_SLOT_NUM, SHM_COMPRESSION),    /* [mm] of the raw disparity by DepthAI. CV_16UC1 */
+        ShmFramePublisher::StreamConfig("disparity_colored", area_mono * 3, SHM_SLOT_NUM),
+#ifdef USE_HOLE_FILLING
+        ShmFramePublisher::StreamConfig("disparity_dense", image_disparity.total() * sizeof(float), SHM_SLOT_NUM),    /* filtered and filled disparity by DepthAI. CV_32FC1 */
+        ShmFramePublisher::StreamConfig("disparity_valid", image_disparity.total(), SHM_SLOT_NUM),                   /* 255 where disparity_dense is measured, 0 where filled. CV_8UC1 */
+#endif
+        ShmFramePublisher::StreamConfig("midasv2", area_mono * 3, SHM_SLOT_NUM),
+        ShmFramePublisher::StreamConfig("hitnet", area_mono * 3, SHM_SLOT_NUM),
+        ShmFramePublisher::StreamConfig("fusion", area_mono * 3, SHM_SLOT_NUM),
+        ShmFramePublisher::StreamConfig("hitnet_disparity", area_mono * sizeof(float), SHM_SLOT_NUM),  /* [px] CV_32FC1 */
+        ShmFramePublisher::StreamConfig("depth", area_mono * sizeof(float), SHM_SLOT_NUM),             /* [m] CV_32FC1 */
+        ShmFramePublisher::StreamConfig("hitnet_disparity16", area_mono * sizeof(uint16_t), SHM_SLOT_NUM, SHM_COMPRESSION),   /* [1/HITNET_DISPARITY_SCALE px] CV_16UC1 */
+    };
+    if (shm_publisher.Open(SHM_NAME, stream_config_list) != ShmFramePublisher::kRetOk) {
+        printf("Shared memory is not available. Continue without publishing\n");
+    }
+}
+
+static void PublishShmFrame(ShmFramePublisher& shm_publisher, const char* name, const cv::Mat& image, int64_t timestamp_us, int64_t sequence_num)
+{
+    if (!shm_publisher.IsOpened() || image.empty()) return;
+    shm_publisher.Write(shm_publisher.GetStreamId(name), image, timestamp_us, sequence_num);
+}
+#endif
+
+static int32_t GetThreadPoolNum(int32_t engine_thread_num)
+{
+#if THREAD_POOL_NUM > 0
+    (void)engine_thread_num;
+    return THREAD_POOL_NUM;
+#else
+    /* Workers on each CPU in the list, or on the CPUs not used by the other threads so as not to oversubscribe them. Including the main thread */
+    const std::vector<int32_t> cpu_list_pool(CPU_LIST_POOL);
+    if (!cpu_list_pool.empty()) return static_cast<int32_t>(cpu_list_pool.size()) + 1;
+    const int32_t cpu_num = static_cast<int32_t>(std::thread::hardware_concurrency());
+    return (std::max)(cpu_num - INFERENCE_THREAD_NUM - engine_thread_num, 1);
+#endif
+}
+
 int32_t main(int argc, char* argv[])
 {
     /*** Initialize ***/
+#ifdef USE_POOLED_MAT_ALLOCATOR
+    /* Install before any cv::Mat is created. This is the default allocator for all threads */
+    cv::Mat::setDefaultAllocator(&PooledMatAllocator::GetInstance());
+#endif
+
     /* variables for processing time measurement */
     double total_time_all = 0;
     double total_time_cap = 0;
@@ -149,15 +307,71 @@ int32_t main(int argc, char* argv[])
     /* Initialize DepthAi */
     DepthAiWrapper depth_ai;
 
-    /* Initialize image processor library */
-    ImageProcessor::InputParam input_param = { WORK_DIR, 4 };
+    /* Initialize image processor library. The engines and the inference backend create their threads in Initialize, and the threads inherit the CPU mask of the main thread */
+    ThreadPool::SetThreadAffinity(std::vector<int32_t>(CPU_LIST_INFERENCE));
+    ImageProcessor::InputParam input_param = { WORK_DIR, INFERENCE_THREAD_NUM, depth_ai.GetFocalLength(), depth_ai.GetBaseline(), FRAME_BUDGET, depth_ai.GetDisparityScale() };
     if (ImageProcessor::Initialize(input_param) != 0) {
         printf("Initialization Error\n");
         return -1;
     }
+    ThreadPool::SetThreadAffinity(std::vector<int32_t>());
+
+    /* Export metrics */
+    MetricsHistogram* metrics_capture_latency = Metrics::GetInstance().AddHistogram("capture_latency_ms", "Time to get images from the device", Metrics::GetLatencyBucketList());
+    MetricsHistogram* metrics_loop_latency = Metrics::GetInstance().AddHistogram("loop_latency_ms", "Time of the main loop including capture and display", Metrics::GetLatencyBucketList());
+#ifdef USE_POOLED_MAT_ALLOCATOR
+    MetricsCounter* metrics_mat_allocation_hit = Metrics::GetInstance().AddCounter("mat_allocation_total", "Allocations of cv::Mat by PooledMatAllocator (hit reuses a cached buffer)", "result=\"hit\"");
+    MetricsCounter* metrics_mat_allocation_miss = Metrics::GetInstance().AddCounter("mat_allocation_total", "Allocations of cv::Mat by PooledMatAllocator (hit reuses a cached buffer)", "result=\"miss\"");
+    MetricsGauge* metrics_mat_in_use = Metrics::GetInstance().AddGauge("mat_allocation_in_use_bytes", "Bytes of cv::Mat buffers in use");
+#endif
+#if METRICS_HTTP_PORT > 0
+    Metrics::GetInstance().StartHttpServer(METRICS_HTTP_PORT);  /* continue without metrics if failed */
+#endif
+#ifdef METRICS_FILE
+    Metrics::GetInstance().StartFileExport(METRICS_FILE, METRICS_FILE_INTERVAL);
+#endif
+
+    /* Threads. The pool is created before the first parallel loop so that workers are pinned from the beginning. The main thread is pinned after all the other threads are created */
+    ThreadPool::GetInstance().Initialize(GetThreadPoolNum(ImageProcessor::GetEngineThreadNum()), std::vector<int32_t>(CPU_LIST_POOL));
+    ThreadPool::SetThreadAffinity(std::vector<int32_t>(CPU_LIST_MAIN));
+
+    /* Edge preserving filter for disparity by DepthAI */
+    GuidedFilter guided_filter;
+    cv::Mat image_disparity_filtered;
+#ifdef USE_TEMPORAL_FILTER
+    TemporalFilter temporal_filter;
+#endif
+#ifdef USE_HOLE_FILLING
+    HoleFilling hole_filling;
+    cv::Mat image_disparity_dense;
+    cv::Mat image_disparity_valid;
+#endif
+
+#ifdef USE_POOLED_MAT_ALLOCATOR
+    PooledMatAllocator::Statistics mat_statistics_previous;
+#endif
+
+#ifdef SHM_NAME
+    /* Opened at the first frame, when the sizes of the images are known */
+    ShmFramePublisher shm_publisher;
+#endif
+
+#ifdef RECORD_FILE
+    FrameRecorder frame_recorder;
+    if (frame_recorder.Open(RECORD_FILE) != FrameRecorder::kRetOk) {
+        printf("Unable to record to %s\n", RECORD_FILE);
+        return -1;
+    }
+    const int32_t record_stream_color = frame_recorder.AddStream("color");
+    const int32_t record_stream_left = frame_recorder.AddStream("left");
+    const int32_t record_stream_right = frame_recorder.AddStream("right");
+    const int32_t record_stream_disparity = frame_recorder.AddStream("disparity", FrameRecordFormat::kCompressionRvl);
+    const int32_t record_stream_hitnet_disparity = frame_recorder.AddStream("hitnet_disparity16", FrameRecordFormat::kCompressionRvl);
+#endif
 
     /*** Process for each frame ***/
     int32_t frame_cnt = 0;
+    int32_t frame_skipped_num = 0;
     for (frame_cnt = 0; ; frame_cnt++) {
         const auto& time_all0 = std::chrono::steady_clock::now();
         /* Read image */
@@ -166,20 +380,100 @@ int32_t main(int argc, char* argv[])
         cv::Mat image_mono_camera_rectified_right = depth_ai.GetMonoCameraRectifiedRight();
         cv::Mat image_mono_camera_rectified_left = depth_ai.GetMonoCameraRectifiedLeft();
         cv::Mat image_disparity = depth_ai.GetDisparity();
+#ifdef USE_MIDAS_TILED
+        cv::Mat image_color = depth_ai.GetColorCameraVideo();
+#else
+        cv::Mat& image_color = image_color_camera_preview;
+#endif
         const auto& time_cap1 = std::chrono::steady_clock::now();
         
         /* Call image processor library */
         const auto& time_image_process0 = std::chrono::steady_clock::now();
         cv::Mat image_processed_depth_0;
         cv::Mat image_processed_depth_1;
+        cv::Mat image_processed_depth_2;
         ImageProcessor::Result result;
-        ImageProcessor::Process(image_color_camera_preview, image_mono_camera_rectified_left, image_mono_camera_rectified_right, image_processed_depth_0, image_processed_depth_1, result);
+        if (ImageProcessor::Process(image_color, image_mono_camera_rectified_left, image_mono_camera_rectified_right, image_disparity, image_processed_depth_0, image_processed_depth_1, image_processed_depth_2, result) != 0) {
+            /* e.g. timeout of an engine or no free output buffer. The results are empty, so the frame is not displayed, published nor recorded */
+            printf("Image processing error. Skip the frame\n");
+            frame_skipped_num++;
+            continue;
+        }
         const auto& time_image_process1 = std::chrono::steady_clock::now();
+        const int32_t frame_processed_cnt = frame_cnt - frame_skipped_num;
+
+        /* Filter disparity using the rectified right image as guide, because disparity by DepthAI is aligned to the right camera */
+        const auto& time_filter0 = std::chrono::steady_clock::now();
+        /* The output is in px (CV_32FC1) for the subpixel disparity too */
+        if (guided_filter.Filter(image_mono_camera_rectified_right, image_disparity, image_disparity_filtered, 4, 1e-2f, depth_ai.GetDisparityScale()) == GuidedFilter::kRetOk) {
+#ifdef USE_TEMPORAL_FILTER
+            temporal_filter.Filter(image_disparity_filtered, image_disparity_filtered, TEMPORAL_FILTER_ALPHA, TEMPORAL_FILTER_RESET_RATIO, TEMPORAL_FILTER_HOLE_FRAME);
+#endif
+#ifdef USE_HOLE_FILLING
+            hole_filling.Fill(image_disparity_filtered, image_disparity_dense, image_disparity_valid, HOLE_FILLING_LEVEL);
+#endif
+        }
+        const auto& time_filter1 = std::chrono::steady_clock::now();
 
-        /* Extend disparity range */
+        /* Extend disparity range. The filtered disparity is in px */
         cv::Mat image_disparity_colored;
-        image_disparity.convertTo(image_disparity_colored, CV_8UC1, depth_ai.GetDisparityMultiplier());
-        cv::applyColorMap(image_disparity_colored, image_disparity_colored, cv::COLORMAP_MAGMA);
+#ifdef USE_HOLE_FILLING
+        image_disparity_colored = CommonHelper::NormalizeDisparity(image_disparity_dense, depth_ai.GetMaxDisparity());
+#else
+        image_disparity_colored = CommonHelper::NormalizeDisparity(image_disparity_filtered, depth_ai.GetMaxDisparity());
+#endif
+        CommonHelper::ApplyColorMap(image_disparity_colored, image_disparity_colored, cv::COLORMAP_MAGMA);
+
+#if defined(SHM_NAME) || defined(RECORD_FILE)
+        /* Raw results. HITNET disparity is converted to 16-bit for lossless compression. They are used before the next Process overwrites them */
+        cv::Mat image_hitnet_disparity;
+        cv::Mat image_depth;
+        cv::Mat image_hitnet_disparity16;
+        if (ImageProcessor::GetDepth(image_hitnet_disparity, image_depth) == 0) {
+            image_hitnet_disparity.convertTo(image_hitnet_disparity16, CV_16UC1, HITNET_DISPARITY_SCALE);   /* invalid (<= 0) is 0 */
+        }
+        const int64_t timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(time_cap1.time_since_epoch()).count();
+#endif
+
+#ifdef SHM_NAME
+        /* Metric depth of the raw disparity in integer, without a float image. Z [mm] = focal [px] * baseline [mm] / (disparity * scale) */
+        cv::Mat image_disparity16 = image_disparity;
+        if (image_disparity.type() != CV_16UC1) image_disparity.convertTo(image_disparity16, CV_16UC1);
+        cv::Mat image_depth_device = CommonHelper::ConvertDisparity2Depth16(image_disparity16, depth_ai.GetFocalLength() * depth_ai.GetBaseline() * 1000.0f / depth_ai.GetDisparityScale());
+#endif
+
+#ifdef SHM_NAME
+        /* Publish to other processes. Frames of the same loop have the same timestamp (capture) and sequence number */
+        const auto& time_publish0 = std::chrono::steady_clock::now();
+        if (frame_processed_cnt == 0) {
+            OpenShmPublisher(shm_publisher, image_color_camera_preview, image_mono_camera_rectified_left, image_disparity);
+        }
+        PublishShmFrame(shm_publisher, "color", image_color_camera_preview, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "left", image_mono_camera_rectified_left, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "right", image_mono_camera_rectified_right, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "disparity", image_disparity, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "depth_device", image_depth_device, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "disparity_colored", image_disparity_colored, timestamp_us, frame_cnt);
+#ifdef USE_HOLE_FILLING
+        PublishShmFrame(shm_publisher, "disparity_dense", image_disparity_dense, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "disparity_valid", image_disparity_valid, timestamp_us, frame_cnt);
+#endif
+        PublishShmFrame(shm_publisher, "midasv2", image_processed_depth_0, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "hitnet", image_processed_depth_1, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "fusion", image_processed_depth_2, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "hitnet_disparity", image_hitnet_disparity, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "depth", image_depth, timestamp_us, frame_cnt);
+        PublishShmFrame(shm_publisher, "hitnet_disparity16", image_hitnet_disparity16, timestamp_us, frame_cnt);
+        const auto& time_publish1 = std::chrono::steady_clock::now();
+#endif
+
+#ifdef RECORD_FILE
+        frame_recorder.Write(record_stream_color, image_color_camera_preview, timestamp_us, frame_cnt);
+        frame_recorder.Write(record_stream_left, image_mono_camera_rectified_left, timestamp_us, frame_cnt);
+        frame_recorder.Write(record_stream_right, image_mono_camera_rectified_right, timestamp_us, frame_cnt);
+        frame_recorder.Write(record_stream_disparity, image_disparity, timestamp_us, frame_cnt);
+        if (!image_hitnet_disparity16.empty()) frame_recorder.Write(record_stream_hitnet_disparity, image_hitnet_disparity16, timestamp_us, frame_cnt);
+#endif
 
         /* Display result */
         cv::imshow("image_color_camera_preview", image_color_camera_preview);
@@ -189,24 +483,57 @@ int32_t main(int argc, char* argv[])
         cv::imshow("disparity", image_disparity_colored);
         cv::imshow("Midas_v2", image_processed_depth_0);
         cv::imshow("HITNET", image_processed_depth_1);
+        if (!image_processed_depth_2.empty()) cv::imshow("Fusion", image_processed_depth_2);
 
         /* Input key command */
         int key = cv::waitKey(1);
         if (key == 'q' || key == 'Q' || key == 27) {
             break;
         }
+        if (key >= '1' && key <= '3') {
+            /* Select HITNET model: 1 = eth3d, 2 = flyingthings, 3 = middlebury */
+            ImageProcessor::Command(ImageProcessor::kCommandStereoModelEth3d + (key - '1'));
+        }
 
         /* Print processing time */
         const auto& time_all1 = std::chrono::steady_clock::now();
         double time_all = (time_all1 - time_all0).count() / 1000000.0;
         double time_cap = (time_cap1 - time_cap0).count() / 1000000.0;
         double time_image_process = (time_image_process1 - time_image_process0).count() / 1000000.0;
+        double time_filter = (time_filter1 - time_filter0).count() / 1000000.0;
+#ifdef SHM_NAME
+        double time_publish = (time_publish1 - time_publish0).count() / 1000000.0;
+#endif
+        metrics_capture_latency->Observe(time_cap);
+        metrics_loop_latency->Observe(time_all);
         printf("Total:               %9.3lf [msec]\n", time_all);
         printf("  Capture:           %9.3lf [msec]\n", time_cap);
         printf("  Image processing:  %9.3lf [msec]\n", time_image_process);
+        printf("    Pre processing:  %9.3lf [msec]\n", result.time_pre_process);
+        printf("      MiDaS:         %9.3lf [msec]\n", result.time_pre_process_midas);
+        printf("      HITNET:        %9.3lf [msec]\n", result.time_pre_process_stereo);
+#ifdef USE_MIDAS_TILED
+        printf("      MiDaS tiling:  %9.3lf [msec]\n", result.time_tiling_midas);
+#endif
+        printf("    Inference:       %9.3lf [msec]\n", result.time_inference);
+        printf("    Post processing: %9.3lf [msec]\n", result.time_post_process);
+#ifdef USE_MIDAS_TILED
+        printf("      MiDaS stitch:  %9.3lf [msec]\n", result.time_stitching_midas);
+#endif
+        printf("  Disparity filter:  %9.3lf [msec]\n", time_filter);
+#ifdef SHM_NAME
+        printf("  Publish:           %9.3lf [msec]\n", time_publish);
+#endif
+#ifdef USE_POOLED_MAT_ALLOCATOR
+        PooledMatAllocator::Statistics mat_statistics = PooledMatAllocator::GetInstance().GetStatistics();
+        metrics_mat_allocation_hit->Add(mat_statistics.hit_num - mat_statistics_previous.hit_num);
+        metrics_mat_allocation_miss->Add(mat_statistics.miss_num - mat_statistics_previous.miss_num);
+        metrics_mat_in_use->Set(static_cast<double>(mat_statistics.bytes_in_use));
+        mat_statistics_previous = mat_statistics;
+#endif
         printf("=== Finished %d frame ===\n\n", frame_cnt);
 
-        if (frame_cnt > 0) {    /* do not count the first process because it may include initialize process */
+        if (frame_processed_cnt > 0) {    /* do not count the first process because it may include initialize process */
             total_time_all += time_all;
             total_time_cap += time_cap;
             total_time_image_process += time_image_process;
@@ -215,6 +542,8 @@ int32_t main(int argc, char* argv[])
     
     /*** Finalize ***/
     /* Print average processing time */
+    if (frame_skipped_num > 0) printf("Skipped frames: %d\n", frame_skipped_num);
+    frame_cnt -= frame_skipped_num;
     if (frame_cnt > 1) {
         frame_cnt--;    /* because the first process was not counted */
         printf("=== Average processing time ===\n");
@@ -222,9 +551,31 @@ int32_t main(int argc, char* argv[])
         printf("  Capture:           %9.3lf [msec]\n", total_time_cap / frame_cnt);
         printf("  Image processing:  %9.3lf [msec]\n", total_time_image_process / frame_cnt);
     }
+#ifdef USE_POOLED_MAT_ALLOCATOR
+    PooledMatAllocator::Statistics mat_statistics = PooledMatAllocator::GetInstance().GetStatistics();
+    printf("=== Mat allocation ===\n");
+    printf("Hit:                 %llu\n", static_cast<unsigned long long>(mat_statistics.hit_num));
+    printf("Miss:                %llu\n", static_cast<unsigned long long>(mat_statistics.miss_num));
+    printf("Peak:                %9.3lf [MB]\n", mat_statistics.bytes_in_use_peak / 1024.0 / 1024.0);
+    printf("Cached:              %9.3lf [MB]\n", mat_statistics.bytes_cached / 1024.0 / 1024.0);
+#endif
+
+#ifdef RECORD_FILE
+    FrameRecorder::Statistics record_statistics = frame_recorder.GetStatistics();
+    frame_recorder.Close();
+    printf("=== Recording ===\n");
+    printf("Written:             %9.3lf [MB] (%.2f of raw)\n", record_statistics.byte_written / 1024.0 / 1024.0,
+        record_statistics.byte_raw > 0 ? static_cast<double>(record_statistics.byte_written) / record_statistics.byte_raw : 0.0);
+    printf("Stall:               %llu\n", static_cast<unsigned long long>(record_statistics.stall_num));
+#endif
 
     /* Fianlize image processor library */
+#ifdef SHM_NAME
+    shm_publisher.Close();      /* readers see IsClosed */
+#endif
     ImageProcessor::Finalize();
+    Metrics::GetInstance().Stop();
+    ThreadPool::GetInstance().Finalize();
     cv::waitKey(-1);
 
 